@@ -15,6 +15,7 @@ fn main() -> miette::Result<()> {
             "src/mutations.cpp",
             "src/tree_builder.cpp",
             "src/branch_length_estimator.cpp",
+            "src/coalescent_rate_profile.cpp",
             "subprojects/gzstream/gzstream.C",
             "pipeline/FindEquivalentBranches.cpp",
             "pipeline/InferBranchLengths.cpp",
@@ -38,6 +39,8 @@ fn main() -> miette::Result<()> {
     println!("cargo:rerun-if-changed=src/tree_builder.hpp");
     println!("cargo:rerun-if-changed=src/branch_length_estimator.cpp");
     println!("cargo:rerun-if-changed=src/branch_length_estimator.hpp");
+    println!("cargo:rerun-if-changed=src/coalescent_rate_profile.cpp");
+    println!("cargo:rerun-if-changed=src/coalescent_rate_profile.hpp");
     println!("cargo:rerun-if-changed=pipeline/FindEquivalentBranches.cpp");
     println!("cargo:rerun-if-changed=pipeline/InferBranchLengths.cpp");
     println!("cargo:rerun-if-changed=pipeline/CombineSections.cpp");
@@ -14,6 +14,7 @@
 #include "anc_builder.hpp"
 #include "tree_builder.hpp"
 #include "usage.hpp"
+#include "parallel.hpp"
 
 void ShowProgress(int progress){
 
@@ -203,87 +204,131 @@ int ReEstimateBranchLengths(cxxopts::ParseResult& result){
      std::cerr << std::endl;
      */
 
+  CoalescentRateProfile profile(epoch, coalescent_rate);
+
   ///////////////////////////////////////// TMRCA Inference /////////////////////////
   //Infer Branchlengths
+  //Trees are read in blocks, the MCMC of trees in a block runs in parallel and the block is written in order.
+  //Seeds are drawn for every tree in order, so the output does not depend on the number of threads.
 
-  AncesTree anc;
-  anc.Read(result["input"].as<std::string>() + ".anc");
-
-  int num_trees = anc.seq.size();
-  int progress_interval = (int)(num_trees/100.0) + 1;
-  int count_trees = 0, progress = 0, progress_step = 1;
-  if(num_trees < 100){
-    progress_step = 100/num_trees;
+  int num_threads = 1;
+  if(result.count("threads")){
+    num_threads = NumThreads(result["threads"].as<int>());
   }
 
+  std::string filename_anc = result["input"].as<std::string>() + ".anc";
+  igzstream is_anc(filename_anc);
+  if(is_anc.fail()) is_anc.open(filename_anc + ".gz");
+  if(is_anc.fail()){ 
+    std::cerr << "Error while opening file " << filename_anc << "(.gz)." << std::endl;
+    exit(1);
+  }
 
-  //////////////////////////////////////////// Read Tree ///////////////////////////////////
-
-  CorrTrees::iterator it_seq   = anc.seq.begin();
-  //Infer branch lengths
-  if(anc.sample_ages.size() == 0){
-    InferBranchLengths bl(data);
-    for(; it_seq != anc.seq.end(); it_seq++){
-      if(count_trees % progress_interval == 0){
-        progress += progress_step;
-        ShowProgress(progress); 
-      }
-      count_trees++; 
-      bl.MCMCVariablePopulationSizeForRelate(data, (*it_seq).tree, epoch, coalescent_rate, rand()); //this is estimating times
-    }
+  //header: number of haplotypes, optionally followed by sample ages, and number of trees
+  std::vector<double> sample_ages(N);
+  int num_trees;
+  std::istringstream is_header;
+  getline(is_anc, line);
+  is_header.str(line);
+  is_header >> line >> N;
+  int num_sample_ages = 0;
+  for(std::vector<double>::iterator it_sample_ages = sample_ages.begin(); it_sample_ages != sample_ages.end(); it_sample_ages++){
+    if(!(is_header >> *it_sample_ages)) break;
+    num_sample_ages++;
+  }
+  if(num_sample_ages != N) sample_ages.clear();
+  getline(is_anc, line);
+  is_header.str(line);
+  is_header.clear();
+  is_header >> line >> num_trees;
+
+  //write to a temporary file first, so that input and output can be the same file
+  std::string filename_out = result["output"].as<std::string>() + ".anc";
+  FILE *pfile = std::fopen((filename_out + ".tmp").c_str(), "w");
+  if(pfile == NULL){
+    std::cerr << "Error while writing to " << filename_out << ".tmp." << std::endl;
+    exit(1);
+  }
+  fprintf(pfile, "NUM_HAPLOTYPES %d ", N);
+  for(std::vector<double>::iterator it_sample_ages = sample_ages.begin(); it_sample_ages != sample_ages.end(); it_sample_ages++){
+    fprintf(pfile, "%f ", *it_sample_ages);
+  }
+  fprintf(pfile, "\n");
+  fprintf(pfile, "NUM_TREES %d\n", num_trees);
+
+  int block_size = 32*num_threads;
+  std::vector<MarginalTree> block(block_size);
+  std::vector<int> seeds(block_size);
+  std::vector<std::vector<float>> v_coordinates(block_size, std::vector<float>(2*data.N-1));
+  std::vector<InferBranchLengths> bl;
+  std::vector<EstimateBranchLengthsWithSampleAge> bl_sample_age;
+  if(sample_ages.size() == 0){
+    bl.assign(num_threads, InferBranchLengths(data));
   }else{
-    EstimateBranchLengthsWithSampleAge bl(data, anc.sample_ages);
-    for(; it_seq != anc.seq.end(); it_seq++){
-      if(count_trees % progress_interval == 0){
-        progress += progress_step;
-        ShowProgress(progress); 
-      }
-      count_trees++; 
-      bl.MCMCVariablePopulationSize(data, (*it_seq).tree, epoch, coalescent_rate, rand()); //this is estimating times
-    }
+    bl_sample_age.assign(num_threads, EstimateBranchLengthsWithSampleAge(data, sample_ages));
   }
 
-  ShowProgress(100);
-  std::cerr << std::endl;
-  //Dump to file
-  anc.Dump(result["output"].as<std::string>() + ".anc");
-
-  ////////////////////////// Update mutation file
-
-  CorrTrees::iterator it_anc = anc.seq.begin();
-  std::vector<float> coordinates(2*data.N-1);
-  int num_tree = mut.info[0].tree;
+  //mutations are mapped onto trees as before: the tree index of the first mutation refers to the first tree,
+  //and mutations beyond the last tree are mapped onto the last tree
   int root = 2*data.N-2;
+  int first_tree_in_mut = mut.info[0].tree;
+  int tree_index_in_mut, branch;
+  std::vector<SNPInfo>::iterator it_mut = mut.info.begin();
 
-  (*it_anc).tree.GetCoordinates(coordinates);
+  int count_trees = 0, block_num_trees;
+  while(count_trees < num_trees){
 
-  std::vector<SNPInfo>::iterator it_mut = mut.info.begin();
-  for(; it_mut != mut.info.end(); it_mut++){
-    //need the tree such that snp_of_next_tree > (*it_mut).snp_id
-    //and snp_of_current_tree <= (*it_mut).snp_id
-    if((*it_mut).tree > num_tree){
-      while((*it_mut).tree > num_tree){
-        it_anc++;
-        if(it_anc == anc.seq.end()){
-          it_anc--;
-          break;
+    block_num_trees = std::min(block_size, num_trees - count_trees);
+    for(int i = 0; i < block_num_trees; i++){
+      getline(is_anc, line);
+      block[i].Read(line, N, sample_ages);
+      seeds[i] = rand();
+    }
+
+    ParallelFor(block_num_trees, num_threads, [&](int i, int thread){
+      if(sample_ages.size() == 0){
+        bl[thread].MCMCVariablePopulationSizeForRelate(data, block[i].tree, profile, seeds[i]); //this is estimating times
+      }else{
+        bl_sample_age[thread].MCMCVariablePopulationSize(data, block[i].tree, profile, seeds[i]); //this is estimating times
+      }
+      block[i].tree.GetCoordinates(v_coordinates[i]);
+    });
+
+    for(int i = 0; i < block_num_trees; i++){
+
+      block[i].Dump(pfile);
+
+      ////////////////////////// Update mutation file
+      std::vector<float>& coordinates = v_coordinates[i];
+      Tree& tree = block[i].tree;
+      for(; it_mut != mut.info.end(); it_mut++){
+        tree_index_in_mut = std::min((*it_mut).tree, first_tree_in_mut + num_trees - 1);
+        if(tree_index_in_mut > first_tree_in_mut + count_trees) break;
+        if((*it_mut).tree != first_tree_in_mut + count_trees) std::cerr << (*it_mut).tree << " " << first_tree_in_mut + count_trees << std::endl;
+        if((*it_mut).branch.size() == 1){
+          branch = *(*it_mut).branch.begin();
+          if(branch != root){
+            (*it_mut).age_begin = coordinates[branch];
+            (*it_mut).age_end   = coordinates[(*tree.nodes[branch].parent).label]; 
+          }else{
+            (*it_mut).age_begin = coordinates[branch];
+            (*it_mut).age_end   = coordinates[branch];
+          }
         }
-        num_tree++;
       }
-      (*it_anc).tree.GetCoordinates(coordinates);
-    }
-    if((*it_mut).tree != num_tree) std::cerr << (*it_mut).tree << " " << num_tree << std::endl;
-    if((*it_mut).branch.size() == 1){
-      int branch = *(*it_mut).branch.begin();
-			if(branch != root){
-        (*it_mut).age_begin = coordinates[branch];
-        (*it_mut).age_end   = coordinates[(*(*it_anc).tree.nodes[branch].parent).label]; 
-			}else{
-				(*it_mut).age_begin = coordinates[branch];
-				(*it_mut).age_end   = coordinates[branch];
-			}
+
+      count_trees++;
+
     }
+
+    ShowProgress((int) (100.0 * count_trees/num_trees));
+
   }
+  is_anc.close();
+  fclose(pfile);
+  std::rename((filename_out + ".tmp").c_str(), filename_out.c_str());
+
+  std::cerr << std::endl;
   mut.Dump(result["output"].as<std::string>() + ".mut"); 
 
   ResourceUsage();
@@ -458,6 +503,8 @@ int SampleBranchLengths(cxxopts::ParseResult& result){
   }
   }
 
+  CoalescentRateProfile profile(epoch, coalescent_rate);
+
   ///////////////////////////////////////// TMRCA Inference /////////////////////////
   //Infer Branchlengths
 
@@ -557,7 +604,7 @@ int SampleBranchLengths(cxxopts::ParseResult& result){
 
       int count = 0;
       if(count < num_samples){
-        bl.MCMCVariablePopulationSizeSample(data, (*it_seq).tree, epoch, coalescent_rate, num_proposals, 1, rand()); //this is estimating times
+        bl.MCMCVariablePopulationSizeSample(data, (*it_seq).tree, profile, num_proposals, 1, rand()); //this is estimating times
 
         if(format == "n"){
           if(it_seq != std::prev(anc.seq.end(),1)){
@@ -574,7 +621,7 @@ int SampleBranchLengths(cxxopts::ParseResult& result){
       }
       count++;
       for(;count < num_samples; count++){
-        bl.MCMCVariablePopulationSizeSample(data, (*it_seq).tree, epoch, coalescent_rate, num_proposals, 0, rand()); //this is estimating times
+        bl.MCMCVariablePopulationSizeSample(data, (*it_seq).tree, profile, num_proposals, 0, rand()); //this is estimating times
 
         if(format == "n"){
           if(it_seq != std::prev(anc.seq.end(),1)){
@@ -668,7 +715,7 @@ int SampleBranchLengths(cxxopts::ParseResult& result){
 
       int count = 0;
       if(count < num_samples){
-        bl.MCMCVariablePopulationSizeSample(data, (*it_seq).tree, epoch, coalescent_rate, num_proposals, 1, rand()); //this is estimating times
+        bl.MCMCVariablePopulationSizeSample(data, (*it_seq).tree, profile, num_proposals, 1, rand()); //this is estimating times
 
         if(format == "n"){
           if(it_seq != std::prev(anc.seq.end(),1)){
@@ -685,7 +732,7 @@ int SampleBranchLengths(cxxopts::ParseResult& result){
       }
       count++;
       for(;count < num_samples; count++){
-        bl.MCMCVariablePopulationSizeSample(data, (*it_seq).tree, epoch, coalescent_rate, num_proposals, 0, rand()); //this is estimating times
+        bl.MCMCVariablePopulationSizeSample(data, (*it_seq).tree, profile, num_proposals, 0, rand()); //this is estimating times
 
         if(format == "n"){
           if(it_seq != std::prev(anc.seq.end(),1)){
@@ -1043,6 +1090,8 @@ int SampleBranchLengthsBinary(cxxopts::ParseResult& result){
     }
   }
 
+  CoalescentRateProfile profile(epoch, coalescent_rate);
+
   ///////////////////////////////////////// TMRCA Inference /////////////////////////
   //Infer Branchlengths
 
@@ -1112,12 +1161,12 @@ int SampleBranchLengthsBinary(cxxopts::ParseResult& result){
 							int i = 0;
 							if(i < num_samples){
 								sampled_trees[i] = mtr.tree;
-								bl.MCMCVariablePopulationSizeSample(data, sampled_trees[i], epoch, coalescent_rate, num_proposals, 1, rand()); //this is estimating times
+								bl.MCMCVariablePopulationSizeSample(data, sampled_trees[i], profile, num_proposals, 1, rand()); //this is estimating times
 							}
 							i++;
 							for(; i < num_samples; i++){
 								sampled_trees[i] = mtr.tree;
-								bl.MCMCVariablePopulationSizeSample(data, sampled_trees[i], epoch, coalescent_rate, num_proposals, 0, rand()); //this is estimating times
+								bl.MCMCVariablePopulationSizeSample(data, sampled_trees[i], profile, num_proposals, 0, rand()); //this is estimating times
 							}
 							first_snp = false;
 						}
@@ -1260,12 +1309,12 @@ int SampleBranchLengthsBinary(cxxopts::ParseResult& result){
 							int i = 0;
 							if(i < num_samples){
 								sampled_trees[i] = mtr.tree;
-								bl.MCMCVariablePopulationSizeSample(data, sampled_trees[i], epoch, coalescent_rate, num_proposals, 1, rand()); //this is estimating times
+								bl.MCMCVariablePopulationSizeSample(data, sampled_trees[i], profile, num_proposals, 1, rand()); //this is estimating times
 							}
 							i++;
 							for(; i < num_samples; i++){
                 sampled_trees[i] = mtr.tree;
-								bl.MCMCVariablePopulationSizeSample(data, sampled_trees[i], epoch, coalescent_rate, num_proposals, 0, rand()); //this is estimating times
+								bl.MCMCVariablePopulationSizeSample(data, sampled_trees[i], profile, num_proposals, 0, rand()); //this is estimating times
 							}
 							first_snp = false;
 						}
@@ -31,7 +31,8 @@ int main(int argc, char* argv[]){
 		("format", "Optional: Output file format when sampling branch. a: anc/mut, n: newick, b:binary. Default: a.", cxxopts::value<std::string>())
     ("mask", "Filename of file containing mask", cxxopts::value<std::string>())
     ("groups", "Names of groups of interest for conditional coalescence rates", cxxopts::value<std::string>())
-    ("seed", "Seed for MCMC in branch lengths estimation.", cxxopts::value<int>());
+    ("seed", "Seed for MCMC in branch lengths estimation.", cxxopts::value<int>())
+    ("threads", "Optional: Number of threads used to reestimate branch lengths. Default: 1, 0 uses all hardware threads.", cxxopts::value<int>());
   
   auto result = options.parse(argc, argv);
   auto help_text = options.help({""});
@@ -154,7 +155,7 @@ int main(int argc, char* argv[]){
     bool help = false;
     if(!result.count("mutation_rate") || !result.count("coal") || !result.count("input") || !result.count("output")){
       std::cout << "Not enough arguments supplied." << std::endl;
-      std::cout << "Needed: mutation_rate, coal, input, output. Optional: dist, mrate, seed." << std::endl;
+      std::cout << "Needed: mutation_rate, coal, input, output. Optional: dist, mrate, seed, threads." << std::endl;
       help = true;
     }
     if(result.count("help") || help){
@@ -4,6 +4,7 @@
 #include <string>
 #include <limits>
 #include <algorithm>
+#include <sstream>
 #include <sys/time.h>
 #include <sys/resource.h>
 #include <cxxopts.hpp>
@@ -16,6 +17,7 @@
 #include "anc_builder.hpp"
 #include "tree_comparer.hpp"
 #include "usage.hpp"
+#include "parallel.hpp"
 
 void
 GetCoordsAndLineages(MarginalTree& mtr, std::vector<float>& coordinates_tree, std::vector<int>& num_lineages){
@@ -226,66 +228,42 @@ GetCoordsAndLineagesForPop(MarginalTree& mtr, Sample& samples, std::vector<int>&
 }
 
 
+//Integrates the number of lineages over each epoch. coordinates are sorted node ages and num_lineages[i] is the
+//number of lineages between coordinates[i] and coordinates[i+1] (as returned by GetCoordsAndLineages).
+//Coordinates and epoch boundaries are merged in a single pass, so this is O(N + number of epochs).
 void
 GetBranchLengthsInEpoch(Data& data, std::vector<double>& epoch, std::vector<float>& coordinates, std::vector<int>& num_lineages, std::vector<double>& branch_lengths_in_epoch){
 
-  branch_lengths_in_epoch.resize(epoch.size()-1);
+  int num_epochs = epoch.size();
+  branch_lengths_in_epoch.resize(num_epochs-1);
   std::fill(branch_lengths_in_epoch.begin(), branch_lengths_in_epoch.end(), 0.0);
 
+  //epoch containing coordinates[0]
   int ep = 0;
+  double age = coordinates[0];
+  while(ep < num_epochs-1 && epoch[ep+1] <= age) ep++;
 
-  for(ep = 0; ep < epoch.size(); ep++){
-    if(coordinates[0] < epoch[ep]) break;
-  }
-  ep--;
-
-  branch_lengths_in_epoch[ep] = 0;
-  for(int i = 1; i < 2*data.N-1; i++){
-
-    if(coordinates[i] > coordinates[i-1]){
-
-      if(coordinates[i] < epoch[ep+1]){
-
-        if(coordinates[i-1] >= epoch[ep]){
-          // epoch[ep], coordinates[i-1], coordinates[i], epoch[ep+1]
-          branch_lengths_in_epoch[ep] += num_lineages[i-1] * (coordinates[i] - coordinates[i-1]); 
-        }else{
-          // coordinates[i-1], epoch[ep], coordinates[i], epoch[ep+1]
-          branch_lengths_in_epoch[ep]  = num_lineages[i-1] * (coordinates[i] - epoch[ep]);  
-        }
-
-      }else{
+  std::vector<float>::iterator it_coords = std::next(coordinates.begin(), 1);
+  std::vector<int>::iterator it_num_lineages = num_lineages.begin();
+  for(int i = 1; i < 2*data.N-1 && ep < num_epochs-1; i++){
 
-        if(coordinates[i-1] >= epoch[ep]){
-          // epoch[ep], coordinates[i-1], epoch[ep+1], coordinates[i]
-          branch_lengths_in_epoch[ep] += num_lineages[i-1] * (epoch[ep+1] - coordinates[i-1]);
-          ep++;
-        }else{
-          assert(0);
-          // coordinates[i-1], epoch[ep], epoch[ep+1], coordinates[i]
-          branch_lengths_in_epoch[ep]  = num_lineages[i-1] * (epoch[ep+1] - epoch[ep]);
-          ep++;
-        }
-
-        if(ep == epoch.size()-1) break;
-
-        while(epoch[ep+1] < coordinates[i] && ep < epoch.size()-1){
-          // coordinates[i-1], epoch[ep], epoch[ep+1], coordinates[i]
-          branch_lengths_in_epoch[ep]  = num_lineages[i-1] * (epoch[ep+1] - epoch[ep]);
-          ep++;
-        }
+    double next_age = *it_coords;
+    double lins     = *it_num_lineages;
 
-        if(ep < epoch.size()-1){
-          assert(coordinates[i] >= epoch[ep]);
-          assert(coordinates[i] <= epoch[ep+1]);
-          branch_lengths_in_epoch[ep]    = num_lineages[i-1] * (coordinates[i] - epoch[ep]); 
-        }else{
-          break;
-        }
+    //epoch boundaries between age and next_age
+    while(epoch[ep+1] < next_age){
+      branch_lengths_in_epoch[ep] += lins * (epoch[ep+1] - age);
+      age = epoch[ep+1];
+      ep++;
+      if(ep == num_epochs-1) break;
+    }
+    if(ep == num_epochs-1) break;
 
-      }
+    branch_lengths_in_epoch[ep] += lins * (next_age - age);
+    age = next_age;
 
-    }
+    it_coords++;
+    it_num_lineages++;
 
   }
 
@@ -307,9 +285,6 @@ CalculateAvgMutationRateForChromosome(cxxopts::ParseResult& result, std::vector<
 
   int N = ancmut.NumTips();
   int L = ancmut.NumSnps();
-  MarginalTree mtr;
-  Muts::iterator it_mut;
-  float num_bases_tree_persists = 0.0; 
 
   Data data(N,L);
   int N_total = 2*data.N-1;
@@ -462,7 +437,7 @@ CalculateAvgMutationRateForChromosome(cxxopts::ParseResult& result, std::vector<
   std::vector<double> count_bases(mutations.info.size(), 0.0);
   std::vector<double>::iterator it_count_bases = count_bases.begin();
 
-  it_mut = mutations.info.begin();
+  Muts::iterator it_mut = mutations.info.begin();
   std::vector<int>::iterator it_dist = dist.begin(), it_pos = pos.begin();
 
   //if first snp is included
@@ -499,91 +474,94 @@ CalculateAvgMutationRateForChromosome(cxxopts::ParseResult& result, std::vector<
   ////////////////////
   // Estimate mutation rate through time
 
-  std::vector<double> branch_lengths_in_epoch(num_epochs);
-  std::vector<float> coordinates_tree(N_total);
-  std::vector<int> num_lineages(N_total);
-  int root = N_total-1;
-  int i = 0;
+  int num_threads = 1;
+  if(result.count("threads")){
+    num_threads = NumThreads(result["threads"].as<int>());
+  }
 
-  double total_num_mutations = 0;
-  double total_branch_length = 0.0;
+  //trees are processed in blocks in parallel, each thread accumulates into its own vectors
+  std::vector<std::vector<double>> mutation_by_epoch_thread(num_threads, std::vector<double>(num_epochs, 0.0));
+  std::vector<std::vector<double>> opportunity_by_epoch_thread(num_threads, std::vector<double>(num_epochs, 0.0));
+  std::vector<std::vector<double>> branch_lengths_in_epoch(num_threads);
+  std::vector<std::vector<float>> coordinates_tree(num_threads, std::vector<float>(N_total));
+  std::vector<std::vector<int>> num_lineages(num_threads, std::vector<int>(N_total));
 
-  //read tree
-  ancmut.FirstSNP(mtr, it_mut);
+  TreeBlock block;
+  int block_size = 10*num_threads;
+  while(ancmut.NextTreeBlock(block, block_size) > 0){
 
-  GetCoordsAndLineages(mtr, coordinates_tree, num_lineages);
-  GetBranchLengthsInEpoch(data, epochs, coordinates_tree, num_lineages, branch_lengths_in_epoch);
+    ParallelFor(block.num_trees, num_threads, [&](int i, int thread){
 
-  SNPInfo snp_info;
-  int current_tree = (*it_mut).tree;
-  int count_snps = 0;
-  for(int snp = 0; snp < data.L; snp++){
+      if(!ancmut.HasMutations(block, i)) return;
 
-    snp_info = (*it_mut);
-    if(snp_info.branch.size() == 1){
+      std::vector<double>& mutation_by_epoch_tree = mutation_by_epoch_thread[thread];
+      //opportunity of the tree is its branch length in each epoch times the sum of count_bases over its SNPs
+      double count_bases_tree = 0.0;
+      bool has_snps = false;
 
-      //std::cerr << num_tree << " " << snp_info.tree << std::endl;
-      if((*it_mut).tree != current_tree){
-        current_tree = (*it_mut).tree;
-        mtr.tree.GetCoordinates(coordinates_tree);
-        GetCoordsAndLineages(mtr, coordinates_tree, num_lineages);
-        GetBranchLengthsInEpoch(data, epochs, coordinates_tree, num_lineages, branch_lengths_in_epoch);
-      }
-      assert(current_tree == snp_info.tree);
+      for(Muts::iterator it_snp = block.it_mut[i]; it_snp != ancmut.mut_end(); it_snp++){
 
-      // identify epoch and add to number of mutations per lineage in epoch
-      int ep = 0;
-      while(epochs[ep] <= snp_info.age_begin){
-        ep++;
-        if(ep == epochs.size()) break;
-      }
-      ep--;
+        const SNPInfo& snp_info = *it_snp;
+        if(snp_info.tree != block.tree_index[i]) break;
+        if(snp_info.branch.size() != 1) continue;
 
-      assert(ep >= 0);
+        // identify epoch and add to number of mutations per lineage in epoch
+        int ep = 0;
+        while(epochs[ep] <= snp_info.age_begin){
+          ep++;
+          if(ep == epochs.size()) break;
+        }
+        ep--;
 
-      count_snps++; 
+        assert(ep >= 0);
 
-      int ep_begin = ep;
-      float age_end = snp_info.age_end;
-      double branch_length = age_end - snp_info.age_begin;
-      if(ep < num_epochs-1){
-        if(age_end <= epochs[ep+1]){
+        float age_end = snp_info.age_end;
+        double branch_length = age_end - snp_info.age_begin;
+        if(ep < num_epochs-1){
+          if(age_end <= epochs[ep+1]){
 
-          mutation_by_epoch[ep] += 1.0;
+            mutation_by_epoch_tree[ep] += 1.0;
 
-        }else{
+          }else{
 
-          mutation_by_epoch[ep] += (epochs[ep+1] - snp_info.age_begin)/branch_length;
-          ep++;
-          while(epochs[ep+1] <= age_end && ep < num_epochs-1){
-            mutation_by_epoch[ep] += (epochs[ep+1]-epochs[ep])/branch_length;
+            mutation_by_epoch_tree[ep] += (epochs[ep+1] - snp_info.age_begin)/branch_length;
             ep++;
-          }
-          if(ep + 1 == num_epochs){
-            assert(epochs[ep] <= age_end);
-          }else{
-            mutation_by_epoch[ep] += (age_end-epochs[ep])/branch_length;
-            assert(epochs[ep+1] > age_end);
-          }
+            while(epochs[ep+1] <= age_end && ep < num_epochs-1){
+              mutation_by_epoch_tree[ep] += (epochs[ep+1]-epochs[ep])/branch_length;
+              ep++;
+            }
+            if(ep + 1 == num_epochs){
+              assert(epochs[ep] <= age_end);
+            }else{
+              mutation_by_epoch_tree[ep] += (age_end-epochs[ep])/branch_length;
+              assert(epochs[ep+1] > age_end);
+            }
 
+          }
         }
-      }
 
-      double foo1 = 0.0, foo2 = 0.0;
-      for(int ep_tmp = 0; ep_tmp < num_epochs; ep_tmp++){
-        double bl = branch_lengths_in_epoch[ep_tmp];
-        opportunity_by_epoch[ep_tmp] += (bl * count_bases[snp]);
-        foo1 += bl;
+        count_bases_tree += count_bases[std::distance(ancmut.mut_begin(), it_snp)];
+        has_snps = true;
+
       }
-      for(int i = data.N; i < 2*data.N-1; i++){
-        total_branch_length += (2*data.N-i) * (coordinates_tree[i] - coordinates_tree[i-1]) * count_bases[snp];
-        foo2 += (2*data.N-i) * (coordinates_tree[i] - coordinates_tree[i-1]);
+
+      if(has_snps){
+        GetCoordsAndLineages(block.mtr[i], coordinates_tree[thread], num_lineages[thread]);
+        GetBranchLengthsInEpoch(data, epochs, coordinates_tree[thread], num_lineages[thread], branch_lengths_in_epoch[thread]);
+        for(int ep = 0; ep < (int) branch_lengths_in_epoch[thread].size(); ep++){
+          opportunity_by_epoch_thread[thread][ep] += branch_lengths_in_epoch[thread][ep] * count_bases_tree;
+        }
       }
 
-    }
+    });
 
-    ancmut.NextSNP(mtr, it_mut);
+  }
 
+  for(int thread = 0; thread < num_threads; thread++){
+    for(int ep = 0; ep < num_epochs; ep++){
+      mutation_by_epoch[ep]    += mutation_by_epoch_thread[thread][ep];
+      opportunity_by_epoch[ep] += opportunity_by_epoch_thread[thread][ep];
+    }
   }
 
   ancmut.CloseFiles(); 
@@ -604,9 +582,6 @@ CalculateMutationDensity(cxxopts::ParseResult& result, std::ofstream& os, int sa
 
   int N = ancmut.NumTips();
   int L = ancmut.NumSnps();
-  MarginalTree mtr;
-  Muts::iterator it_mut;
-  float num_bases_tree_persists = 0.0; 
 
   Data data(N,L);
   int N_total = 2*data.N-1;
@@ -760,67 +735,85 @@ CalculateMutationDensity(cxxopts::ParseResult& result, std::ofstream& os, int sa
   ////////////////////
   // Estimate mutation rate through time
 
-  std::vector<double> num_muts_in_epoch(num_epochs), opportunity_in_epoch(num_epochs);
-  std::vector<int> num_lineages(N_total);
-  double bl, persistence, total_age, prev_age, num_events;
-  int node = sample, ep = 0, ep_start = 0;
+  int num_threads = 1;
+  if(result.count("threads")){
+    num_threads = NumThreads(result["threads"].as<int>());
+  }
+
+  int ep_start = 0;
   int root = N_total-1;
-  int i = 0;
 
   while(epochs[ep_start+1] < ancmut.sample_ages[sample]){
     ep_start++;
   }
 
-  //read tree
-	
-	num_bases_tree_persists = ancmut.NextTree(mtr, it_mut);
-  while(num_bases_tree_persists >= 0){
-
-    std::fill(num_muts_in_epoch.begin(), num_muts_in_epoch.end(), 0.0);
-    std::fill(opportunity_in_epoch.begin(), opportunity_in_epoch.end(), 0.0);
-  
-    node = sample;
-    ep = ep_start;
-    total_age = ancmut.sample_ages[sample];
-    while(node != root){
-
-      bl          = mtr.tree.nodes[node].branch_length;
-      prev_age    = total_age;
-      total_age  += bl;
-      num_events  = mtr.tree.nodes[node].num_events;
-      persistence = 0.0;
-      for(int snp = mtr.tree.nodes[node].SNP_begin; snp <= mtr.tree.nodes[node].SNP_end; snp++){
-        persistence += dist[snp];   
-      }
+  //trees are processed in blocks in parallel, lines are written in the order of trees
+  std::vector<std::vector<double>> num_muts_in_epoch(num_threads, std::vector<double>(num_epochs)), opportunity_in_epoch(num_threads, std::vector<double>(num_epochs));
+  std::vector<std::ostringstream> os_tree;
+
+  TreeBlock block;
+  int block_size = 10*num_threads;
+  while(ancmut.NextTreeBlock(block, block_size) > 0){
+
+    if((int) os_tree.size() < block.num_trees) os_tree.resize(block.num_trees);
+
+    ParallelFor(block.num_trees, num_threads, [&](int i, int thread){
+
+      MarginalTree& mtr = block.mtr[i];
+      std::vector<double>& num_muts    = num_muts_in_epoch[thread];
+      std::vector<double>& opportunity = opportunity_in_epoch[thread];
+      std::fill(num_muts.begin(), num_muts.end(), 0.0);
+      std::fill(opportunity.begin(), opportunity.end(), 0.0);
+
+      double bl, persistence, total_age, prev_age, num_events;
+      int node = sample;
+      int ep = ep_start;
+      total_age = ancmut.sample_ages[sample];
+      while(node != root){
+
+        bl          = mtr.tree.nodes[node].branch_length;
+        prev_age    = total_age;
+        total_age  += bl;
+        num_events  = mtr.tree.nodes[node].num_events;
+        persistence = 0.0;
+        for(int snp = mtr.tree.nodes[node].SNP_begin; snp <= mtr.tree.nodes[node].SNP_end; snp++){
+          persistence += dist[snp];   
+        }
 
-      if(total_age < epochs[ep+1]){
-        num_muts_in_epoch[ep] += num_events;
-        opportunity_in_epoch[ep] += persistence * bl;
-      }else{
-        while(epochs[ep+1] < total_age){
-          num_muts_in_epoch[ep] += num_events * (epochs[ep+1] - prev_age)/bl;
-          opportunity_in_epoch[ep] += persistence * (epochs[ep+1] - prev_age);
-          prev_age = epochs[ep+1];
-          ep++;
+        if(total_age < epochs[ep+1]){
+          num_muts[ep] += num_events;
+          opportunity[ep] += persistence * bl;
+        }else{
+          while(epochs[ep+1] < total_age){
+            num_muts[ep] += num_events * (epochs[ep+1] - prev_age)/bl;
+            opportunity[ep] += persistence * (epochs[ep+1] - prev_age);
+            prev_age = epochs[ep+1];
+            ep++;
+          }
+          num_muts[ep] += num_events * (total_age - prev_age)/bl;
+          opportunity[ep] += persistence * (total_age - prev_age);
         }
-        num_muts_in_epoch[ep] += num_events * (total_age - prev_age)/bl;
-        opportunity_in_epoch[ep] += persistence * (total_age - prev_age);
+
+        node = (*mtr.tree.nodes[node].parent).label;
+
       }
 
-      node = (*mtr.tree.nodes[node].parent).label;
+      std::ostringstream& os_line = os_tree[i];
+      os_line.str("");
+      for(int ep = 0; ep < num_epochs; ep++){
+        os_line << num_muts[ep] << " ";
+      }
+      for(int ep = 0; ep < num_epochs; ep++){
+        os_line << opportunity[ep] << " ";
+      }
+      os_line << "\n";
 
-    }
+    });
 
-    for(int ep = 0; ep < num_epochs; ep++){
-      os << num_muts_in_epoch[ep] << " ";
+    for(int i = 0; i < block.num_trees; i++){
+      os << os_tree[i].str();
     }
-    for(int ep = 0; ep < num_epochs; ep++){
-      os << opportunity_in_epoch[ep] << " ";
-    }
-    os << "\n";
 
-		num_bases_tree_persists = ancmut.NextTree(mtr, it_mut);
-  
   }
 
   ancmut.CloseFiles(); 
@@ -833,7 +826,7 @@ void AvgMutationRate(cxxopts::ParseResult& result, const std::string& help_text)
   bool help = false;
   if(!result.count("input") || !result.count("output")){
     std::cout << "Not enough arguments supplied." << std::endl;
-    std::cout << "Needed: input, output.  Optional: chr, first_chr, last_chr, years_per_gen, bins, dist." << std::endl;
+    std::cout << "Needed: input, output.  Optional: chr, first_chr, last_chr, years_per_gen, bins, dist, threads." << std::endl;
     help = true;
   }
   if(result.count("help") || help){
@@ -1006,7 +999,7 @@ void MutationDensity(cxxopts::ParseResult& result, const std::string& help_text)
   bool help = false;
   if(!result.count("input") || !result.count("output") || !result.count("pop_of_interest")){
     std::cout << "Not enough arguments supplied." << std::endl;
-    std::cout << "Needed: input, output, pop_of_interest.  Optional: chr, first_chr, last_chr, years_per_gen, bins, dist." << std::endl;
+    std::cout << "Needed: input, output, pop_of_interest.  Optional: chr, first_chr, last_chr, years_per_gen, bins, dist, threads." << std::endl;
     help = true;
   }
   if(result.count("help") || help){
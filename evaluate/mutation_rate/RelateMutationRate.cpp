@@ -4,6 +4,7 @@
 #include <string>
 #include <limits>
 #include <algorithm>
+#include <map>
 #include <sys/time.h>
 #include <sys/resource.h>
 #include <cxxopts.hpp>
@@ -16,181 +17,134 @@
 #include "anc_builder.hpp"
 #include "tree_comparer.hpp"
 #include "usage.hpp"
+#include "parallel.hpp"
 #include "AvgMutationRate.cpp"
 
-char
-IsCharNucl(char c){
+//Rolling 2-bit code of the trinucleotide ancestor[p-1], ancestor[p], ancestor[p+1].
+struct TrinucleotideContext{
 
-  std::string nucl = "ACGT";
-  std::string nucl_small = "acgt";
+  int p = 0;
+  int code = 0;    //6 bits, ancestor[p-1] in the highest two bits
+  int unknown = 0; //3 bits, set if base is not in ACGT
 
-  for(int i = 0; i < 4; i++){
-    if(nucl[i] == c){
-      return c;
-    }else if(nucl_small[i] == c){
-      return nucl[i];
-    }
+  void Init(const packed_sequence& ancestor, int ip){
+    p = ip - 2;
+    code = 0;
+    unknown = 7;
+    Next(ancestor);
+    Next(ancestor);
   }
 
-  return 'N';
+  void Next(const packed_sequence& ancestor){
+    int base = ancestor[p+2];
+    code     = ((code << 2) | std::max(base, 0)) & 63;
+    unknown  = ((unknown << 1) | (base < 0)) & 7;
+    p++;
+  }
 
-}
+};
 
 void
 CountBasesByType(Data& data, const std::string& filename_mask, const std::string& filename_ancestor, CollapsedMatrix<double>& count_bases_by_type, std::map<std::string, int>& dict_mutation_pattern, Mutations& mutations, std::vector<int>& pos){
 
   count_bases_by_type.resize(mutations.info.size(),dict_mutation_pattern.size());
 
-  igzstream is;
-  std::string line;
-
-  int i = 0;
-
-  //read ancestral type
-  std::string ancestor;
-  is.open(filename_ancestor);
-  if(is.fail()){
-    std::cerr << "Error while opening ancestor." << std::endl;
-    exit(1);
-  }
-  getline(is,line);
-  while(getline(is,line)){
-    ancestor += line;
-  }
-  is.close();
+  //read ancestral type, A,C,G,T are stored as codes 0,1,2,3
+  std::string nucl = "ACGT";
+  fasta ancestor;
+  ancestor.ReadPacked(filename_ancestor, nucl);
   std::cerr << "Done with reading ancestor." << std::endl;
 
-  //read mask
+  //read mask, only 'P' (case sensitive, lowercase 'p' does not pass) is stored as known
   fasta mask;
-  mask.Read(filename_mask);
+  mask.ReadPacked(filename_mask, "P", false);
   std::cerr << "Done with reading mask." << std::endl;
 
+  //category of mutation for each trinucleotide code and derived base, -1 if not in dict_mutation_pattern
+  //(pattern is upstream, downstream, ancestral, derived)
+  std::vector<int> category_of_context(256, -1);
+  std::string pattern;
+  for(int context = 0; context < 64; context++){
+    for(int derived = 0; derived < 4; derived++){
+      pattern  = nucl[context >> 4];
+      pattern += nucl[context & 3];
+      pattern += nucl[(context >> 2) & 3];
+      pattern += nucl[derived];
+      std::map<std::string, int>::iterator it_dict = dict_mutation_pattern.find(pattern);
+      if(it_dict != dict_mutation_pattern.end()) category_of_context[4*context + derived] = (*it_dict).second;
+    }
+  }
+
   //count bases by type
 
-  std::string pattern;
-  std::string nucl = "ACGT";
   //int mask_threshold = 1801;
   int mask_threshold = 2000;
-  std::string::iterator it_mask, it_start, it_end, it_ancestor; 
 
-  std::cerr << mask.seq.size() << " " << ancestor.size() << std::endl;
-  if(mask.seq.size() < ancestor.size()){
-    int mask_size = mask.seq.size();
-    mask.seq.resize(ancestor.size());
-    std::fill(std::next(mask.seq.begin(),mask_size), mask.seq.end(), 'N');
-  }else{
-    int anc_size = ancestor.size();
-    ancestor.resize(mask.seq.size());
-    std::fill(std::next(ancestor.begin(),anc_size), ancestor.end(), 'N');
-  }
-  assert(mask.seq.size() == ancestor.size());
+  //positions beyond the end of the shorter sequence count as 'N'
+  std::cerr << mask.packed.size << " " << ancestor.packed.size << std::endl;
+  int seq_size = std::max(mask.packed.size, ancestor.packed.size);
+  const packed_sequence& is_pass = mask.packed;
 
-
-  it_start = mask.seq.begin();
-  it_end   = std::next(mask.seq.begin(), std::min((int)mask.seq.size(),1001));
+  //window of mask from start to end (inclusive) around p
+  int start = 0, end = std::min(seq_size, 1001);
   int d_num_nonpass_vincity = 0;
-  for(it_mask = it_start; it_mask != it_end; it_mask++){
-    if(*it_mask != 'P'){
+  for(int i = start; i < end; i++){
+    if(is_pass[i] < 0){
       d_num_nonpass_vincity++;
     } 
   }
-  it_end--;
+  end--;
+
+  int p = 0;
+  TrinucleotideContext context;
+  context.Init(ancestor.packed, p);
 
-  it_mask = mask.seq.begin();
-  it_ancestor = ancestor.begin();
   std::vector<SNPInfo>::iterator it_info = mutations.info.begin();
   std::vector<int>::iterator it_pos = pos.begin();
-  int p = 0;
   int snp = 0;
-  while(it_end != mask.seq.end() && it_mask != std::next(mask.seq.begin(), 1001) && p < (*it_info).pos){
-    it_end++;
-    if(*it_end != 'P') d_num_nonpass_vincity++;
+  while(end != seq_size && p != 1001 && p < (*it_info).pos){
+    end++;
+    if(is_pass[end] < 0) d_num_nonpass_vincity++;
 
-    it_mask++;
-    it_ancestor++;
     p++;
+    context.Next(ancestor.packed);
   }
 
-  if(it_mask == std::next(mask.seq.begin(), 1001)){
-
-    while(it_end != mask.seq.end() && it_mask != std::next(mask.seq.begin(), 1001)){
-      it_end++;
-      if(*it_end != 'P') d_num_nonpass_vincity++;
-
-      //only add if its between the previous and the next snp (in the mutations file with all SNPs)
-      if( p >= 0.5*((*it_pos) + (*std::prev(it_pos,1))) && p < 0.5 * ((*it_pos) + (*std::next(it_pos,1))) ){
-
-        if(*it_mask == 'P' && d_num_nonpass_vincity <= 0.5 * mask_threshold && (*it_info).branch.size() == 1){
-          //add to count 
-          if(IsCharNucl(*std::prev(it_ancestor,1)) != 'N' && IsCharNucl(*std::next(it_ancestor,1)) != 'N' && IsCharNucl(*it_ancestor) != 'N'){
-            pattern  = toupper(*std::prev(it_ancestor,1));
-            pattern += toupper(*std::next(it_ancestor,1));
-            pattern += toupper(*it_ancestor);  
-
-            for(std::string::iterator it_nucl = nucl.begin(); it_nucl != nucl.end(); it_nucl++){
-              if(*it_nucl != IsCharNucl(*it_ancestor)){
-                count_bases_by_type[snp][dict_mutation_pattern[pattern + *it_nucl]] += 1.0;
-              }
-            }
-          }
-        }
-
-      }
-
-      if(p >= 0.5 * ((*std::next(it_pos,1)) + (*it_pos))){
-        it_info++;
-        snp++;
-        if(it_info == mutations.info.end()) break;
-      }
-      while((*it_pos) < (*it_info).pos){
-        it_pos++;
-      }
-
-      it_mask++;
-      it_ancestor++;
-      p++;
-    }
-
-  }else{
-    while(it_end != mask.seq.end() && p < (*it_info).pos){
-      if(*it_start != 'P') d_num_nonpass_vincity--;
-      it_start++;
-      it_end++;
-      if(*it_end != 'P') d_num_nonpass_vincity++;
+  if(p != 1001){
+    while(end != seq_size && p < (*it_info).pos){
+      if(is_pass[start] < 0) d_num_nonpass_vincity--;
+      start++;
+      end++;
+      if(is_pass[end] < 0) d_num_nonpass_vincity++;
       p++;
-      it_mask++;
-      it_ancestor++;
+      context.Next(ancestor.packed);
     } 
   }
 
   assert(p <= (*it_info).pos);
 
-  while(it_end != std::prev(mask.seq.end(),1) && it_info != std::prev(mutations.info.end(),1)){
-    if(*it_start != 'P') d_num_nonpass_vincity--;
-    it_start++;
-    it_end++;
-    if(*it_end != 'P') d_num_nonpass_vincity++;
+  while(end != seq_size-1 && it_info != std::prev(mutations.info.end(),1)){
+    if(is_pass[start] < 0) d_num_nonpass_vincity--;
+    start++;
+    end++;
+    if(is_pass[end] < 0) d_num_nonpass_vincity++;
 
     assert(d_num_nonpass_vincity >= 0);
 
     //only add if its between the previous and the next snp (in the mutations file with all SNPs)
     if( p >= 0.5*((*it_pos) + (*std::prev(it_pos,1))) && p < 0.5 * ((*it_pos) + (*std::next(it_pos,1))) ){
 
-      if(*it_mask == 'P' && d_num_nonpass_vincity <= mask_threshold && (*it_info).branch.size() == 1){
+      if(is_pass[p] >= 0 && d_num_nonpass_vincity <= mask_threshold && (*it_info).branch.size() == 1){
         //add to count
-        if(IsCharNucl(*std::prev(it_ancestor,1)) != 'N' && IsCharNucl(*std::next(it_ancestor,1)) != 'N' && IsCharNucl(*it_ancestor) != 'N'){
-          pattern  = toupper(*std::prev(it_ancestor,1));
-          pattern += toupper(*std::next(it_ancestor,1));
-          pattern += toupper(*it_ancestor);  
-
-          int count = 0;
-          for(std::string::iterator it_nucl = nucl.begin(); it_nucl != nucl.end(); it_nucl++){
-            if(*it_nucl != IsCharNucl(*it_ancestor)){
-              count++;
-              count_bases_by_type[snp][dict_mutation_pattern[pattern + *it_nucl]] += 1.0;
+        if(context.unknown == 0){
+          int ancestral = (context.code >> 2) & 3;
+          std::vector<int>::iterator it_category = std::next(category_of_context.begin(), 4*context.code);
+          for(int derived = 0; derived < 4; derived++){
+            if(derived != ancestral && *it_category >= 0){
+              count_bases_by_type[snp][*it_category] += 1.0;
             }
+            it_category++;
           }
-          assert(count == 3);
         }
       }  
 
@@ -206,37 +160,29 @@ CountBasesByType(Data& data, const std::string& filename_mask, const std::string
     }
     if(it_info == std::prev(mutations.info.end(),1)) break;
 
-    it_mask++;
-    it_ancestor++;
     p++;
+    context.Next(ancestor.packed);
 
   }
 
-  while(it_mask != std::prev(mask.seq.end(),1) && it_info != std::prev(mutations.info.end(),1)){
-    if(*it_start != 'P') d_num_nonpass_vincity--;
-    it_start++;
-
-    //if(snp != data.L-1){
-    //  int begin = std::max(0,snp-10);
-    //  int end   = std::min(data.L-1, snp+10);
-    //  rec = (data.rpos[end] - data.rpos[begin])/(mutations.info[end].pos - mutations.info[begin].pos);
-    //}
+  while(p != seq_size-1 && it_info != std::prev(mutations.info.end(),1)){
+    if(is_pass[start] < 0) d_num_nonpass_vincity--;
+    start++;
 
     assert(d_num_nonpass_vincity >= 0);
     //only add if its between the previous and the next snp (in the mutations file with all SNPs)
     if( p >= 0.5*((*it_pos) + (*std::prev(it_pos,1))) && p < 0.5 * ((*it_pos) + (*std::next(it_pos,1))) ){
 
-      if(*it_mask == 'P' && d_num_nonpass_vincity <= 0.5 * mask_threshold && (*it_info).branch.size() == 1){
+      if(is_pass[p] >= 0 && d_num_nonpass_vincity <= 0.5 * mask_threshold && (*it_info).branch.size() == 1){
         //add to count 
-        if(IsCharNucl(*std::prev(it_ancestor,1)) != 'N' && IsCharNucl(*std::next(it_ancestor,1)) != 'N' && IsCharNucl(*it_ancestor) != 'N'){
-          pattern  = toupper(*std::prev(it_ancestor,1));
-          pattern += toupper(*std::next(it_ancestor,1));
-          pattern += toupper(*it_ancestor);  
-
-          for(std::string::iterator it_nucl = nucl.begin(); it_nucl != nucl.end(); it_nucl++){
-            if(*it_nucl != IsCharNucl(*it_ancestor)){
-              count_bases_by_type[snp][dict_mutation_pattern[pattern + *it_nucl]] += 1.0;
+        if(context.unknown == 0){
+          int ancestral = (context.code >> 2) & 3;
+          std::vector<int>::iterator it_category = std::next(category_of_context.begin(), 4*context.code);
+          for(int derived = 0; derived < 4; derived++){
+            if(derived != ancestral && *it_category >= 0){
+              count_bases_by_type[snp][*it_category] += 1.0;
             }
+            it_category++;
           }
         }
       }  
@@ -252,15 +198,416 @@ CountBasesByType(Data& data, const std::string& filename_mask, const std::string
       it_pos++;
     }
 
-    it_mask++;
-    it_ancestor++;
     p++;
+    context.Next(ancestor.packed);
   }
 
 }
 
 /////////////// Estimate mutation rate ////////////
 
+//Parses a comma separated list of mutation category files.
+std::vector<std::string>
+SplitFilenames(const std::string& filenames){
+
+  std::vector<std::string> split;
+  std::string filename;
+  for(std::string::const_iterator it_str = filenames.begin(); it_str != filenames.end(); it_str++){
+    if(*it_str == ','){
+      if(filename != "") split.push_back(filename);
+      filename = "";
+    }else{
+      filename += *it_str;
+    }
+  }
+  if(filename != "") split.push_back(filename);
+  return split;
+
+}
+
+//Reads a file storing upstream downstream ancestral derived category in each line
+//and checks that all 96 categories are represented and that category indices are contiguous.
+void
+ReadMutationCategories(const std::string& filename, std::map<std::string, int>& dict_mutation_pattern, int& num_categories){
+
+  std::string line;
+  std::string alphabet = "ACGT";
+  std::map<char, std::string> complement;
+  complement['A'] = "T";
+  complement['C'] = "G";
+  complement['G'] = "C";
+  complement['T'] = "A";
+
+  //A-C, A-G, A-T, C-A, C-G, C-T
+  //T-G, T-C, T-A, G-T, G-C, G-A
+  //plus 16 flanks per mutation type, i.e. 6*16 = 96
+
+  igzstream is_cat(filename);
+  if(is_cat.fail()){
+    std::cerr << "Error: unable to open file " << filename << std::endl;
+  }
+  getline(is_cat, line);
+  //I have to make sure all 96 categories are represented in this file
+
+  char mutation_type[5] = {0, 0, 0, 0, 0};
+  std::string pattern, reverse_pattern;
+  int category;
+  num_categories = 0;
+  std::vector<int> check_num_categories;
+  while(getline(is_cat, line)){
+    sscanf(line.c_str(), "%c %c %c %c %d", &mutation_type[0], &mutation_type[1], &mutation_type[2], &mutation_type[3], &category);
+    pattern = mutation_type;
+    dict_mutation_pattern[pattern] = category;
+    pattern = complement[mutation_type[1]] + complement[mutation_type[0]] + complement[mutation_type[2]] + complement[mutation_type[3]];
+    dict_mutation_pattern[pattern] = category;
+    if(category >= num_categories){
+      check_num_categories.resize(category+1);
+      std::fill(std::next(check_num_categories.begin(),num_categories), check_num_categories.end(), 0);
+      num_categories = category + 1;      
+      check_num_categories[category]++;
+    }else{
+      check_num_categories[category]++;
+    }
+  }
+  is_cat.close();
+
+  for(std::vector<int>::iterator it_check = check_num_categories.begin(); it_check != check_num_categories.end(); it_check++){
+    if(*it_check == 0){
+      std::cerr << "Error: category indices not 0-indexed or contiguous." << std::endl;
+      exit(1);
+    }
+  }
+
+  //check that I got all 96 categories
+  std::string mutations[6] = {"CA", "CG", "CT", "AT", "AG", "AC"};
+  std::string reverse_mutations[6] = {"GT", "GC", "GA", "TA", "TC", "TG"};
+  for(std::string::iterator it_str1 = alphabet.begin(); it_str1 != alphabet.end(); it_str1++){
+    for(std::string::iterator it_str2 = alphabet.begin(); it_str2 != alphabet.end(); it_str2++){
+      pattern = *it_str1;
+      pattern += *it_str2;
+      reverse_pattern = complement[*it_str2] + complement[*it_str1];
+
+      for(int m = 0; m < 6; m++){
+        if ( dict_mutation_pattern.find(pattern + mutations[m]) == dict_mutation_pattern.end() && dict_mutation_pattern.find(reverse_pattern + reverse_mutations[m]) == dict_mutation_pattern.end() ) {
+          // not found
+          std::cerr << "Error: not all 96 mutation categories provided." << std::endl;
+          exit(1);
+        }
+      }
+    }   
+  }
+
+}
+
+//////////////////////////////////////////////////////////////
+// Engine shared by WithContext, ForCategory, ForCategoryForGroup and ForPattern.
+// Trees are read in blocks and visited in parallel, and every tree is visited once for all analyses.
+
+//One set of mutation categories to accumulate mutations and opportunities for.
+struct MutationRateAnalysis{
+
+  std::map<std::string, int> dict_mutation_pattern;
+  CollapsedMatrix<double> count_bases_by_type;
+  int num_categories = 0;
+
+  fasta* mask = NULL;     //if set, SNPs at positions masked as 'N' are skipped
+  Sample* samples = NULL; //if set, only SNPs segregating in samples.group_of_interest are used and branch lengths are for this group
+  bool per_tree = false;  //if true, results are stored per tree (for the block bootstrap), otherwise summed over trees
+
+  //per tree if per_tree == true, otherwise a single matrix
+  std::vector<CollapsedMatrix<double>> mutation_by_type_and_epoch;
+  std::vector<CollapsedMatrix<double>> opportunity_by_type_and_epoch;
+
+};
+
+struct MutationRateWorkspace{
+
+  std::vector<float> coordinates_tree, coordinates_pop;
+  std::vector<int> num_lineages, num_lineages_pop;
+  std::vector<double> branch_lengths_in_epoch, branch_lengths_in_epoch_pop;
+  std::vector<Leaves> descendants;
+  std::vector<int> exclude;
+  std::string pattern;
+
+};
+
+//Checks that snp_info is a well defined biallelic SNP with known flanking bases.
+bool
+IsWellDefinedMutation(const SNPInfo& snp_info){
+
+  if(snp_info.upstream_base == "NA" || snp_info.downstream_base == "NA" || snp_info.mutation_type[0] == snp_info.mutation_type[2]) return false;
+  if(snp_info.mutation_type.size() != 3) return false;
+  if(snp_info.mutation_type[0] != 'A' && snp_info.mutation_type[0] != 'C' && snp_info.mutation_type[0] != 'G' && snp_info.mutation_type[0] != 'T') return false;
+  if(snp_info.mutation_type[2] != 'A' && snp_info.mutation_type[2] != 'C' && snp_info.mutation_type[2] != 'G' && snp_info.mutation_type[2] != 'T') return false;
+  return true;
+
+}
+
+//Checks whether the mutation is carried by more than one sample and by a member of samples.group_of_interest.
+bool
+IsSegregatingInGroup(const SNPInfo& snp_info, Sample& samples, std::vector<Leaves>& descendants){
+
+  Leaves& carriers = descendants[snp_info.branch[0]];
+  if(carriers.num_leaves <= 1) return false;
+  for(std::vector<int>::iterator it_mem = carriers.member.begin(); it_mem != carriers.member.end(); it_mem++){
+    for(std::vector<int>::iterator it_group = samples.group_of_interest.begin(); it_group != samples.group_of_interest.end(); it_group++){
+      if(samples.group_of_haplotype[*it_mem] == *it_group) return true;
+    }
+  }
+  return false;
+
+}
+
+//Adds the mutation (split across the epochs its branch spans) and the opportunity of SNP snp to the matrices.
+void
+AddMutationAndOpportunity(const SNPInfo& snp_info, int snp, int ind, float root_age, std::vector<double>& epochs, std::vector<double>& branch_lengths_in_epoch, CollapsedMatrix<double>& count_bases_by_type, CollapsedMatrix<double>& mutation_by_type_and_epoch, CollapsedMatrix<double>& opportunity_by_type_and_epoch){
+
+  int num_epochs = epochs.size();
+  int num_categories = mutation_by_type_and_epoch.subVectorSize(0);
+
+  // identify epoch and add to number of mutations per lineage in epoch
+  int ep = 0;
+  while(epochs[ep] <= snp_info.age_begin){
+    ep++;
+    if(ep == epochs.size()) break;
+  }
+  ep--;
+
+  assert(ep >= 0);
+
+  double age_end = std::min(snp_info.age_end, root_age);
+  assert(age_end <= epochs[num_epochs-1]);
+  double branch_length = age_end - snp_info.age_begin;
+
+  if(age_end <= epochs[ep+1]){
+
+    mutation_by_type_and_epoch[ep][ind] += 1.0;
+
+  }else{
+
+    mutation_by_type_and_epoch[ep][ind]   += (epochs[ep+1] - snp_info.age_begin)/branch_length;
+    ep++;
+    while(epochs[ep+1] <= age_end){
+      mutation_by_type_and_epoch[ep][ind] += (epochs[ep+1]-epochs[ep])/branch_length;
+      ep++;
+    }
+    mutation_by_type_and_epoch[ep][ind]   += (age_end-epochs[ep])/branch_length;
+
+  }
+
+  //branch_lengths_in_epoch has num_epochs-1 entries, the last epoch has no opportunity
+  for(int ep_tmp = 0; ep_tmp < (int) branch_lengths_in_epoch.size(); ep_tmp++){
+    double bl = branch_lengths_in_epoch[ep_tmp];
+    assert(bl >= 0.0);
+    std::vector<double>::iterator it_opp = opportunity_by_type_and_epoch.rowbegin(ep_tmp);
+    std::vector<double>::iterator it_count = count_bases_by_type.rowbegin(snp);
+    for(int ind_tmp = 0; ind_tmp < num_categories; ind_tmp++){
+      *it_opp += bl * (*it_count);
+      it_opp++;
+      it_count++;
+    }
+  }
+
+}
+
+//Streams all trees of ancmut once and fills mutation_by_type_and_epoch and opportunity_by_type_and_epoch of every analysis.
+//Trees are processed in parallel on num_threads threads. Each thread accumulates into its own matrices unless results
+//are stored per tree, and the per-thread matrices are summed at the end, so the result does not depend on num_threads
+//up to floating point rounding.
+void
+AccumulateMutationRates(AncMutIterators& ancmut, Data& data, std::vector<double>& epochs, std::vector<MutationRateAnalysis>& analyses, int num_threads){
+
+  int num_epochs = epochs.size();
+  int N_total    = 2*data.N-1;
+  int root       = N_total-1;
+
+  bool need_all_lineages = false, need_pop_lineages = false;
+  for(std::vector<MutationRateAnalysis>::iterator it_analysis = analyses.begin(); it_analysis != analyses.end(); it_analysis++){
+    int num_matrices = (*it_analysis).per_tree ? ancmut.NumTrees() : num_threads;
+    (*it_analysis).mutation_by_type_and_epoch.resize(num_matrices);
+    (*it_analysis).opportunity_by_type_and_epoch.resize(num_matrices);
+    for(int m = 0; m < num_matrices; m++){
+      (*it_analysis).mutation_by_type_and_epoch[m].resize(num_epochs, (*it_analysis).num_categories);
+      (*it_analysis).opportunity_by_type_and_epoch[m].resize(num_epochs, (*it_analysis).num_categories);
+      std::fill((*it_analysis).mutation_by_type_and_epoch[m].vbegin(), (*it_analysis).mutation_by_type_and_epoch[m].vend(), 0.0);
+      std::fill((*it_analysis).opportunity_by_type_and_epoch[m].vbegin(), (*it_analysis).opportunity_by_type_and_epoch[m].vend(), 0.0);
+    }
+    if((*it_analysis).samples == NULL){
+      need_all_lineages = true;
+    }else{
+      need_pop_lineages = true;
+    }
+  }
+
+  std::vector<MutationRateWorkspace> workspace(num_threads);
+  for(std::vector<MutationRateWorkspace>::iterator it_ws = workspace.begin(); it_ws != workspace.end(); it_ws++){
+    (*it_ws).coordinates_tree.resize(N_total);
+    (*it_ws).num_lineages.resize(N_total);
+    (*it_ws).coordinates_pop.resize(N_total);
+    (*it_ws).num_lineages_pop.resize(N_total);
+  }
+
+  TreeBlock block;
+  int block_size = 10*num_threads;
+  while(ancmut.NextTreeBlock(block, block_size) > 0){
+
+    ParallelFor(block.num_trees, num_threads, [&](int i, int thread){
+
+      if(!ancmut.HasMutations(block, i)) return;
+
+      MutationRateWorkspace& ws = workspace[thread];
+      MarginalTree& mtr = block.mtr[i];
+      int tree_index    = block.tree_index[i];
+
+      float root_age_all = 0.0;
+      if(need_all_lineages){
+        GetCoordsAndLineages(mtr, ws.coordinates_tree, ws.num_lineages);
+        GetBranchLengthsInEpoch(data, epochs, ws.coordinates_tree, ws.num_lineages, ws.branch_lengths_in_epoch);
+        root_age_all = ws.coordinates_tree[root];
+      }
+      if(need_pop_lineages){
+        mtr.tree.FindAllLeaves(ws.descendants);
+      }
+
+      for(std::vector<MutationRateAnalysis>::iterator it_analysis = analyses.begin(); it_analysis != analyses.end(); it_analysis++){
+
+        MutationRateAnalysis& analysis = *it_analysis;
+        std::vector<double>* branch_lengths_in_epoch = &ws.branch_lengths_in_epoch;
+        float root_age = root_age_all;
+        if(analysis.samples != NULL){
+          //need to get branch lengths in epoch for only the pop of interest
+          GetCoordsAndLineagesForPop(mtr, *analysis.samples, ws.exclude, ws.descendants, ws.coordinates_pop, ws.num_lineages_pop);
+          GetBranchLengthsInEpoch(data, epochs, ws.coordinates_pop, ws.num_lineages_pop, ws.branch_lengths_in_epoch_pop);
+          branch_lengths_in_epoch = &ws.branch_lengths_in_epoch_pop;
+          root_age = ws.coordinates_pop[root];
+        }
+
+        int m = analysis.per_tree ? tree_index : thread;
+        CollapsedMatrix<double>& mutation_by_type_and_epoch    = analysis.mutation_by_type_and_epoch[m];
+        CollapsedMatrix<double>& opportunity_by_type_and_epoch = analysis.opportunity_by_type_and_epoch[m];
+
+        for(Muts::iterator it_mut = block.it_mut[i]; it_mut != ancmut.mut_end(); it_mut++){
+
+          const SNPInfo& snp_info = *it_mut;
+          if(snp_info.tree != tree_index) break;
+          if(snp_info.branch.size() != 1) continue;
+          if(analysis.mask != NULL && analysis.mask->seq[snp_info.pos-1] == 'N') continue;
+          if(analysis.samples != NULL && !IsSegregatingInGroup(snp_info, *analysis.samples, ws.descendants)) continue;
+          if(!IsWellDefinedMutation(snp_info)) continue;
+
+          // identify category of mutation
+          ws.pattern  = snp_info.upstream_base + snp_info.downstream_base;
+          ws.pattern += snp_info.mutation_type[0];
+          ws.pattern += snp_info.mutation_type[2];
+          std::map<std::string, int>::iterator it_dict = analysis.dict_mutation_pattern.find(ws.pattern);
+          if(it_dict == analysis.dict_mutation_pattern.end()) continue;
+
+          int snp = std::distance(ancmut.mut_begin(), it_mut);
+          AddMutationAndOpportunity(snp_info, snp, (*it_dict).second, root_age, epochs, *branch_lengths_in_epoch, analysis.count_bases_by_type, mutation_by_type_and_epoch, opportunity_by_type_and_epoch);
+
+        }
+
+      }
+
+    });
+
+  }
+
+  //reduce per-thread matrices
+  for(std::vector<MutationRateAnalysis>::iterator it_analysis = analyses.begin(); it_analysis != analyses.end(); it_analysis++){
+    if((*it_analysis).per_tree) continue;
+    for(int m = 1; m < num_threads; m++){
+      std::vector<double>::iterator it_mut = (*it_analysis).mutation_by_type_and_epoch[0].vbegin();
+      std::vector<double>::iterator it_opp = (*it_analysis).opportunity_by_type_and_epoch[0].vbegin();
+      std::vector<double>::iterator it_mut_thread = (*it_analysis).mutation_by_type_and_epoch[m].vbegin();
+      std::vector<double>::iterator it_opp_thread = (*it_analysis).opportunity_by_type_and_epoch[m].vbegin();
+      for(; it_mut_thread != (*it_analysis).mutation_by_type_and_epoch[m].vend();){
+        *it_mut += *it_mut_thread;
+        *it_opp += *it_opp_thread;
+        it_mut++;
+        it_opp++;
+        it_mut_thread++;
+        it_opp_thread++;
+      }
+    }
+    (*it_analysis).mutation_by_type_and_epoch.resize(1);
+    (*it_analysis).opportunity_by_type_and_epoch.resize(1);
+  }
+
+}
+
+//Block bootstrap over trees (blocks of 1000 consecutive trees) of per tree mutation and opportunity matrices.
+//Writes epochs and n_boot bootstrap samples to filename_mut and filename_opp.
+void
+BootstrapMutationRatesForCategory(std::mt19937& gen, int num_trees, std::vector<double>& epochs, int num_categories, std::vector<CollapsedMatrix<double>>& mutation_by_type_and_epoch, std::vector<CollapsedMatrix<double>>& opportunity_by_type_and_epoch, const std::string& filename_mut, const std::string& filename_opp){
+
+  int num_epochs = epochs.size();
+
+  //bootstrap
+  //sample indices from 0 too num_trees-1 at random with replacement
+  //dump to files and write summarise and finalise functions for bootstrap
+  std::uniform_int_distribution<> sam(0, (num_trees-1.0)/1000.0);
+
+  int n_boot = 100;
+  std::vector<CollapsedMatrix<double>> boot_mutation_by_type_and_epoch(n_boot);
+  std::vector<CollapsedMatrix<double>> boot_opportunity_by_type_and_epoch(n_boot);
+  for(std::vector<CollapsedMatrix<double>>::iterator it_m = boot_mutation_by_type_and_epoch.begin(); it_m != boot_mutation_by_type_and_epoch.end(); it_m++){
+    (*it_m).resize(num_epochs, num_categories);
+  }
+  for(std::vector<CollapsedMatrix<double>>::iterator it_o = boot_opportunity_by_type_and_epoch.begin(); it_o != boot_opportunity_by_type_and_epoch.end(); it_o++){
+    (*it_o).resize(num_epochs, num_categories);
+  } 
+
+  for(int n = 0; n < n_boot; n++){
+
+    std::vector<int> boot_trees(num_trees);
+    int size = 0;
+    for(std::vector<int>::iterator it_boot_trees = boot_trees.begin(); it_boot_trees != boot_trees.end();){
+      int start = 1000*sam(gen);
+      for(int k = start; k < start + 1000 && size < boot_trees.size() && k < boot_trees.size(); k++){
+        *it_boot_trees = k;
+        it_boot_trees++;
+        size++;
+      }
+    }
+    boot_trees.resize(size);
+
+    //fill in boot_mutation_by_type_and_epoch[n] and boot_opportunity_by_type_and_epoch[n] by summing over the trees  
+    for(std::vector<int>::iterator it_boot_trees = boot_trees.begin(); it_boot_trees != boot_trees.end(); it_boot_trees++){
+      std::vector<double>::iterator it_bmut_by_type_and_epoch = boot_mutation_by_type_and_epoch[n].vbegin();
+      std::vector<double>::iterator it_bopp_by_type_and_epoch = boot_opportunity_by_type_and_epoch[n].vbegin();
+      std::vector<double>::iterator it_mut_by_type_and_epoch  = mutation_by_type_and_epoch[*it_boot_trees].vbegin();
+      std::vector<double>::iterator it_opp_by_type_and_epoch  = opportunity_by_type_and_epoch[*it_boot_trees].vbegin();
+      for(; it_mut_by_type_and_epoch != mutation_by_type_and_epoch[*it_boot_trees].vend();){    
+        *it_bmut_by_type_and_epoch += *it_mut_by_type_and_epoch;
+        *it_bopp_by_type_and_epoch += *it_opp_by_type_and_epoch;
+        it_mut_by_type_and_epoch++;
+        it_opp_by_type_and_epoch++;      
+        it_bmut_by_type_and_epoch++;
+        it_bopp_by_type_and_epoch++;
+      }
+    }
+
+  }
+
+  //output mutation_by_type_and_epoch
+  //       opportunity_by_type_and_epoch 
+  FILE* fp;
+  fp = fopen(filename_mut.c_str(), "wb");  
+  fwrite(&num_epochs, sizeof(int), 1, fp);
+  fwrite(&epochs[0], sizeof(double), epochs.size(), fp);
+  for(int n = 0; n < n_boot; n++){
+    boot_mutation_by_type_and_epoch[n].DumpToFile(fp);
+  }
+  fclose(fp);
+  fp = fopen(filename_opp.c_str(), "wb");  
+  for(int n = 0; n < n_boot; n++){
+    boot_opportunity_by_type_and_epoch[n].DumpToFile(fp);
+  }
+  fclose(fp);
+
+}
+
 void FinalizeAvg(cxxopts::ParseResult& result, const std::string& help_text){
 
 
@@ -544,7 +891,7 @@ void MutationRateWithContext(cxxopts::ParseResult& result, const std::string& he
   bool help = false;
   if(!result.count("mask") || !result.count("ancestor") || !result.count("input") || !result.count("output")){
     std::cout << "Not enough arguments supplied." << std::endl;
-    std::cout << "Needed: mask, ancestor, input, output. Optional: years_per_gen, bins, dist." << std::endl;
+    std::cout << "Needed: mask, ancestor, input, output. Optional: years_per_gen, bins, dist, threads." << std::endl;
     help = true;
   }
   if(result.count("help") || help){
@@ -566,12 +913,7 @@ void MutationRateWithContext(cxxopts::ParseResult& result, const std::string& he
   
   int N = ancmut.NumTips();
   int L = ancmut.NumSnps();
-  MarginalTree mtr;
-  Muts::iterator it_mut;
-  float num_bases_tree_persists = 0.0; 
-
   Data data(N,L);
-  int N_total = 2*data.N-1;
 
   std::cerr << "------------------------------------------------------" << std::endl;
   std::cerr << "Calculating mutation rate for 96 categories " << result["input"].as<std::string>() << " ..." << std::endl;
@@ -759,117 +1101,21 @@ void MutationRateWithContext(cxxopts::ParseResult& result, const std::string& he
 
   ///////// Count number of bases by type //////////
 
-  CollapsedMatrix<double> count_bases_by_type;
-  //count_bases_by_type.resize(mutations.info.size(),dict_mutation_pattern.size());
-  CountBasesByType(data, result["mask"].as<std::string>(), result["ancestor"].as<std::string>(), count_bases_by_type, dict_mutation_pattern, mutations, pos);
+  std::vector<MutationRateAnalysis> analyses(1);
+  analyses[0].dict_mutation_pattern = dict_mutation_pattern;
+  analyses[0].num_categories        = num_mutation_cathegories;
+  CountBasesByType(data, result["mask"].as<std::string>(), result["ancestor"].as<std::string>(), analyses[0].count_bases_by_type, analyses[0].dict_mutation_pattern, mutations, pos);
 
   ////////////////////
   // Estimate mutation rate through time
 
-  CollapsedMatrix<double> mutation_by_type_and_epoch;
-  CollapsedMatrix<double> opportunity_by_type_and_epoch;
-  mutation_by_type_and_epoch.resize(num_epochs, num_mutation_cathegories);
-  opportunity_by_type_and_epoch.resize(num_epochs, num_mutation_cathegories);
-  std::vector<double> branch_lengths_in_epoch(num_epochs);
-
-  //Tree subtr;
-  std::vector<float> coordinates_tree(N_total);
-  std::vector<int> num_lineages(N_total);
-  int root = N_total-1;
-  int i = 0;
-
-  //read tree
-  float num_bases_SNP_persists;
-  num_bases_SNP_persists = ancmut.FirstSNP(mtr, it_mut);
-
-  GetCoordsAndLineages(mtr, coordinates_tree, num_lineages);
-  GetBranchLengthsInEpoch(data, epochs, coordinates_tree, num_lineages, branch_lengths_in_epoch);
-
-  SNPInfo snp_info;
-  float rec;
-  int current_tree = (*it_mut).tree;
-  double total_branch_length = 0.0;
-  int count_snps = 0;
-  for(int snp = 0; snp < data.L; snp++){
-
-    snp_info = (*it_mut);
-    if(snp_info.branch.size() == 1){
-     
-      if((*it_mut).tree != current_tree){
-        current_tree = (*it_mut).tree;
-        mtr.tree.GetCoordinates(coordinates_tree);
-        GetCoordsAndLineages(mtr, coordinates_tree, num_lineages);
-        GetBranchLengthsInEpoch(data, epochs, coordinates_tree, num_lineages, branch_lengths_in_epoch);
-      }
-      assert(current_tree == snp_info.tree);
-
-      if(snp_info.upstream_base != "NA" && snp_info.downstream_base != "NA" && snp_info.mutation_type[0] != snp_info.mutation_type[2]){
-
-        if(snp_info.mutation_type.size() == 3){
-
-          if(snp_info.mutation_type[0] == 'A' || snp_info.mutation_type[0] == 'C' || snp_info.mutation_type[0] == 'G' || snp_info.mutation_type[0] == 'T'){
-
-            if(snp_info.mutation_type[2] == 'A' || snp_info.mutation_type[2] == 'C' || snp_info.mutation_type[2] == 'G' || snp_info.mutation_type[2] == 'T'){
-
-              // identify cathegory of mutation
-              pattern = snp_info.upstream_base + snp_info.downstream_base + snp_info.mutation_type[0] + snp_info.mutation_type[2];
-              // then identify its age and number of lineages at the time
-              int ind = dict_mutation_pattern[pattern];
-
-              // identify epoch and add to number of mutations per lineage in epoch
-              int ep = 0;
-              while(epochs[ep] <= snp_info.age_begin){
-                ep++;
-                if(ep == epochs.size()) break;
-              }
-              ep--;
-
-              assert(ep >= 0);
-              assert(mutation_by_type_and_epoch.subVectorSize(ep) == num_mutation_cathegories);
-              //assert(count_bases_by_type[snp][ind] > 0);
-
-              int ep_begin = ep;
-              float age_end = std::min(snp_info.age_end,coordinates_tree[root]);
-              assert(age_end < epochs[num_epochs-1]);
-              double branch_length = age_end - snp_info.age_begin;
-
-              if(age_end <= epochs[ep+1]){
-
-                mutation_by_type_and_epoch[ep][ind] += 1.0;
-
-              }else{
-
-                mutation_by_type_and_epoch[ep][ind]   += (epochs[ep+1] - snp_info.age_begin)/branch_length;
-                ep++;
-                while(epochs[ep+1] <= age_end){
-                  mutation_by_type_and_epoch[ep][ind] += (epochs[ep+1]-epochs[ep])/branch_length;
-                  ep++;
-                }
-                mutation_by_type_and_epoch[ep][ind]   += (age_end-epochs[ep])/branch_length;
-
-              }
- 
-              for(int ep_tmp = 0; ep_tmp < num_epochs; ep_tmp++){
-                double bl = branch_lengths_in_epoch[ep_tmp];
-                for(int ind_tmp = 0; ind_tmp < num_mutation_cathegories; ind_tmp++){
-                  opportunity_by_type_and_epoch[ep_tmp][ind_tmp] += bl * count_bases_by_type[snp][ind_tmp];
-                }
-              }
-
-              //count_snps++;
-              //
-            }
-
-          }
-
-        }
-
-      }
-
-    }
-    num_bases_SNP_persists = ancmut.NextSNP(mtr, it_mut);
-
+  int num_threads = 1;
+  if(result.count("threads")){
+    num_threads = NumThreads(result["threads"].as<int>());
   }
+  AccumulateMutationRates(ancmut, data, epochs, analyses, num_threads);
+  CollapsedMatrix<double>& mutation_by_type_and_epoch    = analyses[0].mutation_by_type_and_epoch[0];
+  CollapsedMatrix<double>& opportunity_by_type_and_epoch = analyses[0].opportunity_by_type_and_epoch[0];
 
   for(int i = 0; i < num_epochs; i++){
     std::cerr << mutation_by_type_and_epoch[i][0] << " " << opportunity_by_type_and_epoch[i][0] << std::endl;
@@ -905,7 +1151,7 @@ void MutationRateForCategory(cxxopts::ParseResult& result, const std::string& he
   bool help = false;
   if(!result.count("mask") || !result.count("ancestor") || !result.count("mutcat") || !result.count("input") || !result.count("output")){
     std::cout << "Not enough arguments supplied." << std::endl;
-    std::cout << "Needed: mask, ancestor, mutcat, input, output. Optional: years_per_gen, bins, dist." << std::endl;
+    std::cout << "Needed: mask, ancestor, mutcat, input, output. Optional: years_per_gen, bins, dist, threads." << std::endl;
     help = true;
   }
   if(result.count("help") || help){
@@ -918,13 +1164,9 @@ void MutationRateForCategory(cxxopts::ParseResult& result, const std::string& he
 
   //////////// PARSE DATA ///////////
 
-  MarginalTree mtr, prev_mtr; //stores marginal trees. mtr.pos is SNP position at which tree starts, mtr.tree stores the tree
-  Muts::iterator it_mut; //iterator for mut file
-  float num_bases_tree_persists = 0.0;
-
   ////////// 1. Read one tree at a time /////////
 
-  //We open anc file and read one tree at a time. File remains open until all trees have been read OR ancmut.CloseFiles() is called.
+  //We open anc file and read trees in blocks. File remains open until all trees have been read OR ancmut.CloseFiles() is called.
   //The mut file is read once, file is closed after constructor is called.
   AncMutIterators ancmut;
 
@@ -933,11 +1175,9 @@ void MutationRateForCategory(cxxopts::ParseResult& result, const std::string& he
   }else{
     ancmut.OpenFiles(result["input"].as<std::string>() + "_chr" + chr + ".anc", result["input"].as<std::string>() + "_chr" + chr + ".mut");
   }
-  num_bases_tree_persists = ancmut.NextTree(mtr, it_mut);
-  int N = (mtr.tree.nodes.size() + 1)/2.0;
+  int N = ancmut.NumTips();
   int L = ancmut.NumSnps();
   Data data(N,L);
-  int N_total = 2*data.N-1;
 
   std::cerr << "------------------------------------------------------" << std::endl;
   std::cerr << "Calculating mutation rate for categories " << result["input"].as<std::string>() << " ..." << std::endl;
@@ -1082,313 +1322,55 @@ void MutationRateForCategory(cxxopts::ParseResult& result, const std::string& he
   /////////////////////////////////////////////////////////////////
   //Mutation specific
 
-  ////////// define mutation types /////////
-  std::string alphabet = "ACGT";
-  std::map<char, std::string> complement;
-  complement['A'] = "T";
-  complement['C'] = "G";
-  complement['G'] = "C";
-  complement['T'] = "A";
-  std::map<std::string, int> dict_mutation_pattern;
-
-  //A-C, A-G, A-T, C-A, C-G, C-T
-  //T-G, T-C, T-A, G-T, G-C, G-A
-  //plus 16 flanks per mutation type, i.e. 6*16 = 96
-
-  //parse file storing
-  //upstream downstream ancestral derived category
-  igzstream is_cat(result["mutcat"].as<std::string>());
-  if(is_cat.fail()){
-    std::cerr << "Error: unable to open file " << result["mutcat"].as<std::string>() << std::endl;
+  int num_threads = 1;
+  if(result.count("threads")){
+    num_threads = NumThreads(result["threads"].as<int>());
   }
-  getline(is_cat, line);
-  //I have to make sure all 96 categories are represented in this file
 
-  char mutation_type[5];
-  std::string pattern, reverse_pattern;
-  int category, num_categories = 0;
-  std::vector<int> check_num_categories;
-  while(getline(is_cat, line)){
-    sscanf(line.c_str(), "%c %c %c %c %d", &mutation_type[0], &mutation_type[1], &mutation_type[2], &mutation_type[3], &category);
-    pattern = mutation_type;
-    dict_mutation_pattern[pattern] = category;
-    pattern = complement[mutation_type[1]] + complement[mutation_type[0]] + complement[mutation_type[2]] + complement[mutation_type[3]];
-    dict_mutation_pattern[pattern] = category;
-    if(category >= num_categories){
-      check_num_categories.resize(category+1);
-      std::fill(std::next(check_num_categories.begin(),num_categories), check_num_categories.end(), 0);
-      num_categories = category + 1;      
-      check_num_categories[category]++;
-    }else{
-      check_num_categories[category]++;
-    }
-  }
-  is_cat.close();
-
-  for(std::vector<int>::iterator it_check = check_num_categories.begin(); it_check != check_num_categories.end(); it_check++){
-    if(*it_check == 0){
-      std::cerr << "Error: category indices not 0-indexed or contiguous." << std::endl;
-      exit(1);
-    }
-  }
-
-  //check that I got all 96 categories and that categories are contiguous integers
-  int index = 0;
-  for(std::string::iterator it_str1 = alphabet.begin(); it_str1 != alphabet.end(); it_str1++){
-    for(std::string::iterator it_str2 = alphabet.begin(); it_str2 != alphabet.end(); it_str2++){
-      pattern = *it_str1;
-      pattern += *it_str2;
-      reverse_pattern = complement[*it_str2] + complement[*it_str1];
-
-      if ( dict_mutation_pattern.find(pattern + "CA") == dict_mutation_pattern.end() && dict_mutation_pattern.find(reverse_pattern + "GT") == dict_mutation_pattern.end() ) {
-        // not found
-        std::cerr << "Error: not all 96 mutation categories provided." << std::endl;
-        exit(1);
-      }
-      if ( dict_mutation_pattern.find(pattern + "CG") == dict_mutation_pattern.end() && dict_mutation_pattern.find(reverse_pattern + "GC") == dict_mutation_pattern.end() ) {
-        // not found
-        std::cerr << "Error: not all 96 mutation categories provided." << std::endl;
-        exit(1);
-      }
-      if ( dict_mutation_pattern.find(pattern + "CT") == dict_mutation_pattern.end() && dict_mutation_pattern.find(reverse_pattern + "GA") == dict_mutation_pattern.end() ) {
-        // not found
-        std::cerr << "Error: not all 96 mutation categories provided." << std::endl;
-        exit(1);
-      }
-      if ( dict_mutation_pattern.find(pattern + "AT") == dict_mutation_pattern.end() && dict_mutation_pattern.find(reverse_pattern + "TA") == dict_mutation_pattern.end() ) {
-        // not found
-        std::cerr << "Error: not all 96 mutation categories provided." << std::endl;
-        exit(1);
-      }
-      if ( dict_mutation_pattern.find(pattern + "AG") == dict_mutation_pattern.end() && dict_mutation_pattern.find(reverse_pattern + "TC") == dict_mutation_pattern.end() ) {
-        // not found
-        std::cerr << "Error: not all 96 mutation categories provided." << std::endl;
-        exit(1);
-      }
-      if ( dict_mutation_pattern.find(pattern + "AC") == dict_mutation_pattern.end() && dict_mutation_pattern.find(reverse_pattern + "TG") == dict_mutation_pattern.end() ) {
-        // not found
-        std::cerr << "Error: not all 96 mutation categories provided." << std::endl;
-        exit(1);
-      }
-    }   
-  }
-
-  ///////// Count number of bases by type //////////
-
-  CollapsedMatrix<double> count_bases_by_type;
-  //count_bases_by_type.resize(mutations.info.size(),dict_mutation_pattern.size());
-  CountBasesByType(data, result["mask"].as<std::string>(), result["ancestor"].as<std::string>(), count_bases_by_type, dict_mutation_pattern, mutations, pos);
   fasta mask;
   mask.Read(result["mask"].as<std::string>());
 
-  ////////////////////////////////////////////////////////////////////////
-  // Estimate mutation rate through time
-
-  std::vector<CollapsedMatrix<double>> mutation_by_type_and_epoch(ancmut.NumTrees());
-  std::vector<CollapsedMatrix<double>> opportunity_by_type_and_epoch(ancmut.NumTrees());
-  for(std::vector<CollapsedMatrix<double>>::iterator it_m = mutation_by_type_and_epoch.begin(); it_m != mutation_by_type_and_epoch.end(); it_m++){
-    (*it_m).resize(num_epochs, num_categories);
-  }
-  for(std::vector<CollapsedMatrix<double>>::iterator it_o = opportunity_by_type_and_epoch.begin(); it_o != opportunity_by_type_and_epoch.end(); it_o++){
-    (*it_o).resize(num_epochs, num_categories);
-  } 
-
-  std::vector<double> branch_lengths_in_epoch(num_epochs);
-
-  //Tree subtr;
-  std::vector<float> coordinates_tree(N_total);
-  std::vector<int> num_lineages(N_total);
-  int root = N_total-1;
-  int i = 0;
-
-  //iterate over trees
-  SNPInfo snp_info;
-  float rec;
-  int num_tree = 0;
-  double total_branch_length = 0.0;
-  int count_snps = 0;
-
-  int snp = 0;
-  while(num_bases_tree_persists >= 0){
-
-    mtr.tree.GetCoordinates(coordinates_tree);
-    GetCoordsAndLineages(mtr, coordinates_tree, num_lineages);
-    GetBranchLengthsInEpoch(data, epochs, coordinates_tree, num_lineages, branch_lengths_in_epoch);
-    num_tree = mutations.info[snp].tree;
-
-    while(num_tree == mutations.info[snp].tree){
-
-      snp_info = mutations.info[snp];
-
-      if(snp_info.branch.size() == 1 && mask.seq[snp_info.pos-1] != 'N'){
-
-        assert(ancmut.get_treecount() == snp_info.tree);
-
-        //if statements to make sure we have a well defined biallelic SNP
-        if(snp_info.upstream_base != "NA" && snp_info.downstream_base != "NA" && snp_info.mutation_type[0] != snp_info.mutation_type[2]){
-
-          if(snp_info.mutation_type.size() == 3){
-
-            if(snp_info.mutation_type[0] == 'A' || snp_info.mutation_type[0] == 'C' || snp_info.mutation_type[0] == 'G' || snp_info.mutation_type[0] == 'T'){
-
-              if(snp_info.mutation_type[2] == 'A' || snp_info.mutation_type[2] == 'C' || snp_info.mutation_type[2] == 'G' || snp_info.mutation_type[2] == 'T'){
-
-                // identify category of mutation
-                pattern = snp_info.upstream_base + snp_info.downstream_base + snp_info.mutation_type[0] + snp_info.mutation_type[2];
-                // then identify its age and number of lineages at the time
-                assert(dict_mutation_pattern.find(pattern) != dict_mutation_pattern.end());
-                int ind = dict_mutation_pattern[pattern];
-
-                // identify epoch and add to number of mutations per lineage in epoch
-                int ep = 0;
-                while(epochs[ep] <= snp_info.age_begin){
-                  ep++;
-                  if(ep == epochs.size()) break;
-                }
-                ep--;
-
-                assert(ep >= 0);
-                assert(mutation_by_type_and_epoch[num_tree].subVectorSize(ep) == num_categories);
-
-                int ep_begin = ep;
-                float age_end = std::min(snp_info.age_end,coordinates_tree[root]);
-                assert(age_end < epochs[num_epochs-1]);
-                double branch_length = age_end - snp_info.age_begin;
+  //one analysis per file in mutcat, all computed in the same pass over the trees
+  std::vector<std::string> filenames_mutcat = SplitFilenames(result["mutcat"].as<std::string>());
+  std::vector<MutationRateAnalysis> analyses(filenames_mutcat.size());
+  for(int k = 0; k < (int) analyses.size(); k++){
 
-                if(age_end <= epochs[ep+1]){
+    ////////// define mutation types /////////
+    ReadMutationCategories(filenames_mutcat[k], analyses[k].dict_mutation_pattern, analyses[k].num_categories);
 
-                  mutation_by_type_and_epoch[num_tree][ep][ind] += 1.0;
+    ///////// Count number of bases by type //////////
+    CountBasesByType(data, result["mask"].as<std::string>(), result["ancestor"].as<std::string>(), analyses[k].count_bases_by_type, analyses[k].dict_mutation_pattern, mutations, pos);
 
-                }else{
-
-                  mutation_by_type_and_epoch[num_tree][ep][ind]   += (epochs[ep+1] - snp_info.age_begin)/branch_length;
-                  ep++;
-                  while(epochs[ep+1] <= age_end){
-                    mutation_by_type_and_epoch[num_tree][ep][ind] += (epochs[ep+1]-epochs[ep])/branch_length;
-                    ep++;
-                  }
-                  mutation_by_type_and_epoch[num_tree][ep][ind]   += (age_end-epochs[ep])/branch_length;
-
-                }
-
-                for(int ep_tmp = 0; ep_tmp < num_epochs; ep_tmp++){
-                  double bl = branch_lengths_in_epoch[ep_tmp];
-                  assert(bl >= 0.0);
-                  for(int ind_tmp = 0; ind_tmp < num_categories; ind_tmp++){
-                    //std::cerr << count_bases_by_type[snp][ind_tmp] << " ";
-                    opportunity_by_type_and_epoch[num_tree][ep_tmp][ind_tmp] += bl * count_bases_by_type[snp][ind_tmp];
-                  }
-                  //std::cerr << std::endl;
-                }
-
-              }
-
-            }
-
-          } 
-
-        }
-
-      }
-
-      snp++;
-
-    }
-
-    num_bases_tree_persists = ancmut.NextTree(mtr, it_mut);
+    analyses[k].mask     = &mask;
+    analyses[k].per_tree = true;
 
   }
 
+  ////////////////////////////////////////////////////////////////////////
+  // Estimate mutation rate through time
 
-  //bootstrap
-  //sample indices from 0 too ancmut.NumTrees()-1 at random with replacement
-  //dump to files and write summarise and finalise functions for bootstrap
+  AccumulateMutationRates(ancmut, data, epochs, analyses, num_threads);
 
   std::random_device rd;  //Will be used to obtain a seed for the random number engine
   std::mt19937 gen(rd()); //Standard mersenne_twister_engine seeded with rd()
-  std::uniform_int_distribution<> sam(0, (ancmut.NumTrees()-1.0)/1000.0);
-
-  int n_boot = 100;
-  std::vector<CollapsedMatrix<double>> boot_mutation_by_type_and_epoch(n_boot);
-  std::vector<CollapsedMatrix<double>> boot_opportunity_by_type_and_epoch(n_boot);
-  for(std::vector<CollapsedMatrix<double>>::iterator it_m = boot_mutation_by_type_and_epoch.begin(); it_m != boot_mutation_by_type_and_epoch.end(); it_m++){
-    (*it_m).resize(num_epochs, num_categories);
+  for(int k = 0; k < (int) analyses.size(); k++){
+    //with several mutcat files, the k-th is written to output_mutcat<k>
+    std::string filename_base = result["output"].as<std::string>();
+    if(analyses.size() > 1) filename_base += "_mutcat" + std::to_string(k);
+    if(chr != "NA") filename_base += "_chr" + chr;
+    BootstrapMutationRatesForCategory(gen, ancmut.NumTrees(), epochs, analyses[k].num_categories, analyses[k].mutation_by_type_and_epoch, analyses[k].opportunity_by_type_and_epoch, filename_base + "_mut" + ".bin", filename_base + "_opp" + ".bin");
   }
-  for(std::vector<CollapsedMatrix<double>>::iterator it_o = boot_opportunity_by_type_and_epoch.begin(); it_o != boot_opportunity_by_type_and_epoch.end(); it_o++){
-    (*it_o).resize(num_epochs, num_categories);
-  } 
-
-  for(int n = 0; n < n_boot; n++){
-  
-    std::vector<int> boot_trees(ancmut.NumTrees());
-    if(0){
-    for(std::vector<int>::iterator it_boot_trees = boot_trees.begin(); it_boot_trees != boot_trees.end(); it_boot_trees++){
-      *it_boot_trees = sam(gen);
-    }
-    }
 
-    int size = 0;
-    for(std::vector<int>::iterator it_boot_trees = boot_trees.begin(); it_boot_trees != boot_trees.end();){
-      int start = 1000*sam(gen);
-      for(int k = start; k < start + 1000 && size < boot_trees.size() && k < boot_trees.size(); k++){
-        *it_boot_trees = k;
-        it_boot_trees++;
-        size++;
-      }
-    }
-    boot_trees.resize(size);
-    //std::sort(boot_trees.begin(), boot_trees.end());
-
-    //fill in boot_mutation_by_type_and_epoch[n] and boot_opportunity_by_type_and_epoch[n] by summing over the trees  
-    for(std::vector<int>::iterator it_boot_trees = boot_trees.begin(); it_boot_trees != boot_trees.end(); it_boot_trees++){
-      std::vector<double>::iterator it_bmut_by_type_and_epoch = boot_mutation_by_type_and_epoch[n].vbegin();
-      std::vector<double>::iterator it_bopp_by_type_and_epoch = boot_opportunity_by_type_and_epoch[n].vbegin();
-      std::vector<double>::iterator it_mut_by_type_and_epoch  = mutation_by_type_and_epoch[*it_boot_trees].vbegin();
-      std::vector<double>::iterator it_opp_by_type_and_epoch  = opportunity_by_type_and_epoch[*it_boot_trees].vbegin();
-      for(; it_mut_by_type_and_epoch != mutation_by_type_and_epoch[*it_boot_trees].vend();){    
-        *it_bmut_by_type_and_epoch += *it_mut_by_type_and_epoch;
-        *it_bopp_by_type_and_epoch += *it_opp_by_type_and_epoch;
-        it_mut_by_type_and_epoch++;
-        it_opp_by_type_and_epoch++;      
-        it_bmut_by_type_and_epoch++;
-        it_bopp_by_type_and_epoch++;
-      }
-    }
-  
-  }
-
-  //output mutation_by_type_and_epoch
-  //       opportunity_by_type_and_epoch 
-  FILE* fp;
-  if(chr == "NA"){
-    fp = fopen((result["output"].as<std::string>() + "_mut" + ".bin" ).c_str(), "wb");  
-  }else{
-    fp = fopen((result["output"].as<std::string>() + "_chr" + chr + "_mut" + ".bin" ).c_str(), "wb");  
-  }
-  fwrite(&num_epochs, sizeof(int), 1, fp);
-  fwrite(&epochs[0], sizeof(double), epochs.size(), fp);
-  for(int n = 0; n < n_boot; n++){
-    boot_mutation_by_type_and_epoch[n].DumpToFile(fp);
-  }
-  fclose(fp);
-  if(chr == "NA"){
-    fp = fopen((result["output"].as<std::string>() + "_opp" + ".bin" ).c_str(), "wb");  
-  }else{
-    fp = fopen((result["output"].as<std::string>() + "_chr" + chr + "_opp" + ".bin" ).c_str(), "wb");  
-  }
-  for(int n = 0; n < n_boot; n++){
-    boot_opportunity_by_type_and_epoch[n].DumpToFile(fp);
-  }
-  fclose(fp);
   ResourceUsage();
 }
 
+
 void MutationRateForCategoryForGroup(cxxopts::ParseResult& result, const std::string& help_text, std::string chr = "NA"){
 
   bool help = false;
   if(!result.count("mask") || !result.count("ancestor") || !result.count("mutcat") || !result.count("pop_of_interest") || !result.count("poplabels") || !result.count("input") || !result.count("output")){
     std::cout << "Not enough arguments supplied." << std::endl;
-    std::cout << "Needed: mask, ancestor, mutcat, input, output, pop_of_interest, poplabels. Optional: years_per_gen, bins, dist." << std::endl;
+    std::cout << "Needed: mask, ancestor, mutcat, input, output, pop_of_interest, poplabels. Optional: years_per_gen, bins, dist, threads." << std::endl;
     help = true;
   }
   if(result.count("help") || help){
@@ -1401,10 +1383,6 @@ void MutationRateForCategoryForGroup(cxxopts::ParseResult& result, const std::st
 
   //////////// PARSE DATA ///////////
 
-  MarginalTree mtr, prev_mtr; //stores marginal trees. mtr.pos is SNP position at which tree starts, mtr.tree stores the tree
-  Muts::iterator it_mut; //iterator for mut file
-  float num_bases_tree_persists = 0.0;
-
   Sample samples;
   samples.Read(result["poplabels"].as<std::string>());
 
@@ -1426,7 +1404,7 @@ void MutationRateForCategoryForGroup(cxxopts::ParseResult& result, const std::st
 
   ////////// 1. Read one tree at a time /////////
 
-  //We open anc file and read one tree at a time. File remains open until all trees have been read OR ancmut.CloseFiles() is called.
+  //We open anc file and read trees in blocks. File remains open until all trees have been read OR ancmut.CloseFiles() is called.
   //The mut file is read once, file is closed after constructor is called.
   AncMutIterators ancmut;
 
@@ -1435,11 +1413,9 @@ void MutationRateForCategoryForGroup(cxxopts::ParseResult& result, const std::st
   }else{
     ancmut.OpenFiles(result["input"].as<std::string>() + "_chr" + chr + ".anc", result["input"].as<std::string>() + "_chr" + chr + ".mut");
   }
-  num_bases_tree_persists = ancmut.NextTree(mtr, it_mut);
   int N = ancmut.NumTips();
   int L = ancmut.NumSnps();
   Data data(N,L);
-  int N_total = 2*data.N-1;
 
   std::cerr << "------------------------------------------------------" << std::endl;
   std::cerr << "Calculating mutation rate for categories " << result["input"].as<std::string>() << " ..." << std::endl;
@@ -1580,420 +1556,90 @@ void MutationRateForCategoryForGroup(cxxopts::ParseResult& result, const std::st
       ep++;
     }
     while(epoch_boundary < epoch_upper){
-      if(log_age < epoch_boundary){
-        if(ep == 1 && age != 0.0){
-          epochs.push_back(age);
-          if(epoch_boundary - log_age < 0.5*epoch_step) epoch_boundary += epoch_step;
-        }
-        if(std::fabs(log_age - epoch_boundary) > 1e-3){
-          epochs.push_back( std::exp(log_10 * epoch_boundary)/years_per_gen );
-        }
-        ep++;
-      }
-      epoch_boundary += epoch_step;
-    }
-    epochs.push_back( std::exp(log_10 * epoch_upper)/years_per_gen );
-    epochs.push_back( std::max(1e8, 10*epochs[epochs.size()-1])/years_per_gen );
-    num_epochs = epochs.size();	
-    
-  }else{
-
-    num_epochs = 31;
-    epochs.resize(num_epochs);
-    epochs[0] = 0.0;
-    epochs[1] = 1e3/years_per_gen;
-    for(int e = 2; e < num_epochs-1; e++){
-      epochs[e] = std::exp( log_10 * ( 3.0 + 4.0 * (e-1.0)/(num_epochs-3.0) ))/years_per_gen;
-    }
-    epochs[num_epochs-1] = 1e8/years_per_gen;
-
-  }
-
-  //for(int i = 0; i < num_epochs; i++){
-  //  std::cerr << epochs[i] << " ";
-  //}
-  //std::cerr << std::endl;
-
-  /////////////////////////////////////////////////////////////////
-  //Mutation specific
-
-  ////////// define mutation types /////////
-  std::string alphabet = "ACGT";
-  std::map<char, std::string> complement;
-  complement['A'] = "T";
-  complement['C'] = "G";
-  complement['G'] = "C";
-  complement['T'] = "A";
-  std::map<std::string, int> dict_mutation_pattern;
-
-  //A-C, A-G, A-T, C-A, C-G, C-T
-  //T-G, T-C, T-A, G-T, G-C, G-A
-  //plus 16 flanks per mutation type, i.e. 6*16 = 96
-
-  //parse file storing
-  //upstream downstream ancestral derived category
-  igzstream is_cat(result["mutcat"].as<std::string>());
-  if(is_cat.fail()){
-    std::cerr << "Error: unable to open file " << result["mutcat"].as<std::string>() << std::endl;
-  }
-  getline(is_cat, line);
-  //I have to make sure all 96 categories are represented in this file
-
-  char mutation_type[5];
-  std::string pattern, reverse_pattern;
-  int category, num_categories = 0;
-  std::vector<int> check_num_categories;
-  while(getline(is_cat, line)){
-    sscanf(line.c_str(), "%c %c %c %c %d", &mutation_type[0], &mutation_type[1], &mutation_type[2], &mutation_type[3], &category);
-    pattern = mutation_type;
-		dict_mutation_pattern[pattern] = category;
-    pattern = complement[mutation_type[1]] + complement[mutation_type[0]] + complement[mutation_type[2]] + complement[mutation_type[3]];
-    dict_mutation_pattern[pattern] = category;
-    if(category >= num_categories){
-      check_num_categories.resize(category+1);
-      std::fill(std::next(check_num_categories.begin(),num_categories), check_num_categories.end(), 0);
-      num_categories = category + 1;      
-      check_num_categories[category]++;
-    }else{
-      check_num_categories[category]++;
-    }
-  }
-  is_cat.close();
-
-  for(std::vector<int>::iterator it_check = check_num_categories.begin(); it_check != check_num_categories.end(); it_check++){
-    if(*it_check == 0){
-      std::cerr << "Error: category indices not 0-indexed or contiguous." << std::endl;
-      exit(1);
-    }
-  }
-
-  //check that I got all 96 categories and that categories are contiguous integers
-  int index = 0;
-  for(std::string::iterator it_str1 = alphabet.begin(); it_str1 != alphabet.end(); it_str1++){
-    for(std::string::iterator it_str2 = alphabet.begin(); it_str2 != alphabet.end(); it_str2++){
-      pattern = *it_str1;
-      pattern += *it_str2;
-      reverse_pattern = complement[*it_str2] + complement[*it_str1];
-
-      if ( dict_mutation_pattern.find(pattern + "CA") == dict_mutation_pattern.end() && dict_mutation_pattern.find(reverse_pattern + "GT") == dict_mutation_pattern.end() ) {
-        // not found
-        std::cerr << "Error: not all 96 mutation categories provided." << std::endl;
-        exit(1);
-      }
-      if ( dict_mutation_pattern.find(pattern + "CG") == dict_mutation_pattern.end() && dict_mutation_pattern.find(reverse_pattern + "GC") == dict_mutation_pattern.end() ) {
-        // not found
-        std::cerr << "Error: not all 96 mutation categories provided." << std::endl;
-        exit(1);
-      }
-      if ( dict_mutation_pattern.find(pattern + "CT") == dict_mutation_pattern.end() && dict_mutation_pattern.find(reverse_pattern + "GA") == dict_mutation_pattern.end() ) {
-        // not found
-				std::cerr << "Error: not all 96 mutation categories provided." << std::endl;
-        exit(1);
-      }
-      if ( dict_mutation_pattern.find(pattern + "AT") == dict_mutation_pattern.end() && dict_mutation_pattern.find(reverse_pattern + "TA") == dict_mutation_pattern.end() ) {
-        // not found
-				std::cerr << "Error: not all 96 mutation categories provided." << std::endl;
-        exit(1);
-      }
-      if ( dict_mutation_pattern.find(pattern + "AG") == dict_mutation_pattern.end() && dict_mutation_pattern.find(reverse_pattern + "TC") == dict_mutation_pattern.end() ) {
-        // not found
-				std::cerr << "Error: not all 96 mutation categories provided." << std::endl;
-        exit(1);
-      }
-      if ( dict_mutation_pattern.find(pattern + "AC") == dict_mutation_pattern.end() && dict_mutation_pattern.find(reverse_pattern + "TG") == dict_mutation_pattern.end() ) {
-        // not found
-				std::cerr << "Error: not all 96 mutation categories provided." << std::endl;
-        exit(1);
-      }
-    }   
-  }
-
-  ///////// Count number of bases by type //////////
-
-  CollapsedMatrix<double> count_bases_by_type;
-  //count_bases_by_type.resize(mutations.info.size(),dict_mutation_pattern.size());
-  CountBasesByType(data, result["mask"].as<std::string>(), result["ancestor"].as<std::string>(), count_bases_by_type, dict_mutation_pattern, mutations, pos);
-  fasta mask;
-  mask.Read(result["mask"].as<std::string>());
-
-  ////////////////////////////////////////////////////////////////////////
-  // Estimate mutation rate through time
-
-  std::vector<CollapsedMatrix<double>> mutation_by_type_and_epoch(ancmut.NumTrees());
-  std::vector<CollapsedMatrix<double>> opportunity_by_type_and_epoch(ancmut.NumTrees());
-  for(std::vector<CollapsedMatrix<double>>::iterator it_m = mutation_by_type_and_epoch.begin(); it_m != mutation_by_type_and_epoch.end(); it_m++){
-    (*it_m).resize(num_epochs, num_categories);
-  }
-  for(std::vector<CollapsedMatrix<double>>::iterator it_o = opportunity_by_type_and_epoch.begin(); it_o != opportunity_by_type_and_epoch.end(); it_o++){
-    (*it_o).resize(num_epochs, num_categories);
-  } 
-
-  std::vector<double> branch_lengths_in_epoch(num_epochs);
-  //Tree subtr;
-  std::vector<float> coordinates_tree(N_total);
-  std::vector<int> num_lineages(N_total);
-  std::vector<Leaves> descendants;
-  int root = N_total-1;
-  int i = 0;
-
-  //iterate over trees
-  SNPInfo snp_info;
-  float rec;
-  int num_tree = 0;
-  double total_branch_length = 0.0;
-  int count_snps = 0;
-
-  std::vector<int> exclude;
-  if(0){
-    std::vector<std::string> id = {"LBK", "NE1", "BR2", "JP14", "NG10", "PB675", "atp016"};
-    //std::vector<std::string> id = {"KK1", "Loschbour", "sf12", "SRA62"};
-    //std::vector<std::string> id = {"WestEurasia"};
-    for(int j = 0; j < id.size(); j++){
-      i = 0;
-      for(; i < samples.groups.size(); i++){
-        if(samples.groups[i] == id[j]) break;
-      }
-      if(i == 0 && samples.groups[0] != id[j]){
-        std::cerr << "Group to exclude not found" << std::endl;
-        exit(1);
+      if(log_age < epoch_boundary){
+        if(ep == 1 && age != 0.0){
+          epochs.push_back(age);
+          if(epoch_boundary - log_age < 0.5*epoch_step) epoch_boundary += epoch_step;
+        }
+        if(std::fabs(log_age - epoch_boundary) > 1e-3){
+          epochs.push_back( std::exp(log_10 * epoch_boundary)/years_per_gen );
+        }
+        ep++;
       }
-      exclude.push_back(i);
+      epoch_boundary += epoch_step;
     }
-  }
-
-  int snp = 0;
-  while(num_bases_tree_persists >= 0){
-
-    //need to get branch lengths in epoch for only the pop of interest
-    mtr.tree.GetCoordinates(coordinates_tree);
-    mtr.tree.FindAllLeaves(descendants);
-    GetCoordsAndLineagesForPop(mtr, samples, exclude, descendants, coordinates_tree, num_lineages);
-    GetBranchLengthsInEpoch(data, epochs, coordinates_tree, num_lineages, branch_lengths_in_epoch);
-    num_tree = mutations.info[snp].tree;
-
-    //for(int i = 0; i < num_lineages.size(); i++){
-    //  std::cerr << num_lineages[i] << " ";
-    //}
-    //std::cerr << std::endl;
-
-    while(num_tree == mutations.info[snp].tree){
-
-      snp_info = mutations.info[snp];
-
-      if(snp_info.branch.size() == 1 && mask.seq[snp_info.pos-1] != 'N'){
-
-        assert(ancmut.get_treecount() == snp_info.tree);
-        //check for mutation whether it is segregating in pop_of_interest
-        bool use = false, excl = false;
-
-        if(descendants[snp_info.branch[0]].num_leaves > 1){
-          for(int i = 0; i < samples.group_of_interest.size(); i++){
-            for(std::vector<int>::iterator it_mem = descendants[snp_info.branch[0]].member.begin(); it_mem != descendants[snp_info.branch[0]].member.end(); it_mem++){
-              if(i == 0){
-                for(int j = 0; j < exclude.size(); j++){
-                  if(samples.group_of_haplotype[*it_mem] == exclude[j]){
-                    excl = true;
-                    break;
-                  }
-                }
-                if(excl){
-                  break;
-                }
-              }
-              if(samples.group_of_haplotype[*it_mem] == samples.group_of_interest[i]){
-                use = true;
-                if(i != 0) break;
-              }
-            }
-            if(excl){
-              use = false;
-              break;
-            }
-          } 
-        }
-
-        //if statements to make sure we have a well defined biallelic SNP
-        if(use && snp_info.upstream_base != "NA" && snp_info.downstream_base != "NA" && snp_info.mutation_type[0] != snp_info.mutation_type[2]){
-
-          if(snp_info.mutation_type.size() == 3){
-
-            if(snp_info.mutation_type[0] == 'A' || snp_info.mutation_type[0] == 'C' || snp_info.mutation_type[0] == 'G' || snp_info.mutation_type[0] == 'T'){
-
-              if(snp_info.mutation_type[2] == 'A' || snp_info.mutation_type[2] == 'C' || snp_info.mutation_type[2] == 'G' || snp_info.mutation_type[2] == 'T'){
-
-                if(0){
-                if(snp_info.upstream_base == "T" && snp_info.downstream_base == "C" && snp_info.mutation_type == "C/T"){
-                  std::cerr << snp_info.pos << " " << snp_info.tree << " " << snp_info.branch[0] << std::endl;
-
-                  std::cerr << "Excl: " << exclude[0] << std::endl;
-                  for(int i = 0; i < descendants[snp_info.branch[0]].member.size(); i++){
-                    std::cerr << samples.group_of_haplotype[descendants[snp_info.branch[0]].member[i]] << " ";
-                  }
-                  std::cerr << std::endl;
-
-
-                }
-                }
-
-                // identify category of mutation
-                pattern = snp_info.upstream_base + snp_info.downstream_base + snp_info.mutation_type[0] + snp_info.mutation_type[2];
-                // then identify its age and number of lineages at the time
-                assert(dict_mutation_pattern.find(pattern) != dict_mutation_pattern.end());
-                int ind = dict_mutation_pattern[pattern];
-
-                // identify epoch and add to number of mutations per lineage in epoch
-                int ep = 0;
-                while(epochs[ep] <= snp_info.age_begin){
-                  ep++;
-                  if(ep == epochs.size()) break;
-                }
-                ep--;
-
-                assert(ep >= 0);
-                assert(mutation_by_type_and_epoch[num_tree].subVectorSize(ep) == num_categories);
-
-                int ep_begin = ep;
-                double age_end = std::min(snp_info.age_end,coordinates_tree[root]);
-                //if(age_end > epochs[num_epochs-1]){
-                //  std::cerr << snp << " " << snp_info.age_end << " " << coordinates_tree[root] << std::endl;
-                //}
-                assert(age_end <= epochs[num_epochs-1]);
-                double branch_length = age_end - snp_info.age_begin;
-
-                if(age_end <= epochs[ep+1]){
-
-                  mutation_by_type_and_epoch[num_tree][ep][ind] += 1.0;
-
-                }else{
-
-                  mutation_by_type_and_epoch[num_tree][ep][ind]   += (epochs[ep+1] - snp_info.age_begin)/branch_length;
-                  ep++;
-                  while(epochs[ep+1] <= age_end){
-                    mutation_by_type_and_epoch[num_tree][ep][ind] += (epochs[ep+1]-epochs[ep])/branch_length;
-                    ep++;
-                  }
-                  mutation_by_type_and_epoch[num_tree][ep][ind]   += (age_end-epochs[ep])/branch_length;
+    epochs.push_back( std::exp(log_10 * epoch_upper)/years_per_gen );
+    epochs.push_back( std::max(1e8, 10*epochs[epochs.size()-1])/years_per_gen );
+    num_epochs = epochs.size();	
+    
+  }else{
 
-                }
+    num_epochs = 31;
+    epochs.resize(num_epochs);
+    epochs[0] = 0.0;
+    epochs[1] = 1e3/years_per_gen;
+    for(int e = 2; e < num_epochs-1; e++){
+      epochs[e] = std::exp( log_10 * ( 3.0 + 4.0 * (e-1.0)/(num_epochs-3.0) ))/years_per_gen;
+    }
+    epochs[num_epochs-1] = 1e8/years_per_gen;
 
-                for(int ep_tmp = 0; ep_tmp < num_epochs; ep_tmp++){
-                  double bl = branch_lengths_in_epoch[ep_tmp];
-                  assert(bl >= 0.0);
-                  for(int ind_tmp = 0; ind_tmp < num_categories; ind_tmp++){
-                    //std::cerr << opportunity_by_type_and_epoch[num_tree][ep_tmp][ind_tmp] << " ";
-                    opportunity_by_type_and_epoch[num_tree][ep_tmp][ind_tmp] += bl * count_bases_by_type[snp][ind_tmp];
-                  }
-                  //std::cerr << std::endl;
-                }
+  }
 
-              }
+  //for(int i = 0; i < num_epochs; i++){
+  //  std::cerr << epochs[i] << " ";
+  //}
+  //std::cerr << std::endl;
 
-            }
+  /////////////////////////////////////////////////////////////////
+  //Mutation specific
 
-          } 
+  int num_threads = 1;
+  if(result.count("threads")){
+    num_threads = NumThreads(result["threads"].as<int>());
+  }
 
-        }
+  fasta mask;
+  mask.Read(result["mask"].as<std::string>());
 
-      }
+  //one analysis per file in mutcat, all computed in the same pass over the trees
+  std::vector<std::string> filenames_mutcat = SplitFilenames(result["mutcat"].as<std::string>());
+  std::vector<MutationRateAnalysis> analyses(filenames_mutcat.size());
+  for(int k = 0; k < (int) analyses.size(); k++){
 
-      snp++;
+    ////////// define mutation types /////////
+    ReadMutationCategories(filenames_mutcat[k], analyses[k].dict_mutation_pattern, analyses[k].num_categories);
 
-    }
+    ///////// Count number of bases by type //////////
+    CountBasesByType(data, result["mask"].as<std::string>(), result["ancestor"].as<std::string>(), analyses[k].count_bases_by_type, analyses[k].dict_mutation_pattern, mutations, pos);
 
-    num_bases_tree_persists = ancmut.NextTree(mtr, it_mut);
+    analyses[k].mask     = &mask;
+    analyses[k].samples  = &samples;
+    analyses[k].per_tree = true;
 
   }
 
+  ////////////////////////////////////////////////////////////////////////
+  // Estimate mutation rate through time
 
-  //bootstrap
-  //sample indices from 0 too ancmut.NumTrees()-1 at random with replacement
-  //dump to files and write summarise and finalise functions for bootstrap
+  AccumulateMutationRates(ancmut, data, epochs, analyses, num_threads);
 
   std::random_device rd;  //Will be used to obtain a seed for the random number engine
   std::mt19937 gen(rd()); //Standard mersenne_twister_engine seeded with rd()
   if(result.count("seed") > 0){
     gen.seed(result["seed"].as<int>());
   }
-  std::uniform_int_distribution<> sam(0, (ancmut.NumTrees()-1.0)/1000.0);
-
-  int n_boot = 100;
-  std::vector<CollapsedMatrix<double>> boot_mutation_by_type_and_epoch(n_boot);
-  std::vector<CollapsedMatrix<double>> boot_opportunity_by_type_and_epoch(n_boot);
-  for(std::vector<CollapsedMatrix<double>>::iterator it_m = boot_mutation_by_type_and_epoch.begin(); it_m != boot_mutation_by_type_and_epoch.end(); it_m++){
-    (*it_m).resize(num_epochs, num_categories);
-  }
-  for(std::vector<CollapsedMatrix<double>>::iterator it_o = boot_opportunity_by_type_and_epoch.begin(); it_o != boot_opportunity_by_type_and_epoch.end(); it_o++){
-    (*it_o).resize(num_epochs, num_categories);
-  } 
-
-  for(int n = 0; n < n_boot; n++){
-  
-    std::vector<int> boot_trees(ancmut.NumTrees());
-    if(0){
-    for(std::vector<int>::iterator it_boot_trees = boot_trees.begin(); it_boot_trees != boot_trees.end(); it_boot_trees++){
-      *it_boot_trees = sam(gen);
-    }
-    }
-
-    int size = 0;
-    for(std::vector<int>::iterator it_boot_trees = boot_trees.begin(); it_boot_trees != boot_trees.end();){
-      int start = 1000*sam(gen);
-      //std::cerr << start << " ";
-      for(int k = start; k < start + 1000 && size < boot_trees.size() && k < boot_trees.size(); k++){
-        *it_boot_trees = k;
-        it_boot_trees++;
-        size++;
-      }
-    }
-    //std::cerr << std::endl;
-    boot_trees.resize(size);
-    //std::sort(boot_trees.begin(), boot_trees.end());
-
-    //fill in boot_mutation_by_type_and_epoch[n] and boot_opportunity_by_type_and_epoch[n] by summing over the trees  
-    for(std::vector<int>::iterator it_boot_trees = boot_trees.begin(); it_boot_trees != boot_trees.end(); it_boot_trees++){
-      std::vector<double>::iterator it_bmut_by_type_and_epoch = boot_mutation_by_type_and_epoch[n].vbegin();
-      std::vector<double>::iterator it_bopp_by_type_and_epoch = boot_opportunity_by_type_and_epoch[n].vbegin();
-      std::vector<double>::iterator it_mut_by_type_and_epoch  = mutation_by_type_and_epoch[*it_boot_trees].vbegin();
-      std::vector<double>::iterator it_opp_by_type_and_epoch  = opportunity_by_type_and_epoch[*it_boot_trees].vbegin();
-      for(; it_mut_by_type_and_epoch != mutation_by_type_and_epoch[*it_boot_trees].vend();){    
-        *it_bmut_by_type_and_epoch += *it_mut_by_type_and_epoch;
-        *it_bopp_by_type_and_epoch += *it_opp_by_type_and_epoch;
-        it_mut_by_type_and_epoch++;
-        it_opp_by_type_and_epoch++;      
-        it_bmut_by_type_and_epoch++;
-        it_bopp_by_type_and_epoch++;
-      }
-    }
-  
-  }
-
-  //output mutation_by_type_and_epoch
-  //       opportunity_by_type_and_epoch 
-  FILE* fp;
-  if(chr == "NA"){
-    fp = fopen((result["output"].as<std::string>() + "_mut" + ".bin" ).c_str(), "wb");  
-  }else{
-    fp = fopen((result["output"].as<std::string>() + "_chr" + chr + "_mut" + ".bin" ).c_str(), "wb");  
-  }
-  fwrite(&num_epochs, sizeof(int), 1, fp);
-  fwrite(&epochs[0], sizeof(double), epochs.size(), fp);
-  for(int n = 0; n < n_boot; n++){
-    boot_mutation_by_type_and_epoch[n].DumpToFile(fp);
-  }
-  fclose(fp);
-  if(chr == "NA"){
-    fp = fopen((result["output"].as<std::string>() + "_opp" + ".bin" ).c_str(), "wb");  
-  }else{
-    fp = fopen((result["output"].as<std::string>() + "_chr" + chr + "_opp" + ".bin" ).c_str(), "wb");  
-  }
-  for(int n = 0; n < n_boot; n++){
-    boot_opportunity_by_type_and_epoch[n].DumpToFile(fp);
+  for(int k = 0; k < (int) analyses.size(); k++){
+    //with several mutcat files, the k-th is written to output_mutcat<k>
+    std::string filename_base = result["output"].as<std::string>();
+    if(analyses.size() > 1) filename_base += "_mutcat" + std::to_string(k);
+    if(chr != "NA") filename_base += "_chr" + chr;
+    BootstrapMutationRatesForCategory(gen, ancmut.NumTrees(), epochs, analyses[k].num_categories, analyses[k].mutation_by_type_and_epoch, analyses[k].opportunity_by_type_and_epoch, filename_base + "_mut" + ".bin", filename_base + "_opp" + ".bin");
   }
-  fclose(fp);
 
   ResourceUsage();
 }
 
+
 void SummarizeWholeGenomeForCategory(cxxopts::ParseResult& result, const std::string& help_text){
 
   //////////////////////////////////
@@ -2220,7 +1866,7 @@ void MutationRateForPattern(cxxopts::ParseResult& result, const std::string& hel
   bool help = false;
   if(!result.count("mask") || !result.count("ancestor") || !result.count("mutcat") || !result.count("input") || !result.count("output")){
     std::cout << "Not enough arguments supplied." << std::endl;
-    std::cout << "Needed: mask, ancestor, mutcat, input, output. Optional: years_per_gen, bins, dist." << std::endl;
+    std::cout << "Needed: mask, ancestor, mutcat, input, output. Optional: years_per_gen, bins, dist, threads." << std::endl;
     help = true;
   }
   if(result.count("help") || help){
@@ -2233,13 +1879,9 @@ void MutationRateForPattern(cxxopts::ParseResult& result, const std::string& hel
 
   //////////// PARSE DATA ///////////
 
-  MarginalTree mtr, prev_mtr; //stores marginal trees. mtr.pos is SNP position at which tree starts, mtr.tree stores the tree
-  Muts::iterator it_mut; //iterator for mut file
-  float num_bases_tree_persists = 0.0;
-
   ////////// 1. Read one tree at a time /////////
 
-  //We open anc file and read one tree at a time. File remains open until all trees have been read OR ancmut.CloseFiles() is called.
+  //We open anc file and read trees in blocks. File remains open until all trees have been read OR ancmut.CloseFiles() is called.
   //The mut file is read once, file is closed after constructor is called.
   AncMutIterators ancmut;
 
@@ -2248,11 +1890,9 @@ void MutationRateForPattern(cxxopts::ParseResult& result, const std::string& hel
   }else{
     ancmut.OpenFiles(result["input"].as<std::string>() + "_chr" + chr + ".anc", result["input"].as<std::string>() + "_chr" + chr + ".mut");
   }
-  num_bases_tree_persists = ancmut.NextTree(mtr, it_mut);
-  int N = (mtr.tree.nodes.size() + 1)/2.0;
+  int N = ancmut.NumTips();
   int L = ancmut.NumSnps();
   Data data(N,L);
-  int N_total = 2*data.N-1;
 
   std::cerr << "------------------------------------------------------" << std::endl;
   std::cerr << "Calculating mutation rate for categories " << result["input"].as<std::string>() << " ..." << std::endl;
@@ -2398,217 +2038,28 @@ void MutationRateForPattern(cxxopts::ParseResult& result, const std::string& hel
   /////////////////////////////////////////////////////////////////
   //Mutation specific
 
-  ////////// define mutation types /////////
-  std::string alphabet = "ACGT";
-  std::map<char, std::string> complement;
-  complement['A'] = "T";
-  complement['C'] = "G";
-  complement['G'] = "C";
-  complement['T'] = "A";
-  std::map<std::string, int> dict_mutation_pattern;
-
-  //A-C, A-G, A-T, C-A, C-G, C-T
-  //T-G, T-C, T-A, G-T, G-C, G-A
-  //plus 16 flanks per mutation type, i.e. 6*16 = 96
-
-  //parse file storing
-  //upstream downstream ancestral derived category
-  igzstream is_cat(result["mutcat"].as<std::string>());
-  if(is_cat.fail()){
-    std::cerr << "Error: unable to open file " << result["mutcat"].as<std::string>() << std::endl;
-  }
-  getline(is_cat, line);
-  //I have to make sure all 96 categories are represented in this file
-
-  char mutation_type[5];
-  std::string pattern, reverse_pattern;
-  int category, num_categories = 0;
-  std::vector<int> check_num_categories;
-  while(getline(is_cat, line)){
-    sscanf(line.c_str(), "%c %c %c %c %d", &mutation_type[0], &mutation_type[1], &mutation_type[2], &mutation_type[3], &category);
-    pattern = mutation_type;
-    dict_mutation_pattern[pattern] = category;
-    pattern = complement[mutation_type[1]] + complement[mutation_type[0]] + complement[mutation_type[2]] + complement[mutation_type[3]];
-    dict_mutation_pattern[pattern] = category;
-    if(category >= num_categories){
-      check_num_categories.resize(category+1);
-      std::fill(std::next(check_num_categories.begin(),num_categories), check_num_categories.end(), 0);
-      num_categories = category + 1;      
-      check_num_categories[category]++;
-    }else{
-      check_num_categories[category]++;
-    }
-  }
-  is_cat.close();
-
-  for(std::vector<int>::iterator it_check = check_num_categories.begin(); it_check != check_num_categories.end(); it_check++){
-    if(*it_check == 0){
-      std::cerr << "Error: category indices not 0-indexed or contiguous." << std::endl;
-      exit(1);
-    }
+  int num_threads = 1;
+  if(result.count("threads")){
+    num_threads = NumThreads(result["threads"].as<int>());
   }
 
-  //check that I got all 96 categories and that categories are contiguous integers
-  int index = 0;
-  for(std::string::iterator it_str1 = alphabet.begin(); it_str1 != alphabet.end(); it_str1++){
-    for(std::string::iterator it_str2 = alphabet.begin(); it_str2 != alphabet.end(); it_str2++){
-      pattern = *it_str1;
-      pattern += *it_str2;
-      reverse_pattern = complement[*it_str2] + complement[*it_str1];
+  std::vector<MutationRateAnalysis> analyses(1);
 
-      if ( dict_mutation_pattern.find(pattern + "CA") == dict_mutation_pattern.end() && dict_mutation_pattern.find(reverse_pattern + "GT") == dict_mutation_pattern.end() ) {
-        // not found
-        std::cerr << "Error: not all 96 mutation categories provided." << std::endl;
-        exit(1);
-      }
-      if ( dict_mutation_pattern.find(pattern + "CG") == dict_mutation_pattern.end() && dict_mutation_pattern.find(reverse_pattern + "GC") == dict_mutation_pattern.end() ) {
-        // not found
-        std::cerr << "Error: not all 96 mutation categories provided." << std::endl;
-        exit(1);
-      }
-      if ( dict_mutation_pattern.find(pattern + "CT") == dict_mutation_pattern.end() && dict_mutation_pattern.find(reverse_pattern + "GA") == dict_mutation_pattern.end() ) {
-        // not found
-        std::cerr << "Error: not all 96 mutation categories provided." << std::endl;
-        exit(1);
-      }
-      if ( dict_mutation_pattern.find(pattern + "AT") == dict_mutation_pattern.end() && dict_mutation_pattern.find(reverse_pattern + "TA") == dict_mutation_pattern.end() ) {
-        // not found
-        std::cerr << "Error: not all 96 mutation categories provided." << std::endl;
-        exit(1);
-      }
-      if ( dict_mutation_pattern.find(pattern + "AG") == dict_mutation_pattern.end() && dict_mutation_pattern.find(reverse_pattern + "TC") == dict_mutation_pattern.end() ) {
-        // not found
-        std::cerr << "Error: not all 96 mutation categories provided." << std::endl;
-        exit(1);
-      }
-      if ( dict_mutation_pattern.find(pattern + "AC") == dict_mutation_pattern.end() && dict_mutation_pattern.find(reverse_pattern + "TG") == dict_mutation_pattern.end() ) {
-        // not found
-        std::cerr << "Error: not all 96 mutation categories provided." << std::endl;
-        exit(1);
-      }
-    }   
-  }
+  ////////// define mutation types /////////
+  ReadMutationCategories(result["mutcat"].as<std::string>(), analyses[0].dict_mutation_pattern, analyses[0].num_categories);
+  int num_categories = analyses[0].num_categories;
 
   ///////// Count number of bases by type //////////
 
-  CollapsedMatrix<double> count_bases_by_type;
-  //count_bases_by_type.resize(mutations.info.size(),dict_mutation_pattern.size());
-  CountBasesByType(data, result["mask"].as<std::string>(), result["ancestor"].as<std::string>(), count_bases_by_type, dict_mutation_pattern, mutations, pos);
+  CountBasesByType(data, result["mask"].as<std::string>(), result["ancestor"].as<std::string>(), analyses[0].count_bases_by_type, analyses[0].dict_mutation_pattern, mutations, pos);
 
   ////////////////////////////////////////////////////////////////////////
   // Estimate mutation rate through time
 
-  std::vector<CollapsedMatrix<double>> mutation_by_type_and_epoch(ancmut.NumTrees());
-  std::vector<CollapsedMatrix<double>> opportunity_by_type_and_epoch(ancmut.NumTrees());
-  for(std::vector<CollapsedMatrix<double>>::iterator it_m = mutation_by_type_and_epoch.begin(); it_m != mutation_by_type_and_epoch.end(); it_m++){
-    (*it_m).resize(num_epochs, num_categories);
-  }
-  for(std::vector<CollapsedMatrix<double>>::iterator it_o = opportunity_by_type_and_epoch.begin(); it_o != opportunity_by_type_and_epoch.end(); it_o++){
-    (*it_o).resize(num_epochs, num_categories);
-  } 
-
-  std::vector<double> branch_lengths_in_epoch(num_epochs);
-
-  //Tree subtr;
-  std::vector<float> coordinates_tree(N_total);
-  std::vector<int> num_lineages(N_total);
-  int root = N_total-1;
-  int i = 0;
-
-  //iterate over trees
-  SNPInfo snp_info;
-  float rec;
-  int num_tree = 0;
-  double total_branch_length = 0.0;
-  int count_snps = 0;
-
-  int snp = 0;
-  while(num_bases_tree_persists >= 0){
-
-    mtr.tree.GetCoordinates(coordinates_tree);
-    GetCoordsAndLineages(mtr, coordinates_tree, num_lineages);
-    GetBranchLengthsInEpoch(data, epochs, coordinates_tree, num_lineages, branch_lengths_in_epoch);
-    num_tree = mutations.info[snp].tree;
-
-    while(num_tree == mutations.info[snp].tree){
-
-      snp_info = mutations.info[snp];
-      if(snp_info.branch.size() == 1){
-
-        assert(ancmut.get_treecount() == snp_info.tree);
-
-        //if statements to make sure we have a well defined biallelic SNP
-        if(snp_info.upstream_base != "NA" && snp_info.downstream_base != "NA" && snp_info.mutation_type[0] != snp_info.mutation_type[2]){
-
-          if(snp_info.mutation_type.size() == 3){
-
-            if(snp_info.mutation_type[0] == 'A' || snp_info.mutation_type[0] == 'C' || snp_info.mutation_type[0] == 'G' || snp_info.mutation_type[0] == 'T'){
-
-              if(snp_info.mutation_type[2] == 'A' || snp_info.mutation_type[2] == 'C' || snp_info.mutation_type[2] == 'G' || snp_info.mutation_type[2] == 'T'){
-
-
-                // identify category of mutation
-                pattern = snp_info.upstream_base + snp_info.downstream_base + snp_info.mutation_type[0] + snp_info.mutation_type[2];
-                // then identify its age and number of lineages at the time
-                assert(dict_mutation_pattern.find(pattern) != dict_mutation_pattern.end());
-                int ind = dict_mutation_pattern[pattern];
-
-                // identify epoch and add to number of mutations per lineage in epoch
-                int ep = 0;
-                while(epochs[ep] <= snp_info.age_begin){
-                  ep++;
-                  if(ep == epochs.size()) break;
-                }
-                ep--;
-
-                assert(ep >= 0);
-                assert(mutation_by_type_and_epoch[num_tree].subVectorSize(ep) == num_categories);
-
-                int ep_begin = ep;
-                float age_end = std::min(snp_info.age_end,coordinates_tree[root]);
-                assert(age_end < epochs[num_epochs-1]);
-                double branch_length = age_end - snp_info.age_begin;
-
-                if(age_end <= epochs[ep+1]){
-
-                  mutation_by_type_and_epoch[num_tree][ep][ind] += 1.0;
-
-                }else{
-
-                  mutation_by_type_and_epoch[num_tree][ep][ind]   += (epochs[ep+1] - snp_info.age_begin)/branch_length;
-                  ep++;
-                  while(epochs[ep+1] <= age_end){
-                    mutation_by_type_and_epoch[num_tree][ep][ind] += (epochs[ep+1]-epochs[ep])/branch_length;
-                    ep++;
-                  }
-                  mutation_by_type_and_epoch[num_tree][ep][ind]   += (age_end-epochs[ep])/branch_length;
-
-                }
-
-                for(int ep_tmp = 0; ep_tmp < num_epochs; ep_tmp++){
-                  double bl = branch_lengths_in_epoch[ep_tmp];
-                  for(int ind_tmp = 0; ind_tmp < num_categories; ind_tmp++){
-                    opportunity_by_type_and_epoch[num_tree][ep_tmp][ind_tmp] += bl * count_bases_by_type[snp][ind_tmp];
-                  }
-                }
-
-              }
-
-            }
-
-          } 
-
-        }
-
-      }
-
-      snp++;
-
-    }
-
-    num_bases_tree_persists = ancmut.NextTree(mtr, it_mut);
-
-  }
+  analyses[0].per_tree = true;
+  AccumulateMutationRates(ancmut, data, epochs, analyses, num_threads);
+  std::vector<CollapsedMatrix<double>>& mutation_by_type_and_epoch    = analyses[0].mutation_by_type_and_epoch;
+  std::vector<CollapsedMatrix<double>>& opportunity_by_type_and_epoch = analyses[0].opportunity_by_type_and_epoch;
 
 
   //bootstrap
@@ -3261,12 +2712,13 @@ int main(int argc, char* argv[]){
     ("dist", "Filename of file containing dist.", cxxopts::value<std::string>())
     ("mask", "Filename of file containing mask", cxxopts::value<std::string>())
     ("ancestor", "Filename of file containing human ancestor genome.", cxxopts::value<std::string>())
-    ("mutcat", "Filename of file containing mutation categories.", cxxopts::value<std::string>())
+    ("mutcat", "Filename of file containing mutation categories. In ForCategoryForChromosome and ForCategoryForPopForChromosome, a comma separated list of files is computed in one pass and the k-th is written to output_mutcat<k>.", cxxopts::value<std::string>())
     ("poplabels", "Optional: Filename of file containing population labels. If ='hap', each haplotype is in its own group.", cxxopts::value<std::string>()) 
     ("pop_of_interest", "Optional: Name of pop of interest.", cxxopts::value<std::string>()) 
     ("i,input", "Filename of .anc and .mut file without file extension", cxxopts::value<std::string>())
     ("o,output", "Output file", cxxopts::value<std::string>())
-    ("seed", "Optional. Random seed.", cxxopts::value<int>());
+    ("seed", "Optional. Random seed.", cxxopts::value<int>())
+    ("threads", "Optional. Number of threads used to process trees. Default: 1, 0 uses all hardware threads.", cxxopts::value<int>());
 
   auto result = options.parse(argc, argv);
   std::string help_text = options.help({""});
@@ -3338,6 +2790,10 @@ int main(int argc, char* argv[]){
       std::cerr << "Sorry, in this mode input and output need to be the same!." << std::endl;
       exit(1);
     }
+    if(result.count("mutcat") && SplitFilenames(result["mutcat"].as<std::string>()).size() > 1){
+      std::cerr << "Sorry, in this mode only one mutcat file is supported. Use ForCategoryForChromosome for several." << std::endl;
+      exit(1);
+    }
 
 		if(result.count("chr")){
 			igzstream is_chr(result["chr"].as<std::string>());
@@ -2,6 +2,9 @@
 #include <fstream>
 #include <utility>
 #include <string>
+#include <sstream>
+#include <limits>
+#include <unordered_map>
 #include <sys/time.h>
 #include <sys/resource.h>
 #include <cxxopts.hpp>
@@ -11,6 +14,7 @@
 #include "anc_builder.hpp"
 #include "tree_comparer.hpp"
 #include "usage.hpp"
+#include "parallel.hpp"
 
 void 
 logFactorial(std::vector<float>& logF, int N){
@@ -148,6 +152,94 @@ log_pvalue(int k, float fk, int N, float fN, std::vector<float>& logF){
 
 }
 
+//Evaluates log_pvalue for a fixed number of haplotypes N.
+//P(f | N, k, fk) is evaluated directly from the log-factorial table for all f in one batch
+//and summed with a two-pass log-sum-exp, so that the loop over f has no loop-carried dependency.
+//Results are memoised on (k, fk, fN), since these combinations repeat across SNPs.
+class SelectionPvalue{
+
+  private:
+
+    int N;
+    std::vector<float> logF;
+    std::vector<float> log_terms;
+    std::unordered_map<unsigned long long, float> cache;
+    size_t max_cache_size = 1 << 22;
+
+  public:
+
+    SelectionPvalue(){}
+    SelectionPvalue(int N): N(N){
+      logFactorial(logF, N);
+    }
+
+    int GetN(){return(N);}
+
+    float Evaluate(int k, float fk, float fN);
+    void Evaluate(const std::vector<float>& num_lin, const std::vector<float>& num_freq, float fN, std::vector<float>& logp);
+
+};
+
+float
+SelectionPvalue::Evaluate(int k, float fk, float fN){
+
+  if(fk < 2) return 1.0;
+  if(k == -1) return 1.0;
+
+  //fk is only fractional for the epoch in which the mutation appears, use the original recursion
+  int ifk = (int) fk, ifN = (int) fN;
+  if(ifk != fk || ifN != fN) return log_pvalue(k, fk, N, fN, logF);
+
+  assert(fN < N);
+  assert(fk < k);
+  assert(fN > 0);
+
+  unsigned long long key = ((unsigned long long) k * (N+1) + ifk) * (N+1) + ifN;
+  std::unordered_map<unsigned long long, float>::iterator it_cache = cache.find(key);
+  if(it_cache != cache.end()) return it_cache->second;
+
+  //log P(f | N, k, fk) for fN <= f <= N-k+fk
+  float log_norm = logF[N-1] - logF[k-1] - logF[N-k] + logF[k-ifk-1] + logF[ifk-1];
+  int f_max      = std::max(ifN, N-k+ifk);
+  int num_terms  = f_max - ifN + 1;
+  log_terms.resize(num_terms);
+  float max_term = -std::numeric_limits<float>::infinity();
+  for(int i = 0; i < num_terms; i++){
+    int f = ifN + i;
+    log_terms[i]  = logF[N-f-1] - logF[N-k+ifk-f] + logF[f-1] - logF[f-ifk] - log_norm;
+    max_term      = std::max(max_term, log_terms[i]);
+  }
+  float sum = 0.0;
+  for(int i = 0; i < num_terms; i++){
+    sum += std::exp(log_terms[i] - max_term);
+  }
+
+  float logp = max_term + std::log(sum);
+  if(logp > 0.0) logp = 0.0;
+  logp /= log_10;
+
+  if(cache.size() >= max_cache_size) cache.clear();
+  cache[key] = logp;
+
+  return(logp);
+
+}
+
+//Calculates log10 pvalues of a SNP for every epoch, given its lineage and frequency trajectory.
+void
+SelectionPvalue::Evaluate(const std::vector<float>& num_lin, const std::vector<float>& num_freq, float fN, std::vector<float>& logp){
+
+  logp.resize(num_freq.size());
+  std::vector<float>::iterator it_logp = logp.begin();
+  std::vector<float>::const_iterator it_lin = num_lin.begin();
+  for(std::vector<float>::const_iterator it_freq = num_freq.begin(); it_freq != num_freq.end(); it_freq++){
+    *it_logp = Evaluate(*it_lin, *it_freq, fN);
+    it_logp++;
+    it_lin++;
+  }
+
+}
+
 struct Qual{
 
   std::string id;
@@ -158,6 +250,232 @@ struct Qual{
 
 };
 
+//Lineage and frequency trajectory of a SNP, as written to .lin and .freq files.
+struct Trajectory{
+
+  std::vector<float> num_freq; //one entry per epoch, from oldest to most recent
+  std::vector<float> num_lin;  //one entry per epoch, followed by when_DAF_is_half and when_mutation_has_freq2
+  int tree_freq, data_freq;
+
+};
+
+//Workspace for GetTrajectory, so that vectors are only allocated once per thread.
+struct TrajectoryWorkspace{
+
+  std::vector<float> coordinates_tree, coordinates_tree_unsrt, coordinates_mutation;
+  std::vector<int> current_branches;
+
+};
+
+//Returns true if snp_info carries a derived allele with DAF > 2 that maps uniquely to tree.
+bool
+IsSelectionCandidate(const SNPInfo& snp_info){
+
+  int freq = 3;
+  if(snp_info.freq.size() > 0){
+    freq = 0;
+    for(std::vector<int>::const_iterator it_freq = snp_info.freq.begin(); it_freq != snp_info.freq.end(); it_freq++){
+      freq += *it_freq;
+      if(freq > 2) break;
+    }
+  }
+
+  return(snp_info.branch.size() == 1 && freq > 2 && !snp_info.flipped);
+
+}
+
+//Calculates the number of lineages and number of lineages carrying the derived allele at each epoch.
+//ws.coordinates_tree (sorted) and ws.coordinates_tree_unsrt need to hold coordinates of tree.
+//Returns false if SNP is not used.
+bool
+GetTrajectory(Tree& tree, const SNPInfo& snp_info, const std::vector<float>& epochs, int N, TrajectoryWorkspace& ws, Trajectory& traj){
+
+  int N_total = 2*N-1;
+  int root = N_total-1;
+  int num_epochs = epochs.size();
+  std::vector<float>& coordinates_tree       = ws.coordinates_tree;
+  std::vector<float>& coordinates_tree_unsrt = ws.coordinates_tree_unsrt;
+  std::vector<float>& coordinates_mutation   = ws.coordinates_mutation;
+  std::vector<int>& current_branches         = ws.current_branches;
+
+  if(snp_info.age_begin > coordinates_tree[root]) return false;
+
+  int b = *snp_info.branch.begin();
+  if(b == -1 || b == root) return false;
+
+  traj.num_freq.clear();
+  traj.num_lin.clear();
+
+  int DAF = 0, DAF_half, num_lin_half = -1;
+  coordinates_mutation.resize(N_total);
+  std::fill(coordinates_mutation.begin(), coordinates_mutation.end(), 0.0);
+  //get nodes below branch b
+  //get coordinates from coordinates_tree_unsrt
+  CopyCoordinates(b, coordinates_mutation, coordinates_tree_unsrt, tree, DAF); //get coordinates of branches below mutation
+  DAF_half = (DAF+1)/2.0;
+  coordinates_mutation[(*tree.nodes[b].parent).label] = coordinates_tree_unsrt[(*tree.nodes[b].parent).label]; //add to that list the coordinate of the parent of branch b
+  std::sort(coordinates_mutation.begin(), coordinates_mutation.end()); //sort coordinates_mutation
+
+  current_branches.resize(N);
+  std::fill(current_branches.begin(), current_branches.end(), 0);
+
+  int num_carriers = 0, num_lineages = 1;
+  int k_when_mutation_appears = -1, k_when_mutation_has_freq2 = -1;
+  int n_mut = root;
+  int n_tree = root;
+  int ep = num_epochs-1; 
+
+  //while epoch[ep] is larger than root of tree, number of lineages is 0
+  while(coordinates_tree[n_tree] < epochs[ep]){
+    traj.num_freq.push_back(0);
+    traj.num_lin.push_back(0);
+    ep--;
+  }
+
+  //now coordinates_tree[n_tree] >= epoch[ep]
+  do{
+
+    if(num_carriers == DAF_half && num_lin_half == -1){
+      num_lin_half = num_lineages;
+    }
+    assert(coordinates_tree[n_tree] >= coordinates_mutation[n_mut]);
+
+    if(coordinates_tree[n_tree] > coordinates_mutation[n_mut]){ //if n_tree is not next node of a branch onto which mutation falls, increase num_lineages
+      num_lineages++;
+      n_tree--;
+    }else{
+      assert(coordinates_tree[n_tree] == coordinates_mutation[n_mut]); //else, n_tree is the node of a branch onto which mutation falls
+
+      if(k_when_mutation_appears == -1){
+
+        num_lineages++;
+        k_when_mutation_appears = num_lineages;
+        current_branches[0]     = tree.nodes[b].label; //current branches stores lineages that carry derived allele
+
+        n_tree--;
+        n_mut--;
+
+      }else{
+
+        float coords = coordinates_mutation[n_mut];
+        while(coords == coordinates_mutation[n_mut] && coords != 0.0){ //there might be multiple nodes with the same coordinates
+
+          num_lineages++;
+          num_carriers++;
+
+          //check which branch has same coordinates as n_tree-1
+          bool check_if_branch_is_found = false;
+          for(int k = 0; k < num_carriers; k++){
+            if(coordinates_tree_unsrt[current_branches[k]] == coordinates_mutation[n_mut]){
+              int branch                       = current_branches[k];
+              current_branches[k]              = (*tree.nodes[branch].child_left).label; //replace current_branch[k] by its children
+              current_branches[num_carriers]   = (*tree.nodes[branch].child_right).label; 
+
+              check_if_branch_is_found = true;
+              break;
+            }
+          } 
+          assert(check_if_branch_is_found);
+          n_tree--;
+          n_mut--;
+
+        }
+
+      }
+
+    } 
+
+    //num_carriers == 1 means (1+num_carriers) have the derived allele
+    if(num_carriers >= 1){
+      if(k_when_mutation_has_freq2 == -1){ //when this happens for the first time, record num_lineages at this point
+        k_when_mutation_has_freq2 = num_lineages;
+        if(num_carriers > 1) k_when_mutation_has_freq2 -= num_carriers - 1; //this is needed because there might be many branches with exactly the same coordinates
+        assert(k_when_mutation_has_freq2);
+      }
+    }
+
+    assert(coordinates_mutation[n_mut] <= coordinates_tree[n_tree]);
+    while(coordinates_tree[n_tree] < epochs[ep]){ //n_tree+1 is above epoch[ep], n_tree is just below, but could span multiple epochs
+
+      float num_muts = 0.0;
+      if(k_when_mutation_appears != -1){ 
+
+        if(num_carriers == 0){
+
+          for(int k = 0; k <= num_carriers; k++){
+            int branch   = current_branches[k];
+
+            assert(epochs[ep] >= coordinates_tree_unsrt[branch]);
+            assert(coordinates_tree_unsrt[branch] <= coordinates_mutation[n_mut]);
+            assert( coordinates_tree_unsrt[(*tree.nodes[branch].parent).label] - epochs[ep] <= (coordinates_tree_unsrt[(*tree.nodes[branch].parent).label] - coordinates_tree_unsrt[branch]));
+            num_muts    += (coordinates_tree_unsrt[(*tree.nodes[branch].parent).label] - epochs[ep])/(coordinates_tree_unsrt[(*tree.nodes[branch].parent).label] - coordinates_tree_unsrt[branch]); 
+
+          }
+
+          assert(1 + num_muts <= num_lineages);
+          traj.num_freq.push_back(num_muts);
+          traj.num_lin.push_back(num_lineages); 
+
+        }else{
+          traj.num_freq.push_back(1 + num_carriers);
+          traj.num_lin.push_back(num_lineages); 
+        }
+
+      }else{
+        traj.num_freq.push_back(0);
+        traj.num_lin.push_back(num_lineages);
+      }
+
+      ep--;
+      if(ep == -1) break;
+    }
+
+  }while(n_tree >= N);
+
+  assert(coordinates_mutation[n_mut] == 0.0);
+  assert(num_lineages == N);
+  num_carriers++; 
+  traj.num_freq.push_back(num_carriers);
+  traj.num_lin.push_back(num_lineages);
+  assert((int) traj.num_freq.size() == num_epochs);
+
+  assert(num_carriers == DAF);
+  traj.tree_freq = num_carriers;
+  traj.data_freq = 0;
+  for(std::vector<int>::const_iterator it_freq = snp_info.freq.begin(); it_freq != snp_info.freq.end(); it_freq++){
+    traj.data_freq += *it_freq;
+  }
+
+  traj.num_lin.push_back(num_lin_half);
+  traj.num_lin.push_back(k_when_mutation_has_freq2);
+
+  return true;
+
+}
+
+//Writes log10 pvalues of a SNP for every epoch, followed by pvalues for when_DAF_is_half and when_mutation_has_freq2.
+void
+WriteLogPvalues(std::ostream& os, const std::vector<float>& num_lin, const std::vector<float>& num_freq, SelectionPvalue& pvalue, std::vector<float>& logp){
+
+  int add_entries = 2;
+  float fN = num_freq[num_freq.size() - 1]; //frequency when N lineages are remaining
+
+  if(fN <= 2){
+    for(int i = 0; i < num_freq.size(); i++){
+      os << "1 ";
+    }
+    os << "1 1\n";
+  }else{
+    pvalue.Evaluate(num_lin, num_freq, fN, logp);
+    for(std::vector<float>::iterator it_logp = logp.begin(); it_logp != logp.end(); it_logp++){
+      os << *it_logp << " ";
+    }
+    os << pvalue.Evaluate(num_lin[num_lin.size() - add_entries], (int)((fN+1.0)/2.0), fN) << " ";
+    os << pvalue.Evaluate(num_lin[num_lin.size() - add_entries+1], 2.0, fN) << "\n";
+  }
+
+}
+
 void 
 Selection(cxxopts::ParseResult& result, const std::string& help_text){
 
@@ -208,18 +526,17 @@ Selection(cxxopts::ParseResult& result, const std::string& help_text){
 
   os << line_lin << "\n";
 
-  //precalculate logF, where logF[k] = log(k!)
-  std::vector<float> logF;
+  //precalculates logF, where logF[k] = log(k!)
+  SelectionPvalue pvalue;
 
   //read line by line
-  int N, k;
-  float fN, fk;
-  std::vector<float> num_lin, num_freq;
+  int N;
+  std::vector<float> num_lin, num_freq, logp;
 
   while(getline(is_freq, line_freq)){
     getline(is_lin, line_lin);
 
-    //get fN, N, k, fk from the line
+    //get N from the line
     std::stringstream s_freq(line_freq);
     std::stringstream s_lin(line_lin);
 
@@ -233,7 +550,7 @@ Selection(cxxopts::ParseResult& result, const std::string& help_text){
     int add_entries = 2;
 
     //read in k from s_lin and fk from s_freq
-    if(logF.size() == 0){
+    if(num_lin.size() == 0){
 
       float foo;
       while(s_lin >> foo) num_lin.push_back(foo);
@@ -242,7 +559,7 @@ Selection(cxxopts::ParseResult& result, const std::string& help_text){
         s_freq >> num_freq[i];
       }
       N = (int)num_lin[num_lin.size() - add_entries - 1];
-      logFactorial(logF, N);
+      pvalue = SelectionPvalue(N);
 
     }else{
 
@@ -255,24 +572,7 @@ Selection(cxxopts::ParseResult& result, const std::string& help_text){
 
     }
 
-    fN = num_freq[num_freq.size() - 1]; //frequency when N lineages are remaining
-
-    if(fN <= 2){
-      for(int i = 0; i < num_freq.size(); i++){
-        os << "1 ";
-      }
-    }else{
-      for(int i = 0; i < num_freq.size(); i++){
-        os << log_pvalue(num_lin[i], num_freq[i], N, fN, logF) << " ";
-      }
-    }
-
-    if(fN > 2){
-			os << log_pvalue(num_lin[num_lin.size() - add_entries], (int)((fN+1.0)/2.0), N, fN, logF) << " ";
-      os << log_pvalue(num_lin[num_lin.size() - add_entries+1], 2.0, N, fN, logF) << "\n";
-    }else{
-      os << "1 1\n";
-    }
+    WriteLogPvalues(os, num_lin, num_freq, pvalue, logp);
 
   }
 
@@ -282,15 +582,18 @@ Selection(cxxopts::ParseResult& result, const std::string& help_text){
   ResourceUsage();
 }
 
+//Calculates lineage and frequency trajectories of every SNP while streaming through trees.
+//If output_frequency, these are written to .freq and .lin. If output_selection, they are directly
+//used to calculate pvalues which are written to .sele, avoiding the round-trip through .freq and .lin.
 void 
-Frequency(cxxopts::ParseResult& result, const std::string& help_text){
+FrequencyAndSelection(cxxopts::ParseResult& result, const std::string& help_text, bool output_frequency, bool output_selection){
 
   //////////////////////////////////
   //Program options
   bool help = false;
   if(!result.count("input") || !result.count("output")){
     std::cout << "Not enough arguments supplied." << std::endl;
-    std::cout << "Needed: input, output. Optional: years_per_gen, first_snp, last_snp." << std::endl;
+    std::cout << "Needed: input, output. Optional: years_per_gen, first_snp, last_snp, threads." << std::endl;
     help = true;
   }
   if(result.count("help") || help){
@@ -300,9 +603,11 @@ Frequency(cxxopts::ParseResult& result, const std::string& help_text){
   }  
 
   std::cerr << "---------------------------------------------------------" << std::endl;
-  std::cerr << "Calculating frequency through time for " + result["input"].as<std::string>() + ".\n";
-
-  std::string line, read;
+  if(output_selection){
+    std::cerr << "Calculating frequency through time and evidence of selection for " + result["input"].as<std::string>() + ".\n";
+  }else{
+    std::cerr << "Calculating frequency through time for " + result["input"].as<std::string>() + ".\n";
+  }
 
   ////////// PARSE DATA //////////
 
@@ -311,15 +616,8 @@ Frequency(cxxopts::ParseResult& result, const std::string& help_text){
   
   int N = ancmut.NumTips();
   int L = ancmut.NumSnps();
-  MarginalTree mtr;
-  Muts::iterator it_mut;
-  float num_bases_tree_persists = 0.0; 
  
   Data data(N,L);
-  int N_total = 2*data.N-1;
-
-  std::vector<float> logF;
-  logFactorial(logF, data.N);
 
   int first_snp, last_snp;
   if(!result.count("first_snp")){
@@ -333,6 +631,11 @@ Frequency(cxxopts::ParseResult& result, const std::string& help_text){
     last_snp = result["last_snp"].as<int>();
   }
 
+  int num_threads = 1;
+  if(result.count("threads")){
+    num_threads = NumThreads(result["threads"].as<int>());
+  }
+
   ///////// EPOCHES /////////
   float years_per_gen = 28.0;
   if(result.count("years_per_gen")){
@@ -419,10 +722,6 @@ Frequency(cxxopts::ParseResult& result, const std::string& help_text){
   }
 
 
-  //read mutations file
-  Mutations mutations(data);
-  mutations.Read(result["input"].as<std::string>() + ".mut");
-
   ////////////////////
   //for a mutation, record how its frequency is changing
 
@@ -430,247 +729,126 @@ Frequency(cxxopts::ParseResult& result, const std::string& help_text){
   //2. From branch on which mutation sits, record time of all coalescent events below.
   //3. Count.
 
-  std::vector<float> coordinates_tree(N_total), coordinates_tree_unsrt(N_total), coordinates_mutation(N_total);
-  std::vector<int> convert_index;
-  int root = N_total-1;
-  int i = 0;
-  int snp_of_next_tree;
-
-  std::ofstream os_freq(result["output"].as<std::string>() + ".freq");
-  if(os_freq.fail()){
-    std::cerr << "Error while opening file." << std::endl;
-    exit(1);
-  }
-  std::ofstream os_lin(result["output"].as<std::string>() + ".lin");
-  if(os_lin.fail()){
-    std::cerr << "Error while opening file." << std::endl;
-    exit(1);
-  }
-
-  int count_tree = 0;
-
-  os_freq << "pos rs_id ";
+  std::ofstream os_freq, os_lin, os_sele;
+  std::string header;
+  header = "pos rs_id ";
   for(int ep = num_epochs-1; ep >= 0; ep--){
-    os_freq << std::to_string(epochs[ep]) << " ";
+    header += std::to_string(epochs[ep]) + " ";
   }
-  os_freq << "TreeFreq DataFreq\n";
 
-  os_lin << "pos rs_id ";
-  for(int ep = num_epochs-1; ep >= 0; ep--){
-    os_lin << std::to_string(epochs[ep]) << " ";
+  if(output_frequency){
+    os_freq.open(result["output"].as<std::string>() + ".freq");
+    if(os_freq.fail()){
+      std::cerr << "Error while opening file." << std::endl;
+      exit(1);
+    }
+    os_lin.open(result["output"].as<std::string>() + ".lin");
+    if(os_lin.fail()){
+      std::cerr << "Error while opening file." << std::endl;
+      exit(1);
+    }
+    os_freq << header << "TreeFreq DataFreq\n";
+    os_lin  << header << "when_DAF_is_half when_mutation_has_freq2\n";
   }
-  //os_lin << "when_mutation_has_freq2 when_mutation_has_freq3 when_mutation_has_freq4 when_mutation_has_freq5 when_mutation_has_freq6 when_mutation_has_freq7\n";
-  os_lin << "when_DAF_is_half when_mutation_has_freq2\n";
-
-
-  //read tree
-  num_bases_tree_persists = ancmut.FirstSNP(mtr, it_mut);
-  mtr.tree.GetCoordinates(coordinates_tree);
-  coordinates_tree_unsrt = coordinates_tree;
-  std::sort(coordinates_tree.begin(), coordinates_tree.end());
-
-  //std::vector<Leaves> leaves;
-  //mtr.tree.FindAllLeaves(leaves);
-  //std::cerr << leaves[*mutations.info[0].branch.begin()].num_leaves << std::endl;
-
-  int current_tree = (*it_mut).tree;
-  SNPInfo snp_info;
-  int freq;
-  float rec;
-  for(int snp = first_snp; snp <= last_snp; snp++){
-
-    snp_info = (*it_mut);
-
-    int freq = 3;
-    if(snp_info.freq.size() > 0){
-      freq = 0;
-      for(std::vector<int>::iterator it_freq = snp_info.freq.begin(); it_freq != snp_info.freq.end(); it_freq++){
-        freq += *it_freq;
-        if(freq > 2) break;
-      }
+  if(output_selection){
+    os_sele.open(result["output"].as<std::string>() + ".sele");
+    if(os_sele.fail()){
+      std::cerr << "Error while opening file " << result["output"].as<std::string>() + ".sele" << std::endl;
+      exit(1);
     }
+    os_sele << header << "when_DAF_is_half when_mutation_has_freq2\n";
+  }
 
-    if(snp_info.branch.size() == 1 && freq > 2 && !snp_info.flipped){
-
-      if((*it_mut).tree != current_tree){
-        current_tree = (*it_mut).tree;
-        mtr.tree.GetCoordinates(coordinates_tree);
-        coordinates_tree_unsrt = coordinates_tree; //unsorted coordinates of tree
-        std::sort(coordinates_tree.begin(), coordinates_tree.end()); //sorted coordinates of tree
-      }
-      assert(current_tree == snp_info.tree);
-
-      if(snp_info.age_begin <= coordinates_tree[root]){
-
-        int b = *snp_info.branch.begin();
+  //Trees are read in blocks. Trajectories are calculated in parallel over trees of a block
+  //and output is written in order once the block is done.
+  int block_size = 10 * num_threads;
+  TreeBlock block;
+  std::vector<TrajectoryWorkspace> workspace(num_threads);
+  std::vector<Trajectory> traj(num_threads);
+  std::vector<SelectionPvalue> pvalue(num_threads, SelectionPvalue(data.N));
+  std::vector<std::vector<float>> logp(num_threads);
+  std::vector<std::ostringstream> out_freq(block_size), out_lin(block_size), out_sele(block_size);
+
+  while(ancmut.NextTreeBlock(block, block_size) > 0){
+
+    ParallelFor(block.num_trees, num_threads, [&](int i, int t){
+
+      out_freq[i].str("");
+      out_lin[i].str("");
+      out_sele[i].str("");
+      if(!ancmut.HasMutations(block, i)) return;
+
+      TrajectoryWorkspace& ws = workspace[t];
+      Tree& tree = block.mtr[i].tree;
+      bool coordinates_computed = false;
+
+      for(Muts::iterator it_mut = block.it_mut[i]; it_mut != ancmut.mut_end(); it_mut++){
+
+        const SNPInfo& snp_info = *it_mut;
+        if(snp_info.tree != block.tree_index[i]) break;
+        int snp = std::distance(ancmut.mut_begin(), it_mut);
+        if(snp < first_snp) continue;
+        if(snp > last_snp) break;
+        if(!IsSelectionCandidate(snp_info)) continue;
+
+        if(!coordinates_computed){
+          tree.GetCoordinates(ws.coordinates_tree);
+          ws.coordinates_tree_unsrt = ws.coordinates_tree; //unsorted coordinates of tree
+          std::sort(ws.coordinates_tree.begin(), ws.coordinates_tree.end()); //sorted coordinates of tree
+          coordinates_computed = true;
+        }
 
-        if(b != -1 && b != root){
+        if(!GetTrajectory(tree, snp_info, epochs, data.N, ws, traj[t])) continue;
 
-          os_freq << snp_info.pos << " " << snp_info.rs_id << " ";
-          os_lin  << snp_info.pos << " " << snp_info.rs_id << " ";
-
-					int DAF = 0, DAF_half, num_lin_half = -1;
-          std::fill(coordinates_mutation.begin(), coordinates_mutation.end(), 0.0);
-          //get nodes below branch b
-          //get coordinates from coordinates_tree_unsrt
-          CopyCoordinates(b, coordinates_mutation, coordinates_tree_unsrt, mtr.tree, DAF); //get coordinates of branches below mutation
-					DAF_half = (DAF+1)/2.0;
-          coordinates_mutation[(*mtr.tree.nodes[b].parent).label] = coordinates_tree_unsrt[(*mtr.tree.nodes[b].parent).label]; //add to that list the coordinate of the parent of branch b
-          std::sort(coordinates_mutation.begin(), coordinates_mutation.end()); //sort coordinates_mutation
-
-          std::vector<int> current_branches(data.N, 0.0);
-
-          int num_carriers = 0, num_lineages = 1;
-          //int k_when_mutation_appears = -1, k_when_mutation_has_freq2 = -1, k_when_mutation_has_freq3 = -1, k_when_mutation_has_freq4 = -1, k_when_mutation_has_freq5 = -1, k_when_mutation_has_freq6 = -1, k_when_mutation_has_freq7 = -1;
-          int k_when_mutation_appears = -1, k_when_mutation_has_freq2 = -1;
-          int n_mut = root;
-          int n_tree = root;
-          int ep = num_epochs-1; 
-
-          //while epoch[ep] is larger than root of tree, number of lineages is 0
-          while(coordinates_tree[n_tree] < epochs[ep]){
-            os_freq << 0 << " ";
-            os_lin  << 0 << " ";
-            ep--;
+        if(output_frequency){
+          out_freq[i] << snp_info.pos << " " << snp_info.rs_id << " ";
+          out_lin[i]  << snp_info.pos << " " << snp_info.rs_id << " ";
+          for(std::vector<float>::iterator it_freq = traj[t].num_freq.begin(); it_freq != traj[t].num_freq.end(); it_freq++){
+            out_freq[i] << *it_freq << " ";
           }
-
-          //now coordinates_tree[n_tree] >= epoch[ep]
-          do{
-
-						if(num_carriers == DAF_half && num_lin_half == -1){
-							num_lin_half = num_lineages;
-							//std::cerr << num_carriers << " " << num_lineages << " " << DAF << std::endl;
-						}
-            assert(coordinates_tree[n_tree] >= coordinates_mutation[n_mut]);
-
-            if(coordinates_tree[n_tree] > coordinates_mutation[n_mut]){ //if n_tree is not next node of a branch onto which mutation falls, increase num_lineages
-              num_lineages++;
-              n_tree--;
-            }else{
-              assert(coordinates_tree[n_tree] == coordinates_mutation[n_mut]); //else, n_tree is the node of a branch onto which mutation falls
-
-              if(k_when_mutation_appears == -1){
-
-                num_lineages++;
-                k_when_mutation_appears = num_lineages;
-                current_branches[0]     = mtr.tree.nodes[b].label; //current branches stores lineages that carry derived allele
-
-                n_tree--;
-                n_mut--;
-
-              }else{
-
-                float coords = coordinates_mutation[n_mut];
-                while(coords == coordinates_mutation[n_mut] && coords != 0.0){ //there might be multiple nodes with the same coordinates
-
-                  num_lineages++;
-                  num_carriers++;
-
-                  //check which branch has same coordinates as n_tree-1
-                  bool check_if_branch_is_found = false;
-                  for(int k = 0; k < num_carriers; k++){
-                    if(coordinates_tree_unsrt[current_branches[k]] == coordinates_mutation[n_mut]){
-                      int branch                       = current_branches[k];
-                      current_branches[k]              = (*mtr.tree.nodes[branch].child_left).label; //replace current_branch[k] by its children
-                      current_branches[num_carriers]   = (*mtr.tree.nodes[branch].child_right).label; 
-
-                      check_if_branch_is_found = true;
-                      break;
-                    }
-                  } 
-                  assert(check_if_branch_is_found);
-                  n_tree--;
-                  n_mut--;
-
-                }
-
-              }
-
-            } 
-
-            //num_carriers == 1 means (1+num_carriers) have the derived allele
-            if(num_carriers >= 1){
-              if(k_when_mutation_has_freq2 == -1){ //when this happens for the first time, record num_lineages at this point
-                //std::cerr << num_carriers << " " << num_lineages << std::endl;
-                k_when_mutation_has_freq2 = num_lineages;
-                if(num_carriers > 1) k_when_mutation_has_freq2 -= num_carriers - 1; //this is needed because there might be many branches with exactly the same coordinates
-                assert(k_when_mutation_has_freq2);
-              }
-            }
-
-            assert(coordinates_mutation[n_mut] <= coordinates_tree[n_tree]);
-            while(coordinates_tree[n_tree] < epochs[ep]){ //n_tree+1 is above epoch[ep], n_tree is just below, but could span multiple epochs
-
-              float num_muts = 0.0;
-              if(k_when_mutation_appears != -1){ 
-
-                if(num_carriers == 0){
-
-                  for(int k = 0; k <= num_carriers; k++){
-                    int branch   = current_branches[k];
-
-                    assert(epochs[ep] >= coordinates_tree_unsrt[branch]);
-                    assert(coordinates_tree_unsrt[branch] <= coordinates_mutation[n_mut]);
-                    assert( coordinates_tree_unsrt[(*mtr.tree.nodes[branch].parent).label] - epochs[ep] <= (coordinates_tree_unsrt[(*mtr.tree.nodes[branch].parent).label] - coordinates_tree_unsrt[branch]));
-                    num_muts    += (coordinates_tree_unsrt[(*mtr.tree.nodes[branch].parent).label] - epochs[ep])/(coordinates_tree_unsrt[(*mtr.tree.nodes[branch].parent).label] - coordinates_tree_unsrt[branch]); 
-
-                  }
-
-                  assert(1 + num_muts <= num_lineages);
-                  //os << (1 + num_muts)/((double) num_lineages) << " ";
-
-                  os_freq << num_muts << " ";
-                  os_lin  << num_lineages << " "; 
-
-                }else{
-                  os_freq << (1 + num_carriers) << " ";
-                  os_lin  << num_lineages << " "; 
-                }
-
-              }else{
-                os_freq << 0 << " ";
-                os_lin  << num_lineages << " ";
-              }
-
-
-              ep--;
-              if(ep == -1) break;
-            }
-
-          }while(n_tree >= data.N);
-
-          assert(coordinates_mutation[n_mut] == 0.0);
-          assert(num_lineages == data.N);
-          num_carriers++; 
-					os_freq << num_carriers << " ";
-          os_lin  << num_lineages << " ";
-
-          os_freq << " " << num_carriers << " ";
-          
-					assert(num_carriers == DAF);
-          int carriers = 0;
-          for(std::vector<int>::iterator it_freq = snp_info.freq.begin(); it_freq != snp_info.freq.end(); it_freq++){
-            carriers += *it_freq;
+          out_freq[i] << " " << traj[t].tree_freq << " " << traj[t].data_freq << "\n";
+          for(int k = 0; k < (int) traj[t].num_lin.size() - 1; k++){
+            out_lin[i] << traj[t].num_lin[k] << " ";
           }
-          os_freq << carriers << "\n";
-
-          //os_lin  << k_when_mutation_has_freq2 << " " << k_when_mutation_has_freq3 << " " << k_when_mutation_has_freq4 << " " << k_when_mutation_has_freq5 << " " << k_when_mutation_has_freq6 << " " << k_when_mutation_has_freq7 << "\n";
-					os_lin  << num_lin_half << " ";
-          os_lin  << k_when_mutation_has_freq2 << "\n";
+          out_lin[i] << traj[t].num_lin[traj[t].num_lin.size() - 1] << "\n";
+        }
+        if(output_selection){
+          out_sele[i] << snp_info.pos << " " << snp_info.rs_id << " ";
+          WriteLogPvalues(out_sele[i], traj[t].num_lin, traj[t].num_freq, pvalue[t], logp[t]);
         }
 
       }
 
+    });
+
+    for(int i = 0; i < block.num_trees; i++){
+      if(output_frequency){
+        os_freq << out_freq[i].str();
+        os_lin  << out_lin[i].str();
+      }
+      if(output_selection) os_sele << out_sele[i].str();
     }
-    ancmut.NextSNP(mtr, it_mut);
+
+    //stop once all SNPs up to last_snp are processed
+    int last = block.num_trees-1;
+    if(ancmut.HasMutations(block, last) && std::distance(ancmut.mut_begin(), block.it_mut[last]) > last_snp) break;
+
   }
 
-  os_freq.close();
-  os_lin.close();
+  if(output_frequency){
+    os_freq.close();
+    os_lin.close();
+  }
+  if(output_selection) os_sele.close();
 
   ResourceUsage();
 }
 
+void 
+Frequency(cxxopts::ParseResult& result, const std::string& help_text){
+  FrequencyAndSelection(result, help_text, true, false);
+}
+
 void 
 SDS(cxxopts::ParseResult& result, const std::string& help_text){
 
@@ -1148,6 +1326,8 @@ int main(int argc, char* argv[]){
     ("last_snp", "Index of last SNP. Optional.", cxxopts::value<int>())
     ("threshold", "Optional: Threshold for number of mutations that trees need for inclusion. Default = 0.", cxxopts::value<int>())
     ("years_per_gen", "Optional: Years per generation (float). Default: 28.", cxxopts::value<float>())
+    ("threads", "Optional: Number of threads used in Frequency and FrequencyAndSelection. Default: 1.", cxxopts::value<int>())
+    ("write_frequency", "Optional: Also write .freq and .lin files in FrequencyAndSelection.")
     ("bins", "Specify epoch bins. Format: lower, upper, stepsize for function c(0,10^seq(lower, upper, stepsize)).", cxxopts::value<std::string>())
     ("i,input", "Filename of .anc and .mut file without file extension", cxxopts::value<std::string>())
     ("o,output", "Output file", cxxopts::value<std::string>());
@@ -1164,6 +1344,10 @@ int main(int argc, char* argv[]){
 
     Frequency(result, help_text);
 
+  }else if(!mode.compare("FrequencyAndSelection")){
+
+    FrequencyAndSelection(result, help_text, result.count("write_frequency") > 0, true);
+
   }else if(!mode.compare("Quality")){
 
     Quality(result, help_text);
@@ -1177,7 +1361,7 @@ int main(int argc, char* argv[]){
     std::cout << "####### error #######" << std::endl;
     std::cout << "Invalid or missing mode." << std::endl;
     std::cout << "Options for --mode are:" << std::endl;
-    std::cout << "Frequency, Selection, Quality, SDS." << std::endl;
+    std::cout << "Frequency, Selection, FrequencyAndSelection, Quality, SDS." << std::endl;
 
   }
 
@@ -5,12 +5,100 @@
 #include <string>
 #include <gzstream.h>
 #include <cxxopts.hpp>
+#include <zlib.h>
 
 #include "data.hpp"
 #include "anc.hpp"
 #include "mutations.hpp"
+#include "parallel.hpp"
 #include "usage.hpp"
 
+//Chunk files and combined files are gzip files in which the header lines form a separate gzip member.
+//CombineAncMut can then copy the compressed bodies of chunks without decompressing them.
+
+static gzFile
+OpenGzip(const std::string& filename, const char* mode){
+  gzFile fp = gzopen(filename.c_str(), mode);
+  if(fp == NULL){
+    std::cerr << "Error while opening " << filename << std::endl;
+    exit(1);
+  }
+  return fp;
+}
+
+//Writes header to fp and ends the gzip member, so that the body starts a new member.
+static void
+WriteGzipHeader(gzFile fp, const std::string& header){
+  gzwrite(fp, header.c_str(), header.size());
+  gzflush(fp, Z_FINISH);
+}
+
+//Returns the size in bytes of the first gzip member of filename if it decompresses to exactly num_lines lines, -1 otherwise.
+static long
+GzipHeaderSize(const std::string& filename, int num_lines){
+
+  FILE* fp = fopen(filename.c_str(), "rb");
+  if(fp == NULL) return -1;
+
+  z_stream strm;
+  strm.zalloc   = Z_NULL;
+  strm.zfree    = Z_NULL;
+  strm.opaque   = Z_NULL;
+  strm.avail_in = 0;
+  strm.next_in  = Z_NULL;
+  if(inflateInit2(&strm, 15 + 16) != Z_OK){
+    fclose(fp);
+    return -1;
+  }
+
+  std::vector<unsigned char> in(1 << 16), out(1 << 16);
+  int count_lines = 0;
+  char last = '\0';
+  int ret = Z_OK;
+  while(ret != Z_STREAM_END && count_lines <= num_lines){
+    if(strm.avail_in == 0){
+      strm.avail_in = fread(&in[0], 1, in.size(), fp);
+      strm.next_in  = &in[0];
+      if(strm.avail_in == 0) break;
+    }
+    strm.avail_out = out.size();
+    strm.next_out  = &out[0];
+    ret = inflate(&strm, Z_NO_FLUSH);
+    if(ret != Z_OK && ret != Z_STREAM_END) break;
+    int num_out = out.size() - strm.avail_out;
+    count_lines += std::count(out.begin(), std::next(out.begin(), num_out), '\n');
+    if(num_out > 0) last = out[num_out-1];
+  }
+
+  long size = -1;
+  if(ret == Z_STREAM_END && count_lines == num_lines && last == '\n') size = strm.total_in;
+  inflateEnd(&strm);
+  fclose(fp);
+  return size;
+
+}
+
+//Appends the bytes of filename from offset onwards to os.
+static void
+AppendRaw(FILE* os, const std::string& filename, long offset){
+
+  FILE* fp = fopen(filename.c_str(), "rb");
+  if(fp == NULL || fseek(fp, offset, SEEK_SET) != 0){
+    std::cerr << "Error while reading " << filename << std::endl;
+    exit(1);
+  }
+  std::vector<char> buffer(1 << 20);
+  size_t num_read;
+  while((num_read = fread(&buffer[0], 1, buffer.size(), fp)) > 0){
+    if(fwrite(&buffer[0], 1, num_read, os) != num_read){
+      std::cerr << "Error while writing combined file" << std::endl;
+      exit(1);
+    }
+  }
+  fclose(fp);
+
+}
+
 void
 DivideAncMut(cxxopts::ParseResult& result, const std::string& help_text){
 
@@ -34,16 +122,16 @@ DivideAncMut(cxxopts::ParseResult& result, const std::string& help_text){
 
   int N, num_trees;
 
-  igzstream is_N(result["anc"].as<std::string>());
-  if(is_N.fail()) is_N.open(result["anc"].as<std::string>() + ".gz");
-  if(is_N.fail()){
+  igzstream is(result["anc"].as<std::string>());
+  if(is.fail()) is.open(result["anc"].as<std::string>() + ".gz");
+  if(is.fail()){
     std::cerr << "Error opening .anc file" << std::endl;
     exit(1);
   }
 	std::istringstream is_header;
 	std::string line, tmp, line2, read;
 	//read num_haplotypes
-	getline(is_N, line);
+	getline(is, line);
 	is_header.str(line);
 	is_header >> tmp;
 	is_header >> N;
@@ -60,42 +148,13 @@ DivideAncMut(cxxopts::ParseResult& result, const std::string& help_text){
 	if(i != N) sample_ages.clear();
 
 	//read num trees
-	getline(is_N, line);
+	getline(is, line);
 	is_header.str(line);
 	is_header.clear();
 	is_header >> tmp;
 	is_header >> num_trees;
   const int num_trees_check = num_trees;
-    
-  int L = 0;
-  igzstream is_L(result["mut"].as<std::string>());
-  if(is_L.fail()) is_L.open(result["mut"].as<std::string>() + ".gz");
-  if(is_L.fail()){
-    std::cerr << "Error opening .mut file" << std::endl;
-    exit(1);
-  }
-  std::string unused;
-  std::getline(is_L, unused); 
-  while ( std::getline(is_L, unused) ){
-    ++L;
-  }
-  is_L.close();
-
-  Data data(N,L);
-
-  int num_threads = result["threads"].as<int>();
-  //divide anc/mut into chunks with ((int) num_trees/(100.0 + num_threads)) + 1 trees each
-  int num_trees_per_chunk = ((int) num_trees/(5.0 * num_threads)) + 1;
-  if(num_trees_per_chunk < 10) num_trees_per_chunk = 10;
 
-  igzstream is(result["anc"].as<std::string>());
-  if(is.fail()) is.open(result["anc"].as<std::string>() + ".gz");
-  if(is.fail()){
-    std::cerr << "Error opening .anc file" << std::endl;
-    exit(1);
-  }
-  assert(getline(is,line));
-  assert(getline(is,line));
   igzstream is_mut(result["mut"].as<std::string>());
   if(is_mut.fail()) is_mut.open(result["mut"].as<std::string>() + ".gz");
   if(is_mut.fail()){
@@ -105,87 +164,103 @@ DivideAncMut(cxxopts::ParseResult& result, const std::string& help_text){
   std::string header;
   assert(getline(is_mut, header));
 
-  Mutations mut;
-  mut.Read(result["mut"].as<std::string>());
-
-  i = 0;
-  int snp = 0, tree_index = mut.info[snp].tree;
+  int num_threads = result["threads"].as<int>();
+  //divide anc/mut into chunks with ((int) num_trees/(100.0 + num_threads)) + 1 trees each
+  int num_trees_per_chunk = ((int) num_trees/(5.0 * num_threads)) + 1;
+  if(num_trees_per_chunk < 10) num_trees_per_chunk = 10;
 
+  //index of trees: chunk c contains trees chunk_first_tree[c] to chunk_first_tree[c+1]-1
+  std::vector<int> chunk_first_tree(1, 0);
   while(num_trees > num_trees_per_chunk + 10){
-    ogzstream os(result["output"].as<std::string>() + "_chr" + std::to_string(i) + ".anc.gz");
-    ogzstream os_mut(result["output"].as<std::string>() + "_chr" + std::to_string(i) + ".mut.gz");
+    chunk_first_tree.push_back(*std::prev(chunk_first_tree.end(),1) + num_trees_per_chunk);
+    num_trees -= num_trees_per_chunk;
+  }
+  chunk_first_tree.push_back(num_trees_check);
+  int num_chunks = chunk_first_tree.size() - 1;
 
-    os << "NUM_HAPLOTYPES " << data.N << " ";
+  std::vector<std::string> header_anc(num_chunks);
+  for(int c = 0; c < num_chunks; c++){
+    std::ostringstream os;
+    os << "NUM_HAPLOTYPES " << N << " ";
     if(sample_ages.size() > 0){
       for(std::vector<double>::iterator it_sample_ages = sample_ages.begin(); it_sample_ages != sample_ages.end(); it_sample_ages++){
         os << *it_sample_ages << " ";
       }
     }
     os << "\n";
-    os << "NUM_TREES " << num_trees_per_chunk << "\n";
-    os_mut << header << "\n";
-
-    //std::cerr << snp << " " << tree_index << " " << i << std::endl;
-    for(int k = 0; k < num_trees_per_chunk; k++){
-      assert(getline(is, line));
-      os << line << "\n";
+    os << "NUM_TREES " << chunk_first_tree[c+1] - chunk_first_tree[c] << "\n";
+    header_anc[c] = os.str();
+  }
 
-      if(snp < data.L){
-        while(mut.info[snp].tree == tree_index){
-          assert(getline(is_mut,line));
-          os_mut << line << "\n";
-          snp++;
-          if(snp >= data.L) break;
+  //The .anc and .mut files are each read once and written concurrently.
+  int L = 0, num_trees_read = 0;
+  ParallelFor(2, 2, [&](int k, int /*thread*/){
+
+    std::string line;
+    if(k == 0){
+
+      gzFile os = NULL;
+      int c = -1;
+      while(getline(is, line)){
+        if(c+1 < num_chunks && num_trees_read == chunk_first_tree[c+1]){
+          if(os != NULL) gzclose(os);
+          c++;
+          os = OpenGzip(result["output"].as<std::string>() + "_chr" + std::to_string(c) + ".anc.gz", "wb");
+          WriteGzipHeader(os, header_anc[c]);
         }
-      }else{
-        std::cerr << "Mutation file does not seem to contain all SNPs.\n";
-        exit(1);
+        line += "\n";
+        gzwrite(os, line.c_str(), line.size());
+        num_trees_read++;
       }
-      tree_index++;
-    }
+      if(os != NULL) gzclose(os);
 
-    os.close();
-    os_mut.close();
-    num_trees -= num_trees_per_chunk;
-    i++;
-  }
+    }else{
 
-  //last chunk
-  ogzstream os(result["output"].as<std::string>() + "_chr" + std::to_string(i) + ".anc.gz");
-  ogzstream os_mut(result["output"].as<std::string>() + "_chr" + std::to_string(i) + ".mut.gz");
-
-  os << "NUM_HAPLOTYPES " << data.N << " ";
-  if(sample_ages.size() > 0){
-    for(std::vector<double>::iterator it_sample_ages = sample_ages.begin(); it_sample_ages != sample_ages.end(); it_sample_ages++){
-      os << *it_sample_ages << " ";
-    }
-  }
-  os << "\n";
-  os << "NUM_TREES " << num_trees << "\n";
-  os_mut << header << "\n";
+      gzFile os = NULL;
+      int c = -1, tree_index_first = -1, tree_index = 0;
+      while(getline(is_mut, line)){
 
+        //tree index is the fifth field
+        std::string::size_type pos = 0;
+        for(int field = 0; field < 4 && pos != std::string::npos; field++){
+          pos = line.find(';', pos);
+          if(pos != std::string::npos) pos++;
+        }
+        if(pos == std::string::npos){
+          std::cerr << "Error while reading .mut file at SNP " << L << std::endl;
+          exit(1);
+        }
+        tree_index = atoi(&line[pos]);
+        if(tree_index_first == -1) tree_index_first = tree_index;
+        tree_index -= tree_index_first;
+        if(tree_index < 0 || tree_index >= num_trees_check){
+          std::cerr << "Mutation file does not seem to match anc file.\n";
+          exit(1);
+        }
 
-  //std::cerr << snp << " " << tree_index << " " << i << std::endl;
-  while(getline(is, line)){
-    os << line << "\n";
-    if(snp < data.L){
-      while(mut.info[snp].tree == tree_index){
-        assert(getline(is_mut,line));
-        os_mut << line << "\n";
-        snp++;
-        if(snp >= data.L) break;
+        while(c+1 < num_chunks && tree_index >= chunk_first_tree[c+1]){
+          if(os != NULL) gzclose(os);
+          c++;
+          os = OpenGzip(result["output"].as<std::string>() + "_chr" + std::to_string(c) + ".mut.gz", "wb");
+          WriteGzipHeader(os, header + "\n");
+        }
+        line += "\n";
+        gzwrite(os, line.c_str(), line.size());
+        L++;
       }
-    }else{
-      //std::cerr << snp << " " << tree_index << " " << i << std::endl;
-      std::cerr << "Mutation file does not seem to contain all SNPs.\n";
-      exit(1);
+      if(os != NULL) gzclose(os);
+      if(tree_index != num_trees_check - 1){
+        std::cerr << "Mutation file does not seem to contain all SNPs.\n";
+        exit(1);
+      }
+
     }
-    tree_index++;
-  }
 
-  assert(tree_index - mut.info[0].tree == num_trees_check);
-  os.close();
-  os_mut.close();
+  });
+
+  assert(num_trees_read == num_trees_check);
+  is.close();
+  is_mut.close();
 
   std::ofstream os_param(result["output"].as<std::string>() + ".param");
   if(os_param.fail()){
@@ -193,7 +268,7 @@ DivideAncMut(cxxopts::ParseResult& result, const std::string& help_text){
     exit(1);
   }
   os_param << "NUM_HAPLOTYPES NUM_SNPS NUM_TREES NUM_CHUNKS\n";
-  os_param << data.N << " " << data.L << " " << num_trees_check << " " << i + 1 << std::endl;
+  os_param << N << " " << L << " " << num_trees_check << " " << num_chunks << std::endl;
   os_param.close();
 
   ResourceUsage();
@@ -220,6 +295,9 @@ CombineAncMut(cxxopts::ParseResult& result, const std::string& help_text){
   std::cerr << "---------------------------------------------------------" << std::endl;
   std::cerr << "Combining .anc/.mut files into one file..." << std::endl;
 
+  int num_threads = 1;
+  if(result.count("threads")) num_threads = NumThreads(result["threads"].as<int>());
+
   std::string line;
   Data data;
   int num_trees, num_chunks;
@@ -236,64 +314,92 @@ CombineAncMut(cxxopts::ParseResult& result, const std::string& help_text){
   sscanf(line.c_str(), "%d %d %d %d", &data.N, &data.L, &num_trees, &num_chunks);
   is_param.close();
 
-  ogzstream os(result["output"].as<std::string>() + ".anc.gz");
-  ogzstream os_mut(result["output"].as<std::string>() + ".mut.gz");
-
+  //chunk files are either uncompressed or gzipped
+  std::vector<std::string> filenames(2*num_chunks);
   for(int i = 0; i < num_chunks; i++){
-    bool is_gzipped = false;
-    igzstream is(result["output"].as<std::string>() + "_chr" + std::to_string(i) + ".anc");
-    if(is.fail()){
-      is.open(result["output"].as<std::string>() + "_chr" + std::to_string(i) + ".anc.gz");
-      is_gzipped = true;
+    for(int k = 0; k < 2; k++){
+      std::string filename = result["output"].as<std::string>() + "_chr" + std::to_string(i) + (k == 0 ? ".anc" : ".mut");
+      std::ifstream is_exists(filename);
+      if(is_exists.fail()) filename += ".gz";
+      filenames[2*i+k] = filename;
     }
-    if(is.fail()){
-      std::cerr << "Error opening .anc file" << std::endl;
-      exit(1);
+  }
+
+  igzstream is(filenames[0]);
+  if(is.fail()){
+    std::cerr << "Error opening .anc file" << std::endl;
+    exit(1);
+  }
+  std::string header_anc;
+  assert(getline(is,header_anc));
+  header_anc += "\nNUM_TREES " + std::to_string(num_trees) + "\n";
+  is.close();
+  igzstream is_mut(filenames[1]);
+  if(is_mut.fail()){
+    std::cerr << "Error opening .mut file" << std::endl;
+    exit(1);
+  }
+  std::string header_mut;
+  assert(getline(is_mut,header_mut));
+  header_mut += "\n";
+  is_mut.close();
+
+  //Body of each chunk as a gzip member: gzipped chunks whose header is a separate member are used as they are,
+  //all other chunks are compressed into temporary files in parallel.
+  std::vector<std::string> filenames_body(2*num_chunks);
+  std::vector<long> offset_body(2*num_chunks);
+  ParallelFor(2*num_chunks, num_threads, [&](int i, int /*thread*/){
+
+    int num_header_lines = (i % 2 == 0) ? 2 : 1;
+    long size = GzipHeaderSize(filenames[i], num_header_lines);
+    if(size >= 0){
+      filenames_body[i] = filenames[i];
+      offset_body[i]    = size;
+      return;
     }
-    if(i == 0){
-      assert(getline(is,line));
-      os << line << "\n";
-      assert(getline(is,line));
-      os << "NUM_TREES " << num_trees << "\n";
-    }else{
-      assert(getline(is,line));
-      assert(getline(is,line));
+
+    igzstream is_chunk(filenames[i]);
+    if(is_chunk.fail()){
+      std::cerr << "Error opening " << filenames[i] << std::endl;
+      exit(1);
     }
-    while(getline(is, line)){
-      os << line << "\n";
+    filenames_body[i] = filenames[i] + ".body.gz";
+    offset_body[i]    = 0;
+    gzFile os = OpenGzip(filenames_body[i], "wb");
+    std::string line;
+    for(int k = 0; k < num_header_lines; k++){
+      assert(getline(is_chunk, line));
     }
-    is.close();
-    if(is_gzipped){
-      std::remove((result["output"].as<std::string>() + "_chr" + std::to_string(i) + ".anc.gz").c_str());
-    }else{
-      std::remove((result["output"].as<std::string>() + "_chr" + std::to_string(i) + ".anc").c_str());
-    } 
-
-    is_gzipped = false;
-    igzstream is_mut(result["output"].as<std::string>() + "_chr" + std::to_string(i) + ".mut");
-    if(is_mut.fail()){
-      is_mut.open(result["output"].as<std::string>() + "_chr" + std::to_string(i) + ".mut.gz");
-      is_gzipped = true;
+    while(getline(is_chunk, line)){
+      line += "\n";
+      gzwrite(os, line.c_str(), line.size());
     }
-    if(is_mut.fail()){
-      std::cerr << "Error opening .mut file" << std::endl;
+    gzclose(os);
+    is_chunk.close();
+
+  });
+
+  std::vector<std::string> header = {header_anc, header_mut};
+  std::vector<std::string> filenames_out = {result["output"].as<std::string>() + ".anc.gz", result["output"].as<std::string>() + ".mut.gz"};
+  ParallelFor(2, std::min(2, num_threads), [&](int k, int /*thread*/){
+    gzFile os_header = OpenGzip(filenames_out[k], "wb");
+    WriteGzipHeader(os_header, header[k]);
+    gzclose(os_header);
+    FILE* os = fopen(filenames_out[k].c_str(), "ab");
+    if(os == NULL){
+      std::cerr << "Error while opening " << filenames_out[k] << std::endl;
       exit(1);
     }
-    assert(getline(is_mut, line));
-    if(i == 0) os_mut << line << "\n";
-    while(getline(is_mut, line)){
-      os_mut << line << "\n";
+    for(int i = k; i < 2*num_chunks; i += 2){
+      AppendRaw(os, filenames_body[i], offset_body[i]);
     }
-    is_mut.close();
+    fclose(os);
+  });
 
-    if(is_gzipped){
-      std::remove((result["output"].as<std::string>() + "_chr" + std::to_string(i) + ".mut.gz").c_str());
-    }else{
-      std::remove((result["output"].as<std::string>() + "_chr" + std::to_string(i) + ".mut").c_str());
-    }
+  for(int i = 0; i < 2*num_chunks; i++){
+    if(filenames_body[i] != filenames[i]) std::remove(filenames_body[i].c_str());
+    std::remove(filenames[i].c_str());
   }
-  os.close();
-  os_mut.close();
 
   std::remove((result["output"].as<std::string>() + ".param").c_str());
 
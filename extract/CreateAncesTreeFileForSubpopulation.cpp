@@ -4,6 +4,7 @@
 #include <cxxopts.hpp>
 
 #include "anc_builder.hpp"
+#include "parallel.hpp"
 #include "usage.hpp"
 namespace fs = std::filesystem;
 
@@ -26,13 +27,13 @@ MakeAncesTreeFile(cxxopts::ParseResult& result, const std::string& help_text, Mu
     exit(0);
   }  
 
+  int num_threads = 1;
+  if(result.count("threads")) num_threads = NumThreads(result["threads"].as<int>());
+
   AncMutIterators ancmut(result["anc"].as<std::string>(), result["mut"].as<std::string>());
   int N = ancmut.NumTips();
   int L = ancmut.NumSnps();
   int num_trees = ancmut.NumTrees();
-  MarginalTree mtr;
-  Muts::iterator it_mut;
-  float num_bases_tree_persists = 0.0;
 
   int i;
   std::string line, read;
@@ -68,10 +69,7 @@ MakeAncesTreeFile(cxxopts::ParseResult& result, const std::string& help_text, Mu
   AncesTreeBuilder ancbuilder(data);
   ancbuilder.PreCalcPotentialBranches(); // precalculating the number of decendants a branch needs to be equivalent (narrowing search space)
   std::vector<int> check_if_trees_are_equivalent;
-  std::vector<int> convert_index, number_in_subpop;
-  std::vector<float> coordinates(N_total, 0.0);
 
-  Tree subtree;
   std::vector<AncesTree> v_anc(1);
   v_anc[0].seq.resize(num_trees);
   CorrTrees::iterator it_subseq = v_anc[0].seq.begin();
@@ -106,118 +104,146 @@ MakeAncesTreeFile(cxxopts::ParseResult& result, const std::string& help_text, Mu
   it_subseq = v_anc[0].seq.begin();
 
 
+  //Subtrees of a block of trees are extracted in parallel, mutations are then mapped onto them in tree order.
+  TreeBlock block;
+  int block_size = 8*num_threads;
+  std::vector<SubTreeExtractor> extractors(block_size, SubTreeExtractor(sample));
+  std::vector<Tree> subtrees(block_size);
+  std::vector<std::vector<float>> v_coordinates(block_size, std::vector<float>(N_total, 0.0));
+  for(std::vector<Tree>::iterator it_subtree = subtrees.begin(); it_subtree != subtrees.end(); it_subtree++){
+    (*it_subtree).sample_ages = &v_anc[0].sample_ages;
+  }
+
   int count_tree = 0, count_included_tree = 0;
   int snp = 0;
   int branch;
   float freq;
   int num_snps_mapped_onto_tree = 0;
-  num_bases_tree_persists = ancmut.NextTree(mtr, it_mut);
-  while(num_bases_tree_persists >= 0.0){
-
-    //read tree
-    mtr.tree.GetSubTree(sample, (*it_subseq).tree, convert_index, number_in_subpop);
-    (*it_subseq).pos = include_snp.size();
-    (*it_subseq).tree.GetCoordinates(coordinates);
-
-    //set branch lengths lifespan to lifespan of tree (will be extended later)
-    for(std::vector<Node>::iterator it_node = (*it_subseq).tree.nodes.begin(); it_node != (*it_subseq).tree.nodes.end(); it_node++){
-      //(*it_node).SNP_begin = (*it_subseq).pos;
-      (*it_node).SNP_begin = include_snp.size();
-      (*it_node).num_events = 0.0;
-    }
-    //previous tree extends to one position before current tree
-    if(it_subseq != v_anc[0].seq.begin()){
-      for(std::vector<Node>::iterator it_node = (*std::prev(it_subseq,1)).tree.nodes.begin(); it_node != (*std::prev(it_subseq,1)).tree.nodes.end(); it_node++){
-        (*it_node).SNP_end = include_snp.size() - 1;
-      }
-    }
+  bool is_done = false;
+  while(!is_done && ancmut.NextTreeBlock(block, block_size) > 0){
 
-    //Map mutations to subtree
-    num_snps_mapped_onto_tree = 0;
+    ParallelFor(block.num_trees, num_threads, [&](int i, int /*thread*/){
+      extractors[i].Extract(block.mtr[i].tree, subtrees[i]);
+      subtrees[i].GetCoordinates(v_coordinates[i]);
+    });
 
-    while(mut.info[snp].tree < count_tree){
-      snp++;
-      if(snp == (int)mut.info.size()) break; 
-    }
-    if(snp == (int)mut.info.size()) break; 
-    assert(mut.info[snp].tree == count_tree);
+    for(int i = 0; i < block.num_trees; i++){
 
-    if(mut.info[snp].freq.size() == sample.groups.size()){
+      std::vector<int>& convert_index    = extractors[i].convert_index;
+      std::vector<int>& number_in_subpop = extractors[i].number_in_subpop;
+      std::vector<float>& coordinates    = v_coordinates[i];
 
-      while(mut.info[snp].tree == count_tree){
+      //read tree
+      (*it_subseq).tree = subtrees[i];
+      (*it_subseq).pos = include_snp.size();
 
-        freq = 0.0; 
-        for(std::vector<int>::iterator it_group_of_interest = sample.group_of_interest.begin(); it_group_of_interest != sample.group_of_interest.end(); it_group_of_interest++){
-          freq += mut.info[snp].freq[*it_group_of_interest];
-          if(freq > 0.0) break;
+      //set branch lengths lifespan to lifespan of tree (will be extended later)
+      for(std::vector<Node>::iterator it_node = (*it_subseq).tree.nodes.begin(); it_node != (*it_subseq).tree.nodes.end(); it_node++){
+        //(*it_node).SNP_begin = (*it_subseq).pos;
+        (*it_node).SNP_begin = include_snp.size();
+        (*it_node).num_events = 0.0;
+      }
+      //previous tree extends to one position before current tree
+      if(it_subseq != v_anc[0].seq.begin()){
+        for(std::vector<Node>::iterator it_node = (*std::prev(it_subseq,1)).tree.nodes.begin(); it_node != (*std::prev(it_subseq,1)).tree.nodes.end(); it_node++){
+          (*it_node).SNP_end = include_snp.size() - 1;
         }
+      }
 
-        if(freq > 0.0){
-
-          if(mut.info[snp].branch.size() == 1){
-            branch = convert_index[*mut.info[snp].branch.begin()];
-            if(branch != -1 && branch != root && number_in_subpop[*mut.info[snp].branch.begin()] > 0){
-              num_snps_mapped_onto_tree++;
-              include_snp.push_back(snp);
-              mut.info[snp].age_begin = coordinates[branch];
-              mut.info[snp].age_end   = coordinates[(*(*it_subseq).tree.nodes[branch].parent).label];
-              assert(count_included_tree >= 0);
-              mut.info[snp].tree      = count_included_tree;
-            }
+      //Map mutations to subtree
+      num_snps_mapped_onto_tree = 0;
+
+      while(mut.info[snp].tree < count_tree){
+        snp++;
+        if(snp == (int)mut.info.size()) break; 
+      }
+      if(snp == (int)mut.info.size()){
+        is_done = true;
+        break;
+      }
+      assert(mut.info[snp].tree == count_tree);
+
+      if(mut.info[snp].freq.size() == sample.groups.size()){
+
+        while(mut.info[snp].tree == count_tree){
+
+          freq = 0.0; 
+          for(std::vector<int>::iterator it_group_of_interest = sample.group_of_interest.begin(); it_group_of_interest != sample.group_of_interest.end(); it_group_of_interest++){
+            freq += mut.info[snp].freq[*it_group_of_interest];
+            if(freq > 0.0) break;
           }
-          for(std::vector<int>::iterator it_branch = mut.info[snp].branch.begin(); it_branch != mut.info[snp].branch.end(); it_branch++){
-            branch = convert_index[*it_branch];
-            if(branch != -1){
-              (*it_subseq).tree.nodes[branch].num_events += 1.0/((float) mut.info[snp].branch.size());
-              *it_branch = branch;
+
+          if(freq > 0.0){
+
+            if(mut.info[snp].branch.size() == 1){
+              branch = convert_index[*mut.info[snp].branch.begin()];
+              if(branch != -1 && branch != root && number_in_subpop[*mut.info[snp].branch.begin()] > 0){
+                num_snps_mapped_onto_tree++;
+                include_snp.push_back(snp);
+                mut.info[snp].age_begin = coordinates[branch];
+                mut.info[snp].age_end   = coordinates[(*(*it_subseq).tree.nodes[branch].parent).label];
+                assert(count_included_tree >= 0);
+                mut.info[snp].tree      = count_included_tree;
+              }
             }
+            for(std::vector<int>::iterator it_branch = mut.info[snp].branch.begin(); it_branch != mut.info[snp].branch.end(); it_branch++){
+              branch = convert_index[*it_branch];
+              if(branch != -1){
+                (*it_subseq).tree.nodes[branch].num_events += 1.0/((float) mut.info[snp].branch.size());
+                *it_branch = branch;
+              }
+            }
+
           }
+          snp++;
+          if(snp == (int)mut.info.size()) break; 
 
         }
-        snp++;
-        if(snp == (int)mut.info.size()) break; 
-
-      }
 
-    }else{
+      }else{
     
-      while(mut.info[snp].tree == count_tree){
-
-          if(mut.info[snp].branch.size() == 1){
-            branch = convert_index[*mut.info[snp].branch.begin()];
-            if(branch != -1 && branch != root && number_in_subpop[*mut.info[snp].branch.begin()] > 0){
-              num_snps_mapped_onto_tree++;
-              include_snp.push_back(snp);
-              mut.info[snp].age_begin = coordinates[branch];
-              mut.info[snp].age_end   = coordinates[(*(*it_subseq).tree.nodes[branch].parent).label];
-              assert(count_included_tree >= 0);
-              mut.info[snp].tree      = count_included_tree;
+        while(mut.info[snp].tree == count_tree){
+
+            if(mut.info[snp].branch.size() == 1){
+              branch = convert_index[*mut.info[snp].branch.begin()];
+              if(branch != -1 && branch != root && number_in_subpop[*mut.info[snp].branch.begin()] > 0){
+                num_snps_mapped_onto_tree++;
+                include_snp.push_back(snp);
+                mut.info[snp].age_begin = coordinates[branch];
+                mut.info[snp].age_end   = coordinates[(*(*it_subseq).tree.nodes[branch].parent).label];
+                assert(count_included_tree >= 0);
+                mut.info[snp].tree      = count_included_tree;
+              }
             }
-          }
-          for(std::vector<int>::iterator it_branch = mut.info[snp].branch.begin(); it_branch != mut.info[snp].branch.end(); it_branch++){
-            branch = convert_index[*it_branch];
-            if(branch != -1){
-              (*it_subseq).tree.nodes[branch].num_events += 1.0/((float) mut.info[snp].branch.size());
-              *it_branch = branch;
+            for(std::vector<int>::iterator it_branch = mut.info[snp].branch.begin(); it_branch != mut.info[snp].branch.end(); it_branch++){
+              branch = convert_index[*it_branch];
+              if(branch != -1){
+                (*it_subseq).tree.nodes[branch].num_events += 1.0/((float) mut.info[snp].branch.size());
+                *it_branch = branch;
+              }
             }
-          }
 
-        snp++;
-        if(snp == (int)mut.info.size()) break; 
+          snp++;
+          if(snp == (int)mut.info.size()) break; 
       
+        }
+
       }
 
-    }
 
+      //increment except if no mutations mapped onto it
+      if(num_snps_mapped_onto_tree != 0){
+        count_included_tree++;
+        it_subseq++;
+      }
+      count_tree++;
+      if(snp == (int)mut.info.size()){
+        is_done = true;
+        break;
+      }
 
-    //increment except if no mutations mapped onto it
-    if(num_snps_mapped_onto_tree != 0){
-      count_included_tree++;
-      it_subseq++;
     }
-    count_tree++;
-    num_bases_tree_persists = ancmut.NextTree(mtr, it_mut);
-    if(snp == (int)mut.info.size()) break; 
+
   }
 
   it_subseq--;
@@ -236,16 +262,20 @@ MakeAncesTreeFile(cxxopts::ParseResult& result, const std::string& help_text, Mu
   it_seq_prev = v_anc[0].seq.begin();
   it_seq      = std::next(it_seq_prev,1); 
 
-  std::vector<std::vector<int>> equivalent_branches;
-  std::vector<std::vector<int>>::iterator it_equivalent_branches;
-
+  std::vector<CorrTrees::iterator> it_seqs;
   for(; it_seq != v_anc[0].seq.end();){
-    equivalent_branches.emplace_back();
-    it_equivalent_branches = std::prev(equivalent_branches.end(),1);
-    ancbuilder.BranchAssociation((*it_seq_prev).tree, (*it_seq).tree, *it_equivalent_branches); //O(N^2) 
+    it_seqs.push_back(it_seq_prev);
     it_seq++;
     it_seq_prev++;
-  }  //Write equivalent_branches to file
+  }
+  it_seqs.push_back(it_seq_prev);
+
+  //pairs of adjacent trees are independent
+  std::vector<std::vector<int>> equivalent_branches(it_seqs.size() - 1);
+  ParallelFor(equivalent_branches.size(), num_threads, [&](int i, int /*thread*/){
+    ancbuilder.BranchAssociation((*it_seqs[i]).tree, (*it_seqs[i+1]).tree, equivalent_branches[i]); //O(N^2)
+  });
+  //Write equivalent_branches to file
   
   fs::path dirname = result["output"].as<fs::path>();
   fs::create_directory(dirname);
@@ -265,7 +295,7 @@ MakeAncesTreeFile(cxxopts::ParseResult& result, const std::string& help_text, Mu
   //Associate branches of adjacent trees
   //Data data(((*v_anc[0].seq.begin()).tree.nodes.size() + 1)/2, 1);
   //AncesTreeBuilder ancbuilder(data);
-  ancbuilder.AssociateTrees(v_anc, dirname);
+  ancbuilder.AssociateTrees(v_anc, (dirname / "").string());
   v_anc[0].Dump(result["output"].as<std::string>() + ".anc");
  
   std::remove((dirname / "equivalent_branches_0.bin").c_str());
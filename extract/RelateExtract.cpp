@@ -29,7 +29,7 @@ int main(int argc, char* argv[]){
 		("years_per_gen", "Years per generation.", cxxopts::value<float>())
     ("threshold", "Threshold used in RemoveTreesWithFewMutations.", cxxopts::value<float>())
 		("anc_genome", "Fasta file containing ancestral genome.", cxxopts::value<std::string>())
-    ("threads", "Optional: Number of threads used (only used to decide chunk size in DivideAncMut)", cxxopts::value<int>())
+    ("threads", "Optional: Number of threads used (decides chunk size in DivideAncMut, parallelises SubTreesForSubpopulation and CombineAncMut with default 1).", cxxopts::value<int>())
 		("transversion", "Only use transversion for bl estimation.")
 		("i,input", "Filename of input (excl file extension).", cxxopts::value<std::string>())
     ("o,output", "Filename of output (excl file extension).", cxxopts::value<std::string>());
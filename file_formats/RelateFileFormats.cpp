@@ -22,6 +22,7 @@ int main(int argc, char* argv[]){
     ("mut", "Filename of .mut file", cxxopts::value<std::string>())
 		("flag", "Flag for different options in each mode", cxxopts::value<std::string>())
     ("i,input", "Filename of input.", cxxopts::value<std::string>())
+    ("threads", "Optional. Number of threads used in ConvertToTreeSequence. Default: 1, 0 uses all hardware threads.", cxxopts::value<int>())
     ("o,output", "Filename of output (excl file extension).", cxxopts::value<std::string>());
 
   auto result = options.parse(argc, argv);
@@ -10,9 +10,11 @@
 #include "data.hpp"
 #include "anc.hpp"
 #include "anc_builder.hpp"
+#include "fast_painting.hpp"
 #include "usage.hpp"
 
-int BuildTopology(cxxopts::ParseResult& result, int chunk_index, int first_section, int last_section){
+//If painting is not NULL, paintings are read from it (as written by Paint) and released after use.
+int BuildTopology(cxxopts::ParseResult& result, int chunk_index, int first_section, int last_section, PaintingBuffer* painting = NULL){
 
   //////////////////////////////////
   //Parse Data
@@ -33,6 +35,7 @@ int BuildTopology(cxxopts::ParseResult& result, int chunk_index, int first_secti
 
 	Data data((file_out + "chunk_" + std::to_string(chunk_index) + ".hap").c_str(), (file_out + "chunk_" + std::to_string(chunk_index) + ".bp").c_str(), (file_out + "chunk_" + std::to_string(chunk_index) + ".dist").c_str(), (file_out + "chunk_" + std::to_string(chunk_index) + ".r").c_str(), (file_out + "chunk_" + std::to_string(chunk_index) + ".rpos").c_str(), (file_out + "chunk_" + std::to_string(chunk_index) + ".state").c_str()); //struct data is defined in data.hpp
   data.name = (file_out + "chunk_" + std::to_string(chunk_index) + "/paint/relate");
+  data.painting = painting;
 
   if(result.count("effectiveN")){
     data.Ne = result["effectiveN"].as<float>();
@@ -134,6 +137,7 @@ int BuildTopology(cxxopts::ParseResult& result, int chunk_index, int first_secti
 
     anc.DumpBin(dirname + result["output"].as<std::string>() + "_" + std::to_string(section) + ".anc");
     ancbuilder.mutations.DumpShortFormat(dirname + result["output"].as<std::string>() + "_" + std::to_string(section) + ".mut", section_startpos, section_endpos);
+    if(painting != NULL) painting -> Release(section);
 
   }
 
@@ -13,7 +13,7 @@
 #include "tree_builder.hpp"
 #include "usage.hpp"
 
-int GetBranchLengths(std::string output, int chunk_index, int first_section, int last_section, double mutation_rate, const double *effectiveN, const std::string *sample_ages_path, const std::string *coal, const int *const_seed){
+int GetBranchLengths(std::string output, int chunk_index, int first_section, int last_section, double mutation_rate, const double *effectiveN, const std::string *sample_ages_path, const std::string *coal, const int *const_seed, bool warm_start, int num_chains){
   int seed;
   if(const_seed == NULL){
     seed = std::time(0) + getpid();
@@ -109,11 +109,21 @@ int GetBranchLengths(std::string output, int chunk_index, int first_section, int
     sample_ages.clear(); 
   }
 
+  if(num_chains > 1 && (is_coal || sample_ages.size() > 0)){
+    std::cerr << "Warning: multiple chains are only implemented for constant population size without sample ages. Using one chain." << std::endl;
+  }
+  if(warm_start && (is_coal || sample_ages.size() > 0)){
+    std::cerr << "Warning: warm start is only implemented for constant population size without sample ages. Ignoring --warm_start." << std::endl;
+  }
+
   ///////////////////////////////////////// TMRCA Inference /////////////////////////
   //Infer Branchlengths
 
   if(sample_ages.size() == 0){
 
+    //the estimator is the workspace of the MCMC, it is sized once for N and reused for all trees
+    InferBranchLengths bl(data, warm_start);
+
     last_section = std::min(num_windows-1, last_section);
     for(int section = first_section; section <= last_section; section++){
 
@@ -127,19 +137,41 @@ int GetBranchLengths(std::string output, int chunk_index, int first_section, int
       anc.ReadBin(filename);
 
       //Infer branch lengths
-      InferBranchLengths bl(data);
       //EstimateBranchLengths bl2(data);
       //EstimateBranchLengthsWithSampleAge bl2(data, sample_ages);
 
       int num_sec = (int) anc.seq.size()/100.0 + 1;
 
       if(is_coal){
+        CoalescentRateProfile profile(epoch, coalescent_rate);
         for(CorrTrees::iterator it_seq = anc.seq.begin(); it_seq != anc.seq.end(); it_seq++){
-          bl.MCMCVariablePopulationSizeForRelate(data, (*it_seq).tree, epoch, coalescent_rate, rand()); //this is estimating times
+          bl.MCMCVariablePopulationSizeForRelate(data, (*it_seq).tree, profile, rand()); //this is estimating times
           //bl2.MCMCVariablePopulationSizeSample(data, (*it_seq).tree, epoch, coalescent_rate, 2e4, 1, rand());
         }
+      }else if(num_chains > 1){
+        //run several chains per tree until they agree, and report how well they agreed
+        InferBranchLengthsMultipleChains bl_chains(data, num_chains, 1.1, warm_start);
+        int count = 0, num_not_converged = 0;
+        double sum_rhat = 0.0, max_rhat = 1.0, sum_proposals = 0.0;
+        CorrTrees::iterator it_seq = anc.seq.begin();
+        for(; it_seq != anc.seq.end(); it_seq++){
+          if(count % num_sec == 0){
+            std::cerr << "[" << section << "/" << last_section << "] " << "[" << count << "/" << anc.seq.size() << "]\r";
+            std::cerr.flush(); 
+          }
+          count++;
+          bl_chains.MCMC(data, (*it_seq).tree, rand()); //this is estimating times
+          sum_rhat      += bl_chains.Rhat();
+          max_rhat       = std::max(max_rhat, bl_chains.Rhat());
+          sum_proposals += bl_chains.NumProposals();
+          if(bl_chains.Rhat() >= 1.1) num_not_converged++;
+        }
+        std::cerr << "[" << section << "/" << last_section << "] " << "[" << count << "/" << anc.seq.size() << "] ";
+        std::cerr << "R-hat mean " << sum_rhat/count << ", max " << max_rhat << ", not converged " << num_not_converged << " trees, " << sum_proposals/count << " proposals per chain." << std::endl;
       }else{
+        //acceptance rates of the MCMC proposals, averaged over trees
         int count = 0;
+        double sum_switch_order = 0.0, sum_change_time = 0.0, min_change_time = 1.0;
         CorrTrees::iterator it_seq = anc.seq.begin();
         for(; it_seq != anc.seq.end(); it_seq++){
           if(count % num_sec == 0){
@@ -149,8 +181,12 @@ int GetBranchLengths(std::string output, int chunk_index, int first_section, int
           count++;
           //bl.MCMC(data, (*it_seq).tree, seed); //this is estimating times
           bl.MCMC(data, (*it_seq).tree, rand()); //this is estimating times
+          sum_switch_order += bl.SwitchOrderAcceptanceRate();
+          sum_change_time  += bl.ChangeTimeAcceptanceRate();
+          min_change_time   = std::min(min_change_time, bl.ChangeTimeAcceptanceRate());
         }
-        std::cerr << "[" << section << "/" << last_section << "] " << "[" << count << "/" << anc.seq.size() << "]\r";
+        std::cerr << "[" << section << "/" << last_section << "] " << "[" << count << "/" << anc.seq.size() << "] ";
+        std::cerr << "Acceptance rate of order switches " << sum_switch_order/count << ", of time changes " << sum_change_time/count << " (lowest tree " << min_change_time << ")." << std::endl;
       }
 
       //Dump to file
@@ -160,6 +196,8 @@ int GetBranchLengths(std::string output, int chunk_index, int first_section, int
 
   }else{
 
+    EstimateBranchLengthsWithSampleAge bl(data, sample_ages);
+
     last_section = std::min(num_windows-1, last_section);
     for(int section = first_section; section <= last_section; section++){
 
@@ -173,14 +211,12 @@ int GetBranchLengths(std::string output, int chunk_index, int first_section, int
       anc.ReadBin(filename);
       anc.sample_ages = sample_ages;
 
-      //Infer branch lengths
-      EstimateBranchLengthsWithSampleAge bl(data, anc.sample_ages);
-
       int num_sec = (int) anc.seq.size()/100.0 + 1;
 
       if(is_coal){
+        CoalescentRateProfile profile(epoch, coalescent_rate);
         for(CorrTrees::iterator it_seq = anc.seq.begin(); it_seq != anc.seq.end(); it_seq++){
-          bl.MCMCVariablePopulationSizeForRelate(data, (*it_seq).tree, epoch, coalescent_rate, rand()); //this is estimating times
+          bl.MCMCVariablePopulationSizeForRelate(data, (*it_seq).tree, profile, rand()); //this is estimating times
           //bl.MCMCVariablePopulationSizeSample(data, (*it_seq).tree, epoch, coalescent_rate, 2e4, 1, rand());
           //for(std::vector<Node>::iterator it_n = (*it_seq).tree.nodes.begin(); it_n != (*it_seq).tree.nodes.end(); it_n++){
           //  (*it_n).branch_length *= 2e4;
@@ -15,9 +15,10 @@ namespace fs = std::filesystem;
 int MakeChunks(cxxopts::ParseResult& result, const std::string& help_text, int chunk_size = 0){
 
   bool help = false;
-  if(!result.count("haps") || !result.count("sample") || !result.count("map") || !result.count("output")){
+  if(((!result.count("haps") || !result.count("sample")) && !result.count("vcf")) || !result.count("map") || !result.count("output")){
     std::cout << "Not enough arguments supplied." << std::endl;
-    std::cout << "Needed: haps, sample, map, output. Optional: memory, dist, transversion." << std::endl;
+    std::cout << "Needed: haps, sample (or vcf), map, output. Optional: memory, dist, transversion." << std::endl;
+    std::cout << "Optional with vcf: remove_ids, ancestor, mask." << std::endl;
     help = true;
   }
   if(result.count("help") || help){
@@ -57,18 +58,23 @@ int MakeChunks(cxxopts::ParseResult& result, const std::string& help_text, int c
   }
   */
 
-  if(result.count("memory")){
-    if(result.count("dist")){
-      data.MakeChunks(result["haps"].as<std::string>(), result["sample"].as<std::string>(), result["map"].as<std::string>(), result["dist"].as<std::string>(), result["output"].as<std::string>(), use_transitions, result["memory"].as<float>());
-    }else{
-      data.MakeChunks(result["haps"].as<std::string>(), result["sample"].as<std::string>(), result["map"].as<std::string>(), "unspecified", result["output"].as<std::string>(), use_transitions, result["memory"].as<float>());
-    }
+  float memory = 5;
+  if(result.count("memory")) memory = result["memory"].as<float>();
+  std::string filename_dist = "unspecified";
+  if(result.count("dist")) filename_dist = result["dist"].as<std::string>();
+
+  if(result.count("vcf")){
+
+    //read vcf once, filtering SNPs in memory instead of preparing haps/sample files with RelateFileFormats
+    vcf m_vcf(result["vcf"].as<std::string>());
+    m_vcf.RemoveNonBiallelicSNPs();
+    if(result.count("remove_ids")) m_vcf.RemoveSamples(result["remove_ids"].as<std::string>());
+    if(result.count("ancestor")) m_vcf.SetAncestor(result["ancestor"].as<std::string>());
+    if(result.count("mask")) m_vcf.SetMask(result["mask"].as<std::string>());
+    data.MakeChunks(m_vcf, result["map"].as<std::string>(), filename_dist, result["output"].as<std::string>(), use_transitions, memory);
+
   }else{
-    if(result.count("dist")){
-      data.MakeChunks(result["haps"].as<std::string>(), result["sample"].as<std::string>(), result["map"].as<std::string>(), result["dist"].as<std::string>(), result["output"].as<std::string>(), use_transitions);
-    }else{
-      data.MakeChunks(result["haps"].as<std::string>(), result["sample"].as<std::string>(), result["map"].as<std::string>(), "unspecified", result["output"].as<std::string>(), use_transitions);
-    }
+    data.MakeChunks(result["haps"].as<std::string>(), result["sample"].as<std::string>(), result["map"].as<std::string>(), filename_dist, result["output"].as<std::string>(), use_transitions, memory);
   }
   
   std::vector<double> sample_ages(data.N);
@@ -12,7 +12,8 @@
 
 namespace fs = std::filesystem;
 
-int Paint(cxxopts::ParseResult& result, int chunk_index){
+//If painting is not NULL, windows it keeps in memory are not written to disk.
+int Paint(cxxopts::ParseResult& result, int chunk_index, PaintingBuffer* painting = NULL){
 
   const fs::path file_out{result["output"].as<fs::path>()};
 
@@ -57,8 +58,25 @@ int Paint(cxxopts::ParseResult& result, int chunk_index){
 
 	}
 
+  if(result.count("painting_format")){
+    std::string painting_format = result["painting_format"].as<std::string>();
+    if(painting_format == "raw"){
+      data.painting_encoding = CollapsedMatrix<float>::raw;
+    }else if(painting_format == "quantized"){
+      data.painting_encoding = CollapsedMatrix<float>::quantized;
+    }else if(painting_format == "compressed"){
+      data.painting_encoding = CollapsedMatrix<float>::compressed;
+    }else{
+      std::cerr << "Error: painting_format needs to be raw, quantized or compressed." << std::endl;
+      exit(1);
+    }
+  }
+
   std::cerr << "---------------------------------------------------------" << std::endl;
   std::cerr << "Painting sequences..." << std::endl;
+  if(painting != NULL){
+    std::cerr << "Keeping " << painting -> NumInMemory() << " of " << num_windows << " windows in memory." << std::endl;
+  }
 
   //create directory called paint/ if not existent
   const fs::path chunk_dir = file_out / ("chunk_" + std::to_string(chunk_index));
@@ -71,7 +89,11 @@ int Paint(cxxopts::ParseResult& result, int chunk_index){
   std::vector<FILE*> pfiles(num_windows);
   for(int w = 0; w < num_windows; w++){
     snprintf(filename, sizeof(char) * 1024, "%s_%i.bin", data.name.c_str(), w);
-    pfiles[w] = fopen(filename, "wb");
+    if(painting != NULL){
+      pfiles[w] = painting -> OpenWrite(w, filename);
+    }else{
+      pfiles[w] = fopen(filename, "wb");
+    }
     assert(pfiles[w] != NULL);
   }
 
@@ -10,6 +10,23 @@
 #include "Finalize.cpp"
 #include "Clean.cpp"
 #include "OptimizeParameters.cpp"
+#include "parallel.hpp"
+#include "tree_sequence.hpp"
+
+//Converts output.anc/mut written by Finalize to output.trees.
+void WriteTreeSequence(cxxopts::ParseResult& result, const std::string& output){
+
+  int num_threads = 1;
+  if(result.count("threads")){
+    num_threads = NumThreads(result["threads"].as<int>());
+  }
+
+  std::cerr << "---------------------------------------------------------" << std::endl;
+  std::cerr << "Writing tree sequence to " << output << ".trees..." << std::endl;
+  DumpTreeSequence(output + ".anc", output + ".mut", output + ".trees", num_threads);
+  ResourceUsage();
+
+}
 
 int main(int argc, char* argv[]){
 
@@ -21,6 +38,10 @@ int main(int argc, char* argv[]){
     ("mode", "Choose which part of the algorithm to run.", cxxopts::value<std::string>()) 
     ("haps", "Filename of haps file (Output file format of Shapeit).", cxxopts::value<std::string>())
     ("sample", "Filename of sample file (Output file format of Shapeit).", cxxopts::value<std::string>())
+    ("vcf", "Filename of phased vcf(.gz) file. Can be used instead of haps and sample.", cxxopts::value<std::string>())
+    ("remove_ids", "Optional, with vcf. Filename of file containing ids of samples to remove (one per line).", cxxopts::value<std::string>())
+    ("ancestor", "Optional, with vcf. Filename of ancestral genome in fasta format, used to flip SNPs.", cxxopts::value<std::string>())
+    ("mask", "Optional, with vcf. Filename of genomic mask in fasta format, used to filter SNPs and calculate dist.", cxxopts::value<std::string>())
     ("map", "Genetic map.", cxxopts::value<std::string>())
     ("m,mutation_rate", "Mutation rate.", cxxopts::value<float>())
     ("N,effectiveN", "Effective population size.", cxxopts::value<float>())
@@ -28,6 +49,8 @@ int main(int argc, char* argv[]){
     ("dist", "Optional but recommended. Distance in BP between SNPs. Can be generated using RelateFileFormats. If unspecified, distances in haps are used.", cxxopts::value<std::string>())
     ("annot", "Optional. Filename of file containing additional annotation of snps. Can be generated using RelateFileFormats.", cxxopts::value<std::string>()) 
     ("memory", "Optional. Approximate memory allowance in GB for storing distance matrices. Default is 5GB.", cxxopts::value<float>())
+    ("painting_format", "Optional. Encoding of paintings written by Paint: raw (default), quantized (16 bit, lossy) or compressed (lossless).", cxxopts::value<std::string>())
+    ("painting_memory", "Optional, with mode All. Keep paintings in memory up to this many GB per chunk instead of writing them to disk; windows beyond that are written to disk.", cxxopts::value<float>())
     ("sample_ages", "Optional. Filename of file containing sample ages (one per line).", cxxopts::value<std::string>()) 
     ("chunk_index", "Optional. Index of chunk. (Use when running parts of the algorithm on an individual chunk.)", cxxopts::value<int>())
     ("first_section", "Optional. Index of first section to infer. (Use when running parts of algorithm on an individual chunk.)", cxxopts::value<int>())
@@ -38,7 +61,11 @@ int main(int argc, char* argv[]){
 		("transversion", "Only use transversion for bl estimation.")
     ("i,input", "Filename of input.", cxxopts::value<std::string>())
 		("painting", "Optional. Copying and transition parameters in chromosome painting algorithm. Format: theta,rho. Default: 0.025,1.", cxxopts::value<std::string>())
-    ("seed", "Optional. Seed for MCMC in branch lengths estimation.", cxxopts::value<int>());
+    ("trees", "Optional, with modes Finalize and All. Also write the output as a tree sequence in tskit format (output.trees).")
+    ("threads", "Optional. Number of threads used to write the tree sequence. Default: 1, 0 uses all hardware threads.", cxxopts::value<int>())
+    ("seed", "Optional. Seed for MCMC in branch lengths estimation.", cxxopts::value<int>())
+    ("warm_start", "Optional. Start the branch length MCMC of each tree from the ages of clades shared with the previous tree. Constant population size without sample ages only.")
+    ("num_chains", "Optional. Number of branch length MCMC chains per tree. With more than one, chains run until their root ages and total branch lengths agree (R-hat < 1.1). Constant population size without sample ages only. Default: 1.", cxxopts::value<int>());
 
   auto result = options.parse(argc, argv);
   auto help_text = options.help({""});
@@ -68,7 +95,7 @@ int main(int argc, char* argv[]){
     bool help = false;
     if(!result.count("chunk_index") || !result.count("output")){
       std::cout << "Not enough arguments supplied." << std::endl;
-      std::cout << "Needed: chunk_index, output." << std::endl; 
+      std::cout << "Needed: chunk_index, output. Optional: painting, painting_format." << std::endl; 
       help = true;
     }
     if(result.count("help") || help){
@@ -86,7 +113,7 @@ int main(int argc, char* argv[]){
     if(!result.count("chunk_index") || !result.count("output")){
       std::cout << "Not enough arguments supplied." << std::endl;
       //std::cout << "Needed: chunk_index, output. Optional: first_section, last_section, anc_allele_unknown, seed." << std::endl;
-      std::cout << "Needed: chunk_index, output. Optional: first_section, last_section, seed." << std::endl; 
+      std::cout << "Needed: chunk_index, output. Optional: first_section, last_section, seed, warm_start, num_chains." << std::endl; 
       help = true;
     }
     if(result.count("help") || help){
@@ -147,7 +174,8 @@ int main(int argc, char* argv[]){
       const std::string *coal = result.count("coal") ? &result["coal"].as<std::string>() : NULL;
       const std::string *sample_ages = result.count("sample_ages") ? &result["sample_ages"].as<std::string>() : NULL;
       const int *seed = result.count("seed") ? &result["seed"].as<int>() : NULL;
-      GetBranchLengths(result["output"].as<std::string>(), result["chunk_index"].as<int>(), first_section, last_section, result["mutation_rate"].as<double>(), effectiveN, sample_ages, coal, seed);
+      int num_chains = result.count("num_chains") ? result["num_chains"].as<int>() : 1;
+      GetBranchLengths(result["output"].as<std::string>(), result["chunk_index"].as<int>(), first_section, last_section, result["mutation_rate"].as<double>(), effectiveN, sample_ages, coal, seed, result.count("warm_start") > 0, num_chains);
 
     }else{
     
@@ -164,7 +192,8 @@ int main(int argc, char* argv[]){
       const std::string *coal = result.count("coal") ? &result["coal"].as<std::string>() : NULL;
       const std::string *sample_ages = result.count("sample_ages") ? &result["sample_ages"].as<std::string>() : NULL;
       const int *seed = result.count("seed") ? &result["seed"].as<int>() : NULL;
-      GetBranchLengths(result["output"].as<std::string>(), result["chunk_index"].as<int>(), 0, num_sections-1, result["mutation_rate"].as<double>(), effectiveN, sample_ages, coal, seed);
+      int num_chains = result.count("num_chains") ? result["num_chains"].as<int>() : 1;
+      GetBranchLengths(result["output"].as<std::string>(), result["chunk_index"].as<int>(), 0, num_sections-1, result["mutation_rate"].as<double>(), effectiveN, sample_ages, coal, seed, result.count("warm_start") > 0, num_chains);
     }
 
   }else if(!mode.compare("CombineSections")){
@@ -180,6 +209,7 @@ int main(int argc, char* argv[]){
     const std::string *sample_ages = result.count("sample_ages") ? &result["sample_ages"].as<std::string>() : NULL;
     const std::string *annot = result.count("annot") ? &result["annot"].as<std::string>() : NULL;
     Finalize(result["output"].as<std::string>(), sample_ages, annot);
+    if(result.count("trees")) WriteTreeSequence(result, result["output"].as<std::string>());
   }else if(!mode.compare("Clean")){
   
     Clean(result, help_text);
@@ -189,10 +219,10 @@ int main(int argc, char* argv[]){
     bool popsize = false;
     if(!result.count("effectiveN") && !result.count("coal")) popsize = true;
     bool help = false;
-    if(!result.count("haps") || !result.count("sample") ||  !result.count("map") || popsize || !result.count("mutation_rate") || !result.count("output")){
+    if(((!result.count("haps") || !result.count("sample")) && !result.count("vcf")) ||  !result.count("map") || popsize || !result.count("mutation_rate") || !result.count("output")){
       std::cout << "Not enough arguments supplied." << std::endl;
       //std::cout << "Needed: haps, sample, map, mutation_rate, effectiveN, output. Optional: seed, annot, dist, coal, max_memory, sample_ages, chunk_index, anc_allele_unknown." << std::endl;
-      std::cout << "Needed: haps, sample, map, mutation_rate, effectiveN, output. Optional: seed, annot, dist, coal, max_memory, sample_ages, chunk_index." << std::endl;
+      std::cout << "Needed: haps, sample (or vcf), map, mutation_rate, effectiveN, output. Optional: seed, annot, dist, coal, max_memory, painting_memory, painting_format, trees, threads, warm_start, num_chains, sample_ages, chunk_index, remove_ids, ancestor, mask." << std::endl;
       help = true;
     }
     if(result.count("help") || help){
@@ -230,8 +260,12 @@ int main(int argc, char* argv[]){
 
       std::cerr << "---------------------------------------------------------" << std::endl;
       std::cerr << "Using:" << std::endl;
-      std::cerr << "  " << result["haps"].as<std::string>() << std::endl;    
-      std::cerr << "  " << result["sample"].as<std::string>() << std::endl;
+      if(result.count("vcf")){
+        std::cerr << "  " << result["vcf"].as<std::string>() << std::endl;
+      }else{
+        std::cerr << "  " << result["haps"].as<std::string>() << std::endl;    
+        std::cerr << "  " << result["sample"].as<std::string>() << std::endl;
+      }
       std::cerr << "  " << result["map"].as<std::string>() << std::endl;
       if(!result.count("coal")){
         std::cerr << "with mu = " << result["mutation_rate"].as<float>() << " and 2Ne = " << result["effectiveN"].as<float>() << "." << std::endl;
@@ -279,14 +313,21 @@ int main(int argc, char* argv[]){
       fclose(fp);
       num_sections--;
 
-      Paint(result, c);
-      BuildTopology(result, c, 0, num_sections-1);
+      if(result.count("painting_memory")){
+        PaintingBuffer painting(N, num_sections, result["painting_memory"].as<float>());
+        Paint(result, c, &painting);
+        BuildTopology(result, c, 0, num_sections-1, &painting);
+      }else{
+        Paint(result, c);
+        BuildTopology(result, c, 0, num_sections-1);
+      }
       FindEquivalentBranches(result["output"].as<std::string>(), c);
       const double *effectiveN = result.count("effectiveN") ? &result["effectiveN"].as<double>() : NULL;
       const std::string *coal = result.count("coal") ? &result["coal"].as<std::string>() : NULL;
       const std::string *sample_ages = result.count("sample_ages") ? &result["sample_ages"].as<std::string>() : NULL;
       const int *seed = result.count("seed") ? &result["seed"].as<int>() : NULL;
-      GetBranchLengths(result["output"].as<std::string>(), result["chunk_index"].as<int>(), 0, num_sections-1, result["mutation_rate"].as<double>(), effectiveN, sample_ages, coal, seed);
+      int num_chains = result.count("num_chains") ? result["num_chains"].as<int>() : 1;
+      GetBranchLengths(result["output"].as<std::string>(), result["chunk_index"].as<int>(), 0, num_sections-1, result["mutation_rate"].as<double>(), effectiveN, sample_ages, coal, seed, result.count("warm_start") > 0, num_chains);
       CombineSections(result["output"].as<std::string>(), c, *effectiveN);
 
     }
@@ -295,6 +336,7 @@ int main(int argc, char* argv[]){
       const std::string *sample_ages = result.count("sample_ages") ? &result["sample_ages"].as<std::string>() : NULL;
       const std::string *annot = result.count("annot") ? &result["annot"].as<std::string>() : NULL;
       Finalize(result["output"].as<std::string>(), sample_ages, annot);
+      if(result.count("trees")) WriteTreeSequence(result, result["output"].as<std::string>());
     }
 
     std::cerr << "---------------------------------------------------------" << std::endl;
@@ -523,6 +523,28 @@ Tree::FindLeaves(Node& node, std::vector<Leaves>& leaves) const{
 
 }
 
+//The hash of a leaf is a mix of its label, the hash of an internal node is the sum of the hashes of its children.
+uint64_t
+Tree::TraverseTreeToGetCladeHashes(const Node& n, std::vector<uint64_t>& clade_hash) const{
+
+  if(n.child_left != NULL){
+    clade_hash[n.label] = TraverseTreeToGetCladeHashes(*n.child_left, clade_hash) + TraverseTreeToGetCladeHashes(*n.child_right, clade_hash);
+  }else{
+    uint64_t z = (n.label + 1) * 0x9e3779b97f4a7c15ULL;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    clade_hash[n.label] = z ^ (z >> 31);
+  }
+  return clade_hash[n.label];
+
+}
+
+void
+Tree::GetCladeHashes(std::vector<uint64_t>& clade_hash) const{
+  clade_hash.resize(nodes.size());
+  TraverseTreeToGetCladeHashes(nodes[nodes.size() - 1], clade_hash);
+}
+
 void
 Tree::TraverseTreeToGetCoordinates(Node& n, std::vector<float>& coordinates){
 
@@ -583,91 +605,80 @@ Tree::GetCoordinates(int node, std::vector<float>& coordinates){
 /////////////////////////////////
 
 void
-Tree::GetNumberOfLeavesInSubpop(const Node& n, std::vector<int>& subpop, std::vector<int>& number_in_subpop) const{
-
-  if(n.child_left != NULL){
+Tree::GetSubTree(Sample& sample, Tree& subtree) const{
 
-    GetNumberOfLeavesInSubpop((*n.child_left), subpop, number_in_subpop);
-    GetNumberOfLeavesInSubpop((*n.child_right), subpop, number_in_subpop);
-    number_in_subpop[n.label] = number_in_subpop[(*n.child_left).label] + number_in_subpop[(*n.child_right).label];
+  SubTreeExtractor extractor(sample);
+  extractor.Extract(*this, subtree);
 
-  }else{
+}
 
-    for(std::vector<int>::iterator it_subpop = subpop.begin(); it_subpop != subpop.end(); it_subpop++){
-      if(*it_subpop == n.label){
-        number_in_subpop[*it_subpop] = 1;
-        break;
-      }
-    }
+void
+Tree::GetSubTree(Sample& sample, Tree& subtree,  std::vector<int>& convert_index, std::vector<int>& number_in_subpop) const{
 
-  }
+  SubTreeExtractor extractor(sample);
+  extractor.Extract(*this, subtree);
+  convert_index.swap(extractor.convert_index);
+  number_in_subpop.swap(extractor.number_in_subpop);
 
 }
 
-void
-Tree::GetSubTree(Sample& sample, Tree& subtree) const{
+/////////////////////////////////
+
+SubTreeExtractor::SubTreeExtractor(Sample& sample){
 
-  std::vector<int> subpop;
+  int N = sample.group_of_haplotype.size();
+  is_in_subpop.resize(N, 0);
+
+  std::vector<char> is_group_of_interest(sample.groups.size(), 0);
+  for(std::vector<int>::iterator it_group_of_interest = sample.group_of_interest.begin(); it_group_of_interest != sample.group_of_interest.end(); it_group_of_interest++){
+    is_group_of_interest[*it_group_of_interest] = 1;
+  }
 
   int hap = 0;
   for(std::vector<int>::iterator it_group_of_haplotype = sample.group_of_haplotype.begin(); it_group_of_haplotype != sample.group_of_haplotype.end(); it_group_of_haplotype++){
-    bool exists = false;
-    for(std::vector<int>::iterator it_group_of_interest = sample.group_of_interest.begin(); it_group_of_interest != sample.group_of_interest.end(); it_group_of_interest++){
-      if(*it_group_of_haplotype == *it_group_of_interest){
-        exists = true;
-        break;
-      }
-    }
-    if(exists){
+    if(is_group_of_interest[*it_group_of_haplotype]){
       subpop.push_back(hap);
+      is_in_subpop[hap] = 1;
     }
     hap++;
   }
 
-  std::vector<int> convert_index, number_in_subpop;
-  GetSubTree(subpop, subtree, convert_index, number_in_subpop);
-
 }
 
-void
-Tree::GetSubTree(Sample& sample, Tree& subtree,  std::vector<int>& convert_index, std::vector<int>& number_in_subpop) const{
+SubTreeExtractor::SubTreeExtractor(const std::vector<int>& subpop, int N): subpop(subpop){
 
-  std::vector<int> subpop;
-
-  int hap = 0;
-  for(std::vector<int>::iterator it_group_of_haplotype = sample.group_of_haplotype.begin(); it_group_of_haplotype != sample.group_of_haplotype.end(); it_group_of_haplotype++){
-    bool exists = false;
-    for(std::vector<int>::iterator it_group_of_interest = sample.group_of_interest.begin(); it_group_of_interest != sample.group_of_interest.end(); it_group_of_interest++){
-      if(*it_group_of_haplotype == *it_group_of_interest){
-        exists = true;
-        break;
-      }
-    }
-    if(exists){
-      subpop.push_back(hap);
-    }
-    hap++;
+  is_in_subpop.resize(N, 0);
+  for(std::vector<int>::const_iterator it_subpop = subpop.begin(); it_subpop != subpop.end(); it_subpop++){
+    is_in_subpop[*it_subpop] = 1;
   }
 
-  GetSubTree(subpop, subtree, convert_index, number_in_subpop);
-
 }
 
 void
-Tree::GetSubTree(std::vector<int>& subpop, Tree& subtree, std::vector<int>& convert_index, std::vector<int>& number_in_subpop) const{
+SubTreeExtractor::Extract(const Tree& tree, Tree& subtree){
+
+  int N_total = tree.nodes.size();
+  int N       = (N_total + 1)/2;
+  assert((int) is_in_subpop.size() == N);
 
-  convert_index.resize(nodes.size(), -1);
+  convert_index.resize(N_total);
   std::fill(convert_index.begin(), convert_index.end(), -1);
 
   //for each node, calculate the number of leaves in subpop below it
-  number_in_subpop.resize(nodes.size(), 0.0);
-  std::fill(number_in_subpop.begin(), number_in_subpop.end(), 0.0);
-  GetNumberOfLeavesInSubpop(*std::prev(nodes.end(),1), subpop, number_in_subpop);
+  //(nodes are visited in order of labels, which relies on children having smaller labels than their parents)
+  number_in_subpop.resize(N_total);
+  for(int i = 0; i < N; i++){
+    number_in_subpop[i] = is_in_subpop[i];
+  }
+  for(int i = N; i < N_total; i++){
+    assert((*tree.nodes[i].child_left).label < i && (*tree.nodes[i].child_right).label < i);
+    number_in_subpop[i] = number_in_subpop[(*tree.nodes[i].child_left).label] + number_in_subpop[(*tree.nodes[i].child_right).label];
+  }
 
-  if(subpop.size() >= (int)(nodes.size() + 1.0)/2.0){
+  if((int) subpop.size() >= N){
 
-    subtree = *this;
-    for(int i = 0; i < (int)nodes.size(); i++){
+    subtree = tree;
+    for(int i = 0; i < N_total; i++){
       convert_index[i] = i;
     }
 
@@ -676,22 +687,22 @@ Tree::GetSubTree(std::vector<int>& subpop, Tree& subtree, std::vector<int>& conv
     int node = 0;
     subtree.nodes.resize(2*subpop.size() - 1);
 
-    for(node = 0; node < subpop.size(); node++){
-      subtree.nodes[node] = nodes[subpop[node]];
+    for(node = 0; node < (int) subpop.size(); node++){
+      subtree.nodes[node] = tree.nodes[subpop[node]];
       subtree.nodes[node].label = node;
       convert_index[subpop[node]] = node;
     }
 
-    for(int i = (int)(nodes.size() + 1.0)/2.0; i < (int) nodes.size(); i++){
+    for(int i = N; i < N_total; i++){
 
-      int child_left  = (*nodes[i].child_left).label;
-      int child_right = (*nodes[i].child_right).label;
+      int child_left  = (*tree.nodes[i].child_left).label;
+      int child_right = (*tree.nodes[i].child_right).label;
 
       if(number_in_subpop[child_left] > 0 && number_in_subpop[child_right] > 0){
 
         assert(convert_index[child_left] != -1);
         assert(convert_index[child_right] != -1);
-        subtree.nodes[node] = nodes[i];
+        subtree.nodes[node] = tree.nodes[i];
         //connect to children.
         subtree.nodes[node].label       = node;
         subtree.nodes[node].child_left  = &subtree.nodes[convert_index[child_left]];
@@ -699,30 +710,22 @@ Tree::GetSubTree(std::vector<int>& subpop, Tree& subtree, std::vector<int>& conv
         subtree.nodes[convert_index[child_left]].parent  = &subtree.nodes[node];
         subtree.nodes[convert_index[child_right]].parent = &subtree.nodes[node];
 
-        convert_index[i]    = node;
-        assert(number_in_subpop[i] > 0);
+        convert_index[i] = node;
         node++;
 
       }else if(number_in_subpop[child_left] > 0){
 
         assert(convert_index[child_left] != -1);
         convert_index[i]                               = convert_index[child_left];
-        subtree.nodes[convert_index[i]].branch_length += nodes[i].branch_length;
-        subtree.nodes[convert_index[i]].num_events    += nodes[i].num_events;
-        assert(number_in_subpop[i] > 0);
+        subtree.nodes[convert_index[i]].branch_length += tree.nodes[i].branch_length;
+        subtree.nodes[convert_index[i]].num_events    += tree.nodes[i].num_events;
 
       }else if(number_in_subpop[child_right] > 0){
 
         assert(convert_index[child_right] != -1);
         convert_index[i]                               = convert_index[child_right];
-        subtree.nodes[convert_index[i]].branch_length += nodes[i].branch_length;
-        subtree.nodes[convert_index[i]].num_events    += nodes[i].num_events;
-        assert(number_in_subpop[i] > 0);
-
-      }else{
-
-        assert(convert_index[i] == -1);
-        assert(number_in_subpop[i] == 0);
+        subtree.nodes[convert_index[i]].branch_length += tree.nodes[i].branch_length;
+        subtree.nodes[convert_index[i]].num_events    += tree.nodes[i].num_events;
 
       }
 
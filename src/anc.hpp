@@ -6,6 +6,7 @@
 ///////////////////////////
 
 #include <list>
+#include <cstdint>
 #include <gzstream.h>
 
 #include "data.hpp"
@@ -68,7 +69,7 @@ class Tree{
 
     void TraverseTreeToGetCoordinates(Node& n, std::vector<float>& coordinates);
     void TraverseTreeToGetCoordinates_sample_age(Node& n, std::vector<float>& coordinates);
-    void GetSubTree(std::vector<int>& subpop, Tree& subtree, std::vector<int>& convert_index, std::vector<int>& number_in_subpop) const;
+    uint64_t TraverseTreeToGetCladeHashes(const Node& n, std::vector<uint64_t>& clade_hash) const;
 
   public:
 
@@ -129,11 +130,11 @@ class Tree{
 
     void FindAllLeaves(std::vector<Leaves>& leaves) const;
     void FindLeaves(Node& node, std::vector<Leaves>& leaves) const; //recursive algorithm to find leaves. stored in leaves.
+    void GetCladeHashes(std::vector<uint64_t>& clade_hash) const; //nodes with identical sets of leaves have identical hashes (in any tree with the same tips)
 
     void GetCoordinates(std::vector<float>& coordinates);
     void GetCoordinates(int node, std::vector<float>& coordinates);
 
-    void GetNumberOfLeavesInSubpop(const Node& n, std::vector<int>& subpop, std::vector<int>& number_in_subpop) const; 
     void GetSubTree(Sample& sample, Tree& subtree) const;
     void GetSubTree(Sample& sample, Tree& subtree, std::vector<int>& convert_index, std::vector<int>& number_in_subpop) const;
 
@@ -156,6 +157,32 @@ class Tree{
 
 };
 
+//Extracts the subtrees of a subpopulation from trees with the same number of tips.
+//Membership of haplotypes is determined once and buffers are reused between trees,
+//so that Extract is a single pass over the nodes (assumes children have smaller labels than parents).
+class SubTreeExtractor{
+
+  private:
+
+    std::vector<int> subpop;
+    std::vector<char> is_in_subpop;
+
+  public:
+
+    //convert_index[i] is the node of the subtree corresponding to node i (-1 if there is none),
+    //number_in_subpop[i] is the number of leaves below node i that are in the subpopulation.
+    std::vector<int> convert_index;
+    std::vector<int> number_in_subpop;
+
+    SubTreeExtractor(){};
+    SubTreeExtractor(Sample& sample);
+    SubTreeExtractor(const std::vector<int>& subpop, int N);
+
+    int NumTips() const{ return subpop.size(); }
+    void Extract(const Tree& tree, Tree& subtree);
+
+};
+
 //Data Structure for a mancinal tree along the genome
 struct MarginalTree{
   int pos;
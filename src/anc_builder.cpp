@@ -60,7 +60,12 @@ DistanceMeasure::GetTopologyWithRepaint(const int snp){
 
   char filename[1024];
   snprintf(filename, sizeof(char) * 1024, "%s_%i.bin", (*data).name.c_str(), section);
-  FILE* pFile = fopen(filename, "rb");
+  FILE* pFile;
+  if((*data).painting != NULL){
+    pFile = (*data).painting -> OpenRead(section, filename);
+  }else{
+    pFile = fopen(filename, "rb");
+  }
   assert(pFile != NULL);
   for(int n = 0; n < N; n++){
     fread(&section_startpos, sizeof(int), 1, pFile);
@@ -74,6 +79,7 @@ DistanceMeasure::GetTopologyWithRepaint(const int snp){
     //Repaint into top and log
     painter.RePaintSection(*data, top[n], log[n], alpha_begin, beta_end, boundarySNP_begin, boundarySNP_end, logscale_alpha, logscale_beta, n);
   }
+  fclose(pFile);
 
   topology  = &top; 
   logscales = &log;
@@ -31,6 +31,11 @@ EstimateBranchLengthsWithSampleAge::EstimateBranchLengthsWithSampleAge(const Dat
   coordinates.resize(N_total);
   sorted_indices.resize(N_total); //node indices in order of coalescent events
   order.resize(N_total); //order of coalescent events
+
+  //workspace that does not depend on the tree, so that the same object can be reused for all trees
+  mut_rate.resize(N_total);
+  last_update.resize(N_total);
+  count_proposals.resize(N_total - N);
 };
 
 //MCMC
@@ -190,7 +195,6 @@ EstimateBranchLengthsWithSampleAge::InitializeOrder(Tree& tree){
 void
 EstimateBranchLengthsWithSampleAge::InitializeMCMC(const Data& data, Tree& tree){
 
-  mut_rate.resize(N_total);
   for(int i = 0; i < N_total; i++){
     int snp_begin = tree.nodes[i].SNP_begin;
     int snp_end   = tree.nodes[i].SNP_end;
@@ -276,6 +280,24 @@ EstimateBranchLengthsWithSampleAge::UpdateAvg(Tree& tree){
 
 }
 
+//Checks that branch lengths are non-negative and that coordinates, order and sorted_indices agree with the tree.
+//This is O(N), so the MCMC only calls it once every delta proposals.
+void
+EstimateBranchLengthsWithSampleAge::CheckState(Tree& tree){
+
+  for(int i = 0; i < N_total-1; i++){
+    assert(tree.nodes[i].branch_length >= 0.0);
+    assert(order[sorted_indices[i]] == i);
+    assert(order[i] < order[(*tree.nodes[i].parent).label]);
+    assert(coordinates[sorted_indices[i]] <= coordinates[sorted_indices[i+1]]);
+  }
+  for(int k = N; k < N_total; k++){
+    assert(coordinates[k] >= coordinates[(*tree.nodes[k].child_left).label]);
+    assert(coordinates[k] >= coordinates[(*tree.nodes[k].child_right).label]);
+  }
+
+}
+
 float
 EstimateBranchLengthsWithSampleAge::log_deltat(float t){
   if(t >= 0){
@@ -1352,130 +1374,12 @@ EstimateBranchLengthsWithSampleAge::CalculatePrior(int k_start, int k_end, std::
 }
 
 double
-EstimateBranchLengthsWithSampleAge::CalculatePrior(const std::vector<double>& epoch, const std::vector<double>& coal_rate, std::vector<double>& p_coordinates, std::vector<int>& p_sorted_indices, std::vector<int>& p_num_lineages){
-
-  double log_likelihood = 0.0;
-  int ep     = 0; 
-  int k_tmp  = 0;
-  int node   = p_sorted_indices[k_tmp];
-  double age = p_coordinates[node];
-  if(node < N){
-    assert(age == sample_age[node]);
-    while(p_sorted_indices[k_tmp] < N){ 
-      k_tmp++;
-      if(p_sorted_indices[k_tmp] < N){
-        if(sample_age[p_sorted_indices[k_tmp]] != age) break;
-      }
-    }
-    k_tmp--;
-  }
-
-  double lower_coord = p_coordinates[p_sorted_indices[k_tmp]], tmp_tau, delta_tmp_tau;
-  int num_lineages_tmp = p_num_lineages[p_sorted_indices[k_tmp]], k_choose_2_tmp;
-  bool is_sample = false;
-
-  while(k_tmp < 2*N-2){
-
-    k_choose_2_tmp   = (num_lineages_tmp * (num_lineages_tmp - 1.0))/2.0;
-    assert(num_lineages_tmp >= 1);
-
-    k_tmp++;
-    is_sample = false;
-    if(p_sorted_indices[k_tmp] < N){
-      age = sample_age[p_sorted_indices[k_tmp]];
-      if(p_sorted_indices[k_tmp-1] < N) assert(age > p_coordinates[p_sorted_indices[k_tmp-1]]);
-      while(p_sorted_indices[k_tmp] < N){ 
-        k_tmp++;
-        if(p_sorted_indices[k_tmp] < N){
-          if(sample_age[p_sorted_indices[k_tmp]] != age) break;
-        }
-      }
-      k_tmp--;
-      is_sample = true;
-    }
-    num_lineages_tmp = p_num_lineages[p_sorted_indices[k_tmp]];
-
-    if(ep < epoch.size() - 1){
-
-      assert(p_coordinates[p_sorted_indices[k_tmp-1]] >= epoch[ep]);
-      if(is_sample == true){
-        tmp_tau = p_coordinates[p_sorted_indices[k_tmp]] - lower_coord;
-        //tmp_tau is difference to sample age
-        delta_tmp_tau = epoch[ep+1] - lower_coord;
-        lower_coord   = p_coordinates[p_sorted_indices[k_tmp]];
-        assert(tmp_tau >= 0.0);
-      }else{
-        tmp_tau       = p_coordinates[p_sorted_indices[k_tmp]] - lower_coord;
-        delta_tmp_tau = epoch[ep+1] - lower_coord;
-        lower_coord   = p_coordinates[p_sorted_indices[k_tmp]];
-      }
-      assert(delta_tmp_tau >= 0.0);
-      //if epoch[ep+1] begins before the current interval (while num_lineages_tmp remain) ends, enter if statement
-      if(delta_tmp_tau <= tmp_tau){
-        //add up rate parameters for this interval
-        if(coal_rate[ep] > 0.0){
-          log_likelihood -= k_choose_2_tmp*coal_rate[ep] * delta_tmp_tau; 
-        }
-        tmp_tau                -= delta_tmp_tau;
-
-        ep++;
-        delta_tmp_tau           = epoch[ep+1] - epoch[ep];
-        while(tmp_tau > delta_tmp_tau && ep < epoch.size() - 1){
-          if(coal_rate[ep] > 0.0){
-            log_likelihood -= k_choose_2_tmp*coal_rate[ep] * delta_tmp_tau; 
-          }
-          tmp_tau              -= delta_tmp_tau;
-
-          ep++;
-          delta_tmp_tau         = epoch[ep+1] - epoch[ep];
-        }
-        assert(tmp_tau >= 0.0);
-        if(coal_rate[ep] == 0){
-          log_likelihood  = -std::numeric_limits<float>::infinity();
-        }else{
-          log_likelihood -= k_choose_2_tmp*coal_rate[ep] * tmp_tau;
-          if(!is_sample) log_likelihood += log(coal_rate[ep]);
-        }
-
-      }else{
-        if(coal_rate[ep] == 0){
-          log_likelihood = -std::numeric_limits<float>::infinity();
-        }else{
-          log_likelihood -= k_choose_2_tmp*coal_rate[ep] * tmp_tau;
-          if(!is_sample) log_likelihood += log(coal_rate[ep]);
-        }
-      }
-
-    }else{
-
-      if(coal_rate[ep] == 0){
-        log_likelihood = -std::numeric_limits<float>::infinity();
-      }else{
-
-        assert(p_coordinates[p_sorted_indices[k_tmp-1]] >= epoch[ep]);
-        if(is_sample == true){
-          tmp_tau = p_coordinates[p_sorted_indices[k_tmp]] - lower_coord;
-          lower_coord   = p_coordinates[p_sorted_indices[k_tmp]];
-          assert(tmp_tau >= 0.0);
-        }else{
-          tmp_tau       = p_coordinates[p_sorted_indices[k_tmp]] - lower_coord;
-          delta_tmp_tau = epoch[ep+1] - lower_coord;
-          lower_coord   = p_coordinates[p_sorted_indices[k_tmp]];
-        }
-
-        log_likelihood -= k_choose_2_tmp * coal_rate[ep] * tmp_tau;
-        if(!is_sample) log_likelihood += log(coal_rate[ep]);
-
-      }
-    }
-  }
-
-  return(log_likelihood);
-
+EstimateBranchLengthsWithSampleAge::CalculatePrior(const CoalescentRateProfile& profile, std::vector<double>& p_coordinates, std::vector<int>& p_sorted_indices, std::vector<int>& p_num_lineages){
+  return CalculatePrior(0, 2*N-2, profile, p_coordinates, p_sorted_indices, p_num_lineages);
 }
 
 double
-EstimateBranchLengthsWithSampleAge::CalculatePrior(int k_start, int k_end, const std::vector<double>& epoch, const std::vector<double>& coal_rate, std::vector<double>& p_coordinates, std::vector<int>& p_sorted_indices, std::vector<int>& p_num_lineages){
+EstimateBranchLengthsWithSampleAge::CalculatePrior(int k_start, int k_end, const CoalescentRateProfile& profile, std::vector<double>& p_coordinates, std::vector<int>& p_sorted_indices, std::vector<int>& p_num_lineages){
 
   double log_likelihood = 0.0;
   int k_tmp  = k_start;
@@ -1492,18 +1396,9 @@ EstimateBranchLengthsWithSampleAge::CalculatePrior(int k_start, int k_end, const
     k_tmp--;
   }
 
-  //coalescent prior  
-  int ep = 0;
-  while(p_coordinates[p_sorted_indices[k_tmp]] >= epoch[ep]){
-    ep++;
-    if(ep == (int)epoch.size()) break;
-  }
-  ep--;
-  assert(ep > -1);
-  assert(p_coordinates[p_sorted_indices[k_tmp]] >= epoch[ep]);
-  //std::cerr << ep << " " << epoch[ep] << " " << k_tmp << " " << p_sorted_indices[k_tmp] << " " << p_coordinates[p_sorted_indices[k_tmp]] << " " << p_coordinates[p_sorted_indices[k_tmp + 1]] << std::endl;
-
-  double lower_coord = p_coordinates[p_sorted_indices[k_tmp]], tmp_tau, delta_tmp_tau;
+  //coalescent prior, each interval contributes -k_choose_2 * (integral of coalescence rate), and the log coalescence rate at its end if it ends in a coalescence
+  double lower_coord = p_coordinates[p_sorted_indices[k_tmp]], upper_coord;
+  double hazard_lower = profile.CumulativeHazard(lower_coord), hazard_upper, log_rate;
   int num_lineages_tmp = p_num_lineages[p_sorted_indices[k_tmp]], k_choose_2_tmp;
   bool is_sample = false;
 
@@ -1529,79 +1424,17 @@ EstimateBranchLengthsWithSampleAge::CalculatePrior(int k_start, int k_end, const
     }
     num_lineages_tmp = p_num_lineages[p_sorted_indices[k_tmp]];
 
-    if(ep < epoch.size() - 1){
-
-      assert(p_coordinates[p_sorted_indices[k_tmp-1]] >= epoch[ep]);
-      if(is_sample == true){
-        tmp_tau = p_coordinates[p_sorted_indices[k_tmp]] - lower_coord;
-        //tmp_tau is difference to sample age
-        delta_tmp_tau = epoch[ep+1] - lower_coord;
-        lower_coord   = p_coordinates[p_sorted_indices[k_tmp]];
-        assert(tmp_tau >= 0.0);
-      }else{
-        tmp_tau       = p_coordinates[p_sorted_indices[k_tmp]] - lower_coord;
-        delta_tmp_tau = epoch[ep+1] - lower_coord;
-        lower_coord   = p_coordinates[p_sorted_indices[k_tmp]];
-      }
-      assert(delta_tmp_tau >= 0.0);
-      //if epoch[ep+1] begins before the current interval (while num_lineages_tmp remain) ends, enter if statement
-      if(delta_tmp_tau <= tmp_tau){
-        //add up rate parameters for this interval
-        if(coal_rate[ep] > 0.0){
-          log_likelihood   -= k_choose_2_tmp*coal_rate[ep] * delta_tmp_tau; 
-        }
-        tmp_tau                -= delta_tmp_tau;
-
-        ep++;
-        delta_tmp_tau           = epoch[ep+1] - epoch[ep];
-        while(tmp_tau > delta_tmp_tau && ep < epoch.size() - 1){
-          if(coal_rate[ep] > 0.0){
-            log_likelihood -= k_choose_2_tmp*coal_rate[ep] * delta_tmp_tau; 
-          }
-          tmp_tau              -= delta_tmp_tau;
-
-          ep++;
-          delta_tmp_tau         = epoch[ep+1] - epoch[ep];
-        }
-        assert(tmp_tau >= 0.0);
-        if(coal_rate[ep] == 0){
-          log_likelihood  = -std::numeric_limits<float>::infinity();
-        }else{
-          log_likelihood  -= k_choose_2_tmp*coal_rate[ep] * tmp_tau;
-          if(!is_sample) log_likelihood += log(coal_rate[ep]);
-        }
-
-      }else{
-        if(coal_rate[ep] == 0){
-          log_likelihood = -std::numeric_limits<float>::infinity();
-        }else{
-          log_likelihood  -= k_choose_2_tmp*coal_rate[ep] * tmp_tau;
-          if(!is_sample) log_likelihood += log(coal_rate[ep]);
-        }
-      }
-
-    }else{
-
-      if(coal_rate[ep] == 0){
-        log_likelihood = -std::numeric_limits<float>::infinity();
-      }else{
-
-        assert(p_coordinates[p_sorted_indices[k_tmp-1]] >= epoch[ep]);
-        if(is_sample == true){
-          tmp_tau = p_coordinates[p_sorted_indices[k_tmp]] - lower_coord;
-          lower_coord   = p_coordinates[p_sorted_indices[k_tmp]];
-          assert(tmp_tau >= 0.0);
-        }else{
-          tmp_tau       = p_coordinates[p_sorted_indices[k_tmp]] - lower_coord;
-          delta_tmp_tau = epoch[ep+1] - lower_coord;
-          lower_coord   = p_coordinates[p_sorted_indices[k_tmp]];
-        }
-
-        log_likelihood -= k_choose_2_tmp * coal_rate[ep] * tmp_tau;
-        if(!is_sample) log_likelihood += log(coal_rate[ep]);
-
-      }
+    upper_coord  = p_coordinates[p_sorted_indices[k_tmp]];
+    assert(upper_coord >= lower_coord);
+    hazard_upper = profile.CumulativeHazard(upper_coord, log_rate);
+    if(log_rate == -std::numeric_limits<double>::infinity()){
+      return -std::numeric_limits<float>::infinity();
     }
+    log_likelihood -= k_choose_2_tmp * (hazard_upper - hazard_lower);
+    if(!is_sample) log_likelihood += log_rate;
+
+    lower_coord  = upper_coord;
+    hazard_lower = hazard_upper;
   }
 
   return(log_likelihood);
@@ -2212,7 +2045,7 @@ EstimateBranchLengthsWithSampleAge::UpdateOneEvent(Tree& tree, int node_k, std::
 ///////////////////// variable NE //////////////////////
 //propose a new time and change events only up to t+bound
 void
-EstimateBranchLengthsWithSampleAge::ChangeTimeWhilekAncestorsVP_new(Tree& tree, int node, const std::vector<double>& epoch, const std::vector<double>& coal_rate, std::uniform_real_distribution<double>& dist_unif){
+EstimateBranchLengthsWithSampleAge::ChangeTimeWhilekAncestorsVP_new(Tree& tree, int node, const CoalescentRateProfile& profile, std::uniform_real_distribution<double>& dist_unif){
 
   //This step is O(N)
   int k = order[node];
@@ -2318,10 +2151,10 @@ EstimateBranchLengthsWithSampleAge::ChangeTimeWhilekAncestorsVP_new(Tree& tree,
     }
 
 
-    log_likelihood = CalculatePrior(epoch, coal_rate, coordinates_new, sorted_indices_new, num_lineages_new);
+    log_likelihood = CalculatePrior(profile, coordinates_new, sorted_indices_new, num_lineages_new);
     if(log_likelihood != -std::numeric_limits<float>::infinity()){
       log_likelihood_ratio += log_likelihood;
-      log_likelihood = CalculatePrior(epoch, coal_rate, coordinates, sorted_indices, num_lineages);
+      log_likelihood = CalculatePrior(profile, coordinates, sorted_indices, num_lineages);
       if(log_likelihood != -std::numeric_limits<float>::infinity()) log_likelihood_ratio -= log_likelihood;
     }
 
@@ -2444,7 +2277,7 @@ EstimateBranchLengthsWithSampleAge::ChangeTimeWhilekAncestorsVP_new(Tree& tree,
 
 //This changes the time of one event, with a beta proposal within the time while k ancestors remain
 void
-EstimateBranchLengthsWithSampleAge::UpdateOneEventVP(Tree& tree, int node_k, const std::vector<double>& epoch, const std::vector<double>& coal_rate, std::gamma_distribution<double>& dist_gamma, std::uniform_real_distribution<double>& dist_unif){
+EstimateBranchLengthsWithSampleAge::UpdateOneEventVP(Tree& tree, int node_k, const CoalescentRateProfile& profile, std::gamma_distribution<double>& dist_gamma, std::uniform_real_distribution<double>& dist_unif){
 
   accept = true;
   log_likelihood_ratio = 0.0;
@@ -2483,11 +2316,11 @@ EstimateBranchLengthsWithSampleAge::UpdateOneEventVP(Tree& tree, int node_k, con
     assert(order[node_k] == order.size() - 1);
     int k_end = order.size() - 1;
     int k_start = order.size() - 2;
-    double log_likelihood = CalculatePrior(k_start, k_end, epoch, coal_rate, coordinates, sorted_indices, num_lineages);
+    double log_likelihood = CalculatePrior(k_start, k_end, profile, coordinates, sorted_indices, num_lineages);
     coordinates[node_k] -= delta_tau;
     if(log_likelihood != -std::numeric_limits<float>::infinity()){
       //log_likelihood_ratio += log_likelihood;
-      log_likelihood -= CalculatePrior(k_start, k_end, epoch, coal_rate, coordinates, sorted_indices, num_lineages);
+      log_likelihood -= CalculatePrior(k_start, k_end, profile, coordinates, sorted_indices, num_lineages);
       if(log_likelihood != -std::numeric_limits<float>::infinity()) log_likelihood_ratio += log_likelihood;
     }
 
@@ -2664,11 +2497,11 @@ EstimateBranchLengthsWithSampleAge::UpdateOneEventVP(Tree& tree, int node_k, con
           }
 
           coordinates[node_k] = coords_new;
-          log_likelihood = CalculatePrior(k_start, k_end, epoch, coal_rate, coordinates, sorted_indices_new, num_lineages_new);
+          log_likelihood = CalculatePrior(k_start, k_end, profile, coordinates, sorted_indices_new, num_lineages_new);
           coordinates[node_k] = coords;
           if(log_likelihood != -std::numeric_limits<float>::infinity()){
             //log_likelihood_ratio += log_likelihood;
-            log_likelihood -= CalculatePrior(k_start, k_end, epoch, coal_rate, coordinates, sorted_indices, num_lineages);
+            log_likelihood -= CalculatePrior(k_start, k_end, profile, coordinates, sorted_indices, num_lineages);
             if(log_likelihood != -std::numeric_limits<float>::infinity()) log_likelihood_ratio += log_likelihood;
           }
         }else{
@@ -2713,11 +2546,11 @@ EstimateBranchLengthsWithSampleAge::UpdateOneEventVP(Tree& tree, int node_k, con
             }
           }
 
-          log_likelihood = CalculatePrior(epoch, coal_rate, coordinates, sorted_indices_new, num_lineages_new);
+          log_likelihood = CalculatePrior(profile, coordinates, sorted_indices_new, num_lineages_new);
           coordinates[node_k] = coords;
           if(log_likelihood != -std::numeric_limits<float>::infinity()){
             //log_likelihood_ratio += log_likelihood;
-            log_likelihood -= CalculatePrior(epoch, coal_rate, coordinates, sorted_indices, num_lineages);
+            log_likelihood -= CalculatePrior(profile, coordinates, sorted_indices, num_lineages);
             if(log_likelihood != -std::numeric_limits<float>::infinity()) log_likelihood_ratio += log_likelihood;
           } 
 
@@ -2884,9 +2717,7 @@ EstimateBranchLengthsWithSampleAge::MCMC(const Data& data, Tree& tree, const int
       SwitchOrder(tree, dist_n(rng), dist_unif);
     }      
 
-    for(int k = 0; k < N_total; k++){
-      assert(tree.nodes[k].branch_length >= 0.0);
-    }
+    if(count % delta == 0) CheckState(tree);
   }
 
   GetCoordinates(tree.nodes[root], coordinates);
@@ -2981,13 +2812,6 @@ EstimateBranchLengthsWithSampleAge::MCMC(const Data& data, Tree& tree, const int
   count = 0;
   for(; count < 100*delta; count++){
 
-    for(int i = 0; i < N_total-1; i++){
-      assert(tree.nodes[i].branch_length >= 0.0);
-      assert(order[sorted_indices[i]] == i);
-      assert(order[i] < order[(*tree.nodes[i].parent).label]);
-      assert(coordinates[sorted_indices[i]] <= coordinates[sorted_indices[i+1]]);
-    }
-
     //Either switch order of coalescent event or extent time while k ancestors 
     uniform_rng = dist_unif(rng);
     if(uniform_rng <= p1/N){
@@ -3004,26 +2828,17 @@ EstimateBranchLengthsWithSampleAge::MCMC(const Data& data, Tree& tree, const int
       SwitchOrder(tree, dist_n(rng), dist_unif);
     }      
 
-    for(int k = 0; k < N_total; k++){
-      assert(tree.nodes[k].branch_length >= 0.0);
-    }
-
-    for(int k = N; k < N_total; k++){
-      assert((coordinates[k] >= coordinates[(*tree.nodes[k].child_left).label]));
-      assert((coordinates[k] >= coordinates[(*tree.nodes[k].child_right).label]));
-      assert(sorted_indices[order[k]] == k);
-    }
+    if(count % delta == 0) CheckState(tree);
   }
 
   avg              = coordinates;
   last_coordinates = coordinates;
-  last_update.resize(N_total);
   std::fill(last_update.begin(), last_update.end(), 1);
   count = 1;
 
   int num_iterations = 0, iterations_threshold = 500*log(data.N);
   bool is_count_threshold = false;
-  std::vector<int> count_proposals(N_total-N, 0);
+  std::fill(count_proposals.begin(), count_proposals.end(), 0);
   is_avg_increasing = false;
   while(!is_avg_increasing){
 
@@ -3056,15 +2871,7 @@ EstimateBranchLengthsWithSampleAge::MCMC(const Data& data, Tree& tree, const int
         UpdateAvg(tree);
       }
 
-      for(int k = 0; k < N_total; k++){
-        assert(tree.nodes[k].branch_length >= 0.0);
-      }
-
-      for(int k = N; k < N_total; k++){
-        assert((coordinates[k] >= coordinates[(*tree.nodes[k].child_left).label]));
-        assert((coordinates[k] >= coordinates[(*tree.nodes[k].child_right).label]));
-        assert(sorted_indices[order[k]] == k);
-      }
+      if(count % delta == 0) CheckState(tree);
 
     }while(count % delta != 0 );
 
@@ -3138,7 +2945,7 @@ EstimateBranchLengthsWithSampleAge::MCMC(const Data& data, Tree& tree, const int
 }  
 
 void
-EstimateBranchLengthsWithSampleAge::MCMCVariablePopulationSize(const Data& data, Tree& tree, const std::vector<double>& epoch, std::vector<double>& coal_rate, const int seed){
+EstimateBranchLengthsWithSampleAge::MCMCVariablePopulationSize(const Data& data, Tree& tree, const CoalescentRateProfile& profile, const int seed){
 
   float uniform_rng;
   rng.seed(seed);
@@ -3188,21 +2995,19 @@ EstimateBranchLengthsWithSampleAge::MCMCVariablePopulationSize(const Data& data,
       uniform_rng = dist_unif(rng);
       if(uniform_rng <= p1/N){
         //std::cerr << "v1" << std::endl;
-        ChangeTimeWhilekAncestorsVP_new(tree, dist_tip(rng), epoch, coal_rate, dist_unif);
+        ChangeTimeWhilekAncestorsVP_new(tree, dist_tip(rng), profile, dist_unif);
       }else if(uniform_rng <= p1){
         //std::cerr << "v2" << std::endl;
-        ChangeTimeWhilekAncestorsVP_new(tree, dist_n(rng), epoch, coal_rate, dist_unif);
+        ChangeTimeWhilekAncestorsVP_new(tree, dist_n(rng), profile, dist_unif);
       }else if(uniform_rng <= p2){
         //std::cerr << "v3" << std::endl;
-        UpdateOneEventVP(tree, dist_oneevent(rng), epoch, coal_rate, dist_gamma, dist_unif);
+        UpdateOneEventVP(tree, dist_oneevent(rng), profile, dist_gamma, dist_unif);
       }else{ 
         //std::cerr << "v4" << std::endl;
         SwitchOrder(tree, dist_n(rng), dist_unif);
       }    
 
-      for(int k = 0; k < N_total; k++){
-        assert(tree.nodes[k].branch_length >= 0.0);
-      }
+      if(count % delta == 0) CheckState(tree);
     }
 
     GetCoordinates(tree.nodes[root], coordinates);
@@ -3381,42 +3186,32 @@ EstimateBranchLengthsWithSampleAge::MCMCVariablePopulationSize(const Data& data,
     uniform_rng = dist_unif(rng);
     if(uniform_rng <= p1/N){
       //std::cerr << "v1" << std::endl;
-      ChangeTimeWhilekAncestorsVP_new(tree, dist_tip(rng), epoch, coal_rate, dist_unif);
+      ChangeTimeWhilekAncestorsVP_new(tree, dist_tip(rng), profile, dist_unif);
       //ChangeTimeWhilekAncestors_new(tree, dist_tip(rng), dist_unif);
     }else if(uniform_rng <= p1){
       //std::cerr << "v2" << std::endl;
-      ChangeTimeWhilekAncestorsVP_new(tree, dist_n(rng), epoch, coal_rate, dist_unif);
+      ChangeTimeWhilekAncestorsVP_new(tree, dist_n(rng), profile, dist_unif);
       //ChangeTimeWhilekAncestors_new(tree, dist_n(rng), dist_unif);
     }else if(uniform_rng <= p2){
       //std::cerr << "v3" << std::endl;
-      UpdateOneEventVP(tree, dist_oneevent(rng), epoch, coal_rate, dist_gamma, dist_unif);
+      UpdateOneEventVP(tree, dist_oneevent(rng), profile, dist_gamma, dist_unif);
       //UpdateOneEvent(tree, dist_oneevent(rng), dist_gamma, dist_unif);
     }else{ 
       //std::cerr << "v4" << std::endl;
       SwitchOrder(tree, dist_n(rng), dist_unif);
     }    
 
-    for(int k = 0; k < N_total; k++){
-      assert(tree.nodes[k].branch_length >= 0.0);
-    }
-
-    for(int k = N; k < N_total; k++){
-      assert((coordinates[k] >= coordinates[(*tree.nodes[k].child_left).label]));
-      assert((coordinates[k] >= coordinates[(*tree.nodes[k].child_right).label]));
-      //std::cerr << k << " " << order[k] << " " << sorted_indices[order[k]] << " " << coordinates[k] << " " << coordinates[sorted_indices[order[k]]] << std::endl;
-      assert(sorted_indices[order[k]] == k);
-    }
+    if(count % delta == 0) CheckState(tree);
   }
 
   avg              = coordinates;
   last_coordinates = coordinates;
-  last_update.resize(N_total);
   std::fill(last_update.begin(), last_update.end(), 1);
   count = 1;
 
   int num_iterations = 0, iterations_threshold = 500*log(data.N);
   bool is_count_threshold = false;
-  std::vector<int> count_proposals(N_total-N, 0);
+  std::fill(count_proposals.begin(), count_proposals.end(), 0);
   is_avg_increasing = false;
   while(!is_avg_increasing){
 
@@ -3430,35 +3225,26 @@ EstimateBranchLengthsWithSampleAge::MCMCVariablePopulationSize(const Data& data,
         //std::cerr << "v1" << std::endl;
         //update_time_while_k_anc++;
         int k_candidate = dist_tip(rng);
-        ChangeTimeWhilekAncestorsVP_new(tree, k_candidate, epoch, coal_rate, dist_unif);
+        ChangeTimeWhilekAncestorsVP_new(tree, k_candidate, profile, dist_unif);
         UpdateAvg(tree);
       }else if(uniform_rng < p1){
         //std::cerr << "v2" << std::endl;
         //update_time_while_k_anc++;
         int k_candidate = dist_n(rng);
-        ChangeTimeWhilekAncestorsVP_new(tree, k_candidate, epoch, coal_rate, dist_unif);
+        ChangeTimeWhilekAncestorsVP_new(tree, k_candidate, profile, dist_unif);
         UpdateAvg(tree);
       }else if(uniform_rng <= p2){
         //std::cerr << "v3" << std::endl;
         int k_candidate = dist_oneevent(rng);
         count_proposals[k_candidate-N]++;
-        UpdateOneEventVP(tree, k_candidate, epoch, coal_rate, dist_gamma, dist_unif);
+        UpdateOneEventVP(tree, k_candidate, profile, dist_gamma, dist_unif);
       }else{ 
         //std::cerr << "v4" << std::endl;
         SwitchOrder(tree, dist_n(rng), dist_unif);
         UpdateAvg(tree);
       }
 
-      for(int k = 0; k < N_total; k++){
-        assert(tree.nodes[k].branch_length >= 0.0);
-      }
-
-      for(int k = N; k < N_total; k++){
-        assert((coordinates[k] >= coordinates[(*tree.nodes[k].child_left).label]));
-        assert((coordinates[k] >= coordinates[(*tree.nodes[k].child_right).label]));
-        //std::cerr << k << " " << order[k] << " " << sorted_indices[order[k]] << " " << coordinates[k] << " " << coordinates[sorted_indices[order[k]]] << std::endl;
-        assert(sorted_indices[order[k]] == k);
-      }
+      if(count % delta == 0) CheckState(tree);
 
     }while(count % delta != 0 );
 
@@ -3529,7 +3315,7 @@ EstimateBranchLengthsWithSampleAge::MCMCVariablePopulationSize(const Data& data,
 }  
 
 void
-EstimateBranchLengthsWithSampleAge::MCMCVariablePopulationSizeForRelate(const Data& data, Tree& tree, const std::vector<double>& epoch, std::vector<double>& coal_rate, const int seed){
+EstimateBranchLengthsWithSampleAge::MCMCVariablePopulationSizeForRelate(const Data& data, Tree& tree, const CoalescentRateProfile& profile, const int seed){
 
   float uniform_rng;
   rng.seed(seed);
@@ -3574,21 +3360,19 @@ EstimateBranchLengthsWithSampleAge::MCMCVariablePopulationSizeForRelate(const Da
     uniform_rng = dist_unif(rng);
     if(uniform_rng <= p1/N){
       //std::cerr << "v1" << std::endl;
-      ChangeTimeWhilekAncestorsVP_new(tree, dist_tip(rng), epoch, coal_rate, dist_unif);
+      ChangeTimeWhilekAncestorsVP_new(tree, dist_tip(rng), profile, dist_unif);
     }else if(uniform_rng <= p1){
       //std::cerr << "v2" << std::endl;
-      ChangeTimeWhilekAncestorsVP_new(tree, dist_n(rng), epoch, coal_rate, dist_unif);
+      ChangeTimeWhilekAncestorsVP_new(tree, dist_n(rng), profile, dist_unif);
     }else if(uniform_rng <= p2){
       //std::cerr << "v3" << std::endl;
-      UpdateOneEventVP(tree, dist_oneevent(rng), epoch, coal_rate, dist_gamma, dist_unif);
+      UpdateOneEventVP(tree, dist_oneevent(rng), profile, dist_gamma, dist_unif);
     }else{ 
       //std::cerr << "v4" << std::endl;
       SwitchOrder(tree, dist_n(rng), dist_unif);
     }    
 
-    for(int k = 0; k < N_total; k++){
-      assert(tree.nodes[k].branch_length >= 0.0);
-    }
+    if(count % delta == 0) CheckState(tree);
   }
 
   GetCoordinates(tree.nodes[root], coordinates);
@@ -3681,50 +3465,33 @@ EstimateBranchLengthsWithSampleAge::MCMCVariablePopulationSizeForRelate(const Da
     count = 0;
     for(; count < 100*delta; count++){
 
-      for(int i = 0; i < N_total-1; i++){
-        assert(tree.nodes[i].branch_length >= 0.0);
-        assert(order[sorted_indices[i]] == i);
-        assert(order[i] < order[(*tree.nodes[i].parent).label]);
-        assert(coordinates[sorted_indices[i]] <= coordinates[sorted_indices[i+1]]);
-      }
-
       //Either switch order of coalescent event or extent time while k ancestors 
       uniform_rng = dist_unif(rng);
       if(uniform_rng <= p1/N){
         //std::cerr << "v1" << std::endl;
-        ChangeTimeWhilekAncestorsVP_new(tree, dist_tip(rng), epoch, coal_rate, dist_unif);
+        ChangeTimeWhilekAncestorsVP_new(tree, dist_tip(rng), profile, dist_unif);
       }else if(uniform_rng <= p1){
         //std::cerr << "v2" << std::endl;
-        ChangeTimeWhilekAncestorsVP_new(tree, dist_n(rng), epoch, coal_rate, dist_unif);
+        ChangeTimeWhilekAncestorsVP_new(tree, dist_n(rng), profile, dist_unif);
       }else if(uniform_rng <= p2){
         //std::cerr << "v3" << std::endl;
-        UpdateOneEventVP(tree, dist_oneevent(rng), epoch, coal_rate, dist_gamma, dist_unif);
+        UpdateOneEventVP(tree, dist_oneevent(rng), profile, dist_gamma, dist_unif);
       }else{ 
         //std::cerr << "v4" << std::endl;
         SwitchOrder(tree, dist_n(rng), dist_unif);
       }    
 
-      for(int k = 0; k < N_total; k++){
-        assert(tree.nodes[k].branch_length >= 0.0);
-      }
-
-      for(int k = N; k < N_total; k++){
-        //std::cerr << k << " " << order[k] << " " << sorted_indices[order[k]] << " " << coordinates[k] << " " << coordinates[sorted_indices[order[k]]] << " " <<  << std::endl;
-        assert((coordinates[k] >= coordinates[(*tree.nodes[k].child_left).label]));
-        assert((coordinates[k] >= coordinates[(*tree.nodes[k].child_right).label]));
-        assert(sorted_indices[order[k]] == k);
-      }
+      if(count % delta == 0) CheckState(tree);
     }
 
     avg              = coordinates;
     last_coordinates = coordinates;
-    last_update.resize(N_total);
     std::fill(last_update.begin(), last_update.end(), 1);
     count = 1;
 
     int num_iterations = 0, iterations_threshold = 500*log(data.N);
     bool is_count_threshold = false;
-    std::vector<int> count_proposals(N_total-N, 0);
+    std::fill(count_proposals.begin(), count_proposals.end(), 0);
     is_avg_increasing = false;
     while(!is_avg_increasing){
 
@@ -3738,35 +3505,26 @@ EstimateBranchLengthsWithSampleAge::MCMCVariablePopulationSizeForRelate(const Da
           //std::cerr << "v1" << std::endl;
           //update_time_while_k_anc++;
           int k_candidate = dist_tip(rng);
-          ChangeTimeWhilekAncestorsVP_new(tree, k_candidate, epoch, coal_rate, dist_unif);
+          ChangeTimeWhilekAncestorsVP_new(tree, k_candidate, profile, dist_unif);
           UpdateAvg(tree);
         }else if(uniform_rng < p1){
           //std::cerr << "v2" << std::endl;
           //update_time_while_k_anc++;
           int k_candidate = dist_n(rng);
-          ChangeTimeWhilekAncestorsVP_new(tree, k_candidate, epoch, coal_rate, dist_unif);
+          ChangeTimeWhilekAncestorsVP_new(tree, k_candidate, profile, dist_unif);
           UpdateAvg(tree);
         }else if(uniform_rng <= p2){
           //std::cerr << "v3" << std::endl;
           int k_candidate = dist_oneevent(rng);
           count_proposals[k_candidate-N]++;
-          UpdateOneEventVP(tree, k_candidate, epoch, coal_rate, dist_gamma, dist_unif);
+          UpdateOneEventVP(tree, k_candidate, profile, dist_gamma, dist_unif);
         }else{ 
           //std::cerr << "v4" << std::endl;
           SwitchOrder(tree, dist_n(rng), dist_unif);
           UpdateAvg(tree);
         }
 
-        for(int k = 0; k < N_total; k++){
-          assert(tree.nodes[k].branch_length >= 0.0);
-        }
-
-        for(int k = N; k < N_total; k++){
-          assert((coordinates[k] >= coordinates[(*tree.nodes[k].child_left).label]));
-          assert((coordinates[k] >= coordinates[(*tree.nodes[k].child_right).label]));
-          //std::cerr << k << " " << order[k] << " " << sorted_indices[order[k]] << " " << coordinates[k] << " " << coordinates[sorted_indices[order[k]]] << std::endl;
-          assert(sorted_indices[order[k]] == k);
-        }
+        if(count % delta == 0) CheckState(tree);
 
       }while(count % delta != 0 );
 
@@ -3834,7 +3592,7 @@ EstimateBranchLengthsWithSampleAge::MCMCVariablePopulationSizeForRelate(const Da
 }  
 
 void
-EstimateBranchLengthsWithSampleAge::MCMCVariablePopulationSizeSample(const Data& data, Tree& tree, const std::vector<double>& epoch, std::vector<double>& coal_rate, int num_proposals, const bool init, const int seed){
+EstimateBranchLengthsWithSampleAge::MCMCVariablePopulationSizeSample(const Data& data, Tree& tree, const CoalescentRateProfile& profile, int num_proposals, const bool init, const int seed){
 
   float uniform_rng;
   rng.seed(seed);
@@ -3954,21 +3712,19 @@ EstimateBranchLengthsWithSampleAge::MCMCVariablePopulationSizeSample(const Data&
       uniform_rng = dist_unif(rng);
       if(uniform_rng <= p1/N){
         //std::cerr << "v1" << std::endl;
-        ChangeTimeWhilekAncestorsVP_new(tree, dist_tip(rng), epoch, coal_rate, dist_unif);
+        ChangeTimeWhilekAncestorsVP_new(tree, dist_tip(rng), profile, dist_unif);
       }else if(uniform_rng <= p1){
         //std::cerr << "v2" << std::endl;
-        ChangeTimeWhilekAncestorsVP_new(tree, dist_n(rng), epoch, coal_rate, dist_unif);
+        ChangeTimeWhilekAncestorsVP_new(tree, dist_n(rng), profile, dist_unif);
       }else if(uniform_rng <= p2){
         //std::cerr << "v3" << std::endl;
-        UpdateOneEventVP(tree, dist_oneevent(rng), epoch, coal_rate, dist_gamma, dist_unif);
+        UpdateOneEventVP(tree, dist_oneevent(rng), profile, dist_gamma, dist_unif);
       }else{ 
         //std::cerr << "v4" << std::endl;
         SwitchOrder(tree, dist_n(rng), dist_unif);
       }    
 
-      for(int k = 0; k < N_total; k++){
-        assert(tree.nodes[k].branch_length >= 0.0);
-      }
+      if(count % delta == 0) CheckState(tree);
     }
 
     GetCoordinates(tree.nodes[root], coordinates);
@@ -4064,11 +3820,11 @@ EstimateBranchLengthsWithSampleAge::MCMCVariablePopulationSizeSample(const Data&
     //Either switch order of coalescent event or extent time while k ancestors 
     uniform_rng = dist_unif(rng);
     if(uniform_rng <= 0.5*p1){
-      ChangeTimeWhilekAncestorsVP_new(tree, dist_tip(rng), epoch, coal_rate, dist_unif);
+      ChangeTimeWhilekAncestorsVP_new(tree, dist_tip(rng), profile, dist_unif);
     }else if(uniform_rng <= p1){
-      ChangeTimeWhilekAncestorsVP_new(tree, dist_n(rng), epoch, coal_rate, dist_unif);
+      ChangeTimeWhilekAncestorsVP_new(tree, dist_n(rng), profile, dist_unif);
     }else if(uniform_rng <= p2){
-      UpdateOneEventVP(tree, dist_oneevent(rng), epoch, coal_rate, dist_gamma, dist_unif);
+      UpdateOneEventVP(tree, dist_oneevent(rng), profile, dist_gamma, dist_unif);
     }else{ 
       SwitchOrder(tree, dist_n(rng), dist_unif);
     }
@@ -2,13 +2,15 @@
 
 #include "data.hpp"
 #include "anc.hpp"
+#include "coalescent_rate_profile.hpp"
+#include "rng.hpp"
 
 
 class EstimateBranchLengthsWithSampleAge{
 
   private:
 
-    std::mt19937 rng;
+    MCMCRandomEngine rng;
 
     int N, L, N_total, Ne;
     float convergence_threshold;
@@ -46,6 +48,7 @@ class EstimateBranchLengthsWithSampleAge{
 
     //update avg
     std::vector<int> last_update;
+    std::vector<int> count_proposals; //number of proposals changing the time while k ancestors, for k = N,...,N_total-1
     std::vector<int>::iterator it_last_update;
     std::vector<double> last_coordinates;
     std::vector<double>::iterator it_last_coords;
@@ -58,24 +61,26 @@ class EstimateBranchLengthsWithSampleAge{
     void InitializeMCMC(const Data& data, Tree& tree);
 
     void UpdateAvg(Tree& tree);
+    void CheckState(Tree& tree);
 
     //can delete
     void ChangeTimeWhilekAncestors(Tree& tree, int k, std::uniform_real_distribution<double>& dist_unif);
     void ChangeTimeWhilekAncestorsVP(Tree& tree, int k, const std::vector<double>& epoch, const std::vector<double>& coal_rate, std::uniform_real_distribution<double>& dist_unif);
 
-    //calculate coalescent prior TODO: optimize these functions
+    //calculate coalescent prior
+    //proposals in the MCMC only use the versions with k_start, k_end, which are restricted to the events between the old and new time of a node
     double CalculatePrior(std::vector<double>& p_coordinates, std::vector<int>& p_sorted_indices, std::vector<int>& p_num_lineages);
     double CalculatePrior(int k_start, int k_end, std::vector<double>& p_coordinates, std::vector<int>& p_sorted_indices, std::vector<int>& p_num_lineages);
-    double CalculatePrior(const std::vector<double>& epoch, const std::vector<double>& coal_rate, std::vector<double>& p_coordinates, std::vector<int>& p_sorted_indices, std::vector<int>& p_num_lineages);
-    double CalculatePrior(int k_start, int k_end, const std::vector<double>& epoch, const std::vector<double>& coal_rate, std::vector<double>& p_coordinates, std::vector<int>& p_sorted_indices, std::vector<int>& p_num_lineages);
+    double CalculatePrior(const CoalescentRateProfile& profile, std::vector<double>& p_coordinates, std::vector<int>& p_sorted_indices, std::vector<int>& p_num_lineages);
+    double CalculatePrior(int k_start, int k_end, const CoalescentRateProfile& profile, std::vector<double>& p_coordinates, std::vector<int>& p_sorted_indices, std::vector<int>& p_num_lineages);
 
     //constant Ne
     void ChangeTimeWhilekAncestors_new(Tree& tree, int k, std::uniform_real_distribution<double>& dist_unif);
     void UpdateOneEvent(Tree& tree, int node_k, std::gamma_distribution<double>& dist_gamma, std::uniform_real_distribution<double>& dist_unif);
 
     //variable Ne
-    void ChangeTimeWhilekAncestorsVP_new(Tree& tree, int k, const std::vector<double>& epoch, const std::vector<double>& coal_rate, std::uniform_real_distribution<double>& dist_unif);
-    void UpdateOneEventVP(Tree& tree, int node_k, const std::vector<double>& epoch, const std::vector<double>& coal_rate, std::gamma_distribution<double>& dist_gamma, std::uniform_real_distribution<double>& dist_unif);
+    void ChangeTimeWhilekAncestorsVP_new(Tree& tree, int k, const CoalescentRateProfile& profile, std::uniform_real_distribution<double>& dist_unif);
+    void UpdateOneEventVP(Tree& tree, int node_k, const CoalescentRateProfile& profile, std::gamma_distribution<double>& dist_gamma, std::uniform_real_distribution<double>& dist_unif);
 
     void SwitchOrder(Tree& tree, int node_k, std::uniform_real_distribution<double>& dist_unif);
     void RandomSwitchOrder(Tree& tree, int node_k, std::uniform_real_distribution<double>& dist_unif);
@@ -89,9 +94,9 @@ class EstimateBranchLengthsWithSampleAge{
     //constant population size MCMC
     void MCMC(const Data& data, Tree& tree, const int seed = std::time(0) + getpid());
     //variable Ne MCMC
-    void MCMCVariablePopulationSize(const Data& data, Tree& tree, const std::vector<double>& epoch, std::vector<double>& coal_rate, const int seed = std::time(0) + getpid());
-    void MCMCVariablePopulationSizeForRelate(const Data& data, Tree& tree, const std::vector<double>& epoch, std::vector<double>& coal_rate, const int seed = std::time(0) + getpid());
-		void MCMCVariablePopulationSizeSample(const Data& data, Tree& tree, const std::vector<double>& epoch, std::vector<double>& coal_rate, int num_proposals, const bool init, const int seed = std::time(0) + getpid());
+    void MCMCVariablePopulationSize(const Data& data, Tree& tree, const CoalescentRateProfile& profile, const int seed = std::time(0) + getpid());
+    void MCMCVariablePopulationSizeForRelate(const Data& data, Tree& tree, const CoalescentRateProfile& profile, const int seed = std::time(0) + getpid());
+		void MCMCVariablePopulationSizeSample(const Data& data, Tree& tree, const CoalescentRateProfile& profile, int num_proposals, const bool init, const int seed = std::time(0) + getpid());
 
 };
 
@@ -0,0 +1,105 @@
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <iterator>
+#include <limits>
+
+#include "coalescent_rate_profile.hpp"
+
+CoalescentRateProfile::CoalescentRateProfile(const std::vector<double>& epoch, const std::vector<double>& coal_rate): epoch(epoch){
+
+  if(epoch.size() == 0 || coal_rate.size() == 0){
+    std::cerr << "Error: Need at least one epoch and coalescence rate." << std::endl;
+    exit(1);
+  }
+
+  //parsing the .coal file may leave one rate more or fewer than epochs; the last rate applies to all remaining epochs
+  this->coal_rate.assign(coal_rate.begin(), std::next(coal_rate.begin(), std::min(coal_rate.size(), epoch.size())));
+  this->coal_rate.resize(epoch.size(), coal_rate.back());
+  log_coal_rate.resize(epoch.size());
+  hazard.resize(epoch.size());
+
+  hazard[0] = 0.0;
+  for(int ep = 0; ep < (int) epoch.size(); ep++){
+    if(this->coal_rate[ep] > 0.0){
+      log_coal_rate[ep] = log(this->coal_rate[ep]);
+    }else{
+      log_coal_rate[ep] = -std::numeric_limits<double>::infinity();
+    }
+    if(ep > 0){
+      assert(epoch[ep] >= epoch[ep-1]);
+      hazard[ep] = hazard[ep-1] + this->coal_rate[ep-1] * (epoch[ep] - epoch[ep-1]);
+    }
+  }
+
+}
+
+int
+CoalescentRateProfile::Epoch(double t) const{
+  int ep = (int) (std::upper_bound(epoch.begin(), epoch.end(), t) - epoch.begin()) - 1;
+  return std::max(ep, 0);
+}
+
+double
+CoalescentRateProfile::CumulativeHazard(double t) const{
+  int ep = Epoch(t);
+  return hazard[ep] + coal_rate[ep] * (t - epoch[ep]);
+}
+
+double
+CoalescentRateProfile::CumulativeHazard(double t, double& log_rate) const{
+  int ep   = Epoch(t);
+  log_rate = log_coal_rate[ep];
+  return hazard[ep] + coal_rate[ep] * (t - epoch[ep]);
+}
+
+double
+CoalescentRateProfile::InverseIntegral(double t0, double h) const{
+
+  assert(h >= 0.0);
+  int ep0       = Epoch(t0);
+  double target = hazard[ep0] + coal_rate[ep0] * (t0 - epoch[ep0]) + h;
+
+  //last epoch whose hazard at its lower boundary does not exceed target
+  int ep = (int) (std::upper_bound(hazard.begin(), hazard.end(), target) - hazard.begin()) - 1;
+  ep     = std::max(ep, ep0);
+
+  if(coal_rate[ep] == 0.0){
+    if(h == 0.0) return t0;
+    return std::numeric_limits<double>::infinity();
+  }
+  return std::max(t0, epoch[ep] + (target - hazard[ep])/coal_rate[ep]);
+
+}
+
+void
+CoalescentRateProfile::CumulativeHazard(const double* t, int n, double* hazard_out, double* log_rate_out) const{
+
+  if(n <= 0) return;
+
+  int num_epochs = (int) epoch.size();
+  int ep = Epoch(t[0]);
+  int i  = 0, i_end;
+  double upper, lower, rate, h;
+  while(i < n){
+
+    //times in [i, i_end) fall into epoch ep
+    upper = (ep + 1 < num_epochs) ? epoch[ep+1] : std::numeric_limits<double>::infinity();
+    i_end = i;
+    while(i_end < n && t[i_end] < upper) i_end++;
+
+    lower = epoch[ep];
+    rate  = coal_rate[ep];
+    h     = hazard[ep];
+    for(int j = i; j < i_end; j++){
+      hazard_out[j] = h + rate * (t[j] - lower);
+    }
+    std::fill(log_rate_out + i, log_rate_out + i_end, log_coal_rate[ep]);
+
+    i = i_end;
+    ep++;
+  }
+
+}
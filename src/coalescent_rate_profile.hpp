@@ -0,0 +1,43 @@
+#ifndef COALESCENT_RATE_PROFILE_HPP
+#define COALESCENT_RATE_PROFILE_HPP
+
+#include <vector>
+
+//Piecewise constant coalescence rate, as read from a .coal file.
+//coal_rate[i] is the rate in [epoch[i], epoch[i+1]), and coal_rate[epoch.size()-1] applies beyond the last epoch.
+//The cumulative hazard H(t) = int_0^t coal_rate(s) ds is precomputed at the epoch boundaries, so
+//integrals and inverse integrals are answered by a binary search instead of walking the epochs.
+class CoalescentRateProfile{
+
+  private:
+
+    std::vector<double> epoch;
+    std::vector<double> coal_rate, log_coal_rate;
+    std::vector<double> hazard; //hazard[i] = H(epoch[i])
+
+  public:
+
+    CoalescentRateProfile(const std::vector<double>& epoch, const std::vector<double>& coal_rate);
+
+    int NumEpochs() const{ return (int) epoch.size(); }
+
+    //index of the epoch containing t
+    int Epoch(double t) const;
+    double Rate(double t) const{ return coal_rate[Epoch(t)]; }
+    double LogRate(double t) const{ return log_coal_rate[Epoch(t)]; }
+
+    double CumulativeHazard(double t) const;
+    //same, and stores log(coal_rate(t)) in log_rate
+    double CumulativeHazard(double t, double& log_rate) const;
+    //int_t0^t1 coal_rate(s) ds
+    double Integral(double t0, double t1) const{ return CumulativeHazard(t1) - CumulativeHazard(t0); }
+    //t1 >= t0 such that Integral(t0, t1) == h. Returns infinity if the hazard is bounded.
+    double InverseIntegral(double t0, double h) const;
+
+    //Batch version for n non-decreasing times: hazard_out[i] = H(t[i]), log_rate_out[i] = log(coal_rate(t[i])).
+    //Epochs are found by a single sweep, and the hazard is evaluated in a branch free loop that the compiler vectorises.
+    void CumulativeHazard(const double* t, int n, double* hazard_out, double* log_rate_out) const;
+
+};
+
+#endif //COALESCENT_RATE_PROFILE_HPP
@@ -2,7 +2,11 @@
 #define COLLAPSED_MATRIX_HPP
 
 #include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
 #include <vector>
+#include <zlib.h>
 
 //modified from http://upcoder.com/2/efficient-vectors-of-vectors
 
@@ -20,6 +24,14 @@ class CollapsedMatrix
     typedef typename std::vector<size_type>::reverse_iterator reverse_index_iterator;
     typedef typename std::vector<size_type>::const_reverse_iterator const_reverse_index_iterator;
 
+    //Encodings of stepping stone rows written by DumpToFile(fp, i, boundarySNP, logscales, encoding).
+    //raw:        values as they are.
+    //quantized:  16 bit log(row max/value), with a resolution of 1/quantization_scale in log space (lossy).
+    //compressed: bytes of values shuffled and deflated with zlib (lossless). Written raw if this does not save space.
+    //The encoding is stored in place of the number of rows (1 for raw rows), so ReadFromFile decodes all of them.
+    enum{ raw = 0, quantized = 1, compressed = 2 };
+    static constexpr double quantization_scale = 512.0;
+
   private:
     std::vector<T> _v;
     std::vector<size_type> _index;
@@ -237,17 +249,60 @@ class CollapsedMatrix
     }
 
     //For stepping stones
-    void DumpToFile(FILE* fp, int i, const std::vector<int>& boundarySNP, const std::vector<T>& logscales){ 
+    void DumpToFile(FILE* fp, int i, const std::vector<int>& boundarySNP, const std::vector<T>& logscales, int encoding = raw){ 
 
       size_type isubVectorSize = this -> subVectorSize(0);
-      size_type isize = 1; 
-      
+      const T* row = &_v[_index[i]];
+
+      std::vector<uint16_t> quantized_row;
+      std::vector<Bytef> compressed_row;
+      T row_max = 0.0;
+      uLongf compressed_size = 0;
+      if(encoding == quantized){
+        quantized_row.resize(isubVectorSize);
+        for(size_type n = 0; n < isubVectorSize; n++){
+          if(row[n] > row_max) row_max = row[n];
+        }
+        for(size_type n = 0; n < isubVectorSize; n++){
+          if(row[n] <= 0.0){
+            quantized_row[n] = 65535; //zero
+          }else{
+            double q = std::round(std::log((double) row_max/row[n]) * quantization_scale);
+            quantized_row[n] = (q < 65534.0) ? (uint16_t) q : 65534;
+          }
+        }
+      }else if(encoding == compressed){
+        size_type num_bytes = isubVectorSize * sizeof(T);
+        std::vector<Bytef> shuffled(num_bytes);
+        const Bytef* bytes = (const Bytef*) row;
+        for(size_type n = 0; n < isubVectorSize; n++){
+          for(size_type b = 0; b < sizeof(T); b++){
+            shuffled[b*isubVectorSize + n] = bytes[n*sizeof(T) + b];
+          }
+        }
+        compressed_size = compressBound(num_bytes);
+        compressed_row.resize(compressed_size);
+        if(compress2(&compressed_row[0], &compressed_size, &shuffled[0], num_bytes, 1) != Z_OK || compressed_size >= num_bytes){
+          encoding = raw;
+        }
+      }
+
+      size_type isize = 1 + encoding; 
       fwrite(&isize, sizeof(size_type), 1, fp);
       fwrite(&isubVectorSize, sizeof(size_type), 1, fp);
       
       fwrite(&boundarySNP[i], sizeof(int), 1, fp); 
       fwrite(&logscales[i], sizeof(T), 1, fp); 
-      fwrite(&_v[_index[i]], sizeof(T), isubVectorSize, fp);
+      if(encoding == quantized){
+        fwrite(&row_max, sizeof(T), 1, fp);
+        fwrite(&quantized_row[0], sizeof(uint16_t), isubVectorSize, fp);
+      }else if(encoding == compressed){
+        size_type isize_compressed = compressed_size;
+        fwrite(&isize_compressed, sizeof(size_type), 1, fp);
+        fwrite(&compressed_row[0], sizeof(Bytef), compressed_size, fp);
+      }else{
+        fwrite(row, sizeof(T), isubVectorSize, fp);
+      }
 
     }
     
@@ -286,10 +341,43 @@ class CollapsedMatrix
       //read into _v
       fread(&isize, sizeof(size_type), 1, pFile);
       fread(&isubVectorSize, sizeof(size_type), 1, pFile);
-      fread(&boundarySNP, sizeof(int), isize, pFile);
-      fread(&logscale, sizeof(T), isize, pFile);
-      resize(isize, isubVectorSize);
-      fread(&_v[0], sizeof(T), isize * isubVectorSize, pFile);
+      fread(&boundarySNP, sizeof(int), 1, pFile);
+      fread(&logscale, sizeof(T), 1, pFile);
+      resize(1, isubVectorSize);
+
+      int encoding = isize - 1;
+      if(encoding == quantized){
+        T row_max;
+        std::vector<uint16_t> quantized_row(isubVectorSize);
+        fread(&row_max, sizeof(T), 1, pFile);
+        fread(&quantized_row[0], sizeof(uint16_t), isubVectorSize, pFile);
+        for(size_type n = 0; n < isubVectorSize; n++){
+          if(quantized_row[n] == 65535){
+            _v[n] = 0.0;
+          }else{
+            _v[n] = row_max * std::exp(-quantized_row[n]/quantization_scale);
+          }
+        }
+      }else if(encoding == compressed){
+        size_type isize_compressed;
+        fread(&isize_compressed, sizeof(size_type), 1, pFile);
+        std::vector<Bytef> compressed_row(isize_compressed);
+        fread(&compressed_row[0], sizeof(Bytef), isize_compressed, pFile);
+        uLongf num_bytes = isubVectorSize * sizeof(T);
+        std::vector<Bytef> shuffled(num_bytes);
+        int ret = uncompress(&shuffled[0], &num_bytes, &compressed_row[0], isize_compressed);
+        assert(ret == Z_OK);
+        assert(num_bytes == isubVectorSize * sizeof(T));
+        Bytef* bytes = (Bytef*) &_v[0];
+        for(size_type n = 0; n < isubVectorSize; n++){
+          for(size_type b = 0; b < sizeof(T); b++){
+            bytes[n*sizeof(T) + b] = shuffled[b*isubVectorSize + n];
+          }
+        }
+      }else{
+        assert(encoding == raw);
+        fread(&_v[0], sizeof(T), isubVectorSize, pFile);
+      }
      
     }
 
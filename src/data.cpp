@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <gzstream.h>
 
 #include "data.hpp"
@@ -5,77 +6,112 @@
 
 static double lower_bound = 1e-10;
 
-FILE*
-gzip::open(const char* filename, const char* mode){
-
-  //if(mode != "r" || mode != "rb"){
-  //  std::cerr << "Mode " << mode << " is currently not supported" << std::endl;
-  //}
+void
+line_reader::open(const char* filename){
 
-  if(is_open == true){
-    std::cerr << "Object already in use. Please define a new object for each file." << std::endl;
+  if(fp != NULL){
+    std::cerr << "Object already in use. Please close the previous file first." << std::endl;
     exit(1);
   }
 
-  //determine if file is gzipped
-  FILE* fp_check = fopen(filename, "rb");
-  unsigned char buffer;
-  if(fp_check == NULL){
+  //gzopen reads files that are not gzipped as they are
+  fp = gzopen(filename, "rb");
+  if(fp == NULL){
     std::cerr << "Failed to open file " << filename << std::endl;
     exit(1);
   }
-  fread(&buffer, 1, 1, fp_check);
-  is_gzipped = false;
-  if(buffer == 0x1f){
-    fread(&buffer, 1, 1, fp_check);
-    if(buffer == 0x8b){
-      fread(&buffer, 1, 1, fp_check);
-      if(buffer == 0x08){
-        is_gzipped = true;
-      }
-    }
+  gzbuffer(fp, 1 << 20);
+
+  if(buffer.size() == 0) buffer.resize(1 << 22);
+  it_begin = buffer.data();
+  it_end   = buffer.data();
+  eof      = false;
+
+}
+
+void
+line_reader::close(){
+  if(fp != NULL){
+    gzclose(fp);
+    fp = NULL;
   }
-  fclose(fp_check);
+  it_begin = NULL;
+  it_end   = NULL;
+  eof      = true;
+}
 
-  if(is_gzipped){
+void
+line_reader::Fill(){
+
+  int unread = it_end - it_begin;
+  if(unread > 0 && it_begin != buffer.data()) memmove(buffer.data(), it_begin, unread);
+  //always keep one byte spare to terminate the last line
+  if(unread + 1 >= (int) buffer.size()) buffer.resize(2*buffer.size());
+  it_begin = buffer.data();
+  it_end   = buffer.data() + unread;
+
+  int num_read = gzread(fp, it_end, buffer.size() - unread - 1);
+  if(num_read < 0){
+    int errnum;
+    std::cerr << "Error while reading file: " << gzerror(fp, &errnum) << std::endl;
+    exit(1);
+  }
+  if(num_read == 0) eof = true;
+  it_end += num_read;
 
-    const char prefix[] = "gunzip -c ";
-    char *cmd;
-    cmd = (char*) malloc(sizeof(prefix) + strlen(filename) + 10);
-    if (!cmd) {
-      fprintf(stderr, "%s: malloc: %s\n", filename, strerror(errno));
-      exit(1);
-    }
-    sprintf(cmd,"%s \'%s\'", prefix, filename);
+}
 
-    FILE* fp = popen(cmd, mode);
-    if(fp == NULL){
-      std::cerr << "Failed to open file " << filename << std::endl;
-      exit(1);
-    }
-    return(fp);
+char*
+line_reader::ReadLine(int& length){
 
-  }else{
+  if(fp == NULL) return NULL;
 
-    FILE* fp = fopen(filename, mode);
-    if(fp == NULL){
-      std::cerr << "Failed to open file " << filename << std::endl;
-      exit(1);
-    }
-    return(fp);
+  char* it_newline = (char*) memchr(it_begin, '\n', it_end - it_begin);
+  while(it_newline == NULL && !eof){
+    int searched = it_end - it_begin;
+    Fill();
+    it_newline = (char*) memchr(it_begin + searched, '\n', it_end - it_begin - searched);
+  }
+  if(it_newline == NULL){
+    if(it_begin == it_end) return NULL; //end of file
+    it_newline = it_end; //last line has no '\n'
+  }
 
+  char* line = it_begin;
+  it_begin   = (it_newline == it_end) ? it_end : it_newline + 1;
+  *it_newline = '\0';
+  length = it_newline - line;
+  if(length > 0 && line[length-1] == '\r'){
+    length--;
+    line[length] = '\0';
   }
+  return line;
 
 }
 
-void
-gzip::close(FILE* fp){
-  if(is_gzipped){
-    pclose(fp);
-  }else{
-    fclose(fp);
+bool
+line_reader::ReadLine(std::string& line){
+  int length;
+  char* it_line = ReadLine(length);
+  if(it_line == NULL) return false;
+  line.assign(it_line, length);
+  return true;
+}
+
+int
+line_reader::CountLines(){
+
+  if(fp == NULL) return 0;
+
+  int lines = 0;
+  while(true){
+    lines += std::count(it_begin, it_end, '\n');
+    it_begin = it_end;
+    if(eof) break;
+    Fill();
   }
-  is_open = false;
+  return lines;
+
 }
 
 
@@ -134,13 +170,26 @@ void
 Data::MakeChunks(const std::string& filename_haps, const std::string& filename_sample, const std::string& filename_map, const std::string& filename_dist, const std::string& file_out, bool use_transitions, float min_memory){
 
   haps m_haps(filename_haps.c_str(), filename_sample.c_str());
-  N = m_haps.GetN();
-  L = m_haps.GetL();
+  MakeChunks(m_haps, filename_map, filename_dist, file_out, use_transitions, min_memory);
+  m_haps.CloseFile();
+
+}
+
+void 
+Data::MakeChunks(snp_source& snps, const std::string& filename_map, const std::string& filename_dist, const std::string& file_out, bool use_transitions, float min_memory){
+
+  //SNPs are streamed from snps, so L is only known once all SNPs are read
+  N = snps.GetN();
+  L = 0;
   std::vector<char>::size_type uN = N; 
+  if(!snps.HasSNP()){
+    std::cerr << "Error: No SNPs in input." << std::endl;
+    exit(1);
+  }
 
-  bp_pos.resize(L+1);
-  std::vector<std::string> ancestral(L), alternative(L);
-  std::vector<std::string> rsid(L);
+  bp_pos.clear();
+  std::vector<std::string> ancestral, alternative;
+  std::vector<std::string> rsid;
 
   double min_memory_size = (min_memory) * 1e9/4.0 - (2*N*N + 3*N), actual_min_memory_size = 0.0; //5GB per window 
   if(min_memory_size <= 0){
@@ -151,14 +200,12 @@ Data::MakeChunks(const std::string& filename_haps, const std::string& filename_s
   int max_windows_per_section = 0;
 
   int overlap = 20000;
-  int max_chunk_size = std::min(L+1, (int) (min_memory_size/N)); //can store 
+  int max_chunk_size = (int) (min_memory_size/N); //can store 
   if(min_memory >= 100) max_chunk_size = 2500000; 
 
-  std::vector<std::vector<char> > p_seq(max_chunk_size), p_overlap(overlap);
-  std::vector<std::vector<char> >::iterator it_p = p_seq.begin(), it_poverlap;
-  for(; it_p != p_seq.end(); it_p++){
-    (*it_p).resize(N);
-  }
+  //rows of p_seq are allocated as they are needed
+  std::vector<std::vector<char> > p_seq, p_overlap(overlap);
+  std::vector<std::vector<char> >::iterator it_p, it_poverlap;
 
   int snp = 0;
   std::vector<int> window_boundaries(windows_per_section+1), window_boundaries_overlap(windows_per_section+1);
@@ -173,7 +220,7 @@ Data::MakeChunks(const std::string& filename_haps, const std::string& filename_s
   int chunk_size;
   int chunk_index = 0;
   double window_memory_size = 0.0;
-  while(snp < L){ 
+  while(snps.HasSNP()){ 
 
     FILE* fp_haps_chunk = fopen((file_out + "/chunk_" + std::to_string(chunk_index) + ".hap").c_str(), "wb");
     FILE* fp_state = fopen((file_out + "/chunk_" + std::to_string(chunk_index) + ".state").c_str(), "wb");
@@ -212,25 +259,22 @@ Data::MakeChunks(const std::string& filename_haps, const std::string& filename_s
 
 
     int snp_begin             = snp;
-    it_p                      = p_seq.begin();
     window_memory_size        = 0.0;
     chunk_size                = 0;
 
     window_boundaries[0] = snp_begin; 
     num_windows          = 1;
     int snps_in_window   = 0;
-    while(num_windows + num_windows_overlap < windows_per_section && chunk_size < max_chunk_size && snp < L){
-
-      m_haps.ReadSNP(*it_p, bp_pos[snp]);
+    while(num_windows + num_windows_overlap < windows_per_section && chunk_size < max_chunk_size && snps.HasSNP()){
 
-      ancestral[snp]   = m_haps.ancestral;
-      alternative[snp] = m_haps.alternative;
-      rsid[snp]        = m_haps.rsid;
+      if(chunk_size == (int) p_seq.size()) p_seq.emplace_back(N);
+      int bp;
+      int num_derived = snps.ReadSNP(p_seq[chunk_size], bp);
 
-      int num_derived = 0;
-      for(std::vector<char>::iterator it_snp = (*it_p).begin(); it_snp != (*it_p).end(); it_snp++){
-        if(*it_snp == '1') num_derived++;
-      }
+      bp_pos.push_back(bp);
+      ancestral.push_back(snps.ancestral);
+      alternative.push_back(snps.alternative);
+      rsid.push_back(snps.rsid);
 
       window_memory_size += num_derived * (N+1); //+ 2.88*N; //2.88 = 72/25 (72 bytes per 2 nodes, 1 tree in 25 snps) 
       //73 comes from  ((N+1+2*Node)*x + N^2 + 3*N) which I am using as an approximation of memory usage
@@ -244,7 +288,6 @@ Data::MakeChunks(const std::string& filename_haps, const std::string& filename_s
         num_windows++;
       }
 
-      it_p++;
       snp++;
       snps_in_window++;
       chunk_size++;
@@ -334,9 +377,7 @@ Data::MakeChunks(const std::string& filename_haps, const std::string& filename_s
         }
         snp_tmp++;
 
-        for(std::vector<char>::iterator it_row = (*it_p).begin(); it_row != (*it_p).end(); it_row++){ 
-          fwrite(&(*it_row), sizeof(char), 1, fp_haps_chunk);
-        }
+        fwrite(&(*it_p)[0], sizeof(char), uN, fp_haps_chunk);
       }
 
     }
@@ -357,9 +398,7 @@ Data::MakeChunks(const std::string& filename_haps, const std::string& filename_s
       }
       snp_tmp++;
 
-      for(std::vector<char>::iterator it_row = (*it_p).begin(); it_row != (*it_p).end(); it_row++){ 
-        fwrite(&(*it_row), sizeof(char), 1, fp_haps_chunk);
-      }
+      fwrite(&(*it_p)[0], sizeof(char), uN, fp_haps_chunk);
     }
 
     fclose(fp_haps_chunk);
@@ -367,8 +406,8 @@ Data::MakeChunks(const std::string& filename_haps, const std::string& filename_s
     chunk_index++;
 
   }
-  bp_pos[bp_pos.size()-1] = bp_pos[bp_pos.size()-2] + 1;
-  m_haps.CloseFile();
+  L = snp;
+  bp_pos.push_back(bp_pos[L-1] + 1);
 
   assert(section_boundary_end[section_boundary_end.size()-1] == L);
   assert(section_boundary_start.size() == section_boundary_end.size());
@@ -394,7 +433,12 @@ Data::MakeChunks(const std::string& filename_haps, const std::string& filename_s
 	dist.resize(L); 
   std::vector<int>::iterator it_pos, it_bppos, it_bppos_next;
 
-  if(filename_dist == "unspecified"){
+  if(filename_dist == "unspecified" && (int) snps.dist.size() == L){
+
+    //distances determined by the source, e.g. using a mask
+    dist = snps.dist;
+
+  }else if(filename_dist == "unspecified"){
 
     it_pos = dist.begin();
     it_bppos = bp_pos.begin();
@@ -417,19 +461,20 @@ Data::MakeChunks(const std::string& filename_haps, const std::string& filename_s
   }else{
 
 
-    char buffer[40];
-    gzip g;
-    FILE* fp_dist = g.open(filename_dist.c_str(), "r");
-    fscanf(fp_dist, "%s %s", buffer, buffer);
+    line_reader reader(filename_dist.c_str());
+    char* line;
+    int length;
+    reader.ReadLine(length); //header
     int mbp, mdist;
     snp = 0;
-    while(fscanf(fp_dist, "%d %d", &mbp, &mdist) !=EOF){
+    while((line = reader.ReadLine(length)) != NULL){
+      if(sscanf(line, "%d %d", &mbp, &mdist) != 2) continue;
       assert(snp < L);
       assert(bp_pos[snp] == mbp);
 			dist[snp] = mdist;
       snp++;
     }
-    g.close(fp_dist);
+    reader.close();
 
   }
 
@@ -550,32 +595,75 @@ Data::ReadSequenceFromBin(const char* filename){
 }
 
 ////////////////////////////
-void
+//copies the whitespace separated field starting at or after it into field and moves it past the field
+static inline char*
+ReadField(char* it, char* it_end, char* field){
+  while(it != it_end && (*it == ' ' || *it == '\t')) it++;
+  char* it_field = it;
+  while(it != it_end && *it != ' ' && *it != '\t') it++;
+  int length = std::min((int) (it - it_field), 1023);
+  memcpy(field, it_field, length);
+  field[length] = '\0';
+  return it;
+}
+
+int
 haps::ReadSNP(std::vector<char>& sequence, int& bp){
 
   //read a line, extract bp and fp_props
   //snp;pos_of_snp;rs-id;ancestral_allele/alternative_allele;downstream_allele;upstream_allele;All;
-  fscanf(fp, "%s %s %d %s %s", chr, rsid, &bp, &ancestral, &alternative);
+  int length;
+  char* line = reader.ReadLine(length);
+  if(line == NULL){
+    std::cerr << "Error: Unexpected end of haps file." << std::endl;
+    exit(1);
+  }
+  snps_read++;
+  char* it_end = line + length;
+  char buffer[1024];
+  char* it = ReadField(line, it_end, chr);
+  it = ReadField(it, it_end, rsid);
+  it = ReadField(it, it_end, buffer);
+  bp = atoi(buffer);
+  it = ReadField(it, it_end, ancestral);
+  it = ReadField(it, it_end, alternative);
 
   assert(sequence.size() > 0);
-  //read haplotypes into sequence
-  std::vector<char>::iterator it_seq = sequence.begin(); 
+  //read haplotypes into sequence, counting derived alleles in the same pass
+  int N_seq = sequence.size();
+  int num_derived = 0;
+  char* seq = &sequence[0];
+
+  //haplotypes are normally written as " 0 1 0 ...", so the alleles can be read with a fixed stride
+  bool is_regular = (it_end - it == 2*N_seq);
+  if(is_regular){
+    int num_invalid = 0;
+    for(int i = 0; i < N_seq; i++){
+      char d       = it[2*i+1];
+      seq[i]       = d;
+      num_derived += d & 1;
+      num_invalid += (it[2*i] != ' ') | ((d | 1) != '1');
+    }
+    is_regular = (num_invalid == 0);
+  }
 
-  fgets(line, 2*N+10, fp);
-  char d = line[0];
-  int i  = 0;
-  while(d != '\0' && it_seq != sequence.end()){
-    if(d == '0'){
-      *it_seq = '0';
-      it_seq++;
-    }else if(d == '1'){
-      *it_seq = '1';
-      it_seq++;
+  if(!is_regular){
+    num_derived = 0;
+    int i = 0;
+    for(; it != it_end && i < N_seq; it++){
+      if(*it == '0'){
+        seq[i] = '0';
+        i++;
+      }else if(*it == '1'){
+        seq[i] = '1';
+        num_derived++;
+        i++;
+      }
     }
-    i++;
-    d = line[i];
+    assert(i == N_seq);
   }
-  assert(it_seq == sequence.end());
+
+  return num_derived;
 
 }
 
@@ -597,37 +685,20 @@ haps::DumpSNP(std::vector<char>& sequence, int bp, FILE* fp_out){
 
 map::map(const char* filename){
 
-  gzip g;
-
-  fp = g.open(filename, "r");
-  assert(fp);
-  int lines = 0;
-  while(!feof(fp)){
-    if(fgetc(fp) == '\n'){
-      lines++;
-    }
-  }
-  lines--;//don't count the header
-  g.close(fp);
-
-  fp = g.open(filename, "r");
-  assert(fp);
-  //skip header
-  fscanf(fp, "%s", buffer); 
-  fscanf(fp, "%s", buffer); 
-  fscanf(fp, "%s", buffer); 
-
-  bp.resize(lines);
-  gen_pos.resize(lines);
+  line_reader reader(filename);
+  char* line;
+  int length;
+  reader.ReadLine(length); //skip header
 
   float dummy;
-  double fbp;
-  for(int snp = 0; snp < lines; snp++){
-    fscanf(fp, "%lf %f %lf", &fbp, &dummy, &gen_pos[snp]);
-    bp[snp] = fbp;
+  double fbp, fgen_pos;
+  while((line = reader.ReadLine(length)) != NULL){
+    if(sscanf(line, "%lf %f %lf", &fbp, &dummy, &fgen_pos) != 3) continue;
+    bp.push_back(fbp);
+    gen_pos.push_back(fgen_pos);
   }
 
-  g.close(fp);
+  reader.close();
 
 }
 
@@ -652,4 +723,396 @@ fasta::Read(const std::string filename){
 
 }
 
+void
+fasta::ReadPacked(const std::string filename, const std::string& alphabet, const bool ignore_case){
+
+  igzstream is(filename);
+  if(is.fail()){
+    std::cerr << "Error while opening file " << filename << "." << std::endl;
+    exit(1);
+  }
+  packed.clear(alphabet, ignore_case);
+  std::string line;
+  getline(is,line);
+  while(getline(is,line)){
+    packed.append(line);
+  }
+  is.close();
+
+}
+
+void
+packed_sequence::clear(const std::string& ialphabet, const bool iignore_case){
+
+  assert(ialphabet.size() <= 4);
+  alphabet = ialphabet;
+  ignore_case = iignore_case;
+  size = 0;
+  codes.clear();
+  known.clear();
+
+}
+
+void
+packed_sequence::append(const std::string& line){
+
+  //lookup table from character to code, -1 if not in alphabet
+  int code_of_char[256];
+  std::fill(code_of_char, code_of_char + 256, -1);
+  for(int a = 0; a < (int) alphabet.size(); a++){
+    if(ignore_case){
+      code_of_char[(unsigned char) std::toupper(alphabet[a])] = a;
+      code_of_char[(unsigned char) std::tolower(alphabet[a])] = a;
+    }else{
+      code_of_char[(unsigned char) alphabet[a]] = a;
+    }
+  }
+
+  codes.resize(((long int) size + line.size() + 31)/32, 0);
+  known.resize(((long int) size + line.size() + 63)/64, 0);
+  for(std::string::const_iterator it_c = line.begin(); it_c != line.end(); it_c++){
+    int code = code_of_char[(unsigned char) *it_c];
+    if(code >= 0){
+      codes[size >> 5] |= ((uint64_t) code) << (2*(size & 31));
+      known[size >> 6] |= 1ULL << (size & 63);
+    }
+    size++;
+  }
+
+}
+
+
 
+////////////////////////////
+//moves it past the whitespace separated field starting at or after it
+static inline char*
+SkipField(char* it, char* it_end){
+  while(it != it_end && (*it == ' ' || *it == '\t')) it++;
+  while(it != it_end && *it != ' ' && *it != '\t') it++;
+  return it;
+}
+
+vcf::vcf(const std::string& filename){
+  reader.open(filename.c_str());
+}
+
+void
+vcf::RemoveNonBiallelicSNPs(){
+  if(is_init){
+    std::cerr << "Error: Filters need to be set before reading SNPs." << std::endl;
+    exit(1);
+  }
+  remove_non_biallelic = true;
+}
+
+void
+vcf::RemoveSamples(const std::string& filename_ids){
+  if(is_init){
+    std::cerr << "Error: Filters need to be set before reading SNPs." << std::endl;
+    exit(1);
+  }
+  line_reader is(filename_ids.c_str());
+  std::string line;
+  while(is.ReadLine(line)){
+    ids_remove.push_back(line);
+  }
+  is.close();
+}
+
+void
+vcf::SetAncestor(const std::string& filename_ancestor){
+  if(is_init){
+    std::cerr << "Error: Filters need to be set before reading SNPs." << std::endl;
+    exit(1);
+  }
+  ancestor.Read(filename_ancestor);
+  use_ancestor = true;
+}
+
+void
+vcf::SetMask(const std::string& filename_mask){
+  if(is_init){
+    std::cerr << "Error: Filters need to be set before reading SNPs." << std::endl;
+    exit(1);
+  }
+  mask.Read(filename_mask);
+  use_mask = true;
+}
+
+void
+vcf::Init(){
+
+  if(is_init) return;
+  is_init = true;
+
+  if(remove_non_biallelic) has_lookahead = NextConverted(lookahead);
+  Advance();
+
+}
+
+bool
+vcf::NextConverted(vcf_snp& snp){
+
+  char* line;
+  int length;
+  char field[1024];
+  while((line = reader.ReadLine(length)) != NULL){
+
+    char* it     = line;
+    char* it_end = line + length;
+
+    if(line[0] == '#'){
+      if(strncmp(line, "#CHROM", 6) == 0){
+        //sample ids start in column 10
+        for(int k = 0; k < 9; k++) it = SkipField(it, it_end);
+        samples.clear();
+        while(true){
+          it = ReadField(it, it_end, field);
+          if(field[0] == '\0') break;
+          samples.push_back(field);
+        }
+      }
+      continue;
+    }
+
+    it = ReadField(it, it_end, field);
+    snp.chr = field;
+    it = ReadField(it, it_end, field);
+    snp.bp = atoi(field);
+    it = ReadField(it, it_end, field);
+    snp.rsid = field;
+    it = ReadField(it, it_end, field);
+    snp.ancestral = field;
+    it = ReadField(it, it_end, field);
+    snp.alternative = field;
+    if(snp.ancestral.size() != 1 || snp.alternative.size() != 1) continue;
+    //skip QUAL, FILTER, INFO, FORMAT
+    for(int k = 0; k < 4; k++) it = SkipField(it, it_end);
+    while(it != it_end && (*it == ' ' || *it == '\t')) it++;
+    if(it == it_end) continue;
+
+    if(ploidy == 0){
+      if(samples.size() == 0){
+        std::cerr << "Error: Could not find sample ids in vcf header." << std::endl;
+        exit(1);
+      }
+      ploidy = (it_end - it >= 3 && (it[1] == '|' || it[1] == '/')) ? 2 : 1;
+      N_vcf  = ploidy * samples.size();
+
+      //haplotypes that are kept after removing samples
+      for(int k = 0; k < (int) samples.size(); k++){
+        if(std::find(ids_remove.begin(), ids_remove.end(), samples[k]) == ids_remove.end()){
+          for(int j = 0; j < ploidy; j++) remaining_haps.push_back(ploidy*k + j);
+        }
+      }
+      N = remaining_haps.size();
+    }
+
+    //genotypes, only keeping SNPs with valid genotypes for all samples
+    snp.sequence.resize(N_vcf);
+    std::vector<char>::iterator it_seq = snp.sequence.begin();
+    int i = 0, num_derived = 0;
+    bool is_valid = true;
+    while(it != it_end){
+      while(it != it_end && (*it == ' ' || *it == '\t')) it++;
+      if(it == it_end) break;
+      if(i == N_vcf){
+        is_valid = false;
+        break;
+      }
+      bool is_diploid = (it_end - it >= 3 && (it[1] == '|' || it[1] == '/'));
+      if(is_diploid != (ploidy == 2)){
+        if(it[0] != '0' && it[0] != '1'){
+          is_valid = false;
+          break;
+        }
+        std::cerr << "Error: Detected both haploid and diploid samples." << std::endl;
+        exit(1);
+      }
+      for(int j = 0; j < ploidy; j++){
+        char d = it[2*j];
+        if(d != '0' && d != '1') is_valid = false;
+        *it_seq = d;
+        num_derived += (d == '1');
+        it_seq++;
+        i++;
+      }
+      if(!is_valid) break;
+      while(it != it_end && *it != ' ' && *it != '\t') it++;
+    }
+    if(!is_valid || i != N_vcf) continue;
+    if(num_derived == 0 || num_derived == N_vcf) continue;
+
+    for(std::string::iterator it_rsid = snp.rsid.begin(); it_rsid != snp.rsid.end(); it_rsid++){
+      if(*it_rsid == ';') *it_rsid = ',';
+    }
+    num_read++;
+    return true;
+
+  }
+
+  return false;
+
+}
+
+bool
+vcf::NextBiallelic(vcf_snp& snp){
+
+  if(!remove_non_biallelic) return NextConverted(snp);
+
+  //only keep SNPs that do not share their position with the previous or next SNP
+  while(has_lookahead){
+    std::swap(snp, lookahead);
+    has_lookahead = NextConverted(lookahead);
+    if(has_lookahead && lookahead.bp < snp.bp){
+      std::cerr << "An error occurred at BP " << lookahead.bp << ". Input file might not be sorted by bp." << std::endl;
+      exit(1);
+    }
+    bool is_biallelic = (snp.bp != bp_prev) && (!has_lookahead || lookahead.bp != snp.bp);
+    bp_prev = snp.bp;
+    if(is_biallelic) return true;
+    num_non_biallelic++;
+  }
+  return false;
+
+}
+
+bool
+vcf::FilterSamples(vcf_snp& snp){
+
+  //remaining_haps is increasing, so sequence can be compacted in place
+  int num_derived = 0;
+  for(int k = 0; k < N; k++){
+    snp.sequence[k] = snp.sequence[remaining_haps[k]];
+    if(snp.sequence[k] == '1') num_derived++;
+  }
+  snp.sequence.resize(N);
+
+  if(num_derived == 0 || num_derived == N){
+    num_fixed++;
+    return false;
+  }
+  return true;
+
+}
+
+bool
+vcf::FlipUsingAncestor(vcf_snp& snp){
+
+  char ancestral_allele = 'N';
+  if(snp.bp >= 1 && snp.bp <= (int) ancestor.seq.size()) ancestral_allele = std::toupper(ancestor.seq[snp.bp-1]);
+
+  if(ancestral_allele == snp.ancestral[0]){
+    return true;
+  }else if(ancestral_allele == snp.alternative[0]){
+    std::swap(snp.ancestral, snp.alternative);
+    for(std::vector<char>::iterator it_seq = snp.sequence.begin(); it_seq != snp.sequence.end(); it_seq++){
+      *it_seq = (*it_seq == '0') ? '1' : '0';
+    }
+    num_flipped++;
+    return true;
+  }
+  num_no_ancestor++;
+  return false;
+
+}
+
+bool
+vcf::FilterUsingMask(vcf_snp& snp){
+
+  //same criteria and distances as FilterHapsUsingMask in RelateFileFormats
+  int mask_threshold = 2000;
+  int mask_size = mask.seq.size();
+  int bp = snp.bp;
+  if(bp < 1 || bp > mask_size || mask.seq[bp-1] != 'P'){
+    num_masked++;
+    return false;
+  }
+
+  int d_num_nonpass_vincity = 0;
+  for(int i = std::max(0, bp - 1000); i < std::min(mask_size, bp + 1001); i++){
+    if(mask.seq[i] != 'P') d_num_nonpass_vincity++;
+  }
+  if(d_num_nonpass_vincity >= mask_threshold){
+    num_masked++;
+    return false;
+  }
+
+  if(bp_prev_mask >= 0){
+    //count bases between the previous SNP and this SNP that pass the mask
+    int distance = 0;
+    int i_start = std::max(0, bp_prev_mask - 1000);
+    int i_end   = std::min(mask_size, bp_prev_mask + 1001);
+    d_num_nonpass_vincity = 0;
+    for(int i = i_start; i < i_end; i++){
+      if(mask.seq[i] != 'P') d_num_nonpass_vincity++;
+    }
+    i_end--;
+
+    for(int i = bp_prev_mask; i < bp; i++){
+      if(mask.seq[i_start] != 'P') d_num_nonpass_vincity--;
+      i_start++;
+      if(i_end != mask_size){
+        i_end++;
+        if(i_end == mask_size || mask.seq[i_end] != 'P') d_num_nonpass_vincity++;
+      }
+      assert(d_num_nonpass_vincity >= 0);
+      if(mask.seq[i] == 'P' && d_num_nonpass_vincity < mask_threshold){
+        distance++;
+      }
+    }
+
+    if(distance == 0) distance = 1;
+    dist.push_back(distance);
+  }
+  bp_prev_mask = bp;
+  return true;
+
+}
+
+void
+vcf::Advance(){
+
+  has_next = false;
+  while(NextBiallelic(next)){
+    if(!ids_remove.empty() && !FilterSamples(next)) continue;
+    if(use_ancestor && !FlipUsingAncestor(next)) continue;
+    if(use_mask && !FilterUsingMask(next)) continue;
+    has_next = true;
+    return;
+  }
+
+  //end of file
+  if(use_mask && bp_prev_mask >= 0) dist.push_back(1);
+  reader.close();
+
+  std::cerr << "Read " << num_read << " segregating biallelic SNPs from vcf." << std::endl;
+  if(remove_non_biallelic) std::cerr << "Removed " << num_non_biallelic << " non-biallelic SNPs." << std::endl;
+  if(!ids_remove.empty()) std::cerr << "Removed " << num_fixed << " SNPs that are not segregating after removing samples." << std::endl;
+  if(use_ancestor) std::cerr << "Removed " << num_no_ancestor << " SNPs because of non-matching nucleotides and flipped " << num_flipped << " SNPs." << std::endl;
+  if(use_mask) std::cerr << "Removed " << num_masked << " SNPs using mask." << std::endl;
+
+}
+
+int
+vcf::ReadSNP(std::vector<char>& sequence, int& bp){
+
+  Init();
+  if(!has_next){
+    std::cerr << "Error: Unexpected end of vcf file." << std::endl;
+    exit(1);
+  }
+
+  assert((int) sequence.size() == N);
+  std::copy(next.sequence.begin(), next.sequence.end(), sequence.begin());
+  int num_derived = std::count(sequence.begin(), sequence.end(), '1');
+  bp = next.bp;
+  snprintf(chr, sizeof(chr), "%s", next.chr.c_str());
+  snprintf(rsid, sizeof(rsid), "%s", next.rsid.c_str());
+  snprintf(ancestral, sizeof(ancestral), "%s", next.ancestral.c_str());
+  snprintf(alternative, sizeof(alternative), "%s", next.alternative.c_str());
+
+  Advance();
+  return num_derived;
+
+}
@@ -2,29 +2,54 @@
 #define DATA_HPP
 
 #include <string>
+#include <vector>
+#include <cstdint>
+#include <zlib.h>
 
 #include "collapsed_matrix.hpp"
 
 
-class gzip{
+//Buffered line reader for plain or gzipped text files.
+//Gzipped files are decompressed in-process by zlib (uncompressed files are passed through unchanged),
+//and lines are handed out from a large buffer instead of being read one character at a time.
+class line_reader{
 
   private:
 
-    bool is_gzipped = false;
-    bool is_open    = false;
+    gzFile fp = NULL;
+    std::vector<char> buffer;
+    char* it_begin = NULL; //first unread character in buffer
+    char* it_end   = NULL; //end of decompressed data in buffer
+    bool eof = false;
+
+    //moves unread data to the front of buffer and appends the next block of the file
+    void Fill();
 
   public:
 
-   gzip(){};
+    line_reader(){};
+    line_reader(const char* filename){open(filename);};
+    line_reader(const line_reader&) = delete;
+    line_reader& operator=(const line_reader&) = delete;
+    ~line_reader(){close();};
+
+    //exits if the file can't be opened
+    void open(const char* filename);
+    void close();
 
-   //function that takes in a file pointer, filename and opens the file
-   FILE* open(const char* filename, const char* mode);
-   
-   //function that takes in a file pointer and closes the file.
-   void close(FILE* fp);
+    //Returns pointer to the next line, with '\n' (and a trailing '\r') replaced by '\0', or NULL at end of file.
+    //The pointer is valid until the next call.
+    char* ReadLine(int& length);
+    bool ReadLine(std::string& line);
+
+    //Number of '\n' from the current position to the end of file. Consumes the rest of the file.
+    int CountLines();
 
 };
 
+class snp_source;
+class PaintingBuffer;
+
 //struct recording all the data needed for building anc
 struct Data{
 
@@ -40,6 +65,8 @@ struct Data{
 	std::vector<int> dist;    //vector specifying location of each SNP along the genome
   std::vector<double> r;   //vector of recombination distances from one SNP to the next
   std::vector<double> rpos; //vector of cumulative recombination distances
+  const PaintingBuffer* painting = NULL; //if set, paintings held in memory are read from here instead of name_<w>.bin
+  int painting_encoding = CollapsedMatrix<float>::raw; //encoding of rows when writing paintings (raw, quantized or compressed)
 
   ///////////
 
@@ -57,6 +84,8 @@ struct Data{
   void SetName(const std::string& name);
   void SetPainting(double theta, double rho);
   void MakeChunks(const std::string& filename_haps, const std::string& filename_sample, const std::string& filename_map, const std::string& filename_dist, const std::string& file_out, bool use_transition, float max_memory = 5);
+  //Same as above, but streams SNPs from snps (e.g. haps or vcf) in a single pass.
+  void MakeChunks(snp_source& snps, const std::string& filename_map, const std::string& filename_dist, const std::string& file_out, bool use_transition, float max_memory = 5);
   //void MakeChunks2(const std::string& filename_haps, const std::string& filename_sample, const std::string& filename_map, const std::string& filename_dist);
 
   ///////////
@@ -94,7 +123,28 @@ struct Element{
   double rate;
 };
 
-class haps{
+//SNPs read one at a time, as used by Data::MakeChunks.
+class snp_source{
+
+  public:
+
+    char chr[1024];
+    char rsid[1024];
+    char ancestral[1024], alternative[1024];
+    //distances between consecutive SNPs read so far, if the source determines them itself (e.g. using a mask), otherwise empty
+    std::vector<int> dist;
+
+    virtual ~snp_source(){};
+
+    virtual int GetN() = 0;
+    //true if there is another SNP to read
+    virtual bool HasSNP() = 0;
+    //reads next SNP into sequence and bp, and returns number of derived alleles
+    virtual int ReadSNP(std::vector<char>& sequence, int& bp) = 0;
+
+};
+
+class haps: public snp_source{
 
   //class to read/write bed.
   //define with file pointer or filename and never use it to write and read.
@@ -102,55 +152,42 @@ class haps{
   private:
 
     int N, L;
-    FILE* fp;
-    gzip g; 
-    char* line;
+    int snps_read = 0;
+    line_reader reader;
 
   public:
 
-    char chr[1024];
-    char rsid[1024];
-    char ancestral[1024], alternative[1024];
-
     haps(const char* filename_haps, const char* filename_sample){ 
 
-      //fp = fopen(filename_sample, "r");
-      fp = g.open(filename_sample, "r");
-      assert(fp);
+      char* line;
+      int length;
+
+      reader.open(filename_sample);
       N = 0;
 			char id1[1024], id2[1024], dummy[1024];
-			assert(fscanf(fp, "%s %s %s", id1, id2, dummy) == 3); //header
-			assert(fscanf(fp, "%s %s %s", id1, id2, dummy) == 3); //header
-			while(fscanf(fp, "%s %s %s", id1, id2, dummy) == 3){
+      reader.ReadLine(length); //header
+      reader.ReadLine(length); //header
+			while((line = reader.ReadLine(length)) != NULL && sscanf(line, "%s %s %s", id1, id2, dummy) == 3){
         if(strcmp(id1, id2) == 0){
           N += 2;
 				}else{
           N++;
 				}
 			}
-      g.close(fp);
-
-			//fp = fopen(filename_haps, "r");
-      fp = g.open(filename_haps, "r");
-      assert(fp);
-      L = 0;
-      while(!feof(fp)){
-        if(fgetc(fp) == '\n'){
-          L++;
-        }
-      }
-      g.close(fp);
-
-      //fp = fopen(filename_haps, "r");
-      fp = g.open(filename_haps, "r");
-      assert(fp);
-      line = (char*) malloc(2*N+10);
+      reader.close();
+
+      reader.open(filename_haps);
+      L = reader.CountLines();
+      reader.close();
+
+      reader.open(filename_haps);
 
     }
 
-    void ReadSNP(std::vector<char>& sequence, int& bp); //gets hap info for SNP
+    bool HasSNP(){return(snps_read < L);}
+    int ReadSNP(std::vector<char>& sequence, int& bp); //gets hap info for SNP, returns number of derived alleles
     void DumpSNP(std::vector<char>& sequence, int bp, FILE* fp_out); //dumps hap info for SNP
-    void CloseFile(){g.close(fp);};
+    void CloseFile(){reader.close();};
 
     int GetN(){return(N);}
     int GetL(){return(L);}
@@ -159,11 +196,6 @@ class haps{
 
 class map{
 
-  private:
-
-    FILE* fp;
-    char buffer[30];
-
   public:
  
     std::vector<int> bp;
@@ -172,10 +204,99 @@ class map{
 
 };
 
+//Sequence with 2 bits per position. Characters in alphabet (at most 4, case insensitive unless ignore_case is false)
+//are stored as their index in alphabet and all other characters are flagged as unknown, so a 250Mb chromosome needs ~90MB instead of 250MB.
+struct packed_sequence{
+
+  std::string alphabet;
+  bool ignore_case = true;
+  int size = 0;
+  std::vector<uint64_t> codes; //32 positions per word
+  std::vector<uint64_t> known; //64 positions per word
+
+  void clear(const std::string& alphabet, const bool ignore_case = true);
+  void append(const std::string& line);
+
+  //Returns index of character at position i in alphabet, or -1 if it is not in alphabet or i is out of range.
+  int operator[](int i) const{
+    if(i < 0 || i >= size) return -1;
+    if(((known[i >> 6] >> (i & 63)) & 1ULL) == 0) return -1;
+    return (int) ((codes[i >> 5] >> (2*(i & 31))) & 3ULL);
+  }
+
+};
+
 struct fasta{
 
   std::string seq;
+  packed_sequence packed;
   void Read(const std::string filename);
+  //Reads sequence directly into packed (seq stays empty), keeping only whether characters are in alphabet and which one.
+  void ReadPacked(const std::string filename, const std::string& alphabet, const bool ignore_case = true);
+
+};
+
+//Reads SNPs from a vcf(.gz) file in a single pass. The filters of RelateFileFormats are applied in memory
+//instead of rewriting a haps file for each of them, in the order
+//ConvertFromVcf, RemoveNonBiallelicSNPs, RemoveSamples, FlipHapsUsingAncestor, FilterHapsUsingMask.
+//As in ConvertFromVcf, only SNPs with phased (or haploid) genotypes for all samples are read and
+//SNPs that are not segregating are removed. Optional filters need to be set before the first SNP is read.
+class vcf: public snp_source{
+
+  private:
+
+    struct vcf_snp{
+      std::string chr, rsid, ancestral, alternative;
+      int bp;
+      std::vector<char> sequence;
+    };
+
+    line_reader reader;
+    bool is_init = false;
+
+    int N_vcf = 0, N = 0;     //number of haplotypes in vcf, number of haplotypes after removing samples
+    int ploidy = 0;   //determined from first SNP
+    std::vector<std::string> ids_remove;
+    std::vector<int> remaining_haps;
+
+    bool remove_non_biallelic = false;
+    bool has_lookahead = false;
+    int bp_prev = -1;
+    vcf_snp lookahead;
+
+    bool use_ancestor = false, use_mask = false;
+    fasta ancestor, mask;
+    int bp_prev_mask = -1;
+
+    bool has_next = false;
+    vcf_snp next;
+
+    //number of SNPs removed by each filter, number of flipped SNPs
+    int num_read = 0, num_non_biallelic = 0, num_fixed = 0, num_no_ancestor = 0, num_masked = 0, num_flipped = 0;
+
+    void Init();
+    void Advance();
+    //reads next line with a biallelic SNP that has valid genotypes for all samples and is segregating
+    bool NextConverted(vcf_snp& snp);
+    bool NextBiallelic(vcf_snp& snp);
+    bool FilterSamples(vcf_snp& snp);
+    bool FlipUsingAncestor(vcf_snp& snp);
+    bool FilterUsingMask(vcf_snp& snp);
+
+  public:
+
+    std::vector<std::string> samples; //sample ids in vcf
+
+    vcf(const std::string& filename);
+
+    void RemoveNonBiallelicSNPs();
+    void RemoveSamples(const std::string& filename_ids);
+    void SetAncestor(const std::string& filename_ancestor);
+    void SetMask(const std::string& filename_mask);
+
+    int GetN(){Init(); return(N);}
+    bool HasSNP(){Init(); return(has_next);}
+    int ReadSNP(std::vector<char>& sequence, int& bp);
 
 };
 
@@ -1,3 +1,8 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+
 #include "fast_painting.hpp"
 #include "fast_log.hpp"
 
@@ -608,9 +613,9 @@ _PaintSteppingStones(
     fwrite(&endinterval, sizeof(int), 1, pfiles[i]);
 
     //dump alpha
-    alpha.DumpToFile(pfiles[i], i, boundarySNP_begin, logscales_alpha); 
+    alpha.DumpToFile(pfiles[i], i, boundarySNP_begin, logscales_alpha, data.painting_encoding); 
     //dump beta
-    beta.DumpToFile(pfiles[i], i, boundarySNP_end, logscales_beta); 
+    beta.DumpToFile(pfiles[i], i, boundarySNP_end, logscales_beta, data.painting_encoding); 
 
   }
 
@@ -1127,3 +1132,84 @@ FastPainting::RePaintSection(const Data& data, CollapsedMatrix<float>& topology,
 
 
 
+
+//////////////////////// PaintingBuffer //////////////////
+
+PaintingBuffer::PaintingBuffer(int N, int num_windows, double max_memory){
+
+  buffers.resize(num_windows, NULL);
+  sizes.resize(num_windows, 0);
+  in_memory.resize(num_windows, false);
+
+  double window_memory = WindowSize(N)/1e9;
+  double memory = 0.0;
+  for(int w = 0; w < num_windows; w++){
+    memory += window_memory;
+    if(memory > max_memory) break;
+    in_memory[w] = true;
+  }
+
+}
+
+PaintingBuffer::~PaintingBuffer(){
+  for(int w = 0; w < (int) buffers.size(); w++){
+    Release(w);
+  }
+}
+
+size_t
+PaintingBuffer::WindowSize(int N){
+  //per haplotype: start and end of interval, then alpha and beta as written by CollapsedMatrix<float>::DumpToFile
+  size_t matrix_size = 2*sizeof(CollapsedMatrix<float>::size_type) + sizeof(int) + sizeof(float) + N*sizeof(float);
+  return ((size_t) N) * (2*sizeof(int) + 2*matrix_size);
+}
+
+int
+PaintingBuffer::NumInMemory() const{
+  return std::count(in_memory.begin(), in_memory.end(), true);
+}
+
+FILE*
+PaintingBuffer::OpenWrite(int w, const char* filename){
+
+  FILE* fp;
+  if(in_memory[w]){
+    Release(w);
+    fp = open_memstream(&buffers[w], &sizes[w]);
+  }else{
+    fp = fopen(filename, "wb");
+  }
+  if(fp == NULL){
+    std::cerr << "Error: Failed to open painting of window " << w << "." << std::endl;
+    exit(1);
+  }
+  return fp;
+
+}
+
+FILE*
+PaintingBuffer::OpenRead(int w, const char* filename) const{
+
+  FILE* fp;
+  if(in_memory[w]){
+    assert(buffers[w] != NULL);
+    fp = fmemopen(buffers[w], sizes[w], "rb");
+  }else{
+    fp = fopen(filename, "rb");
+  }
+  if(fp == NULL){
+    std::cerr << "Error: Failed to open painting of window " << w << "." << std::endl;
+    exit(1);
+  }
+  return fp;
+
+}
+
+void
+PaintingBuffer::Release(int w){
+  if(buffers[w] != NULL){
+    free(buffers[w]);
+    buffers[w] = NULL;
+    sizes[w]   = 0;
+  }
+}
@@ -50,4 +50,35 @@ class FastPainting{
 
 };
 
+//Paintings of all windows of a chunk, handed from Paint to BuildTopology within one process.
+//Windows are kept in memory as long as their estimated size fits into max_memory (in GB),
+//the remaining windows are spilled to the usual files name_<w>.bin.
+class PaintingBuffer{
+
+  private:
+
+    std::vector<char*> buffers;
+    std::vector<size_t> sizes;
+    std::vector<bool> in_memory;
+
+  public:
+
+    PaintingBuffer(int N, int num_windows, double max_memory);
+    ~PaintingBuffer();
+    PaintingBuffer(const PaintingBuffer&) = delete;
+    PaintingBuffer& operator=(const PaintingBuffer&) = delete;
+
+    //Size in bytes of the painting of one window.
+    static size_t WindowSize(int N);
+    bool InMemory(int w) const{return in_memory[w];};
+    int NumInMemory() const;
+
+    //Opens window w for writing (in memory or filename) and for reading. Close with fclose.
+    FILE* OpenWrite(int w, const char* filename);
+    FILE* OpenRead(int w, const char* filename) const;
+    //Frees the memory of window w once its topology is built.
+    void Release(int w);
+
+};
+
 #endif //FAST_PAINTING_HPP
@@ -1,4 +1,5 @@
 pub mod pipelines;
+mod scheduler;
 use autocxx::prelude::include_cpp;
 
 include_cpp! {
@@ -844,6 +844,29 @@ AncMutIterators::NextTree(MarginalTree& mtr, Muts::iterator& it_mut, int mode){
 
 }
 
+int
+AncMutIterators::NextTreeBlock(TreeBlock& block, int block_size){
+
+  if((int) block.mtr.size() < block_size){
+    block.mtr.resize(block_size);
+    block.it_mut.resize(block_size);
+    block.num_bases_tree_persists.resize(block_size);
+    block.tree_index.resize(block_size);
+  }
+
+  block.num_trees = 0;
+  while(block.num_trees < block_size){
+    double num_bases_tree_persists = NextTree(block.mtr[block.num_trees], block.it_mut[block.num_trees]);
+    if(num_bases_tree_persists < 0.0) break;
+    block.num_bases_tree_persists[block.num_trees] = num_bases_tree_persists;
+    block.tree_index[block.num_trees]              = tree_index_in_anc;
+    block.num_trees++;
+  }
+
+  return(block.num_trees);
+
+}
+
 double
 AncMutIterators::FirstSNP(MarginalTree& mtr, Muts::iterator& it_mut){
 
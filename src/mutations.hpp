@@ -25,6 +25,17 @@ struct SNPInfo{
 
 typedef std::vector<SNPInfo> Muts; //I could change this to deque but deque has no splice
 
+//Consecutive marginal trees read by AncMutIterators::NextTreeBlock, so that they can be processed in parallel.
+struct TreeBlock{
+
+  int num_trees = 0;
+  std::vector<MarginalTree> mtr;
+  std::vector<Muts::iterator> it_mut; //first SNP of each tree (only valid if tree has mutations)
+  std::vector<double> num_bases_tree_persists;
+  std::vector<int> tree_index;
+
+};
+
 class Mutations{
 
   private:
@@ -109,6 +120,10 @@ class AncMutIterators{
     }
 
     double NextTree(MarginalTree& mtr, Muts::iterator& it_mut, int mode = 0);
+    int NextTreeBlock(TreeBlock& block, int block_size); //returns number of trees read
+    bool HasMutations(const TreeBlock& block, int i){
+      return(block.it_mut[i] != mut.info.end() && (*block.it_mut[i]).tree == block.tree_index[i]);
+    }
     double FirstSNP(MarginalTree& mtr, Muts::iterator& it_mut);
     double NextSNP(MarginalTree& mtr, Muts::iterator& it_mut);
 
@@ -0,0 +1,42 @@
+#ifndef PARALLEL_HPP
+#define PARALLEL_HPP
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+//Returns num_threads if positive, otherwise the number of hardware threads.
+inline int NumThreads(int num_threads = 0){
+  if(num_threads > 0) return num_threads;
+  int n = std::thread::hardware_concurrency();
+  return (n > 0) ? n : 1;
+}
+
+//Calls f(i, thread_index) for every i in [0,n).
+//The range is divided into contiguous slices, one per thread, so results written to index i
+//can be output in order afterwards. With num_threads == 1 no thread is spawned.
+template<typename F>
+void ParallelFor(int n, int num_threads, F f){
+
+  num_threads = std::max(1, std::min(num_threads, n));
+  if(num_threads == 1){
+    for(int i = 0; i < n; i++) f(i, 0);
+    return;
+  }
+
+  std::vector<std::thread> threads;
+  threads.reserve(num_threads);
+  for(int t = 0; t < num_threads; t++){
+    int begin = (int)(((long long) n * t)/num_threads);
+    int end   = (int)(((long long) n * (t+1))/num_threads);
+    threads.emplace_back([begin, end, t, &f](){
+      for(int i = begin; i < end; i++) f(i, t);
+    });
+  }
+  for(std::vector<std::thread>::iterator it_thread = threads.begin(); it_thread != threads.end(); it_thread++){
+    (*it_thread).join();
+  }
+
+}
+
+#endif //PARALLEL_HPP
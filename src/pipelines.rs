@@ -1,3 +1,4 @@
+use crate::scheduler::Scheduler;
 use crate::{ffi, resource_usage};
 use autocxx::{c_int, prelude::moveit};
 use byteorder::{NativeEndian, ReadBytesExt};
@@ -50,6 +51,24 @@ fn read_parameters_bin(parameters: &PathBuf) -> miette::Result<Parameters> {
     })
 }
 
+struct ChunksParameters {
+    num_chunks: usize,
+    /// Estimated memory in GB needed to build topologies in one section.
+    memory_size: f64,
+}
+
+fn read_chunks_parameters_bin(parameters: &PathBuf) -> miette::Result<ChunksParameters> {
+    let mut file = std::fs::File::open(parameters).into_diagnostic()?;
+    let _num_samples = file.read_i32::<NativeEndian>().into_diagnostic()?;
+    let _num_alleles = file.read_i32::<NativeEndian>().into_diagnostic()?;
+    let num_chunks = file.read_i32::<NativeEndian>().into_diagnostic()? as usize;
+    let memory_size = file.read_f64::<NativeEndian>().into_diagnostic()?;
+    Ok(ChunksParameters {
+        num_chunks,
+        memory_size,
+    })
+}
+
 /// Use to make smaller chunks from the data.
 #[derive(Parser, Debug)]
 pub struct MakeChunks {
@@ -403,6 +422,12 @@ pub struct InferBranchLengths {
     /// Seed for MCMC in branch lengths estimation.
     #[arg(long, value_name = "INT")]
     seed: Option<u64>,
+    /// Start the MCMC of each tree from the ages of clades shared with the previous tree.
+    #[arg(long, default_value_t = false)]
+    warm_start: bool,
+    /// Number of MCMC chains per tree. With more than one, chains run until their root ages and total branch lengths agree (R-hat < 1.1). Constant population size without sample ages only.
+    #[arg(long, default_value_t = 1, value_name = "INT")]
+    num_chains: usize,
 }
 
 impl InferBranchLengths {
@@ -439,6 +464,8 @@ impl InferBranchLengths {
                 sample_ages,
                 coal,
                 seed,
+                self.warm_start,
+                c_int(self.num_chains as i32),
             );
         }
         Ok(())
@@ -575,10 +602,164 @@ pub struct PipelineAll {
     /// Seed for MCMC in branch lengths estimation.
     #[arg(long, value_name = "INT")]
     seed: Option<u64>,
+    /// Start the branch length MCMC of each tree from the ages of clades shared with the previous tree.
+    #[arg(long, default_value_t = false)]
+    warm_start: bool,
+    /// Number of branch length MCMC chains per tree. With more than one, chains run until their root ages and total branch lengths agree (R-hat < 1.1). Constant population size without sample ages only.
+    #[arg(long, default_value_t = 1, value_name = "INT")]
+    num_chains: usize,
+    /// Number of threads used to run chunks and sections in parallel. Default is all available cores.
+    /// Each stage runs on a single thread (the --threads option of the C++ Relate binary only applies to
+    /// writing tree sequences, which this pipeline does not do), so this is the total number of threads.
+    #[arg(long, value_name = "INT")]
+    threads: Option<usize>,
+    /// Approximate memory budget in GB for all stages running at the same time. Default is no limit.
+    #[arg(long, value_name = "FLOAT")]
+    max_memory: Option<f64>,
 }
 
 impl PipelineAll {
     pub fn execute(&self) -> Result<()> {
+        let num_threads = self.threads.unwrap_or_else(|| {
+            std::thread::available_parallelism()
+                .map(|n| n.get())
+                .unwrap_or(1)
+        });
+        let max_memory = self.max_memory.unwrap_or(f64::INFINITY);
+
+        let chunks: Vec<usize> = if let Some(chunk_index) = self.chunk_index {
+            vec![chunk_index]
+        } else {
+            MakeChunks::new(
+                self.haps.clone(),
+                self.sample.clone(),
+                self.map.clone(),
+                self.dist.clone(),
+                self.output.clone(),
+                self.transversion,
+                self.memory,
+            )
+            .execute()?;
+            let parameters = read_chunks_parameters_bin(&self.output.join("parameters.bin"))?;
+            (0..parameters.num_chunks).collect()
+        };
+        let memory_size = read_chunks_parameters_bin(&self.output.join("parameters.bin"))
+            .map(|parameters| parameters.memory_size)
+            .unwrap_or(self.memory as f64);
+
+        // Stages form a graph per chunk: Paint -> BuildTopology (per section) -> FindEquivalentBranches
+        // -> InferBranchLengths (per section) -> CombineSections, followed by Finalize for all chunks.
+        // Tasks are added chunk by chunk, so earlier chunks are preferred while later chunks fill idle threads.
+        // Sections get their own seeds, drawn in order, so results do not depend on the number of threads.
+        let mut rng: Option<StdRng> = self.seed.map(SeedableRng::seed_from_u64);
+        let mut scheduler = Scheduler::new();
+        let mut combined = Vec::new();
+        for &chunk in &chunks {
+            let parameters =
+                read_parameters_bin(&self.output.join(format!("parameters_c{}.bin", chunk)))?;
+            let num_sections = parameters.num_windows;
+            let (first_section, last_section) = if self.chunk_index.is_some() {
+                (
+                    self.first_section.unwrap_or(0),
+                    std::cmp::min(self.last_section.unwrap_or(num_sections - 1), num_sections - 1),
+                )
+            } else {
+                (0, num_sections - 1)
+            };
+            // haplotypes of the chunk, stored as one byte per allele
+            let data_memory = (parameters.num_samples * parameters.num_alleles) as f64 / 1e9;
+
+            let paint = Paint::new(chunk, self.output.clone(), self.painting.clone());
+            let paint = scheduler.add(format!("Paint (chunk {})", chunk), data_memory, &[], move || {
+                paint.execute()
+            });
+
+            let mut topologies = Vec::new();
+            for section in first_section..(last_section + 1) {
+                let build_topology = BuildTopology {
+                    chunk_index: chunk,
+                    output: self.output.clone(),
+                    first_section: Some(section),
+                    last_section: Some(section),
+                    effective_population_size: self.effective_population_size,
+                    painting: self.painting.clone(),
+                    seed: rng.as_mut().map(|rng| rng.gen::<u64>()),
+                    sample_ages: self.sample_ages.clone(),
+                    fb: self.fb,
+                    anc_allele_unknown: self.anc_allele_unknown,
+                };
+                topologies.push(scheduler.add(
+                    format!("BuildTopology (chunk {}, section {})", chunk, section),
+                    data_memory + memory_size,
+                    &[paint],
+                    move || build_topology.execute(),
+                ));
+            }
+
+            let find_equivalent_branches = FindEquivalentBranches {
+                output: self.output.clone(),
+                chunk_index: chunk,
+            };
+            let equivalent_branches = scheduler.add(
+                format!("FindEquivalentBranches (chunk {})", chunk),
+                data_memory,
+                &topologies,
+                move || find_equivalent_branches.execute(),
+            );
+
+            // GetBranchLengths draws the seeds of its MCMC runs from rand(), which is shared by all
+            // threads, so these tasks are run one at a time to keep seeded runs reproducible.
+            let mut branch_lengths = Vec::new();
+            for section in first_section..(last_section + 1) {
+                let infer_branch_lengths = InferBranchLengths {
+                    output: self.output.clone(),
+                    chunk_index: chunk,
+                    first_section: Some(section),
+                    last_section: Some(section),
+                    mutation_rate: self.mutation_rate,
+                    effective_population_size: self.effective_population_size,
+                    sample_ages: self.sample_ages.clone(),
+                    coal: self.coal.clone(),
+                    seed: self.seed,
+                    warm_start: self.warm_start,
+                    num_chains: self.num_chains,
+                };
+                branch_lengths.push(scheduler.add_serial(
+                    format!("InferBranchLengths (chunk {}, section {})", chunk, section),
+                    data_memory,
+                    &[equivalent_branches],
+                    move || infer_branch_lengths.execute(),
+                ));
+            }
+
+            let combine_sections = CombineSections {
+                output: self.output.clone(),
+                chunk_index: chunk,
+                effective_population_size: self.effective_population_size,
+            };
+            combined.push(scheduler.add(
+                format!("CombineSections (chunk {})", chunk),
+                data_memory,
+                &branch_lengths,
+                move || combine_sections.execute(),
+            ));
+        }
+
+        if self.chunk_index.is_none() {
+            let finalize = Finalize {
+                output: self.output.clone(),
+                sample_ages: self.sample_ages.clone(),
+                annot: self.annot.clone(),
+            };
+            scheduler.add("Finalize".to_string(), 0., &combined, move || finalize.execute());
+        }
+
+        scheduler.run(num_threads, max_memory)?;
+
+        eprintln!("---------------------------------------------------------");
+        eprintln!("Done.");
+        eprintln!("---------------------------------------------------------");
+        resource_usage();
         Ok(())
     }
 }
@@ -0,0 +1,86 @@
+#ifndef RNG_HPP
+#define RNG_HPP
+
+#include <cstdint>
+#include <limits>
+
+//xoshiro256++ by Blackman and Vigna (http://prng.di.unimi.it/).
+//Satisfies UniformRandomBitGenerator, so it can be used with the std distributions.
+//Compared to std::mt19937 the state is 32 bytes instead of 2.5kB, there is no state regeneration step,
+//and each call returns 64 bits, so uniform_real_distribution<double> needs one call per number instead of two.
+class Xoshiro256PlusPlus{
+
+  private:
+
+    uint64_t s[4];
+
+    static inline uint64_t rotl(const uint64_t x, int k){
+      return (x << k) | (x >> (64 - k));
+    }
+
+  public:
+
+    typedef uint64_t result_type;
+
+    static constexpr result_type min(){ return 0; }
+    static constexpr result_type max(){ return std::numeric_limits<result_type>::max(); }
+
+    explicit Xoshiro256PlusPlus(uint64_t seed_value = 1){ seed(seed_value); }
+
+    //The state is filled by splitmix64, so nearby seeds (such as seed, seed+1, ...) give unrelated streams.
+    void seed(uint64_t seed_value){
+      for(int i = 0; i < 4; i++){
+        uint64_t z = (seed_value += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        s[i] = z ^ (z >> 31);
+      }
+    }
+
+    inline result_type operator()(){
+      const uint64_t result = rotl(s[0] + s[3], 23) + s[0];
+      const uint64_t t = s[1] << 17;
+      s[2] ^= s[0];
+      s[3] ^= s[1];
+      s[1] ^= s[2];
+      s[0] ^= s[3];
+      s[2] ^= t;
+      s[3] = rotl(s[3], 45);
+      return result;
+    }
+
+    //Advances the stream by 2^128 calls. Calling jump() c times on copies of one generator gives
+    //c non-overlapping streams from a single seed.
+    void jump(){
+      static const uint64_t JUMP[] = { 0x180ec6d33cfd0abaULL, 0xd5a61266f0c9392cULL, 0xa9582618e03fc9aaULL, 0x39abdc4529b1661cULL };
+      uint64_t s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+      for(int i = 0; i < 4; i++){
+        for(int b = 0; b < 64; b++){
+          if(JUMP[i] & (uint64_t(1) << b)){
+            s0 ^= s[0];
+            s1 ^= s[1];
+            s2 ^= s[2];
+            s3 ^= s[3];
+          }
+          (*this)();
+        }
+      }
+      s[0] = s0;
+      s[1] = s1;
+      s[2] = s2;
+      s[3] = s3;
+    }
+
+    bool operator==(const Xoshiro256PlusPlus& other) const{
+      return s[0] == other.s[0] && s[1] == other.s[1] && s[2] == other.s[2] && s[3] == other.s[3];
+    }
+    bool operator!=(const Xoshiro256PlusPlus& other) const{ return !(*this == other); }
+
+};
+
+//Random engine used by the branch length MCMC (InferBranchLengths, EstimateBranchLengthsWithSampleAge).
+//Any UniformRandomBitGenerator with seed(int) works here; set this to std::mt19937 to reproduce the
+//random streams of earlier versions.
+typedef Xoshiro256PlusPlus MCMCRandomEngine;
+
+#endif //RNG_HPP
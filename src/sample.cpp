@@ -1,5 +1,7 @@
-#include <gzstream.h>
+#include <iostream>
+#include <algorithm>
 
+#include "data.hpp"
 #include "sample.hpp"
 
 void
@@ -9,11 +11,12 @@ Sample::Read(const std::string& filename){
 
   std::string line, read, read2, ploidy;
   bool exists;
+  std::vector<std::string> group_of_sample;
 
   //Read all possible labels
-  igzstream is(filename);
-  getline(is, line);
-  while(getline(is, line)){
+  line_reader is(filename.c_str());
+  is.ReadLine(line);
+  while(is.ReadLine(line)){
 
     int i = 0;
     while(line[i] != ' ' && line[i] != '\t') i++;
@@ -47,6 +50,7 @@ Sample::Read(const std::string& filename){
 				}
 			}
 		}
+    group_of_sample.push_back(read);
     exists = false;
     for(std::vector<std::string>::iterator it_groups = groups.begin(); it_groups != groups.end(); it_groups++){
       if(!read.compare(*it_groups)){
@@ -63,37 +67,13 @@ Sample::Read(const std::string& filename){
   is.close();
   std::sort(groups.begin(), groups.end());
 
-  //read group_of_haplotype
-  is.open(filename);
-  if(is.fail()){
-    std::cerr << "Error while opening file." << std::endl;
-    exit(1);
-  }
-  getline(is, line);
+  //assign group_of_haplotype from the labels read above, so the file is only read once
   int ind;
-  while(getline(is, line)){
-
-    int i = 0;
-    while(line[i] != ' ' && line[i] != '\t') i++;
-    i++;
-    read.clear();
-    while(line[i] != ' ' && line[i] != '\t'){
-      read += line[i];
-      i++;
-    }
-
-    ind = 0;
-    for(std::vector<std::string>::iterator it_groups = groups.begin(); it_groups != groups.end(); it_groups++){
-      if(!read.compare(*it_groups)){
-        group_of_haplotype.push_back(ind);
-        if(diploid) group_of_haplotype.push_back(ind);
-        break;
-      }
-      ind++;
-    }
-
+  for(std::vector<std::string>::iterator it_sample = group_of_sample.begin(); it_sample != group_of_sample.end(); it_sample++){
+    ind = std::lower_bound(groups.begin(), groups.end(), *it_sample) - groups.begin();
+    group_of_haplotype.push_back(ind);
+    if(diploid) group_of_haplotype.push_back(ind);
   }
-  is.close();
 
   //calculate group sizes
   group_sizes.resize(groups.size());
@@ -0,0 +1,324 @@
+//! Runs the stages of [crate::pipelines::PipelineAll] as a dependency graph, so that independent
+//! chunks and sections are processed concurrently within a thread and memory budget.
+
+use miette::Result;
+use std::collections::BTreeSet;
+use std::sync::{Condvar, Mutex};
+
+/// Index of a task added to a [Scheduler].
+pub type TaskId = usize;
+
+type Job<'a> = Box<dyn FnOnce() -> Result<()> + Send + 'a>;
+
+struct Task {
+    name: String,
+    /// Estimated memory usage in GB.
+    memory: f64,
+    /// Serial tasks never run at the same time as other serial tasks.
+    serial: bool,
+    dependents: Vec<TaskId>,
+    num_dependencies: usize,
+}
+
+struct State<'a> {
+    jobs: Vec<Option<Job<'a>>>,
+    num_dependencies: Vec<usize>,
+    ready: BTreeSet<TaskId>,
+    running_memory: f64,
+    num_running: usize,
+    serial_running: bool,
+    num_finished: usize,
+    error: Option<miette::Report>,
+}
+
+/// Tasks with dependencies, executed by [Scheduler::run].
+pub struct Scheduler<'a> {
+    tasks: Vec<Task>,
+    jobs: Vec<Option<Job<'a>>>,
+}
+
+impl<'a> Scheduler<'a> {
+    pub fn new() -> Self {
+        Self { tasks: Vec::new(), jobs: Vec::new() }
+    }
+
+    /// Adds a task that can start once all tasks in `dependencies` have finished.
+    /// Among ready tasks, the one added first is started first.
+    pub fn add<F>(&mut self, name: String, memory: f64, dependencies: &[TaskId], job: F) -> TaskId
+    where
+        F: FnOnce() -> Result<()> + Send + 'a,
+    {
+        self.push(name, memory, false, dependencies, Box::new(job))
+    }
+
+    /// Same as [Scheduler::add], but the task does not overlap with other serial tasks
+    /// (e.g. stages that rely on the global state of rand()).
+    pub fn add_serial<F>(&mut self, name: String, memory: f64, dependencies: &[TaskId], job: F) -> TaskId
+    where
+        F: FnOnce() -> Result<()> + Send + 'a,
+    {
+        self.push(name, memory, true, dependencies, Box::new(job))
+    }
+
+    fn push(&mut self, name: String, memory: f64, serial: bool, dependencies: &[TaskId], job: Job<'a>) -> TaskId {
+        let id = self.tasks.len();
+        for &dependency in dependencies {
+            assert!(dependency < id, "tasks can only depend on tasks added before them");
+            self.tasks[dependency].dependents.push(id);
+        }
+        self.tasks.push(Task {
+            name,
+            memory,
+            serial,
+            dependents: Vec::new(),
+            num_dependencies: dependencies.len(),
+        });
+        self.jobs.push(Some(job));
+        id
+    }
+
+    /// Runs all tasks on `num_threads` threads, keeping the summed memory estimates of running
+    /// tasks below `max_memory` (GB). Stops starting new tasks after the first error and returns it.
+    /// Jobs are expected to be single-threaded; a job that starts its own threads is still counted once.
+    pub fn run(self, num_threads: usize, max_memory: f64) -> Result<()> {
+        let tasks = self.tasks;
+        let num_tasks = tasks.len();
+        let state = State {
+            jobs: self.jobs,
+            num_dependencies: tasks.iter().map(|task| task.num_dependencies).collect(),
+            ready: (0..num_tasks)
+                .filter(|&id| tasks[id].num_dependencies == 0)
+                .collect(),
+            running_memory: 0.,
+            num_running: 0,
+            serial_running: false,
+            num_finished: 0,
+            error: None,
+        };
+        let state = Mutex::new(state);
+        let changed = Condvar::new();
+
+        std::thread::scope(|scope| {
+            for _ in 0..num_threads.max(1) {
+                scope.spawn(|| loop {
+                    let (id, job) = {
+                        let mut state = state.lock().unwrap();
+                        let id = loop {
+                            if state.error.is_some() || state.num_finished == num_tasks {
+                                return;
+                            }
+                            if let Some(id) = next_task(&tasks, &state, max_memory) {
+                                break id;
+                            }
+                            state = changed.wait(state).unwrap();
+                        };
+                        let task = &tasks[id];
+                        state.ready.remove(&id);
+                        state.running_memory += task.memory;
+                        state.num_running += 1;
+                        state.serial_running |= task.serial;
+                        (id, state.jobs[id].take().unwrap())
+                    };
+
+                    let task = &tasks[id];
+                    eprintln!("Starting {}.", task.name);
+                    let result = job();
+
+                    let mut state = state.lock().unwrap();
+                    state.num_running -= 1;
+                    state.running_memory = if state.num_running == 0 {
+                        0.
+                    } else {
+                        state.running_memory - task.memory
+                    };
+                    if task.serial {
+                        state.serial_running = false;
+                    }
+                    state.num_finished += 1;
+                    match result {
+                        Ok(()) => {
+                            for &dependent in &task.dependents {
+                                state.num_dependencies[dependent] -= 1;
+                                if state.num_dependencies[dependent] == 0 {
+                                    state.ready.insert(dependent);
+                                }
+                            }
+                        }
+                        Err(error) => {
+                            if state.error.is_none() {
+                                state.error = Some(error);
+                            }
+                        }
+                    }
+                    changed.notify_all();
+                });
+            }
+        });
+
+        match state.into_inner().unwrap().error {
+            Some(error) => Err(error),
+            None => Ok(()),
+        }
+    }
+}
+
+/// Next ready task that fits into the memory budget. A task that needs more than
+/// `max_memory` on its own is only started when nothing else is running.
+fn next_task(tasks: &[Task], state: &State, max_memory: f64) -> Option<TaskId> {
+    state.ready.iter().copied().find(|&id| {
+        let task = &tasks[id];
+        (state.num_running == 0 || state.running_memory + task.memory <= max_memory)
+            && !(task.serial && state.serial_running)
+    })
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::time::Duration;
+
+    /// Numbers of running tasks, running serial tasks and their memory, and the maxima reached.
+    /// Jobs only record, checks are done after [Scheduler::run] returns.
+    #[derive(Default)]
+    struct Usage {
+        running: usize,
+        serial: usize,
+        memory: f64,
+        max_running: usize,
+        max_serial: usize,
+        max_memory: f64,
+        finished: Vec<String>,
+        started_early: Vec<String>,
+    }
+
+    fn job<'a>(
+        usage: &'a Mutex<Usage>,
+        name: &str,
+        memory: f64,
+        serial: bool,
+        dependencies: &[&str],
+    ) -> impl FnOnce() -> Result<()> + Send + 'a {
+        let name = name.to_string();
+        let dependencies: Vec<String> = dependencies.iter().map(|dependency| dependency.to_string()).collect();
+        move || {
+            {
+                let mut usage = usage.lock().unwrap();
+                if dependencies.iter().any(|dependency| !usage.finished.contains(dependency)) {
+                    usage.started_early.push(name.clone());
+                }
+                usage.running += 1;
+                usage.serial += serial as usize;
+                usage.memory += memory;
+                usage.max_running = usage.max_running.max(usage.running);
+                usage.max_serial = usage.max_serial.max(usage.serial);
+                usage.max_memory = usage.max_memory.max(usage.memory);
+            }
+            std::thread::sleep(Duration::from_millis(5));
+            let mut usage = usage.lock().unwrap();
+            usage.running -= 1;
+            usage.serial -= serial as usize;
+            usage.memory -= memory;
+            usage.finished.push(name);
+            Ok(())
+        }
+    }
+
+    #[test]
+    fn tasks_start_after_their_dependencies() {
+        // per chunk: one task, three tasks depending on it and one task depending on those,
+        // followed by a task depending on all chunks
+        let usage = Mutex::new(Usage::default());
+        let mut scheduler = Scheduler::new();
+        let mut names = Vec::new();
+        let mut last = Vec::new();
+        for chunk in 0..4 {
+            let first_name = format!("first {}", chunk);
+            let first = scheduler.add(first_name.clone(), 0., &[], job(&usage, &first_name, 0., false, &[]));
+            let mut middle = Vec::new();
+            let mut middle_names = Vec::new();
+            for section in 0..3 {
+                let name = format!("middle {} {}", chunk, section);
+                middle.push(scheduler.add(name.clone(), 0., &[first], job(&usage, &name, 0., false, &[&first_name])));
+                middle_names.push(name);
+            }
+            let middle_names: Vec<&str> = middle_names.iter().map(|name| name.as_str()).collect();
+            let last_name = format!("last {}", chunk);
+            last.push(scheduler.add(last_name.clone(), 0., &middle, job(&usage, &last_name, 0., false, &middle_names)));
+            names.push(last_name);
+        }
+        let names: Vec<&str> = names.iter().map(|name| name.as_str()).collect();
+        scheduler.add("all".to_string(), 0., &last, job(&usage, "all", 0., false, &names));
+        scheduler.run(4, f64::INFINITY).unwrap();
+
+        let usage = usage.into_inner().unwrap();
+        assert_eq!(usage.finished.len(), 4 * 5 + 1);
+        assert!(usage.started_early.is_empty(), "started before their dependencies: {:?}", usage.started_early);
+        assert!(usage.max_running > 1);
+    }
+
+    #[test]
+    fn running_tasks_stay_within_the_memory_limit() {
+        let usage = Mutex::new(Usage::default());
+        let mut scheduler = Scheduler::new();
+        for i in 0..12 {
+            let name = format!("task {}", i);
+            let memory = 1. + (i % 3) as f64 * 0.5;
+            scheduler.add(name.clone(), memory, &[], job(&usage, &name, memory, false, &[]));
+        }
+        scheduler.run(8, 3.).unwrap();
+
+        let usage = usage.into_inner().unwrap();
+        assert_eq!(usage.finished.len(), 12);
+        assert!(usage.max_running > 1);
+        assert!(usage.max_memory <= 3.);
+    }
+
+    #[test]
+    fn task_larger_than_the_memory_limit_runs_alone() {
+        let usage = Mutex::new(Usage::default());
+        let mut scheduler = Scheduler::new();
+        scheduler.add("large".to_string(), 10., &[], job(&usage, "large", 10., false, &[]));
+        for i in 0..4 {
+            let name = format!("task {}", i);
+            scheduler.add(name.clone(), 1., &[], job(&usage, &name, 1., false, &[]));
+        }
+        scheduler.run(8, 3.).unwrap();
+
+        let usage = usage.into_inner().unwrap();
+        assert_eq!(usage.finished.len(), 5);
+        assert_eq!(usage.finished[0], "large");
+        assert_eq!(usage.max_memory, 10.);
+    }
+
+    #[test]
+    fn serial_tasks_do_not_overlap() {
+        let usage = Mutex::new(Usage::default());
+        let mut scheduler = Scheduler::new();
+        for i in 0..16 {
+            let name = format!("task {}", i);
+            if i % 2 == 0 {
+                scheduler.add_serial(name.clone(), 0., &[], job(&usage, &name, 0., true, &[]));
+            } else {
+                scheduler.add(name.clone(), 0., &[], job(&usage, &name, 0., false, &[]));
+            }
+        }
+        scheduler.run(8, f64::INFINITY).unwrap();
+
+        let usage = usage.into_inner().unwrap();
+        assert_eq!(usage.finished.len(), 16);
+        assert_eq!(usage.max_serial, 1);
+        assert!(usage.max_running > 1);
+    }
+
+    #[test]
+    fn first_error_is_returned_and_dependents_are_not_started() {
+        let usage = Mutex::new(Usage::default());
+        let mut scheduler = Scheduler::new();
+        let failing = scheduler.add("failing".to_string(), 0., &[], || Err(miette::miette!("failed")));
+        scheduler.add("dependent".to_string(), 0., &[failing], job(&usage, "dependent", 0., false, &["failing"]));
+        let error = scheduler.run(2, f64::INFINITY).unwrap_err();
+
+        assert_eq!(error.to_string(), "failed");
+        assert!(usage.into_inner().unwrap().finished.is_empty());
+    }
+}
@@ -1325,16 +1325,40 @@ MinMatch::UPGMA(CollapsedMatrix<float>& d, Tree& tree){
 //////////////////////////////////////////
 
 
-InferBranchLengths::InferBranchLengths(const Data& data){
+InferBranchLengths::InferBranchLengths(const Data& data, const bool warm_start): warm_start(warm_start){
   N       = data.N;
   N_total = 2*N - 1;
   L       = data.L;
   Ne      = data.Ne;
 
-  old_branch_length.resize(N_total);
   coordinates.resize(N_total);
+  em_rate.resize(N_total + 1);
+  em_zero.resize(N_total + 1);
+  em_mut_rate.resize(N_total + 1);
   sorted_indices.resize(N_total); //node indices in order of coalescent events
   order.resize(N_total); //order of coalescent events
+
+  sum_coordinates.resize(N_total);
+  last_update.resize(N_total);
+  parent_label.resize(N_total);
+
+  prior_times_old.resize(N);
+  prior_times_new.resize(N);
+  prior_hazard_old.resize(N);
+  prior_hazard_new.resize(N);
+  prior_log_rate_old.resize(N);
+  prior_log_rate_new.resize(N);
+
+  //workspace that does not depend on the tree, so that the same object can be reused for all trees
+  mut_rate.resize(N_total);
+  count_proposals.resize(N_total - N);
+  num_burn_in     = 0;
+  num_initialized = 0;
+  switch_proposed.resize(N_total - N);
+  switch_accepted.resize(N_total - N);
+  change_time_proposed.resize(N_total - N);
+  change_time_accepted.resize(N_total - N);
+  logFactorial(N); //precalculates log(k!) for k = 0,...,N
 };
 
 
@@ -1344,7 +1368,6 @@ InferBranchLengths::InitializeBranchLengths(Tree& tree){
 
   int node_i, num_lineages;
   //initialize using coalescent prior
-  coordinates.resize(N_total);
   for(int i = 0; i < N; i++){
     coordinates[i] = 0.0;
   }
@@ -1361,7 +1384,6 @@ InferBranchLengths::InitializeBranchLengths(Tree& tree){
 void
 InferBranchLengths::InitializeMCMC(const Data& data, Tree& tree){
 
-  mut_rate.resize(N_total);
   for(int i = 0; i < N_total; i++){
     int snp_begin = tree.nodes[i].SNP_begin;
     int snp_end   = tree.nodes[i].SNP_end;
@@ -1387,9 +1409,6 @@ InferBranchLengths::InitializeMCMC(const Data& data, Tree& tree){
   //1. sort coordinate vector to obtain sorted_indices
   //2. sort sorted_indices to obtain order
 
-  order.resize(N_total);
-  sorted_indices.resize(N_total);
-
   for(int i = 0; i < N_total; i++){
     order[i] = i;
     sorted_indices[i] = i;
@@ -1402,6 +1421,60 @@ InferBranchLengths::InitializeMCMC(const Data& data, Tree& tree){
 
 }
 
+//Initialises the order of coalescent events from the posterior mean ages of the previous tree:
+//clades that also exist in the previous tree are placed at their age in that state, all other nodes directly above their children.
+//Assumes that children have smaller labels than parents. Returns the number of internal nodes found in the previous tree.
+int
+InferBranchLengths::InitializeOrderFromPreviousTree(Tree& tree){
+
+  tree.GetCladeHashes(clade_hash);
+  if(clade_prev.empty()) return 0;
+
+  int num_initialized = 0;
+  for(int i = 0; i < N; i++){
+    coordinates[i] = 0.0;
+  }
+  for(int i = N; i < N_total; i++){
+    double min_age = std::max(coordinates[(*tree.nodes[i].child_left).label], coordinates[(*tree.nodes[i].child_right).label]);
+    std::unordered_map<uint64_t, int>::iterator it_clade = clade_prev.find(clade_hash[i]);
+    if(it_clade != clade_prev.end() && coordinates_prev[(*it_clade).second] > min_age){
+      coordinates[i] = coordinates_prev[(*it_clade).second];
+      num_initialized++;
+    }else{
+      int num_lineages = 2*N-i;
+      coordinates[i] = min_age + 2.0/(num_lineages * (num_lineages - 1.0));
+    }
+  }
+  if(num_initialized == 0) return 0;
+
+  //children are always younger than parents, so this order is consistent with the tree
+  std::stable_sort(std::next(sorted_indices.begin(), N), sorted_indices.end(), [&](int i1, int i2) { return coordinates[i1] < coordinates[i2]; });
+  for(int i = N; i < N_total; i++){
+    order[sorted_indices[i]] = i;
+  }
+
+  return num_initialized;
+
+}
+
+void
+InferBranchLengths::StoreForNextTree(){
+
+  //posterior mean ages; the sums are up to date after the stopping rule of MCMC
+  coordinates_prev.resize(N_total);
+  for(int i = 0; i < N; i++){
+    coordinates_prev[i] = 0.0;
+  }
+  for(int i = N; i < N_total; i++){
+    coordinates_prev[i] = sum_coordinates[i]/count;
+  }
+  clade_prev.clear();
+  for(int i = N; i < N_total; i++){
+    clade_prev[clade_hash[i]] = i;
+  }
+
+}
+
 float
 InferBranchLengths::LikelihoodGivenTimes(Tree& tree){
 
@@ -1444,58 +1517,58 @@ InferBranchLengths::LikelihoodGivenTimes(Tree& tree){
 }
 
 void
-InferBranchLengths::UpdateAvg(Tree& tree){
-
+InferBranchLengths::InitializeAvg(Tree& tree){
 
-  if(update_node1 != -1){
+  //the current state is iteration 1
+  count = 1;
+  sum_coordinates = coordinates;
+  std::fill(last_update.begin(), last_update.end(), 1);
+  for(int i = 0; i < N_total - 1; i++){
+    parent_label[i] = (*tree.nodes[i].parent).label;
+  }
+  parent_label[N_total - 1] = N_total - 1;
 
-    if(update_node2 != -1){
+}
 
-      it_avg         = std::next(avg.begin(), update_node1);
-      it_coords      = std::next(coordinates.begin(), update_node1);
-      it_last_update = std::next(last_update.begin(), update_node1);
-      it_last_coords = std::next(last_coordinates.begin(), update_node1);
-      *it_avg         += ((count - *it_last_update) * (*it_last_coords - *it_avg) + *it_coords - *it_last_coords)/count;
-      *it_last_update  = count;
-      *it_last_coords  = *it_coords;
+//Called by proposals before coordinates[node] changes in iteration count.
+inline void
+InferBranchLengths::AccumulateAge(int node){
+  sum_coordinates[node] += (count - 1 - last_update[node]) * coordinates[node];
+  last_update[node]      = count - 1;
+}
 
-      it_avg         = std::next(avg.begin(), update_node2);
-      it_coords      = std::next(coordinates.begin(), update_node2);
-      it_last_update = std::next(last_update.begin(), update_node2);
-      it_last_coords = std::next(last_coordinates.begin(), update_node2);
-      *it_avg         += ((count - *it_last_update) * (*it_last_coords - *it_avg) + *it_coords - *it_last_coords)/count;
-      *it_last_update  = count;
-      *it_last_coords  = *it_coords;
+void
+InferBranchLengths::FlushAvg(){
 
-      update_node1 = -1;
-      update_node2 = -1;
+  //bring the sums of all nodes up to iteration count
+  for(int i = N; i < N_total; i++){
+    sum_coordinates[i] += (count - last_update[i]) * coordinates[i];
+    last_update[i]      = count;
+  }
 
-    }else{
+}
 
-      for(std::vector<int>::iterator it_node = std::next(sorted_indices.begin(), update_node1); it_node != sorted_indices.end(); it_node++){
-        avg[*it_node]             += ((count - last_update[*it_node]) * (last_coordinates[*it_node] - avg[*it_node]) + coordinates[*it_node] - last_coordinates[*it_node])/count;
-        last_update[*it_node]      = count;
-        last_coordinates[*it_node] = coordinates[*it_node];
-      }
-      update_node1 = -1;
+bool
+InferBranchLengths::IsAvgIncreasing(){
 
-    }
+  FlushAvg();
 
+  //averages are sums divided by count, so sums can be compared directly
+  int num_decreasing = 0;
+  for(int i = N; i < N_total - 1; i++){
+    num_decreasing += (sum_coordinates[i] > sum_coordinates[parent_label[i]]);
   }
+  return (num_decreasing == 0);
 
+}
 
-  /*  
-      it_avg = std::next(avg.begin(), N);
-      it_coords = std::next(coordinates.begin(), N);
-  //update avg
-  for(int ell = N; ell < N_total; ell++){
-   *it_avg  += (*it_coords - *it_avg)/count;
-   last_update[ell] = count;
-   it_avg++;
-   it_coords++;
-   }
-   */
+void
+InferBranchLengths::BranchLengthsFromAvg(Tree& tree){
 
+  //sums are up to date after IsAvgIncreasing returned true
+  for(int i = 0; i < N_total - 1; i++){
+    tree.nodes[i].branch_length = ((double) Ne) * (sum_coordinates[parent_label[i]] - sum_coordinates[i])/count;
+  }
 
 }
 
@@ -1717,11 +1790,11 @@ InferBranchLengths::SwitchOrder(Tree& tree, int k, std::uniform_real_distributio
         order[node_k]             = new_order;
         order[node_swap_k]        = k;
 
+        AccumulateAge(node_k);
+        AccumulateAge(node_swap_k);
         double tmp_coords                       = coordinates[node_k];
         coordinates[node_k]                     = coordinates[node_swap_k];
         coordinates[node_swap_k]                = tmp_coords;
-        update_node1 = node_k;
-        update_node2 = node_swap_k;
 
         //calculate new branch lengths
         tree.nodes[node_k].branch_length                 = coordinates[(*tree.nodes[node_k].parent).label]  - coordinates[node_k];
@@ -1854,8 +1927,8 @@ InferBranchLengths::ChangeTimeWhilekAncestors(Tree& tree, int k, std::uniform_re
   if(accept){
     //calculate new branch lengths
     it_sorted_indices = std::next(sorted_indices.begin(), k);
-    update_node1 = k;
     for(; it_sorted_indices != sorted_indices.end(); it_sorted_indices++){
+      AccumulateAge(*it_sorted_indices);
       coordinates[*it_sorted_indices]                 += delta_tau;
       child_left_label                                 = (*tree.nodes[*it_sorted_indices].child_left).label;
       tree.nodes[child_left_label].branch_length       = coordinates[*it_sorted_indices] - coordinates[child_left_label];
@@ -1869,7 +1942,7 @@ InferBranchLengths::ChangeTimeWhilekAncestors(Tree& tree, int k, std::uniform_re
 }
 
 float
-InferBranchLengths::ChangeTimeWhilekAncestorsVP(Tree& tree, int k, const std::vector<double>& epoch, const std::vector<double>& coal_rate, std::uniform_real_distribution<double>& dist_unif){
+InferBranchLengths::ChangeTimeWhilekAncestorsVP(Tree& tree, int k, const CoalescentRateProfile& profile, std::uniform_real_distribution<double>& dist_unif){
 
   //This step is O(N)
   num_lineages = 2*N-k;
@@ -1878,9 +1951,6 @@ InferBranchLengths::ChangeTimeWhilekAncestorsVP(Tree& tree, int k, const std::ve
 
   k_choose_2 = num_lineages * (num_lineages-1.0)/2.0;
 
-  //coorindates[sorted_indices[k-1]] determines the epoch at the lower end.
-  //from there, I have to propose a new time by drawing a time for the first epoch, and if it is exceeding the epoch, for the next epoch etc.
-
   tau_old   = coordinates[sorted_indices[k]] - coordinates[sorted_indices[k-1]];
 
   log_likelihood_ratio = 0.0;
@@ -1904,179 +1974,39 @@ InferBranchLengths::ChangeTimeWhilekAncestorsVP(Tree& tree, int k, const std::ve
 
   //std::cerr << "var: " << log_likelihood_ratio << std::endl;
 
-  //coalescent prior  
-  int ep_begin = 0;
-  while(coordinates[sorted_indices[k-1]] >= epoch[ep_begin]){
-    ep_begin++;
-    if(ep_begin == (int)epoch.size()) break;
-  }
-  ep_begin--;
-  assert(ep_begin > -1);
-  assert(coordinates[sorted_indices[k-1]] >= epoch[ep_begin]);
-  if( coordinates[sorted_indices[k-1]] >= epoch[ep_begin+1]  ){
-    assert(ep_begin == (int) epoch.size() - 1);
-  }
-
-  int ep;
-  double tmp_tau, delta_tmp_tau;
-  ep            = ep_begin;
-  tmp_tau       = tau_new;
-
-  int k_tmp = k;
+  //coalescent prior
+  //events k,...,2N-2 are shifted by delta_tau, so only the intervals from event k-1 onwards change.
+  //The cumulative hazard at the old and new ages is evaluated in one sweep over the epochs each.
+  int num_events = 2*N-1-k;
+  prior_times_old[0] = coordinates[sorted_indices[k-1]];
+  for(int i = 0; i < num_events; i++){
+    prior_times_old[i+1] = coordinates[sorted_indices[k+i]];
+    prior_times_new[i]   = prior_times_old[i+1] + delta_tau;
+  }
+  profile.CumulativeHazard(&prior_times_old[0], num_events + 1, &prior_hazard_old[0], &prior_log_rate_old[0]);
+  profile.CumulativeHazard(&prior_times_new[0], num_events, &prior_hazard_new[0], &prior_log_rate_new[0]);
+
+  double log_prior_new = 0.0, log_prior_old = 0.0, hazard_begin_new = prior_hazard_old[0], k_choose_2_tmp;
   int num_lineages_tmp = num_lineages;
-  float k_choose_2_tmp = k_choose_2;
-  bool foo = false;
-  int end_ep = -1;
-  // For k_tmp == k, I am actually changing the time while num_lineages ancestors remain.
-  // For k_tmp > k, I need to check whether these were pushed to older epochs by the update, and adjust coalescent times.
-  while(k_tmp < 2*N-1){
-    if(ep < epoch.size() - 1){
-
-      if(k_tmp > k){
-        //assert(coordinates[sorted_indices[k_tmp-1]] + delta_tau >= epoch[ep]);
-        //assert(coordinates[sorted_indices[k_tmp-1]] + delta_tau < epoch[ep + 1]);
-        tmp_tau = coordinates[sorted_indices[k_tmp]] - coordinates[sorted_indices[k_tmp-1]];
-        delta_tmp_tau = epoch[ep+1] - (coordinates[sorted_indices[k_tmp-1]] + delta_tau);
-        //update k_choose_2
-        k_choose_2_tmp *= (num_lineages_tmp - 2.0)/num_lineages_tmp;
-        num_lineages_tmp--;
-        assert(num_lineages_tmp > 1);
-      }else{
-        assert(coordinates[sorted_indices[k_tmp-1]] >= epoch[ep]);
-        delta_tmp_tau = epoch[ep+1] - coordinates[sorted_indices[k_tmp-1]];
-      }
-
-      //assert(tmp_tau >= 0.0);
-      assert(delta_tmp_tau >= 0.0);
-      //if epoch[ep+1] begins before the current interval (while num_lineages_tmp remain) ends, enter if statement
-      if(delta_tmp_tau <= tmp_tau){
-
-        //add up rate parameters for this interval
-        if(coal_rate[ep] > 0.0){
-          log_likelihood_ratio   -= k_choose_2_tmp*coal_rate[ep] * delta_tmp_tau; 
-        }
-        tmp_tau                -= delta_tmp_tau;
-
-        ep++;
-        delta_tmp_tau           = epoch[ep+1] - epoch[ep];
-        while(tmp_tau > delta_tmp_tau && ep < epoch.size() - 1){
-          if(coal_rate[ep] > 0.0){
-            log_likelihood_ratio -= k_choose_2_tmp*coal_rate[ep] * delta_tmp_tau; 
-          }
-          tmp_tau              -= delta_tmp_tau;
-
-          ep++;
-          delta_tmp_tau         = epoch[ep+1] - epoch[ep];
-        }
-        assert(tmp_tau >= 0.0);
-        if(coal_rate[ep] == 0){
-          log_likelihood_ratio  = -std::numeric_limits<float>::infinity();
-        }else{
-          log_likelihood_ratio -= k_choose_2_tmp*coal_rate[ep] * tmp_tau - fast_log(coal_rate[ep]);
-        }
-
-      }else{
-
-        if(coal_rate[ep] == 0){
-          log_likelihood_ratio = -std::numeric_limits<float>::infinity();
-        }else{
-          log_likelihood_ratio -= k_choose_2_tmp * coal_rate[ep] * tmp_tau - fast_log(coal_rate[ep]);
-        }
-      }
-
-    }else{
-
-      if(coal_rate[ep] == 0){
-        log_likelihood_ratio = -std::numeric_limits<float>::infinity();
-      }else{
-        if(k_tmp > k){
-          tmp_tau = coordinates[sorted_indices[k_tmp]] - coordinates[sorted_indices[k_tmp-1]];
-        }
-        log_likelihood_ratio -= k_choose_2_tmp * coal_rate[ep] * tmp_tau - fast_log(coal_rate[ep]);
-      }
-
-    }
-    k_tmp++;
-
+  for(int i = 0; i < num_events; i++){
+    k_choose_2_tmp    = num_lineages_tmp * (num_lineages_tmp - 1.0)/2.0;
+    log_prior_new    += prior_log_rate_new[i]   - k_choose_2_tmp * (prior_hazard_new[i] - hazard_begin_new);
+    log_prior_old    += prior_log_rate_old[i+1] - k_choose_2_tmp * (prior_hazard_old[i+1] - prior_hazard_old[i]);
+    hazard_begin_new  = prior_hazard_new[i];
+    num_lineages_tmp--;
+  }
+
+  //a coalescence at a time with zero coalescence rate has probability zero
+  if(log_prior_new == -std::numeric_limits<double>::infinity()){
+    log_likelihood_ratio  = -std::numeric_limits<float>::infinity();
+  }else if(log_prior_old == -std::numeric_limits<double>::infinity()){
+    log_likelihood_ratio  = std::numeric_limits<float>::infinity();
+  }else{
+    log_likelihood_ratio += log_prior_new - log_prior_old;
   }
 
   if(log_likelihood_ratio != -std::numeric_limits<float>::infinity()){
 
-    ep            = ep_begin;
-    tmp_tau       = tau_old;
-
-    int k_max = k_tmp;
-    k_tmp = k;
-    k_choose_2_tmp = k_choose_2;
-    num_lineages_tmp = num_lineages;
-    while(k_tmp < k_max){
-
-      if(ep < epoch.size() - 1){
-
-        if(k_tmp > k){
-          //assert(coordinates[sorted_indices[k_tmp-1]] >= epoch[ep]);
-          //assert(coordinates[sorted_indices[k_tmp-1]] < epoch[ep + 1]);
-          tmp_tau = coordinates[sorted_indices[k_tmp]] - coordinates[sorted_indices[k_tmp-1]];
-          delta_tmp_tau = epoch[ep+1] - coordinates[sorted_indices[k_tmp-1]];
-          //update k_choose_2
-          k_choose_2_tmp *= (num_lineages_tmp - 2.0)/num_lineages_tmp;
-          num_lineages_tmp--;
-        }else{
-          //assert(coordinates[sorted_indices[k_tmp-1]] >= epoch[ep]);
-          delta_tmp_tau = epoch[ep+1] - coordinates[sorted_indices[k_tmp-1]];
-        }
-
-        assert(delta_tmp_tau >= 0.0);
-        if(delta_tmp_tau <= tmp_tau){
-          if(coal_rate[ep] > 0.0){
-            log_likelihood_ratio  += k_choose_2_tmp*coal_rate[ep] * delta_tmp_tau; 
-          }
-          tmp_tau                -= delta_tmp_tau;
-          ep++;
-          delta_tmp_tau           = epoch[ep+1] - epoch[ep];
-          while(tmp_tau > delta_tmp_tau && ep < epoch.size() - 1){
-            if(coal_rate[ep] > 0.0){
-              log_likelihood_ratio += k_choose_2_tmp*coal_rate[ep] * delta_tmp_tau; 
-            }
-            tmp_tau              -= delta_tmp_tau;
-            ep++;
-            delta_tmp_tau         = epoch[ep+1] - epoch[ep];
-          }
-          assert(tmp_tau >= 0.0);
-          if(coal_rate[ep] == 0){
-            log_likelihood_ratio = std::numeric_limits<float>::infinity();
-          }else{
-            log_likelihood_ratio += k_choose_2_tmp*coal_rate[ep] * tmp_tau - fast_log(coal_rate[ep]);
-          }
-
-        }else{
-
-          if(coal_rate[ep] == 0){
-            log_likelihood_ratio = std::numeric_limits<float>::infinity();
-          }else{
-            log_likelihood_ratio += k_choose_2_tmp*coal_rate[ep] * tmp_tau - fast_log(coal_rate[ep]);
-          }
-        }
-
-      }else{
-        if(coal_rate[ep] == 0){
-          log_likelihood_ratio = std::numeric_limits<float>::infinity();
-        }else{
-          if(k_tmp > k){
-            tmp_tau = coordinates[sorted_indices[k_tmp]] - coordinates[sorted_indices[k_tmp-1]];
-          }
-          log_likelihood_ratio += k_choose_2_tmp*coal_rate[ep] * tmp_tau - fast_log(coal_rate[ep]);
-        }
-      }
-
-      k_tmp++;
-    }
-
-    //log_likelihood_ratio  = 0.0;
-    //log_likelihood_ratio = fast_log(tau_old/tau_new) + (tau_new/tau_old - tau_old/tau_new);   
-    //log_likelihood_ratio -= k_choose_2 * delta_tau;
-    //std::cerr << "var: " << log_likelihood_ratio << " " << log(tau_old/tau_new) + (tau_new/tau_old - tau_old/tau_new) - k_choose_2 * delta_tau << std::endl;
-
     if(log_likelihood_ratio != std::numeric_limits<float>::infinity()){
       //assert(order[node_k] == k);
       int count_number_of_spanning_branches = 0;
@@ -2146,9 +2076,9 @@ InferBranchLengths::ChangeTimeWhilekAncestorsVP(Tree& tree, int k, const std::ve
     //calculate new branch lengths
 
     it_sorted_indices = std::next(sorted_indices.begin(), k);
-    update_node1 = k;
 
     for(; it_sorted_indices != sorted_indices.end(); it_sorted_indices++){
+      AccumulateAge(*it_sorted_indices);
       coordinates[*it_sorted_indices]                 += delta_tau;
       if(coordinates[*it_sorted_indices] < coordinates[*std::prev(it_sorted_indices,1)]){
         coordinates[*it_sorted_indices] = coordinates[*std::prev(it_sorted_indices,1)]; 
@@ -2186,7 +2116,7 @@ InferBranchLengths::GetCoordinates(Node& n, std::vector<double>& coords){
 }
 
 void
-InferBranchLengths::MCMC(const Data& data, Tree& tree, const int seed){
+InferBranchLengths::StartChain(const Data& data, Tree& tree, const int seed){
 
   int delta = std::max(data.N/10.0, 10.0);
   convergence_threshold = 10.0/Ne; //approximately x generations
@@ -2199,17 +2129,27 @@ InferBranchLengths::MCMC(const Data& data, Tree& tree, const int seed){
   std::uniform_int_distribution<int> dist_switch(N,N_total-2);
 
   root = N_total - 1;
-  logFactorial(N); //precalculates log(k!) for k = 0,...,N
 
   ////////// Initialize MCMC ///////////
 
   //Initialize MCMC using coalescent prior
   InitializeMCMC(data, tree); 
 
-  //Randomly switch around order of coalescences
-  for(int j = 0; j < (int) data.N * data.N; j++){
-    RandomSwitchOrder(tree, dist_switch(rng), dist_unif);
-  }   
+  //With a warm start, the order of coalescences is taken from the previous tree instead of being randomised,
+  //and burn-in is shortened in proportion to the number of clades shared with the previous tree.
+  num_burn_in = 100*delta;
+  num_initialized = 0;
+  if(warm_start) num_initialized = InitializeOrderFromPreviousTree(tree);
+
+  if(num_initialized > 0){
+    initial_order = order;
+    num_burn_in = std::max(10*delta, (int) (num_burn_in * (1.0 - num_initialized/(N_total - N + 0.0))));
+  }else{
+    //Randomly switch around order of coalescences
+    for(int j = 0; j < (int) data.N * data.N; j++){
+      RandomSwitchOrder(tree, dist_switch(rng), dist_unif);
+    }   
+  }
 
   //Apply EM algorithm to calculate MLE of branch lengths given order of coalescences
   InitializeBranchLengths(tree);
@@ -2248,7 +2188,7 @@ InferBranchLengths::MCMC(const Data& data, Tree& tree, const int seed){
 
   //transient
   count = 0;
-  for(; count < 100*delta; count++){
+  for(; count < num_burn_in; count++){
 
     //Either switch order of coalescent event or extent time while k ancestors 
     uniform_rng = dist_unif(rng);
@@ -2260,39 +2200,85 @@ InferBranchLengths::MCMC(const Data& data, Tree& tree, const int seed){
 
   }
 
-  //Now start estimating branch lenghts. We store the average of coalescent ages in avg calculate branch lengths from here.
-  //UpdateAvg is used to update avg.
-  //Coalescent ages of the tree are stored in coordinates (this is updated in SwitchOrder and ChangeTimeWhilekAncestors)
+  //Now start estimating branch lenghts. We store the sum of coalescent ages over iterations in sum_coordinates and calculate branch lengths from here.
+  //Coalescent ages of the tree are stored in coordinates (this is updated in SwitchOrder and ChangeTimeWhilekAncestors, which also update sum_coordinates)
 
-  avg              = coordinates;
-  last_coordinates = coordinates;
-  last_update.resize(N_total);
-  std::fill(last_update.begin(), last_update.end(), 1);
-  count = 1;
+  InitializeAvg(tree);
+
+  std::fill(switch_proposed.begin(), switch_proposed.end(), 0);
+  std::fill(switch_accepted.begin(), switch_accepted.end(), 0);
+  std::fill(change_time_proposed.begin(), change_time_proposed.end(), 0);
+  std::fill(change_time_accepted.begin(), change_time_accepted.end(), 0);
+
+}
+
+double
+InferBranchLengths::SwitchOrderAcceptanceRate() const{
+  int num_proposed = 0, num_accepted = 0;
+  for(int i = 0; i < (int) switch_proposed.size(); i++){
+    num_proposed += switch_proposed[i];
+    num_accepted += switch_accepted[i];
+  }
+  if(num_proposed == 0) return 0.0;
+  return num_accepted/(double) num_proposed;
+}
+
+double
+InferBranchLengths::ChangeTimeAcceptanceRate() const{
+  int num_proposed = 0, num_accepted = 0;
+  for(int i = 0; i < (int) change_time_proposed.size(); i++){
+    num_proposed += change_time_proposed[i];
+    num_accepted += change_time_accepted[i];
+  }
+  if(num_proposed == 0) return 0.0;
+  return num_accepted/(double) num_proposed;
+}
+
+void
+InferBranchLengths::SampleBlock(Tree& tree, int delta, std::vector<int>& count_proposals){
+
+  float uniform_rng;
+  std::uniform_real_distribution<double> dist_unif(0,1);
+  std::uniform_int_distribution<int> dist_k(N,N_total-1);
+  std::uniform_int_distribution<int> dist_switch(N,N_total-2);
+
+  do{
+
+    count++;
+
+    //Either switch order of coalescent event or extent time while k ancestors 
+    uniform_rng = dist_unif(rng);
+    if(uniform_rng < 0.8){
+      int k_candidate = dist_switch(rng);
+      int node_k      = sorted_indices[k_candidate];
+      SwitchOrder(tree, k_candidate, dist_unif);
+      switch_proposed[k_candidate-N]++;
+      if(sorted_indices[k_candidate] != node_k) switch_accepted[k_candidate-N]++;
+    }else{ 
+      int k_candidate = dist_k(rng);
+      count_proposals[k_candidate-N]++;
+      ChangeTimeWhilekAncestors(tree, k_candidate, dist_unif);
+      change_time_proposed[k_candidate-N]++;
+      if(accept) change_time_accepted[k_candidate-N]++;
+    }
+
+  }while(count % delta != 0 );
+
+}
+
+void
+InferBranchLengths::MCMC(const Data& data, Tree& tree, const int seed){
+
+  int delta = std::max(data.N/10.0, 10.0);
+  StartChain(data, tree, seed);
 
   int num_iterations = 0;
   bool is_count_threshold = false;
-  std::vector<int> count_proposals(N_total-N, 0);
+  std::fill(count_proposals.begin(), count_proposals.end(), 0);
   is_avg_increasing = false;
   while(!is_avg_increasing){
 
-    do{
-
-      count++;
-
-      //Either switch order of coalescent event or extent time while k ancestors 
-      uniform_rng = dist_unif(rng);
-      if(uniform_rng < 0.8){
-        SwitchOrder(tree, dist_switch(rng), dist_unif);
-        UpdateAvg(tree);
-      }else{ 
-        int k_candidate = dist_k(rng);
-        count_proposals[k_candidate-N]++;
-        ChangeTimeWhilekAncestors(tree, k_candidate, dist_unif);
-        UpdateAvg(tree);
-      }
-
-    }while(count % delta != 0 );
+    SampleBlock(tree, delta, count_proposals);
 
     num_iterations++;
 
@@ -2313,42 +2299,16 @@ InferBranchLengths::MCMC(const Data& data, Tree& tree, const int seed){
     }
 
     if(is_avg_increasing){
-      //update all nodes in avg 
-      it_avg = std::next(avg.begin(), N);
-      it_coords = std::next(coordinates.begin(), N);
-      it_last_update = std::next(last_update.begin(), N);
-      it_last_coords = std::next(last_coordinates.begin(), N);
-      //update avg
-      for(int ell = N; ell < N_total; ell++){
-        *it_avg  += ((count - *it_last_update) * (*it_last_coords - *it_avg))/count;
-        *it_last_update = count;
-        *it_last_coords = *it_coords;
-        it_avg++;
-        it_coords++;
-        it_last_update++;
-        it_last_coords++;
-      }
-      //check if coalescent ages are non-decreasing in avg
-      int ell = N;
-      for(it_avg = std::next(avg.begin(),N); it_avg != avg.end(); it_avg++){
-        if(ell < root){
-          if(*it_avg > avg[(*tree.nodes[ell].parent).label]){
-            is_avg_increasing = false;
-            break;
-          }
-        }
-        ell++;
-      }
+      //update all nodes and check if coalescent ages are non-decreasing in the average
+      is_avg_increasing = IsAvgIncreasing();
     }
 
   }
 
   //////////// Caluclate branch lengths from avg ////////////
 
-  //don't need to update avg again because I am guaranteed to finish with having updated all nodes
-  for(std::vector<Node>::iterator it_n = tree.nodes.begin(); it_n != std::prev(tree.nodes.end(),1); it_n++){
-    (*it_n).branch_length = ((double) Ne) * (avg[(*(*it_n).parent).label] - avg[(*it_n).label]);
-  }
+  BranchLengthsFromAvg(tree);
+  if(warm_start) StoreForNextTree();
 
   /*
      for(std::vector<Node>::iterator it_n = tree.nodes.begin(); it_n != std::prev(tree.nodes.end(),1); it_n++){
@@ -2359,7 +2319,7 @@ InferBranchLengths::MCMC(const Data& data, Tree& tree, const int seed){
 }  
 
 void
-InferBranchLengths::MCMCVariablePopulationSize(const Data& data, Tree& tree, const std::vector<double>& epoch, std::vector<double>& coal_rate, const int seed){
+InferBranchLengths::MCMCVariablePopulationSize(const Data& data, Tree& tree, const CoalescentRateProfile& profile, const int seed){
 
   float uniform_rng;
   rng.seed(seed);
@@ -2371,7 +2331,6 @@ InferBranchLengths::MCMCVariablePopulationSize(const Data& data, Tree& tree, con
 
   int delta = std::max(data.N/10.0, 10.0);
   root = N_total - 1;
-  logFactorial(N); //precalculates log(k!) for k = 0,...,N
 
   InitializeMCMC(data, tree); //Initialize using coalescent prior 
 
@@ -2379,7 +2338,6 @@ InferBranchLengths::MCMCVariablePopulationSize(const Data& data, Tree& tree, con
     (*it_node).branch_length /= data.Ne;
   }
 
-  coordinates.resize(N_total);
   GetCoordinates(tree.nodes[root], coordinates);
   //avg   = coordinates;
 
@@ -2441,21 +2399,17 @@ InferBranchLengths::MCMCVariablePopulationSize(const Data& data, Tree& tree, con
     if(uniform_rng < 0.5){
       SwitchOrder(tree, dist_switch(rng), dist_unif);
     }else{ 
-      ChangeTimeWhilekAncestorsVP(tree, dist_k(rng), epoch, coal_rate, dist_unif);
+      ChangeTimeWhilekAncestorsVP(tree, dist_k(rng), profile, dist_unif);
       //ChangeTimeWhilekAncestorsLocal(tree, dist_k(rng), dist_unif);
     }
 
   }
 
-  avg              = coordinates;
-  last_coordinates = coordinates;
-  last_update.resize(N_total);
-  std::fill(last_update.begin(), last_update.end(), 1);
-  count = 1;
+  InitializeAvg(tree);
 
   int num_iterations = 0;
   bool is_count_threshold = false;
-  std::vector<int> count_proposals(N_total-N, 0);
+  std::fill(count_proposals.begin(), count_proposals.end(), 0);
   is_avg_increasing = false;
   while(!is_avg_increasing){
 
@@ -2467,13 +2421,11 @@ InferBranchLengths::MCMCVariablePopulationSize(const Data& data, Tree& tree, con
       uniform_rng = dist_unif(rng);
       if(uniform_rng < 0.6){
         SwitchOrder(tree, dist_switch(rng), dist_unif);
-        UpdateAvg(tree);
       }else{ 
         int k_candidate = dist_k(rng);
         count_proposals[k_candidate-N]++;
-        ChangeTimeWhilekAncestorsVP(tree, k_candidate, epoch, coal_rate, dist_unif);
+        ChangeTimeWhilekAncestorsVP(tree, k_candidate, profile, dist_unif);
         //count++;
-        UpdateAvg(tree);
       }
 
     }while(count % delta != 0 );
@@ -2493,41 +2445,15 @@ InferBranchLengths::MCMCVariablePopulationSize(const Data& data, Tree& tree, con
     }
 
     if(is_avg_increasing){
-      //update all nodes in avg 
-      it_avg = std::next(avg.begin(), N);
-      it_coords = std::next(coordinates.begin(), N);
-      it_last_update = std::next(last_update.begin(), N);
-      it_last_coords = std::next(last_coordinates.begin(), N);
-      //update avg
-      for(int ell = N; ell < N_total; ell++){
-        *it_avg  += ((count - *it_last_update) * (*it_last_coords - *it_avg))/count;
-        *it_last_update = count;
-        *it_last_coords = *it_coords;
-        it_avg++;
-        it_coords++;
-        it_last_update++;
-        it_last_coords++;
-      }
-      //check if coalescent ages are non-decreasing in avg
-      int ell = N;
-      for(it_avg = std::next(avg.begin(),N); it_avg != avg.end(); it_avg++){
-        if(ell < root){
-          if(*it_avg > avg[(*tree.nodes[ell].parent).label]){
-            is_avg_increasing = false;
-            break;
-          }
-        }
-        ell++;
-      }
+      //update all nodes and check if coalescent ages are non-decreasing in the average
+      is_avg_increasing = IsAvgIncreasing();
     }
 
 
   }
 
   if(1){
-    for(std::vector<Node>::iterator it_n = tree.nodes.begin(); it_n != std::prev(tree.nodes.end(),1); it_n++){
-      (*it_n).branch_length = ((double) Ne) * (avg[(*(*it_n).parent).label] - avg[(*it_n).label]);
-    }
+    BranchLengthsFromAvg(tree);
   }else{
     for(std::vector<Node>::iterator it_n = tree.nodes.begin(); it_n != std::prev(tree.nodes.end(),1); it_n++){
       (*it_n).branch_length = ((double) Ne) * (*it_n).branch_length;
@@ -2537,7 +2463,7 @@ InferBranchLengths::MCMCVariablePopulationSize(const Data& data, Tree& tree, con
 }  
 
 void
-InferBranchLengths::MCMCVariablePopulationSizeForRelate(const Data& data, Tree& tree, const std::vector<double>& epoch, std::vector<double>& coal_rate, const int seed){
+InferBranchLengths::MCMCVariablePopulationSizeForRelate(const Data& data, Tree& tree, const CoalescentRateProfile& profile, const int seed){
 
   int delta = std::max(data.N/10.0, 10.0);
   convergence_threshold = 10.0/Ne; //approximately x generations
@@ -2550,7 +2476,6 @@ InferBranchLengths::MCMCVariablePopulationSizeForRelate(const Data& data, Tree&
   std::uniform_int_distribution<int> dist_switch(N,N_total-2);
 
   root = N_total - 1;
-  logFactorial(N); //precalculates log(k!) for k = 0,...,N
 
   ////////// Initialize MCMC ///////////
 
@@ -2567,6 +2492,7 @@ InferBranchLengths::MCMCVariablePopulationSizeForRelate(const Data& data, Tree&
   EM(data, tree);
 
   //EM may set some branch lengths to 0. To get a better starting point, we set the minimum branch length to min_tau
+  //The intervals are drawn from the coalescent prior under the variable population size.
   double min_tau = 1.0/Ne, tau_new, tau;
   double push = 0.0, k_choose_2;
   int node_i, num_lineages;
@@ -2581,7 +2507,7 @@ InferBranchLengths::MCMCVariablePopulationSizeForRelate(const Data& data, Tree&
     if(tau < min_tau){
 
       do{
-        tau_new   = -fast_log(dist_unif(rng))/k_choose_2;
+        tau_new   = profile.InverseIntegral(coordinates[sorted_indices[i-1]], -fast_log(dist_unif(rng))/k_choose_2) - coordinates[sorted_indices[i-1]];
         assert(tau_new >= 0.0);
       }while( coordinates[node_i] + push + tau_new - tau < coordinates[sorted_indices[i-1]] );
       push     += tau_new - tau;
@@ -2607,24 +2533,19 @@ InferBranchLengths::MCMCVariablePopulationSizeForRelate(const Data& data, Tree&
       SwitchOrder(tree, dist_switch(rng), dist_unif);
     }else{
       //ChangeTimeWhilekAncestors(tree, dist_k(rng), dist_unif);
-      ChangeTimeWhilekAncestorsVP(tree, dist_k(rng), epoch, coal_rate, dist_unif); 
+      ChangeTimeWhilekAncestorsVP(tree, dist_k(rng), profile, dist_unif); 
     }
 
   }
 
-  //Now start estimating branch lenghts. We store the average of coalescent ages in avg calculate branch lengths from here.
-  //UpdateAvg is used to update avg.
-  //Coalescent ages of the tree are stored in coordinates (this is updated in SwitchOrder and ChangeTimeWhilekAncestors)
+  //Now start estimating branch lenghts. We store the sum of coalescent ages over iterations in sum_coordinates and calculate branch lengths from here.
+  //Coalescent ages of the tree are stored in coordinates (this is updated in SwitchOrder and ChangeTimeWhilekAncestors, which also update sum_coordinates)
 
-  avg              = coordinates;
-  last_coordinates = coordinates;
-  last_update.resize(N_total);
-  std::fill(last_update.begin(), last_update.end(), 1);
-  count = 1;
+  InitializeAvg(tree);
 
   int num_iterations = 0;
   bool is_count_threshold = false;
-  std::vector<int> count_proposals(N_total-N, 0);
+  std::fill(count_proposals.begin(), count_proposals.end(), 0);
   is_avg_increasing = false;
   while(!is_avg_increasing){
 
@@ -2636,13 +2557,11 @@ InferBranchLengths::MCMCVariablePopulationSizeForRelate(const Data& data, Tree&
       uniform_rng = dist_unif(rng);
       if(uniform_rng < 0.5){
         SwitchOrder(tree, dist_switch(rng), dist_unif);
-        UpdateAvg(tree);
       }else{ 
         int k_candidate = dist_k(rng);
         count_proposals[k_candidate-N]++;
         //ChangeTimeWhilekAncestors(tree, dist_k(rng), dist_unif);
-        ChangeTimeWhilekAncestorsVP(tree, dist_k(rng), epoch, coal_rate, dist_unif);
-        UpdateAvg(tree);
+        ChangeTimeWhilekAncestorsVP(tree, dist_k(rng), profile, dist_unif);
       }
 
     }while(count % delta != 0 );
@@ -2666,32 +2585,8 @@ InferBranchLengths::MCMCVariablePopulationSizeForRelate(const Data& data, Tree&
     }
 
     if(is_avg_increasing){
-      //update all nodes in avg 
-      it_avg = std::next(avg.begin(), N);
-      it_coords = std::next(coordinates.begin(), N);
-      it_last_update = std::next(last_update.begin(), N);
-      it_last_coords = std::next(last_coordinates.begin(), N);
-      //update avg
-      for(int ell = N; ell < N_total; ell++){
-        *it_avg  += ((count - *it_last_update) * (*it_last_coords - *it_avg))/count;
-        *it_last_update = count;
-        *it_last_coords = *it_coords;
-        it_avg++;
-        it_coords++;
-        it_last_update++;
-        it_last_coords++;
-      }
-      //check if coalescent ages are non-decreasing in avg
-      int ell = N;
-      for(it_avg = std::next(avg.begin(),N); it_avg != avg.end(); it_avg++){
-        if(ell < root){
-          if(*it_avg > avg[(*tree.nodes[ell].parent).label]){
-            is_avg_increasing = false;
-            break;
-          }
-        }
-        ell++;
-      }
+      //update all nodes and check if coalescent ages are non-decreasing in the average
+      is_avg_increasing = IsAvgIncreasing();
     }
 
 
@@ -2699,10 +2594,7 @@ InferBranchLengths::MCMCVariablePopulationSizeForRelate(const Data& data, Tree&
 
   //////////// Caluclate branch lengths from avg ////////////
 
-  //don't need to update avg again because I am guaranteed to finish with having updated all nodes
-  for(std::vector<Node>::iterator it_n = tree.nodes.begin(); it_n != std::prev(tree.nodes.end(),1); it_n++){
-    (*it_n).branch_length = ((double) Ne) * (avg[(*(*it_n).parent).label] - avg[(*it_n).label]);
-  }
+  BranchLengthsFromAvg(tree);
 
   /*
      for(std::vector<Node>::iterator it_n = tree.nodes.begin(); it_n != std::prev(tree.nodes.end(),1); it_n++){
@@ -2713,7 +2605,7 @@ InferBranchLengths::MCMCVariablePopulationSizeForRelate(const Data& data, Tree&
 }  
 
 void
-InferBranchLengths::MCMCVariablePopulationSizeSample(const Data& data, Tree& tree, const std::vector<double>& epoch, std::vector<double>& coal_rate, int num_proposals, const bool init, const int seed){
+InferBranchLengths::MCMCVariablePopulationSizeSample(const Data& data, Tree& tree, const CoalescentRateProfile& profile, int num_proposals, const bool init, const int seed){
 
   float uniform_rng;
   std::uniform_real_distribution<double> dist_unif(0,1);
@@ -2725,7 +2617,6 @@ InferBranchLengths::MCMCVariablePopulationSizeSample(const Data& data, Tree& tre
 
     rng.seed(seed);
     root = N_total - 1;
-    logFactorial(N); //precalculates log(k!) for k = 0,...,N
 
     InitializeMCMC(data, tree); //Initialize using coalescent prior 
 
@@ -2735,7 +2626,6 @@ InferBranchLengths::MCMCVariablePopulationSizeSample(const Data& data, Tree& tre
        }
        */
 
-    coordinates.resize(N_total);
     GetCoordinates(tree.nodes[root], coordinates);
 
     std::size_t m1(0);
@@ -2812,7 +2702,7 @@ InferBranchLengths::MCMCVariablePopulationSizeSample(const Data& data, Tree& tre
        std::mt19937 rng2 = rng;
        */
 
-    float tmp1 = ChangeTimeWhilekAncestorsVP(tree, dist_k(rng), epoch, coal_rate, dist_unif);
+    float tmp1 = ChangeTimeWhilekAncestorsVP(tree, dist_k(rng), profile, dist_unif);
     //float tmp2 = ChangeTimeWhilekAncestors(tree, dist_k(rng), dist_unif);
     /*
        rng = rng2;
@@ -2832,6 +2722,72 @@ InferBranchLengths::MCMCVariablePopulationSizeSample(const Data& data, Tree& tre
 
 
 
+//One EM update of the coalescent ages for the current order of coalescences. Branch lengths are taken from coordinates.
+//In the interval ending at event i, a branch spanning it with length l and m mutations is expected to carry deltat/l * m of them,
+//and the new length of the interval is the sum of these over spanning branches, divided by their mutation rate plus k choose 2.
+//Branch b spans the intervals ending at events order[b]+1,...,order[parent], so the sums over spanning branches are obtained
+//by adding them at the first and subtracting them after the last interval (difference arrays), and a prefix sum over intervals.
+//This makes an update O(N) instead of visiting all spanning branches of every interval.
+//Coalescent ages are updated in place and branch lengths are written to tree. Returns the total branch length.
+double
+InferBranchLengths::EMUpdate(Tree& tree){
+
+  std::fill(em_rate.begin(), em_rate.end(), 0.0);
+  std::fill(em_zero.begin(), em_zero.end(), 0.0);
+  std::fill(em_mut_rate.begin(), em_mut_rate.end(), 0.0);
+
+  int parent, begin, end;
+  double branch_length, num_events;
+  for(int b = 0; b < N_total - 1; b++){
+    parent        = parent_label[b];
+    begin         = std::max(order[b] + 1, N);
+    end           = order[parent] + 1;
+    branch_length = coordinates[parent] - coordinates[b];
+    num_events    = tree.nodes[b].num_events;
+    if(branch_length == 0.0){
+      //all intervals spanned by b have length 0, and b contributes all its mutations to each of them
+      em_zero[begin] += num_events;
+      em_zero[end]   -= num_events;
+    }else{
+      em_rate[begin] += num_events/branch_length;
+      em_rate[end]   -= num_events/branch_length;
+    }
+    em_mut_rate[begin] += mut_rate[b];
+    em_mut_rate[end]   -= mut_rate[b];
+  }
+
+  //prefix sums can be slightly negative because of rounding, so they are truncated at 0
+  double rate = 0.0, zero = 0.0, event_prob = 0.0;
+  double deltat, num_events_on_subbranch, num_lineages;
+  double prev_old_coordinate = 0.0, prev_coordinate = 0.0;
+  int node;
+  for(int i = N; i < N_total; i++){
+    rate       += em_rate[i];
+    zero       += em_zero[i];
+    event_prob += em_mut_rate[i];
+
+    node   = sorted_indices[i];
+    deltat = coordinates[node] - prev_old_coordinate;
+    assert(deltat >= 0.0);
+    num_events_on_subbranch = std::max(0.0, deltat * rate + zero);
+    num_lineages            = 2*N - i;
+
+    prev_old_coordinate = coordinates[node];
+    coordinates[node]   = prev_coordinate + num_events_on_subbranch/(std::max(0.0, event_prob) + num_lineages * (num_lineages - 1.0)/2.0);
+    prev_coordinate     = coordinates[node];
+  }
+
+  double total_branch_length = 0.0;
+  for(int i = N; i < N_total; i++){
+    Node& n = tree.nodes[i];
+    (*n.child_left).branch_length  = coordinates[i] - coordinates[(*n.child_left).label];
+    (*n.child_right).branch_length = coordinates[i] - coordinates[(*n.child_right).label];
+    total_branch_length           += (*n.child_left).branch_length + (*n.child_right).branch_length;
+  }
+  return total_branch_length;
+
+}
+
 void
 InferBranchLengths::EM(const Data& data, Tree& tree, bool called_as_main){
 
@@ -2842,107 +2798,197 @@ InferBranchLengths::EM(const Data& data, Tree& tree, bool called_as_main){
     InitializeBranchLengths(tree);
   }
 
-  //////////////
-  //initializing
-
-  std::vector<int>::iterator it_n        = sorted_indices.begin();
-  std::vector<int>::iterator it_n_plus_N = sorted_indices.begin() + N;
+  for(int i = 0; i < N_total - 1; i++){
+    parent_label[i] = (*tree.nodes[i].parent).label;
+  }
+  parent_label[N_total - 1] = N_total - 1;
 
   ///////////////////////////////////////
   //iterate until branch lengths converge
 
   double total_branch_length_diff, total_branch_length = std::numeric_limits<float>::infinity(), prev_total_branch_length;
-  double prev_old_coordinate;
-  double deltat, num_events_on_subbranch, event_prob;
-  std::vector<int>::iterator n;
-  std::vector<double>::iterator it_coords;
-  double prev_coordinate;
-  Node *tree_it, *tree_n;
-  std::vector<double>::iterator it_old_branch_length;
-
-  //initialize old_branch_length
-  old_branch_length.resize(tree.nodes.size());
-  std::vector<Node>::iterator it_node = tree.nodes.begin();
-  for(it_old_branch_length = old_branch_length.begin(); it_old_branch_length != old_branch_length.end(); it_old_branch_length++){
-    *it_old_branch_length = (*it_node).branch_length;
-    it_node++;
-  }
-
   do{
 
-    spanning_branches.resize(N); //consider different data structure
-    for(int n = 0; n < N; n++){
-      spanning_branches[n] = n;
+    prev_total_branch_length = total_branch_length;
+    total_branch_length      = EMUpdate(tree);
+    total_branch_length_diff = std::fabs(total_branch_length - prev_total_branch_length)/((double) N_total); //difference per branch   
+
+  }while(total_branch_length_diff > convergence_threshold); 
+
+
+  if(called_as_main){
+    for(auto it = tree.nodes.begin(); it != tree.nodes.end(); it++){
+      (*it).branch_length *= ((double) Ne);
     }
+  }
 
-    prev_total_branch_length = total_branch_length;
-    total_branch_length = 0.0;
-    prev_old_coordinate = 0.0; 
-
-    n = sorted_indices.begin() + N;
-    prev_coordinate = 0.0;
-    for(; n != sorted_indices.end(); n++){
-
-      tree_n = &tree.nodes[*n];
-
-      it_coords = std::next(coordinates.begin(),*n);
-      deltat = *it_coords - prev_old_coordinate; 
-      assert(deltat >= 0.0); 
-
-      //for all branches that span the current region, calculate the number of events in that region
-      num_events_on_subbranch = 0.0;
-      event_prob              = 0.0;
-      for(std::deque<int>::iterator it = spanning_branches.begin(); it != spanning_branches.end();){
-        tree_it = &tree.nodes[*it];
-        it_old_branch_length = std::next(old_branch_length.begin(), *it);
-        if(order[(*(*tree_it).parent).label] >= order[*n]){   
-          if(*it_old_branch_length < deltat) std::cerr << *it_old_branch_length << " " << deltat << std::endl;
-          assert(*it_old_branch_length >= deltat); 
-          if(*it_old_branch_length == 0.0){
-            num_events_on_subbranch += (*tree_it).num_events;
-          }else{
-            num_events_on_subbranch += deltat/(*it_old_branch_length) * (*tree_it).num_events;
-          }
-          event_prob += mut_rate[(*tree_it).label]; //precalculate this line
-          it++;
-        }else{ 
-          *it_old_branch_length = (*tree_it).branch_length;
-          it                    = spanning_branches.erase(it); //two branches will be erased per iteration 
-        }
-      }
-      assert(num_events_on_subbranch >= 0.0);
-      assert(event_prob >= 0.0);
 
-      //infer new coordinate of n 
-      prev_old_coordinate = *it_coords;
-      *it_coords          = prev_coordinate + num_events_on_subbranch/(event_prob + ((double) spanning_branches.size() * (spanning_branches.size() - 1.0)/2.0)); 
-      prev_coordinate     = *it_coords;
-      //update branch lengths
-      (*(*tree_n).child_left).branch_length  = *it_coords - coordinates[(*(*tree_n).child_left).label];
-      (*(*tree_n).child_right).branch_length = *it_coords - coordinates[(*(*tree_n).child_right).label];
-      //if((*(*tree_n).child_left).branch_length < 1e-10)  (*(*tree_n).child_left).branch_length  = 0.0;
-      //if((*(*tree_n).child_right).branch_length < 1e-10) (*(*tree_n).child_right).branch_length = 0.0;
-      total_branch_length                   += (*(*tree_n).child_left).branch_length + (*(*tree_n).child_right).branch_length;
-      spanning_branches.push_back(*n);
+}
+
+
+/////////////////////////////////////////////
+
+InferBranchLengthsMultipleChains::InferBranchLengthsMultipleChains(const Data& data, int num_chains, float rhat_threshold, const bool warm_start): rhat_threshold(rhat_threshold){
+
+  if(num_chains < 2){
+    std::cerr << "Error: Need at least two chains to calculate R-hat." << std::endl;
+    exit(1);
+  }
+
+  N       = data.N;
+  N_total = 2*N - 1;
+  Ne      = data.Ne;
+  rhat    = 0.0;
+  num_proposals = 0;
 
+  chains.assign(num_chains, InferBranchLengths(data, warm_start));
+  chain_trees.reserve(num_chains - 1);
+  count_proposals.resize(N_total - N);
+  sum_coordinates.resize(N_total);
+  sum_stats.resize(2*num_chains);
+  sum_sq_stats.resize(2*num_chains);
+
+}
+
+void
+InferBranchLengthsMultipleChains::RecordStats(){
+
+  //root age and total branch length, in units of Ne. The total branch length is the root age plus the sum of all coalescent ages.
+  double root_age, total_branch_length;
+  for(int c = 0; c < (int) chains.size(); c++){
+    const std::vector<double>& coordinates = chains[c].coordinates;
+    root_age            = coordinates[N_total - 1];
+    total_branch_length = root_age;
+    for(int i = N; i < N_total; i++){
+      total_branch_length += coordinates[i];
     }
+    sum_stats[2*c]        += root_age;
+    sum_sq_stats[2*c]     += root_age * root_age;
+    sum_stats[2*c+1]      += total_branch_length;
+    sum_sq_stats[2*c+1]   += total_branch_length * total_branch_length;
+  }
+  num_blocks++;
 
-    total_branch_length_diff = std::fabs(total_branch_length - prev_total_branch_length)/((double) N_total); //difference per branch   
+}
 
-    //at this point, spanning_branches should only have 3 entries left. (the two branches to the root + the root)
-    for(std::deque<int>::iterator it = spanning_branches.begin(); it != spanning_branches.end(); it++){
-      old_branch_length[*it] = tree.nodes[*it].branch_length;
-    }    
+double
+InferBranchLengthsMultipleChains::CalculateRhat(){
 
-  }while(total_branch_length_diff > convergence_threshold); 
+  //Gelman-Rubin potential scale reduction factor of the root age and the total branch length,
+  //using one sample per chain and block. Returns the larger of the two.
+  double n = num_blocks;
+  double num_chains = chains.size();
+  double max_rhat = 1.0;
+  double mean, mean_all, W, B, var_plus;
 
+  for(int stat = 0; stat < 2; stat++){
 
-  if(called_as_main){
-    for(auto it = tree.nodes.begin(); it != tree.nodes.end(); it++){
-      (*it).branch_length *= ((double) Ne);
+    mean_all = 0.0;
+    W        = 0.0;
+    for(int c = 0; c < (int) chains.size(); c++){
+      mean      = sum_stats[2*c+stat]/n;
+      mean_all += mean;
+      W        += (sum_sq_stats[2*c+stat] - n * mean * mean)/(n - 1.0);
+    }
+    mean_all /= num_chains;
+    W        /= num_chains;
+
+    B = 0.0;
+    for(int c = 0; c < (int) chains.size(); c++){
+      mean = sum_stats[2*c+stat]/n;
+      B   += (mean - mean_all) * (mean - mean_all);
+    }
+    B *= n/(num_chains - 1.0);
+
+    var_plus = (n - 1.0)/n * W + B/n;
+    if(W > 0.0){
+      max_rhat = std::max(max_rhat, std::sqrt(var_plus/W));
+    }else if(B > 0.0){
+      return std::numeric_limits<double>::infinity();
     }
+
   }
 
+  return max_rhat;
 
 }
 
+void
+InferBranchLengthsMultipleChains::MCMC(const Data& data, Tree& tree, const int seed){
+
+  int delta = std::max(data.N/10.0, 10.0);
+  int num_chains = chains.size();
+
+  //chain 0 runs on tree, the others on copies of it
+  chain_trees.clear();
+  for(int c = 1; c < num_chains; c++){
+    chain_trees.emplace_back(tree);
+  }
+
+  chains[0].StartChain(data, tree, seed);
+  for(int c = 1; c < num_chains; c++){
+    chains[c].StartChain(data, chain_trees[c-1], seed + c);
+  }
+
+  std::fill(count_proposals.begin(), count_proposals.end(), 0);
+  std::fill(sum_stats.begin(), sum_stats.end(), 0.0);
+  std::fill(sum_sq_stats.begin(), sum_sq_stats.end(), 0.0);
+  num_blocks = 0;
+  rhat       = std::numeric_limits<double>::infinity();
+
+  //if chains do not agree, stop checking R-hat after 100 times the proposals of the burn-in
+  int max_num_blocks = 10000;
+  bool is_count_threshold = false, is_converged = false;
+  int num_decreasing;
+  while(!is_converged){
+
+    chains[0].SampleBlock(tree, delta, count_proposals);
+    for(int c = 1; c < num_chains; c++){
+      chains[c].SampleBlock(chain_trees[c-1], delta, count_proposals);
+    }
+    RecordStats();
+
+    //as in InferBranchLengths::MCMC, every coalescent event needs at least 20 proposals, but these are counted over all chains
+    if(!is_count_threshold){
+      is_count_threshold = true;
+      for(std::vector<int>::iterator it_count = count_proposals.begin(); it_count != count_proposals.end(); it_count++){
+        if(*it_count < 20){
+          is_count_threshold = false;
+          break;
+        }
+      }
+      if(!is_count_threshold) continue;
+    }
+
+    rhat = CalculateRhat();
+    if(rhat >= rhat_threshold && num_blocks < max_num_blocks) continue;
+
+    //check if coalescent ages are non-decreasing in the average over all chains
+    std::fill(sum_coordinates.begin(), sum_coordinates.end(), 0.0);
+    for(std::vector<InferBranchLengths>::iterator it_chain = chains.begin(); it_chain != chains.end(); it_chain++){
+      (*it_chain).FlushAvg();
+      for(int i = N; i < N_total; i++){
+        sum_coordinates[i] += (*it_chain).sum_coordinates[i];
+      }
+    }
+    num_decreasing = 0;
+    for(int i = N; i < N_total - 1; i++){
+      num_decreasing += (sum_coordinates[i] > sum_coordinates[chains[0].parent_label[i]]);
+    }
+    is_converged = (num_decreasing == 0);
+
+  }
+  num_proposals = chains[0].count - 1;
+
+  //////////// Caluclate branch lengths from avg over all chains ////////////
+
+  double num_samples = ((double) num_chains) * chains[0].count;
+  for(int i = 0; i < N_total - 1; i++){
+    tree.nodes[i].branch_length = ((double) Ne) * (sum_coordinates[chains[0].parent_label[i]] - sum_coordinates[i])/num_samples;
+  }
+
+  for(std::vector<InferBranchLengths>::iterator it_chain = chains.begin(); it_chain != chains.end(); it_chain++){
+    if((*it_chain).warm_start) (*it_chain).StoreForNextTree();
+  }
+
+}
@@ -5,9 +5,12 @@
 // Class for Hierarchical clustering.
 /////////////////////////////
 #include <random>
+#include <unordered_map>
 
 #include "data.hpp"
 #include "anc.hpp"
+#include "coalescent_rate_profile.hpp"
+#include "rng.hpp"
 
 struct Candidate{
   int lin1 = -1;
@@ -89,7 +92,7 @@ class InferBranchLengths{
 
   private:
 
-    std::mt19937 rng;
+    MCMCRandomEngine rng;
 
     int N, L, N_total, Ne;
     float convergence_threshold;
@@ -98,6 +101,9 @@ class InferBranchLengths{
     bool is_avg_increasing;
     float max_diff = 0.0, diff; //diff of coordinates
     int count; //count number of iterations
+    int num_burn_in; //number of burn-in iterations of the last call of MCMC
+    int num_initialized; //number of internal nodes initialised from the previous tree in the last call of MCMC
+    std::vector<int> initial_order; //order of coalescent events after a warm start initialisation
     bool accept; //use to check if proposal in MCMC is accepted.
     float log_likelihood_ratio; //store log of ratio of likelihoods
 
@@ -111,58 +117,135 @@ class InferBranchLengths{
     int num_lineages;
     double k_choose_2;
 
-    std::vector<double> avg_prev, avg;
     std::vector<double> coordinates;
-    std::vector<double>::iterator it_avg, it_avg_prev, it_coords;
 
-    std::vector<float> logF;
+    std::vector<float> logF; //log(k!) for k = 0,...,N, calculated in the constructor
     std::vector<float> mut_rate;
+    std::vector<int> count_proposals; //number of proposals changing the time while k ancestors, for k = N,...,N_total-1
+    //proposals and accepted proposals in the sampling phase of the last call of MCMC, per coalescent event k = N,...,N_total-1 (index k-N)
+    std::vector<int> switch_proposed, switch_accepted, change_time_proposed, change_time_accepted;
 
     std::vector<int> sorted_indices; //node indices in order of coalescent events
     std::vector<int> order; //order of coalescent events
     std::vector<int>::iterator it_sorted_indices;
 
-    //update avg
+    //running average of coalescent ages, stored as arrays indexed by node
+    //sum_coordinates[i] is the sum of the ages of node i over iterations 1,...,last_update[i]. Since then, its age has been coordinates[i].
+    //Proposals call AccumulateAge before changing coordinates[i], so that only changed nodes are touched per iteration.
+    std::vector<double> sum_coordinates;
     std::vector<int> last_update;
-    std::vector<int>::iterator it_last_update;
-    std::vector<double> last_coordinates;
-    std::vector<double>::iterator it_last_coords;
-    int update_node1 = -1, update_node2 = -1;
+    std::vector<int> parent_label;
+
+    //EM: differences of the sums over spanning branches of mutations per unit branch length, of mutations on branches of length 0,
+    //and of mutation rates, between consecutive intervals (see EMUpdate)
+    std::vector<double> em_rate, em_zero, em_mut_rate;
+
+    //warm start: clades of the previous tree and their posterior mean ages
+    bool warm_start;
+    std::vector<uint64_t> clade_hash;
+    std::unordered_map<uint64_t, int> clade_prev;
+    std::vector<double> coordinates_prev;
 
-    //EM
-    std::vector<double> old_branch_length;
-    std::deque<int> spanning_branches;
+    //variable population size: coalescent ages before and after a proposal, and the cumulative hazard and log coalescence rate at these ages
+    std::vector<double> prior_times_old, prior_times_new, prior_hazard_old, prior_hazard_new, prior_log_rate_old, prior_log_rate_new;
 
     void InitializeBranchLengths(Tree& tree);
     void InitializeMCMC(const Data& data, Tree& tree);
+    int InitializeOrderFromPreviousTree(Tree& tree);
+    void StoreForNextTree();
 
     float LikelihoodGivenTimes(Tree& tree);
-    void UpdateAvg(Tree& tree);
+    void InitializeAvg(Tree& tree);
+    void AccumulateAge(int node);
+    void FlushAvg();
+    bool IsAvgIncreasing();
+    void BranchLengthsFromAvg(Tree& tree);
     void logFactorial(int max);
+    double EMUpdate(Tree& tree);
 
     float ChangeTimeWhilekAncestors(Tree& tree, int k, std::uniform_real_distribution<double>& dist_unif);
-    float ChangeTimeWhilekAncestorsVP(Tree& tree, int k, const std::vector<double>& epoch, const std::vector<double>& coal_rate, std::uniform_real_distribution<double>& dist_unif);
+    float ChangeTimeWhilekAncestorsVP(Tree& tree, int k, const CoalescentRateProfile& profile, std::uniform_real_distribution<double>& dist_unif);
 
     void SwitchOrder(Tree& tree, int k, std::uniform_real_distribution<double>& dist_unif);
     void RandomSwitchOrder(Tree& tree, int k, std::uniform_real_distribution<double>& dist_unif);
 
+    //constant population size MCMC in steps, so that several chains can be run in lock-step:
+    //StartChain initializes, burns in and starts the running average; SampleBlock proposes until count is a multiple of delta
+    void StartChain(const Data& data, Tree& tree, const int seed);
+    void SampleBlock(Tree& tree, int delta, std::vector<int>& count_proposals);
+
+    friend class InferBranchLengthsMultipleChains;
+
   public:
 
-    InferBranchLengths(const Data& data);
+    //if warm_start is true, MCMC starts from the order of coalescences of clades in the tree of the previous call
+    InferBranchLengths(const Data& data, const bool warm_start = false);
 
     //this is a post-processing step
     void GetCoordinates(Node& n, std::vector<double>& coords);
+
+    //Acceptance statistics of the sampling phase (after burn-in) of the last call of MCMC, indexed by coalescent event k-N.
+    //A SwitchOrder proposal counts as accepted if it changed the order of coalescent events.
+    const std::vector<int>& NumSwitchOrderProposals() const{ return switch_proposed; }
+    const std::vector<int>& NumSwitchOrderAccepted() const{ return switch_accepted; }
+    const std::vector<int>& NumChangeTimeProposals() const{ return change_time_proposed; }
+    const std::vector<int>& NumChangeTimeAccepted() const{ return change_time_accepted; }
+    double SwitchOrderAcceptanceRate() const;
+    double ChangeTimeAcceptanceRate() const;
+
+    //Warm start of the last call of MCMC: number of internal nodes initialised from the previous tree, number of burn-in iterations,
+    //and the order of coalescent events (indexed by node) the chain started from if any node was initialised.
+    int NumInitializedFromPreviousTree() const{ return num_initialized; }
+    int NumBurnIn() const{ return num_burn_in; }
+    const std::vector<int>& GetInitialOrder() const{ return initial_order; }
     //constant population size MCMC
     void MCMC(const Data& data, Tree& tree, const int seed = std::time(0) + getpid());
     //variable population size MCMC
-    void MCMCVariablePopulationSize(const Data& data, Tree& tree, const std::vector<double>& epoch, std::vector<double>& coal_rate, const int seed = std::time(0) + getpid());
+    void MCMCVariablePopulationSize(const Data& data, Tree& tree, const CoalescentRateProfile& profile, const int seed = std::time(0) + getpid());
     //variable population size MCMC, for Relate (i.e. correct initialization etc)
-    void MCMCVariablePopulationSizeForRelate(const Data& data, Tree& tree, const std::vector<double>& epoch, std::vector<double>& coal_rate, const int seed = std::time(0) + getpid());
+    void MCMCVariablePopulationSizeForRelate(const Data& data, Tree& tree, const CoalescentRateProfile& profile, const int seed = std::time(0) + getpid());
     //variable population size MCMC resample
-    void MCMCVariablePopulationSizeSample(const Data& data, Tree& tree, const std::vector<double>& epoch, std::vector<double>& coal_rate, int num_proposals, const bool init, const int seed = std::time(0) + getpid());
+    void MCMCVariablePopulationSizeSample(const Data& data, Tree& tree, const CoalescentRateProfile& profile, int num_proposals, const bool init, const int seed = std::time(0) + getpid());
     void EM(const Data& data, Tree& tree, bool called_as_main = false);
 
 };
 
+//Runs num_chains independent constant population size MCMC chains of InferBranchLengths on the same tree.
+//Chains are advanced in lock-step blocks of delta proposals. After each block, the root age and total branch length of each chain are recorded,
+//and sampling stops once the potential scale reduction factor (R-hat) of both is below rhat_threshold.
+//The minimum number of proposals per coalescent event (20, as in InferBranchLengths::MCMC) is counted over all chains.
+//Branch lengths are calculated from the averages over all chains.
+class InferBranchLengthsMultipleChains{
+
+  private:
+
+    int N, N_total, Ne;
+    float rhat_threshold;
+    double rhat; //largest R-hat of the last tree
+    int num_proposals; //proposals per chain after burn-in for the last tree
+
+    std::vector<InferBranchLengths> chains;
+    std::vector<Tree> chain_trees; //trees of chains 1,...,num_chains-1. Chain 0 uses the tree passed to MCMC.
+    std::vector<int> count_proposals;
+    std::vector<double> sum_coordinates;
+
+    //sums over blocks of root age (2*c) and total branch length (2*c+1) of chain c, and of their squares
+    std::vector<double> sum_stats, sum_sq_stats;
+    int num_blocks;
+
+    void RecordStats();
+    double CalculateRhat();
+
+  public:
+
+    InferBranchLengthsMultipleChains(const Data& data, int num_chains, float rhat_threshold = 1.1, const bool warm_start = false);
+
+    void MCMC(const Data& data, Tree& tree, const int seed = std::time(0) + getpid());
+
+    //convergence diagnostics of the last tree
+    double Rhat() const{ return rhat; }
+    int NumProposals() const{ return num_proposals; }
+
+};
 
 #endif //TREE_BUILDER_HPP
@@ -0,0 +1,353 @@
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <iterator>
+#include <unordered_map>
+#include <vector>
+#include <err.h>
+#include <tskit.h>
+
+#include "anc.hpp"
+#include "mutations.hpp"
+#include "parallel.hpp"
+#include "tree_sequence.hpp"
+
+#define check_tsk_error(val) if (val < 0) {\
+  errx(EXIT_FAILURE, "line %d: %s", __LINE__, tsk_strerror(val));\
+}
+
+//Nodes, edges and mutations of one marginal tree, indexed by the node labels of the tree.
+struct TreeTables{
+
+  std::vector<double> node_time;
+  std::vector<uint64_t> node_hash;
+  std::vector<int> node_num_leaves;
+  std::vector<int> parent;
+  double left, right;
+  std::vector<tsk_id_t> mutation_site;
+  std::vector<int> mutation_node;
+  std::vector<char> derived_state;
+
+};
+
+static int
+GetNumLeaves(const Node& n, std::vector<int>& num_leaves){
+
+  if(n.child_left != NULL){
+    num_leaves[n.label] = GetNumLeaves(*n.child_left, num_leaves) + GetNumLeaves(*n.child_right, num_leaves);
+  }else{
+    num_leaves[n.label] = 1;
+  }
+  return num_leaves[n.label];
+
+}
+
+static void
+GetTreeTables(MarginalTree& mtr, Muts::iterator it_mut, int N, int L, const std::vector<double>& bps, std::vector<float>& coordinates, TreeTables& tables){
+
+  int root = 2*N - 2;
+
+  //make sure that parents are strictly older than children
+  mtr.tree.GetCoordinates(coordinates);
+  for(int i = 0; i < (int) mtr.tree.nodes.size()-1; i++){
+    if(!(coordinates[(*mtr.tree.nodes[i].parent).label] - coordinates[i] > 0.0)){
+      int parent = (*mtr.tree.nodes[i].parent).label, child = i;
+      while(coordinates[parent] <= coordinates[child] + std::nextafter(coordinates[child], coordinates[child] + 1)){
+        coordinates[parent] = coordinates[child] + std::nextafter(coordinates[child], coordinates[child] + 1);
+        if(parent == root) break;
+        child  = parent;
+        parent = (*mtr.tree.nodes[parent].parent).label;
+      }
+    }
+  }
+
+  for(int i = 0; i < (int) mtr.tree.nodes.size()-1; i++){
+    assert(coordinates[i] < coordinates[(*mtr.tree.nodes[i].parent).label]);
+  }
+
+  int snp = mtr.pos;
+  if(snp == 0){
+    tables.left = 0;
+  }else{
+    tables.left = (bps[snp] + bps[snp-1])/2.0;
+  }
+
+  int tree_count = (*it_mut).tree;
+
+  //Mutation table
+  tables.mutation_site.clear();
+  tables.mutation_node.clear();
+  tables.derived_state.clear();
+  int l = snp;
+  while((*it_mut).tree == tree_count){
+    if((*it_mut).branch.size() == 1){
+      tables.mutation_site.push_back(l);
+      tables.mutation_node.push_back(*(*it_mut).branch.begin());
+      tables.derived_state.push_back((*it_mut).mutation_type[2]);
+    }
+
+    l++;
+    it_mut++;
+    if(l == L) break;
+  }
+
+  int snp_end = l;
+  if(snp_end < L){
+    tables.right = (bps[snp_end-1] + bps[snp_end])/2.0;
+  }else{
+    tables.right = bps[L-1] + 1;
+  }
+
+  assert(tables.left != tables.right);
+  assert(tables.left <= bps[snp]);
+  assert(tables.right >= bps[snp]);
+
+  //Nodes and edges
+  tables.node_time.assign(std::next(coordinates.begin(), N), coordinates.end());
+  mtr.tree.GetCladeHashes(tables.node_hash);
+  tables.node_num_leaves.resize(2*N-1);
+  GetNumLeaves(mtr.tree.nodes[root], tables.node_num_leaves);
+  tables.parent.resize(2*N-2);
+  std::vector<int>::iterator it_parent = tables.parent.begin();
+  for(std::vector<Node>::iterator it_node = mtr.tree.nodes.begin(); it_node != std::prev(mtr.tree.nodes.end(),1); it_node++){
+    *it_parent = (*(*it_node).parent).label;
+    it_parent++;
+  }
+
+}
+
+void
+DumpTreeSequence(const std::string& filename_anc, const std::string& filename_mut, const std::string& filename_trees, int num_threads){
+
+  //The mut file is read once by the constructor, trees are read block by block.
+  AncMutIterators ancmut(filename_anc, filename_mut);
+  int N = ancmut.NumTips(), L = ancmut.NumSnps();
+  Muts::iterator it_mut, it_mut_first = ancmut.mut_begin(), it_mut_tmp;
+
+  //........................................................................
+  //Populate ts tables
+
+  int ret;
+  tsk_table_collection_t tables;
+  ret = tsk_table_collection_init(&tables, 0);
+  check_tsk_error(ret);
+
+  tables.sequence_length = (*std::prev(ancmut.mut_end(),1)).pos + 1;
+  for(int i = 0; i < N; i++){
+    ret = tsk_individual_table_add_row(&tables.individuals, 0, NULL, 0 , NULL, 0, NULL, 0);
+    check_tsk_error(ret);
+  }
+
+  //sites table
+  char ancestral_allele[1];
+  double pos, pos_begin, pos_end;
+  std::vector<double> bps(L);
+  int bps_index = 0;
+  for(it_mut = it_mut_first; it_mut != ancmut.mut_end();){
+    ancestral_allele[0] = (*it_mut).mutation_type[0];
+    pos = (*it_mut).pos;
+    int count = 0;
+
+    it_mut_tmp = it_mut;
+    while((*it_mut_tmp).pos == pos){
+      it_mut_tmp++;
+      count++;
+      if(it_mut_tmp == ancmut.mut_end()) break;
+    }
+    assert(count > 0);
+
+    if(count == 1){
+      ret = tsk_site_table_add_row(&tables.sites, (*it_mut).pos, ancestral_allele, 1, NULL, 0);
+      bps[bps_index] = (*it_mut).pos;
+      bps_index++;
+      it_mut++;
+    }else{
+
+      //SNPs at the same position are spread out evenly between the neighbouring midpoints
+      if(it_mut_tmp != ancmut.mut_end()){
+        pos_end = ((*it_mut_tmp).pos + (*std::prev(it_mut_tmp)).pos)/2.0;
+      }else{
+        pos_end = (*std::prev(it_mut_tmp)).pos;
+      }
+      it_mut_tmp = it_mut;
+      if(it_mut_tmp != it_mut_first){
+        pos_begin = ((*it_mut_tmp).pos + (*std::prev(it_mut_tmp)).pos)/2.0;
+      }else{
+        pos_begin = pos;
+      }
+      int i = 0;
+      while((*it_mut_tmp).pos == pos){
+        ret = tsk_site_table_add_row(&tables.sites, ((i+1.0)/(count+1.0))*(pos_end - pos_begin) + pos_begin, ancestral_allele, 1, NULL, 0);
+        bps[bps_index] = ((i+1.0)/(count+1.0))*(pos_end - pos_begin) + pos_begin;
+        bps_index++;
+        it_mut_tmp++;
+        i++;
+        if(it_mut_tmp == ancmut.mut_end()) break;
+      }
+      it_mut = it_mut_tmp;
+
+    }
+
+    check_tsk_error(ret);
+  }
+  assert(bps_index == L);
+
+  for(int i = 0; i < N; i++){
+    double sample_age = (ancmut.sample_ages.size() > 0) ? ancmut.sample_ages[i] : 0.0;
+    ret = tsk_node_table_add_row(&tables.nodes, TSK_NODE_IS_SAMPLE, sample_age, TSK_NULL, i, NULL, 0);
+    check_tsk_error(ret);
+  }
+
+  /////////////////////////////////////////////////////////////////////////////
+
+  //An internal node is shared with the previous tree if it has the same descendants (same clade hash and
+  //number of descendants) and the same time,
+  //an edge is extended if both its parent and child are shared and the parent is unchanged.
+  TreeBlock block;
+  int block_size = 8*num_threads;
+  std::vector<TreeTables> tree_tables(block_size);
+  std::vector<std::vector<float>> coordinates(num_threads, std::vector<float>(2*N-1, 0.0));
+
+  //node ids, node times, numbers of descendants, parent ids and edge left ends of the previous and current tree, indexed by node label
+  std::vector<tsk_id_t> id(2*N-1), id_prev(2*N-1), parent_id(2*N-2), parent_id_prev(2*N-2);
+  std::vector<double> time_prev(N-1), left(2*N-2), left_prev(2*N-2);
+  std::vector<int> num_leaves_prev(N-1);
+  std::vector<char> extended(2*N-2);
+  std::vector<int> label_prev(2*N-1);
+  std::unordered_map<uint64_t, int> hash_prev;
+  hash_prev.reserve(N-1);
+  double right_prev = 0.0;
+  bool is_first = true;
+  for(int i = 0; i < N; i++){
+    id[i] = i;
+    id_prev[i] = i;
+  }
+  tsk_id_t num_nodes = N;
+
+  //columns appended to the tables for each tree
+  std::vector<tsk_flags_t> node_flags(N-1, 0);
+  std::vector<tsk_id_t> node_null(N-1, TSK_NULL);
+  std::vector<double> node_time;
+  std::vector<double> edge_left, edge_right;
+  std::vector<tsk_id_t> edge_parent, edge_child;
+  std::vector<tsk_id_t> mutation_node, mutation_parent;
+  std::vector<double> mutation_time;
+  std::vector<tsk_size_t> derived_state_offset;
+
+  while(ancmut.NextTreeBlock(block, block_size) > 0){
+
+    ParallelFor(block.num_trees, num_threads, [&](int i, int thread){
+      GetTreeTables(block.mtr[i], block.it_mut[i], N, L, bps, coordinates[thread], tree_tables[i]);
+    });
+
+    for(int i = 0; i < block.num_trees; i++){
+
+      TreeTables& t = tree_tables[i];
+
+      //Node table
+      node_time.clear();
+      for(int k = 0; k < N; k++){
+        label_prev[k] = k;
+      }
+      for(int k = N; k < 2*N-1; k++){
+        label_prev[k] = -1;
+        if(!is_first){
+          std::unordered_map<uint64_t, int>::iterator it_hash = hash_prev.find(t.node_hash[k]);
+          if(it_hash != hash_prev.end() && time_prev[(*it_hash).second - N] == t.node_time[k-N] && num_leaves_prev[(*it_hash).second - N] == t.node_num_leaves[k]){
+            label_prev[k] = (*it_hash).second;
+          }
+        }
+        if(label_prev[k] >= 0){
+          id[k] = id_prev[label_prev[k]];
+        }else{
+          id[k] = num_nodes;
+          node_time.push_back(t.node_time[k-N]);
+          num_nodes++;
+        }
+      }
+      if(node_time.size() > 0){
+        ret = tsk_node_table_append_columns(&tables.nodes, node_time.size(), &node_flags[0], &node_time[0], &node_null[0], &node_null[0], NULL, NULL);
+        check_tsk_error(ret);
+      }
+
+      //Edge table, edges of the previous tree that are not extended end at t.left
+      std::fill(extended.begin(), extended.end(), 0);
+      for(int k = 0; k < 2*N-2; k++){
+        parent_id[k] = id[t.parent[k]];
+        left[k] = t.left;
+        int k_prev = label_prev[k];
+        if(!is_first && k_prev >= 0 && parent_id_prev[k_prev] == parent_id[k]){
+          left[k] = left_prev[k_prev];
+          extended[k_prev] = 1;
+        }
+      }
+      edge_left.clear();
+      edge_right.clear();
+      edge_parent.clear();
+      edge_child.clear();
+      if(!is_first){
+        for(int k = 0; k < 2*N-2; k++){
+          if(!extended[k]){
+            edge_left.push_back(left_prev[k]);
+            edge_right.push_back(right_prev);
+            edge_parent.push_back(parent_id_prev[k]);
+            edge_child.push_back(id_prev[k]);
+          }
+        }
+      }
+      if(edge_left.size() > 0){
+        ret = tsk_edge_table_append_columns(&tables.edges, edge_left.size(), &edge_left[0], &edge_right[0], &edge_parent[0], &edge_child[0], NULL, NULL);
+        check_tsk_error(ret);
+      }
+
+      //Mutation table
+      int num_mutations = t.mutation_site.size();
+      if(num_mutations > 0){
+        mutation_node.resize(num_mutations);
+        for(int m = 0; m < num_mutations; m++){
+          mutation_node[m] = id[t.mutation_node[m]];
+        }
+        mutation_parent.assign(num_mutations, TSK_NULL);
+        mutation_time.assign(num_mutations, TSK_UNKNOWN_TIME);
+        derived_state_offset.resize(num_mutations + 1);
+        for(int m = 0; m <= num_mutations; m++){
+          derived_state_offset[m] = m;
+        }
+        ret = tsk_mutation_table_append_columns(&tables.mutations, num_mutations, &t.mutation_site[0], &mutation_node[0], &mutation_parent[0], &mutation_time[0], &t.derived_state[0], &derived_state_offset[0], NULL, NULL);
+        check_tsk_error(ret);
+      }
+
+      hash_prev.clear();
+      for(int k = N; k < 2*N-1; k++){
+        hash_prev[t.node_hash[k]] = k;
+      }
+      std::copy(t.node_time.begin(), t.node_time.end(), time_prev.begin());
+      std::copy(std::next(t.node_num_leaves.begin(), N), t.node_num_leaves.end(), num_leaves_prev.begin());
+      id.swap(id_prev);
+      parent_id.swap(parent_id_prev);
+      left.swap(left_prev);
+      right_prev = t.right;
+      is_first = false;
+
+    }
+
+  }
+
+  //edges of the last tree
+  edge_left.assign(left_prev.begin(), left_prev.end());
+  edge_right.assign(2*N-2, right_prev);
+  edge_child.assign(id_prev.begin(), std::prev(id_prev.end(), 1));
+  if(!is_first){
+    ret = tsk_edge_table_append_columns(&tables.edges, 2*N-2, &edge_left[0], &edge_right[0], &parent_id_prev[0], &edge_child[0], NULL, NULL);
+    check_tsk_error(ret);
+  }
+
+  ret = tsk_table_collection_sort(&tables, NULL, 0);
+  check_tsk_error(ret);
+
+  // Write out the tree sequence
+  ret = tsk_table_collection_dump(&tables, filename_trees.c_str(), 0);
+  check_tsk_error(ret);
+  tsk_table_collection_free(&tables);
+
+}
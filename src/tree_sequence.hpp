@@ -0,0 +1,13 @@
+#ifndef TREE_SEQUENCE_HPP
+#define TREE_SEQUENCE_HPP
+
+#include <string>
+
+//Converts anc/mut files to a tree sequence in tskit format (filename_trees).
+//The mut file is read once. Trees are read in blocks, nodes, edges and mutations of the trees in a block are
+//built on num_threads threads and then appended to the tables in tree order, so the output does not depend on num_threads.
+//Internal nodes with identical descendants and times in adjacent trees are stored once, and edges between them
+//span all trees in which they are unchanged.
+void DumpTreeSequence(const std::string& filename_anc, const std::string& filename_mut, const std::string& filename_trees, int num_threads = 1);
+
+#endif //TREE_SEQUENCE_HPP
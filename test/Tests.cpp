@@ -3,3 +3,5 @@
 #include "test_treebuilder.cpp"
 #include "test_ancbuilder.cpp"
 #include "test_applications.cpp"
+#include "test_tree_sequence.cpp"
+#include "test_anc_mut_chunks.cpp"
@@ -0,0 +1,137 @@
+#include <catch2/catch_test_macros.hpp>
+#include <cstdio>
+#include <fstream>
+#include <cxxopts.hpp>
+#include <zlib.h>
+
+#include "../extract/AncMutChunks.cpp"
+
+static cxxopts::ParseResult
+ParseAncMutChunksOptions(const std::vector<std::string>& args){
+
+  cxxopts::Options options("RelateExtract");
+  options.add_options()
+    ("help", "Print help.")
+    ("anc", "Filename of file containing trees.", cxxopts::value<std::string>())
+    ("mut", "Filename of file containing mut.", cxxopts::value<std::string>())
+    ("threads", "Number of threads.", cxxopts::value<int>())
+    ("o,output", "Filename of output (excl file extension).", cxxopts::value<std::string>());
+
+  std::vector<const char*> argv(1, "RelateExtract");
+  for(std::vector<std::string>::const_iterator it_args = args.begin(); it_args != args.end(); it_args++){
+    argv.push_back((*it_args).c_str());
+  }
+  return options.parse(argv.size(), &argv[0]);
+
+}
+
+//Decompressed content of a plain text or gzip file (with any number of members).
+static std::string
+ReadDecompressed(const std::string& filename){
+
+  gzFile fp = gzopen(filename.c_str(), "rb");
+  REQUIRE(fp != NULL);
+  std::string content;
+  std::vector<char> buffer(1 << 16);
+  int num_read;
+  while((num_read = gzread(fp, &buffer[0], buffer.size())) > 0){
+    content.append(&buffer[0], num_read);
+  }
+  gzclose(fp);
+  return content;
+
+}
+
+TEST_CASE( "Testing DivideAncMut and CombineAncMut" ){
+
+  int N = 4, num_trees = 45;
+  std::string filename = "test_anc_mut_chunks";
+
+  std::ostringstream anc, mut;
+  anc << "NUM_HAPLOTYPES " << N << " \n";
+  anc << "NUM_TREES " << num_trees << "\n";
+  mut << "snp;pos_of_snp;dist;rs-id;tree_index;branch_indices;is_not_mapping;is_flipped;age_begin;age_end;ancestral_allele/alternative_allele;upstream_allele;downstream_allele;\n";
+  int snp = 0;
+  for(int tree = 0; tree < num_trees; tree++){
+    anc << snp << ": 4:(" << tree + 1 << ".00000 0.000 " << snp << " " << snp + tree % 3 << ") 4:(1.00000 0.000 0 1) 5:(2.00000 0.000 0 1) 5:(2.00000 0.000 0 1) 6:(3.00000 0.000 0 1) 6:(2.00000 0.000 0 1) -1:(0.00000 0.000 0 1) \n";
+    for(int k = 0; k <= tree % 3; k++){
+      mut << snp << ";" << 10*(snp+1) << ";10;snp" << snp << ";" << tree << ";" << snp % (2*N-2) << ";0;0;0;0;A/C;NA;NA;\n";
+      snp++;
+    }
+  }
+
+  std::ofstream os_anc(filename + ".anc");
+  os_anc << anc.str();
+  os_anc.close();
+  std::ofstream os_mut(filename + ".mut");
+  os_mut << mut.str();
+  os_mut.close();
+
+  cxxopts::ParseResult options_divide  = ParseAncMutChunksOptions({"--anc", filename + ".anc", "--mut", filename + ".mut", "--threads", "1", "--output", filename});
+  cxxopts::ParseResult options_combine = ParseAncMutChunksOptions({"--threads", "2", "--output", filename});
+
+  SECTION("Chunks written by DivideAncMut"){
+
+    DivideAncMut(options_divide, "");
+
+    std::ifstream is_param(filename + ".param");
+    std::string line;
+    getline(is_param, line);
+    int num_haplotypes, num_snps, num_trees_param, num_chunks;
+    is_param >> num_haplotypes >> num_snps >> num_trees_param >> num_chunks;
+    is_param.close();
+    REQUIRE(num_haplotypes == N);
+    REQUIRE(num_snps == snp);
+    REQUIRE(num_trees_param == num_trees);
+    REQUIRE(num_chunks == 4);
+
+    CombineAncMut(options_combine, "");
+
+  }
+
+  SECTION("Chunks that are plain text or single gzip members"){
+
+    DivideAncMut(options_divide, "");
+
+    //the body of these chunks is not a separate gzip member, so CombineAncMut has to compress it again
+    for(int c = 0; c < 2; c++){
+      for(std::string extension : {".anc", ".mut"}){
+        std::string filename_chunk = filename + "_chr" + std::to_string(c) + extension;
+        std::string content = ReadDecompressed(filename_chunk + ".gz");
+        std::remove((filename_chunk + ".gz").c_str());
+        if(c == 0){
+          std::ofstream os(filename_chunk);
+          os << content;
+          os.close();
+        }else{
+          gzFile fp = gzopen((filename_chunk + ".gz").c_str(), "wb");
+          REQUIRE(fp != NULL);
+          gzwrite(fp, content.c_str(), content.size());
+          gzclose(fp);
+        }
+      }
+    }
+
+    CombineAncMut(options_combine, "");
+
+  }
+
+  //the combined files decompress to the input
+  REQUIRE(ReadDecompressed(filename + ".anc.gz") == anc.str());
+  REQUIRE(ReadDecompressed(filename + ".mut.gz") == mut.str());
+
+  //chunks, temporary files and the parameter file are removed
+  for(int c = 0; c < 4; c++){
+    for(std::string extension : {".anc", ".mut", ".anc.gz", ".mut.gz", ".anc.body.gz", ".mut.body.gz", ".anc.gz.body.gz", ".mut.gz.body.gz"}){
+      std::ifstream is(filename + "_chr" + std::to_string(c) + extension);
+      REQUIRE(is.fail());
+    }
+  }
+  std::ifstream is_param(filename + ".param");
+  REQUIRE(is_param.fail());
+
+  for(std::string extension : {".anc", ".mut", ".anc.gz", ".mut.gz"}){
+    std::remove((filename + extension).c_str());
+  }
+
+}
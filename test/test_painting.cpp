@@ -3,6 +3,7 @@
 #include "data.hpp"
 #include "fast_painting.hpp"
 #include "fast_log.hpp"
+#include "anc_builder.hpp"
 
 
 TEST_CASE( "Testing painting" ){
@@ -135,3 +136,91 @@ TEST_CASE( "Testing painting" ){
 
 }
 
+
+TEST_CASE( "Testing encodings of paintings" ){
+
+  //paint into memory with each encoding and compare the distance matrices obtained from the paintings
+
+  int N = 10;
+  int L = 300;
+  Data data(N,L);
+  data.theta  = 0.025;
+  data.ntheta = 1.0 - data.theta;
+
+  data.sequence.resize(L,N);
+  data.r.resize(L);
+  data.rpos.resize(L);
+  srand(1);
+  for(int snp = 0; snp < L; snp++){
+    data.r[snp]    = 0.01;
+    data.rpos[snp] = 0.01 * snp;
+    for(int n = 0; n < N; n++){
+      data.sequence[snp][n] = '0';
+    }
+    //derived in a clade of haplotypes that changes along the sequence, plus noise
+    int first = (snp/50) % N, last = first + rand() % (N/2);
+    for(int n = first; n <= last && n < N; n++){
+      data.sequence[snp][n] = '1';
+    }
+    data.sequence[snp][rand() % N] = '1';
+  }
+
+  std::vector<int> window_boundaries = {0, 100, 200, L};
+  int num_windows = window_boundaries.size() - 1;
+
+  std::vector<int> encodings = {CollapsedMatrix<float>::raw, CollapsedMatrix<float>::quantized, CollapsedMatrix<float>::compressed};
+  std::vector<std::vector<CollapsedMatrix<float>>> matrices(encodings.size());
+  for(int e = 0; e < (int) encodings.size(); e++){
+
+    PaintingBuffer painting(N, num_windows, 1.0);
+    data.painting          = &painting;
+    data.painting_encoding = encodings[e];
+
+    std::vector<FILE*> pfiles(num_windows);
+    for(int w = 0; w < num_windows; w++){
+      pfiles[w] = painting.OpenWrite(w, "");
+    }
+    for(int k = 0; k < N; k++){
+      FastPainting painter(data);
+      painter.PaintSteppingStones(data, window_boundaries, pfiles, k);
+    }
+    for(int w = 0; w < num_windows; w++){
+      fclose(pfiles[w]);
+    }
+
+    for(int w = 0; w < num_windows; w++){
+      DistanceMeasure d(data, w);
+      for(int snp = window_boundaries[w]; snp < window_boundaries[w+1]; snp++){
+        //advance to snp as in AncesTreeBuilder::BuildTopology
+        if(snp > window_boundaries[w]){
+          for(int i = 0; i < N; i++){
+            if(data.sequence[snp][i] == '1'){
+              d.v_snp_prev[i]++;
+              d.v_rpos_prev[i] = data.rpos[snp];
+            }
+          }
+        }
+        d.GetMatrix(snp);
+        matrices[e].push_back(d.matrix);
+      }
+    }
+    data.painting = NULL;
+
+  }
+
+  //compressed paintings are lossless, quantized paintings have an error of at most 1/(2*quantization_scale)
+  //in log space for each of alpha and beta, which bounds the error of the distances before and after subtracting the row minimum.
+  float bound = 4.0/(2.0*CollapsedMatrix<float>::quantization_scale);
+  float max_error = 0.0;
+  for(int snp = 0; snp < L; snp++){
+    for(int i = 0; i < N; i++){
+      for(int j = 0; j < N; j++){
+        REQUIRE(matrices[2][snp][i][j] == matrices[0][snp][i][j]);
+        max_error = std::max(max_error, std::fabs(matrices[1][snp][i][j] - matrices[0][snp][i][j]));
+      }
+    }
+  }
+  REQUIRE(max_error > 0.0);
+  REQUIRE(max_error < bound);
+
+}
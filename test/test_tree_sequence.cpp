@@ -0,0 +1,115 @@
+#include <catch2/catch_test_macros.hpp>
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <tskit.h>
+
+#include "anc.hpp"
+#include "mutations.hpp"
+#include "tree_sequence.hpp"
+
+//Clades of a marginal tree as pairs (set of leaves as bit mask, age), sorted.
+static void
+GetClades(Tree& tree, std::vector<std::pair<int, double>>& clades){
+
+  int N = (tree.nodes.size() + 1)/2;
+  std::vector<float> coordinates;
+  tree.GetCoordinates(coordinates);
+
+  std::vector<int> mask(2*N-1, 0);
+  for(int i = 0; i < N; i++){
+    Node* n = &tree.nodes[i];
+    while((*n).parent != NULL){
+      n = (*n).parent;
+      mask[(*n).label] |= 1 << i;
+    }
+  }
+
+  clades.clear();
+  for(int k = N; k < 2*N-1; k++){
+    clades.push_back(std::make_pair(mask[k], (double) coordinates[k]));
+  }
+  std::sort(clades.begin(), clades.end());
+
+}
+
+//Clades of the tree of a tree sequence at position pos, in the same format as GetClades.
+static void
+GetClades(tsk_treeseq_t& ts, double pos, int N, std::vector<std::pair<int, double>>& clades){
+
+  tsk_tree_t tree;
+  REQUIRE(tsk_tree_init(&tree, &ts, 0) == 0);
+  REQUIRE(tsk_tree_seek(&tree, pos, 0) == 0);
+
+  std::vector<int> mask(tsk_treeseq_get_num_nodes(&ts), 0);
+  for(int i = 0; i < N; i++){
+    tsk_id_t u = tree.parent[i];
+    while(u != TSK_NULL){
+      mask[u] |= 1 << i;
+      u = tree.parent[u];
+    }
+  }
+
+  clades.clear();
+  for(int u = N; u < (int) mask.size(); u++){
+    if(mask[u] > 0) clades.push_back(std::make_pair(mask[u], ts.tables->nodes.time[u]));
+  }
+  std::sort(clades.begin(), clades.end());
+  tsk_tree_free(&tree);
+
+}
+
+TEST_CASE( "Testing conversion to tree sequence" ){
+
+  //N = 4, three trees with two SNPs each. The second tree is identical to the first,
+  //the third tree has the same root but different cherries.
+  int N = 4, L = 6;
+  std::string filename_anc = "test_tree_sequence.anc", filename_mut = "test_tree_sequence.mut", filename_trees = "test_tree_sequence.trees";
+
+  std::ofstream os_anc(filename_anc);
+  os_anc << "NUM_HAPLOTYPES " << N << " \n";
+  os_anc << "NUM_TREES 3\n";
+  os_anc << "0: 4:(1.00000 0.000 0 1) 4:(1.00000 0.000 0 1) 5:(2.00000 0.000 0 1) 5:(2.00000 0.000 0 1) 6:(3.00000 0.000 0 1) 6:(2.00000 0.000 0 1) -1:(0.00000 0.000 0 1) \n";
+  os_anc << "2: 4:(1.00000 0.000 2 3) 4:(1.00000 0.000 2 3) 5:(2.00000 0.000 2 3) 5:(2.00000 0.000 2 3) 6:(3.00000 0.000 2 3) 6:(2.00000 0.000 2 3) -1:(0.00000 0.000 2 3) \n";
+  os_anc << "4: 4:(1.00000 0.000 4 5) 5:(2.00000 0.000 4 5) 4:(1.00000 0.000 4 5) 5:(2.00000 0.000 4 5) 6:(3.00000 0.000 4 5) 6:(2.00000 0.000 4 5) -1:(0.00000 0.000 4 5) \n";
+  os_anc.close();
+
+  std::ofstream os_mut(filename_mut);
+  os_mut << "snp;pos_of_snp;dist;rs-id;tree_index;branch_indices;is_not_mapping;is_flipped;age_begin;age_end;ancestral_allele/alternative_allele;upstream_allele;downstream_allele;\n";
+  for(int snp = 0; snp < L; snp++){
+    os_mut << snp << ";" << 10*(snp+1) << ";10;snp" << snp << ";" << snp/2 << ";" << snp % N << ";0;0;0;0;A/C;NA;NA;\n";
+  }
+  os_mut.close();
+
+  DumpTreeSequence(filename_anc, filename_mut, filename_trees, 2);
+
+  tsk_treeseq_t ts;
+  REQUIRE(tsk_treeseq_load(&ts, filename_trees.c_str(), 0) == 0);
+
+  //the first two trees share all nodes and edges, the third tree only shares the root with them
+  REQUIRE(tsk_treeseq_get_num_samples(&ts) == N);
+  REQUIRE(tsk_treeseq_get_num_nodes(&ts) == 2*N-1 + 2);
+  REQUIRE(tsk_treeseq_get_num_edges(&ts) == 2*(2*N-2));
+  REQUIRE(tsk_treeseq_get_num_trees(&ts) == 2);
+  REQUIRE(tsk_treeseq_get_num_sites(&ts) == L);
+  REQUIRE(tsk_treeseq_get_num_mutations(&ts) == L);
+
+  //each marginal tree has the same clades and ages in the tree sequence, at the position of each of its SNPs
+  AncesTree anc;
+  anc.Read(filename_anc);
+  REQUIRE(anc.seq.size() == 3);
+  std::vector<std::pair<int, double>> clades_anc, clades_ts;
+  for(CorrTrees::iterator it_seq = anc.seq.begin(); it_seq != anc.seq.end(); it_seq++){
+    GetClades((*it_seq).tree, clades_anc);
+    for(int snp = (*it_seq).pos; snp < (*it_seq).pos + 2; snp++){
+      GetClades(ts, ts.tables->sites.position[snp], N, clades_ts);
+      REQUIRE(clades_ts == clades_anc);
+    }
+  }
+
+  tsk_treeseq_free(&ts);
+  std::remove(filename_anc.c_str());
+  std::remove(filename_mut.c_str());
+  std::remove(filename_trees.c_str());
+
+}
@@ -363,8 +363,193 @@ TEST_CASE( "Testing MCMC of branch lengths (2)" ){
 
   bl.MCMC(data,tree);
 
+  //acceptance statistics of the sampling phase
+  int num_change_time = 0;
+  for(int k = 0; k < N-1; k++){
+    REQUIRE(bl.NumSwitchOrderAccepted()[k] <= bl.NumSwitchOrderProposals()[k]);
+    REQUIRE(bl.NumChangeTimeAccepted()[k] <= bl.NumChangeTimeProposals()[k]);
+    REQUIRE(bl.NumChangeTimeProposals()[k] >= 20);
+    num_change_time += bl.NumChangeTimeProposals()[k];
+  }
+  REQUIRE(bl.NumSwitchOrderProposals()[N-2] == 0); //the root cannot switch order
+  REQUIRE(num_change_time > 0);
+  REQUIRE(bl.ChangeTimeAcceptanceRate() > 0.0);
+  REQUIRE(bl.ChangeTimeAcceptanceRate() <= 1.0);
+  REQUIRE(bl.SwitchOrderAcceptanceRate() >= 0.0);
+  REQUIRE(bl.SwitchOrderAcceptanceRate() <= 1.0);
+
   //for(int i = 0; i < 2*N-1; i++){
   //  std::cerr << i << " " << tree.nodes[i].branch_length << " " << tree.nodes[i].num_events/(1.0*data.mu) << std::endl;
   //}
 }
 
+
+//Builds a tree of N = 8 samples with clades {2i,2i+1} and {4i,...,4i+3}, and sets up data with no mutations.
+//If swap is true, samples 5 and 6 are exchanged, so the pairs below {4,...,7} are {4,6} and {5,7} instead of {4,5} and {6,7}.
+static void
+BuildTreeOfPairs(Data& data, Tree& tree, bool swap = false){
+
+  int N = data.N;
+  int L = data.L;
+  data.theta = 0.025;
+  data.mu = 1e-8;
+  data.dist.resize(L);
+  data.rpos.resize(L);
+  data.dist[0] = 0;
+  data.rpos[0] = 0;
+  data.dist[1] = 1;
+  data.rpos[1] = 1;
+
+  std::vector<int> sample(N);
+  for(int i = 0; i < N; i++) sample[i] = i;
+  if(swap) std::swap(sample[5], sample[6]);
+
+  CollapsedMatrix<float> d;
+  d.resize(N,N);
+  for(int i = 0; i < N; i++){
+    for(int j = 0; j < N; j++){
+      d[i][j] = (sample[i]/2 == sample[j]/2) ? 0 : ((sample[i]/4 == sample[j]/4) ? 1 : 2);
+    }
+  }
+
+  MinMatch tb(data);
+  std::vector<double> sample_ages(N,0);
+  tb.QuickBuild(d,tree,sample_ages);
+
+}
+
+TEST_CASE( "Testing warm start of MCMC of branch lengths" ){
+
+  int N = 8;
+  int L = 2;
+  Data data(N,L); //struct data is defined in data.hpp
+
+  //the two trees differ in the pairs below {4,...,7}
+  Tree tree_prev, tree;
+  BuildTreeOfPairs(data, tree_prev);
+  BuildTreeOfPairs(data, tree, true);
+
+  std::vector<uint64_t> clade_hash_prev, clade_hash;
+  tree_prev.GetCladeHashes(clade_hash_prev);
+  tree.GetCladeHashes(clade_hash);
+  std::vector<int> node_prev(2*N-1, -1); //node of tree_prev with the same clade
+  int num_shared = 0;
+  for(int i = N; i < 2*N-1; i++){
+    for(int j = N; j < 2*N-1; j++){
+      if(clade_hash[i] == clade_hash_prev[j]) node_prev[i] = j;
+    }
+    if(node_prev[i] >= 0) num_shared++;
+  }
+  REQUIRE(num_shared == N-3);
+
+  InferBranchLengths bl(data, true);
+  bl.MCMC(data, tree_prev, 1);
+  REQUIRE(bl.NumInitializedFromPreviousTree() == 0);
+  REQUIRE(bl.NumBurnIn() == 1000);
+  std::vector<float> coords_prev(2*N-1);
+  GetCoordinates(tree_prev.nodes[2*N-2], coords_prev); //posterior mean ages of tree_prev
+
+  //Shared clades are older than their children in the posterior mean of tree_prev, and the quartet {4,...,7}
+  //is older than the initial ages of the new pairs below it, so all shared clades are initialised.
+  bl.MCMC(data, tree, 2);
+  REQUIRE(bl.NumInitializedFromPreviousTree() == num_shared);
+  const std::vector<int>& order = bl.GetInitialOrder();
+  for(int i = 0; i < 2*N-2; i++){
+    REQUIRE(order[i] < order[(*tree.nodes[i].parent).label]);
+  }
+  for(int i = N; i < 2*N-1; i++){
+    for(int j = N; j < 2*N-1; j++){
+      if(node_prev[i] >= 0 && node_prev[j] >= 0){
+        REQUIRE((order[i] < order[j]) == (coords_prev[node_prev[i]] < coords_prev[node_prev[j]]));
+      }
+    }
+  }
+
+  //burn-in is shortened in proportion to the number of shared clades
+  int delta = 10;
+  REQUIRE(bl.NumBurnIn() == (int) (100*delta * (1.0 - num_shared/(N-1.0))));
+  for(int i = 0; i < 2*N-2; i++){
+    REQUIRE(tree.nodes[i].branch_length >= 0.0);
+  }
+
+  //without warm start, nothing is initialised
+  InferBranchLengths bl_cold(data);
+  bl_cold.MCMC(data, tree_prev, 1);
+  bl_cold.MCMC(data, tree, 2);
+  REQUIRE(bl_cold.NumInitializedFromPreviousTree() == 0);
+  REQUIRE(bl_cold.NumBurnIn() == 100*delta);
+
+}
+
+TEST_CASE( "Testing multiple chains of MCMC of branch lengths" ){
+
+  int N = 8;
+  int L = 2;
+  Data data(N,L); //struct data is defined in data.hpp
+  Tree tree;
+  BuildTreeOfPairs(data, tree);
+
+  InferBranchLengths bl(data);
+  InferBranchLengthsMultipleChains bl_chains(data, 4);
+  double root_age = 0.0, root_age_chains = 0.0;
+  int num_reps = 50;
+  for(int rep = 0; rep < num_reps; rep++){
+    Tree tree_single = tree, tree_chains = tree;
+    bl.MCMC(data, tree_single, rep + 1);
+    bl_chains.MCMC(data, tree_chains, rep + 1);
+    REQUIRE(bl_chains.Rhat() < 1.1);
+    REQUIRE(bl_chains.NumProposals() > 0);
+
+    std::vector<float> coords(2*N-1), coords_chains(2*N-1);
+    GetCoordinates(tree_single.nodes[2*N-2], coords);
+    GetCoordinates(tree_chains.nodes[2*N-2], coords_chains);
+    for(int i = 0; i < 2*N-2; i++){
+      REQUIRE(tree_chains.nodes[i].branch_length >= 0.0);
+    }
+    root_age        += coords[2*N-2];
+    root_age_chains += coords_chains[2*N-2];
+  }
+
+  root_age        /= num_reps;
+  root_age_chains /= num_reps;
+  REQUIRE(root_age_chains > 0.75 * root_age);
+  REQUIRE(root_age_chains < 1.25 * root_age);
+
+}
+
+TEST_CASE( "Testing coalescent rate profile" ){
+
+  std::vector<double> epoch = {0.0, 1.0, 3.0, 3.0, 10.0};
+  std::vector<double> coal_rate = {2.0, 0.5, 7.0, 1.0, 4.0};
+  CoalescentRateProfile profile(epoch, coal_rate);
+
+  //walk through the epochs linearly, as the samplers used to do
+  std::vector<double> t = {0.0, 0.5, 1.0, 2.0, 3.0, 5.0, 10.0, 12.5};
+  for(std::vector<double>::iterator it_t = t.begin(); it_t != t.end(); it_t++){
+    double h = 0.0;
+    int ep = 0;
+    while(ep < (int) epoch.size() - 1 && epoch[ep+1] <= *it_t){
+      h += coal_rate[ep] * (epoch[ep+1] - epoch[ep]);
+      ep++;
+    }
+    h += coal_rate[ep] * (*it_t - epoch[ep]);
+    REQUIRE(std::fabs(profile.CumulativeHazard(*it_t) - h) < 1e-10);
+    REQUIRE(profile.Rate(*it_t) == coal_rate[ep]);
+  }
+
+  //inverse of the integral
+  for(std::vector<double>::iterator it_t = t.begin(); it_t != t.end(); it_t++){
+    for(double h = 0.0; h < 20.0; h += 0.7){
+      REQUIRE(std::fabs(profile.Integral(*it_t, profile.InverseIntegral(*it_t, h)) - h) < 1e-10);
+    }
+  }
+
+  //batch version
+  std::vector<double> hazard(t.size()), log_rate(t.size());
+  profile.CumulativeHazard(&t[0], t.size(), &hazard[0], &log_rate[0]);
+  for(int i = 0; i < (int) t.size(); i++){
+    REQUIRE(std::fabs(hazard[i] - profile.CumulativeHazard(t[i])) < 1e-10);
+    REQUIRE(std::fabs(log_rate[i] - std::log(profile.Rate(t[i]))) < 1e-10);
+  }
+
+}